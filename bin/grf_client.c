@@ -0,0 +1,283 @@
+/*
+ * Client of the grfd daemon
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "grf.h"
+#include "grf_registers.h"
+#include "grf_history.h"
+#include "grf_logging.h"
+
+#define GRF_CLIENT_LINE_MAX     256     /* Maximum length of a request accepted by the daemon */
+
+extern void grf_print_data(struct grf_device *device);
+extern int grf_print_register(struct grf_device *device, uint16_t key, void *userdata);
+
+/*---------------------------------------------------------------------------*/
+static int client_connect(const char *server)
+{
+	struct sockaddr_un addr;
+	int                fd;
+	int                ret;
+
+	if (strlen(server) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, server);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)))
+	{
+		ret = errno;
+		close(fd);
+		errno = ret;
+		return -1;
+	}
+
+	return fd;
+}
+
+static int client_send(int fd, char **args, int nargs)
+{
+	char    line[GRF_CLIENT_LINE_MAX];
+	size_t  len = 0;
+	size_t  sent;
+	ssize_t count;
+	int     i;
+
+	/* Join the command and its arguments to a single line */
+	for (i = 0; i < nargs; i++)
+	{
+		if (strpbrk(args[i], " \t\r\n") || len + strlen(args[i]) + 1 >= sizeof(line))
+			return EINVAL;
+		len += sprintf(line + len, "%s%s", args[i], (i + 1 < nargs) ? " " : "\n");
+	}
+
+	for (sent = 0; sent < len; sent += count)
+	{
+		count = send(fd, line + sent, len - sent, MSG_NOSIGNAL);
+		if (count < 0)
+			return errno;
+	}
+
+	return 0;
+}
+
+static int client_parse_data(char *data, struct grf_device *device)
+{
+	char      *saveptr;
+	char      *token;
+	char      *end;
+	long long  timestamp;
+
+	/* DATA <device> <timestamp> KKKK:VVVVVVVV ... */
+	memset(device, 0, sizeof(struct grf_device));
+	token = strtok_r(data, " ", &saveptr);
+	if (!token || strlen(token) != GRF_DEVICEID_LEN)
+		return EPROTO;
+	memcpy(device->id, token, GRF_DEVICEID_LEN + 1);
+	token = strtok_r(NULL, " ", &saveptr);
+	if (!token)
+		return EPROTO;
+	timestamp = strtoll(token, &end, 10);
+	if (*end != '\0')
+		return EPROTO;
+	device->timestamp = timestamp;
+
+	/* The registers are decoded just like the ones received from the radio */
+	while ((token = strtok_r(NULL, " ", &saveptr)))
+	{
+		if (grf_register_decode(device, token, strlen(token), NULL) == EINVAL)
+			return EPROTO;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_client_request(const char *server, char **args, int nargs, struct grf_history *history,
+                       struct grf_devicelist *devices, int *failed)
+{
+	struct grf_devicelist  found;
+	struct grf_device      device;
+	FILE                  *stream;
+	char                  *line = NULL;
+	size_t                 size = 0;
+	ssize_t                len;
+	char                   id[GRF_DEVICEID_LEN + 1];
+	bool                   groups = false;
+	bool                   members;
+	uint16_t               key;
+	size_t                 i;
+	int                    fd;
+	int                    ret;
+
+	assert(server);
+	assert(args);
+	assert(nargs > 0);
+	assert(failed);
+
+	*failed = 0;
+	fd = client_connect(server);
+	if (fd < 0)
+		return errno;
+	ret = client_send(fd, args, nargs);
+	if (ret)
+	{
+		close(fd);
+		return ret;
+	}
+	stream = fdopen(fd, "r");
+	if (!stream)
+	{
+		ret = errno;
+		close(fd);
+		return ret;
+	}
+
+	/* The devices of a group read are recorded in the history like the ones of a scan */
+	members = history && nargs > 1 && strcasecmp(args[0], "request-group") == 0;
+
+	/* Output the data lines of the reply until the final status arrives */
+	grf_devicelist_init(&found);
+	memset(&device, 0, sizeof(struct grf_device));
+	ret = ECONNRESET;
+	while ((len = getline(&line, &size, stream)) > 0)
+	{
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		grf_logging_dbg("reply: %s", line);
+
+		if (strcmp(line, "OK") == 0)
+		{
+			ret = 0;
+			break;
+		}
+		else if (strncmp(line, "ERROR ", 6) == 0)
+		{
+			ret = atoi(line + 6);
+			if (ret <= 0)
+				ret = EPROTO;
+			break;
+		}
+		else if (strncmp(line, "VERSION ", 8) == 0)
+		{
+			printf("Firmware version: %s\n", line + 8);
+		}
+		else if (strncmp(line, "GROUP ", 6) == 0)
+		{
+			if (!groups)
+				printf("Found the following groups:\n");
+			printf("    %s\n", line + 6);
+			groups = true;
+		}
+		else if (strncmp(line, "DEVICE ", 7) == 0)
+		{
+			ret = grf_devicelist_add(devices ? devices : &found, line + 7);
+			if (ret)
+				break;
+		}
+		else if (strncmp(line, "DATA ", 5) == 0)
+		{
+			ret = client_parse_data(line + 5, &device);
+			if (ret)
+				break;
+			printf("Data of %s:\n", device.id);
+			grf_print_data(&device);
+			if (members && (ret = grf_devicelist_add(&found, device.id)))
+				break;
+
+			/* Selected readings are in the history of the daemon already */
+			if (history && strcasecmp(args[0], "select") != 0)
+			{
+				ret = grf_history_append(history, &device);
+				if (ret)
+					fprintf(stderr, "ERROR: Storing data of device %s failed: %s\n", device.id, strerror(ret));
+			}
+		}
+		else if (sscanf(line, "REGISTER %4s", id) == 1 && len > 9 + GRF_DEVICEID_LEN)
+		{
+			/* Registers of a device arrive one after the other */
+			if (strcmp(id, device.id) != 0)
+			{
+				memset(&device, 0, sizeof(struct grf_device));
+				memcpy(device.id, id, GRF_DEVICEID_LEN + 1);
+				printf("Registers of %s:\n", device.id);
+			}
+			if (grf_register_decode(&device, line + 10 + GRF_DEVICEID_LEN, len - 10 - GRF_DEVICEID_LEN, &key) == 0)
+				grf_print_register(&device, key, NULL);
+		}
+		else if (sscanf(line, "FAILED %4s %d", id, &ret) == 2)
+		{
+			fprintf(stderr, "ERROR: Requesting data of device %s failed: %s\n", id, strerror(ret));
+			(*failed)++;
+			if (members && (ret = grf_devicelist_add(&found, id)))
+				break;
+		}
+		else
+		{
+			grf_logging_warn("Unexpected reply \"%s\"", line);
+		}
+		ret = ECONNRESET;
+	}
+
+	/* Record the devices of the group so the history reports it without the server */
+	if (!ret && history && nargs > 1 && (members || strcasecmp(args[0], "scan-devices") == 0))
+	{
+		ret = grf_history_set_group(history, args[1], devices ? devices : &found);
+		if (ret)
+			fprintf(stderr, "ERROR: Storing devices of group %s failed: %s\n", args[1], strerror(ret));
+		ret = 0;
+	}
+
+	/* Output the devices found by a scan unless the caller is interested in them */
+	if (!ret && !devices && strcasecmp(args[0], "scan-devices") == 0)
+	{
+		if (found.len < 1)
+			printf("No devices found!\n");
+		else
+			printf("Found %zu devices:\n", found.len);
+		for (i = 0; i < found.len; i++)
+			printf("    %s\n", found.ids[i]);
+	}
+	grf_devicelist_free(&found);
+	free(line);
+	fclose(stream);
+
+	return ret;
+}
+/*---------------------------------------------------------------------------*/
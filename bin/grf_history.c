@@ -0,0 +1,351 @@
+/*
+ * History query command implementation
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+
+#include "grf.h"
+#include "grf_registers.h"
+#include "grf_history.h"
+#include "grf_logging.h"
+
+#define GRF_HISTORY_MAXFIELDS       16
+#define GRF_HISTORY_DEFAULT_FIELDS  "battery-voltage,temperature-1,temperature-2"
+
+#define GRF_BUCKET_NONE             0
+#define GRF_BUCKET_DAY              1
+#define GRF_BUCKET_WEEK             2
+#define GRF_BUCKET_MONTH            3
+#define GRF_BUCKET_YEAR             4
+
+/* Aggregate of a field over a bucket */
+struct grf_history_aggregate
+{
+	double       min;
+	double       max;
+	double       sum;
+};
+
+/* State of a history report */
+struct grf_history_report
+{
+	const struct grf_register_field *fields[GRF_HISTORY_MAXFIELDS];
+	size_t       nfields;
+	int          bucket;
+	char         device[GRF_DEVICEID_LEN + 1];	/* Device of the current bucket */
+	time_t       start;							/* Start of the current bucket */
+	time_t       end;							/* Start of the next bucket */
+	size_t       count;							/* Number of readings in the current bucket */
+	struct grf_history_aggregate aggregates[GRF_HISTORY_MAXFIELDS];
+	size_t       total;							/* Number of readings reported */
+};
+
+/*---------------------------------------------------------------------------*/
+static void field_name(const struct grf_register_field *field, char *name, size_t size)
+{
+	size_t i;
+
+	/* Derive the name from the label, e.g. "battery voltage:" -> "battery-voltage" */
+	for (i = 0; i + 1 < size && field->label[i] && field->label[i] != ':'; i++)
+		name[i] = (field->label[i] == ' ') ? '-' : field->label[i];
+	name[i] = '\0';
+}
+
+static double field_value(const struct grf_register_field *field, const struct grf_device *device)
+{
+	const char *member = (const char *)device + field->offset;
+
+	switch (field->type)
+	{
+		case GRF_REGISTER_TYPE_U8:
+			return *(const uint8_t *)member;
+		case GRF_REGISTER_TYPE_U16:
+			return *(const uint16_t *)member;
+		case GRF_REGISTER_TYPE_U32:
+			return *(const uint32_t *)member;
+		default:
+			return *(const float *)member;
+	}
+}
+
+static int parse_fields(struct grf_history_report *report, const char *list)
+{
+	char    name[32];
+	char    wanted[32];
+	size_t  len;
+	size_t  i;
+
+	/* Look up each name of the comma separated list among the known fields */
+	while (*list)
+	{
+		len = strcspn(list, ",");
+		if (len >= sizeof(wanted) || report->nfields >= GRF_HISTORY_MAXFIELDS)
+			return EINVAL;
+		memcpy(wanted, list, len);
+		wanted[len] = '\0';
+		for (i = 0; i < grf_register_nfields; i++)
+		{
+			field_name(&grf_register_fields[i], name, sizeof(name));
+			if (grf_register_fields[i].known && grf_register_fields[i].count == 1 && strcasecmp(name, wanted) == 0)
+				break;
+		}
+		if (i >= grf_register_nfields)
+		{
+			fprintf(stderr, "Unknown field \"%s\", use one of:", wanted);
+			for (i = 0; i < grf_register_nfields; i++)
+			{
+				field_name(&grf_register_fields[i], name, sizeof(name));
+				if (grf_register_fields[i].known)
+					fprintf(stderr, " %s", name);
+			}
+			fprintf(stderr, "\n");
+			return EINVAL;
+		}
+		report->fields[report->nfields++] = &grf_register_fields[i];
+		list += len + (list[len] == ',');
+	}
+
+	return (report->nfields > 0) ? 0 : EINVAL;
+}
+
+static time_t bucket_start(int bucket, time_t timestamp, time_t *end)
+{
+	struct tm tm;
+	time_t    start;
+
+	*end = 0;
+	if (bucket == GRF_BUCKET_NONE)
+		return 0;
+
+	/* Buckets follow the calendar in local time */
+	localtime_r(&timestamp, &tm);
+	tm.tm_sec   = 0;
+	tm.tm_min   = 0;
+	tm.tm_hour  = 0;
+	tm.tm_isdst = -1;
+	switch (bucket)
+	{
+		case GRF_BUCKET_WEEK:
+			tm.tm_mday -= (tm.tm_wday + 6) % 7;
+			break;
+		case GRF_BUCKET_MONTH:
+			tm.tm_mday = 1;
+			break;
+		case GRF_BUCKET_YEAR:
+			tm.tm_mday = 1;
+			tm.tm_mon  = 0;
+			break;
+	}
+	start = mktime(&tm);
+
+	/* Determine the start of the next bucket */
+	switch (bucket)
+	{
+		case GRF_BUCKET_DAY:
+			tm.tm_mday += 1;
+			break;
+		case GRF_BUCKET_WEEK:
+			tm.tm_mday += 7;
+			break;
+		case GRF_BUCKET_MONTH:
+			tm.tm_mon += 1;
+			break;
+		case GRF_BUCKET_YEAR:
+			tm.tm_year += 1;
+			break;
+	}
+	tm.tm_isdst = -1;
+	*end = mktime(&tm);
+
+	return start;
+}
+
+static void report_header(const struct grf_history_report *report)
+{
+	char   name[32];
+	size_t i;
+
+	/* Output a line per device and period with min, mean and max of each field */
+	printf("    %-6s %-10s %7s", "device", "period", "count");
+	for (i = 0; i < report->nfields; i++)
+	{
+		field_name(report->fields[i], name, sizeof(name));
+		printf("  %32.32s", name);
+	}
+	printf("\n");
+}
+
+static void report_flush(struct grf_history_report *report)
+{
+	const struct grf_register_field *field;
+	struct tm                        tm;
+	char                             period[32];
+	size_t                           i;
+
+	if (report->count == 0)
+		return;
+
+	switch (report->bucket)
+	{
+		case GRF_BUCKET_NONE:
+			snprintf(period, sizeof(period), "all");
+			break;
+		case GRF_BUCKET_MONTH:
+			strftime(period, sizeof(period), "%Y-%m", localtime_r(&report->start, &tm));
+			break;
+		case GRF_BUCKET_YEAR:
+			strftime(period, sizeof(period), "%Y", localtime_r(&report->start, &tm));
+			break;
+		default:
+			strftime(period, sizeof(period), "%Y-%m-%d", localtime_r(&report->start, &tm));
+			break;
+	}
+
+	printf("    %-6s %-10s %7zu", report->device, period, report->count);
+	for (i = 0; i < report->nfields; i++)
+	{
+		field = report->fields[i];
+		printf("  %10.*f %10.*f %10.*f", field->precision, report->aggregates[i].min,
+		       field->precision, report->aggregates[i].sum / report->count,
+		       field->precision, report->aggregates[i].max);
+	}
+	printf("\n");
+	report->count = 0;
+}
+
+static int report_reading(const struct grf_device *device, void *userdata)
+{
+	struct grf_history_report    *report = userdata;
+	struct grf_history_aggregate *aggregate;
+	double                        value;
+	size_t                        i;
+
+	/* The readings arrive ordered by device and time, so a bucket is
+	 * complete as soon as a reading of another bucket arrives.
+	 */
+	if (report->count > 0 && (strcmp(device->id, report->device) != 0 || (report->bucket != GRF_BUCKET_NONE &&
+	                          (device->timestamp < report->start || device->timestamp >= report->end))))
+		report_flush(report);
+	if (report->total == 0)
+		report_header(report);
+	if (report->count == 0)
+	{
+		memcpy(report->device, device->id, sizeof(report->device));
+		report->start = bucket_start(report->bucket, device->timestamp, &report->end);
+	}
+
+	for (i = 0; i < report->nfields; i++)
+	{
+		aggregate = &report->aggregates[i];
+		value     = field_value(report->fields[i], device);
+		if (report->count == 0 || value < aggregate->min)
+			aggregate->min = value;
+		if (report->count == 0 || value > aggregate->max)
+			aggregate->max = value;
+		aggregate->sum = (report->count == 0) ? value : aggregate->sum + value;
+	}
+	report->count++;
+	report->total++;
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_parse_time(const char *str, time_t *timestamp)
+{
+	struct tm   tm;
+	const char *end;
+	char       *num;
+
+	/* Accept seconds since the epoch prefixed by '@' */
+	if (str[0] == '@')
+	{
+		*timestamp = strtoll(str + 1, &num, 10);
+		return (num != str + 1 && *num == '\0') ? 0 : EINVAL;
+	}
+
+	/* Accept YYYY-MM-DD optionally followed by HH:MM[:SS] in local time */
+	memset(&tm, 0, sizeof(struct tm));
+	end = strptime(str, "%Y-%m-%d", &tm);
+	if (end && (*end == ' ' || *end == 'T'))
+	{
+		end = strptime(end + 1, "%H:%M", &tm);
+		if (end && *end == ':')
+			end = strptime(end + 1, "%S", &tm);
+	}
+	if (!end || *end != '\0')
+		return EINVAL;
+	tm.tm_isdst = -1;
+	*timestamp  = mktime(&tm);
+
+	return 0;
+}
+
+int grf_history_report(struct grf_history *hist, const char (*ids)[GRF_DEVICEID_LEN + 1], size_t nids,
+                       time_t since, time_t until, const char *fields, const char *bucket, size_t *count)
+{
+	struct grf_history_report report;
+	size_t                    i;
+	int                       retval;
+
+	memset(&report, 0, sizeof(struct grf_history_report));
+	if (!fields)
+		fields = GRF_HISTORY_DEFAULT_FIELDS;
+	if (parse_fields(&report, fields))
+	{
+		fprintf(stderr, "Invalid field list \"%s\"\n", fields);
+		return EINVAL;
+	}
+	if (!bucket || strcasecmp(bucket, "none") == 0)
+		report.bucket = GRF_BUCKET_NONE;
+	else if (strcasecmp(bucket, "day") == 0)
+		report.bucket = GRF_BUCKET_DAY;
+	else if (strcasecmp(bucket, "week") == 0)
+		report.bucket = GRF_BUCKET_WEEK;
+	else if (strcasecmp(bucket, "month") == 0)
+		report.bucket = GRF_BUCKET_MONTH;
+	else if (strcasecmp(bucket, "year") == 0)
+		report.bucket = GRF_BUCKET_YEAR;
+	else
+	{
+		fprintf(stderr, "Invalid period \"%s\", use one of: none, day, week, month, year\n", bucket);
+		return EINVAL;
+	}
+
+	/* Without IDs all devices are reported */
+	retval = 0;
+	if (nids == 0)
+		retval = grf_history_query(hist, NULL, since, until, report_reading, &report);
+	for (i = 0; i < nids && !retval; i++)
+		retval = grf_history_query(hist, ids[i], since, until, report_reading, &report);
+	report_flush(&report);
+	*count = report.total;
+
+	return retval;
+}
+/*---------------------------------------------------------------------------*/
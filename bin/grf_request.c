@@ -26,41 +26,45 @@
 #include <string.h>
 #include <errno.h>
 
-#include <math.h>
-
 #include "grf.h"
+#include "grf_registers.h"
+#include "grf_history.h"
+#include "grf_fleet.h"
 #include "grf_logging.h"
 
+/* State of reading a group */
+struct grf_read_group_state
+{
+	struct grf_history *history;	/* History to append the readings to (may be NULL) */
+	int                 failed;		/* Number of devices failed */
+};
+
 void grf_print_data(struct grf_device *device)
 {
-	int i;
+	const struct grf_register_field *field;
+	char                             label[32];
+	char                             value[64];
+	bool                             known = true;
+	size_t                           i;
+	unsigned int                     j;
 
 	printf("--------------------------------------------\n");
-	printf("    serial number:               %08X\n", device->serial_number);
-	printf("    operation time:              %d days %d hours %d minutes %.2f seconds\n",
-	       (int)(device->operation_time / (24.0f * 3600.0f)),
-	       (int)(fmodf(device->operation_time, 24.0f * 3600.0f) / 3600.0f),
-	       (int)(fmodf(device->operation_time, 3600.0f) / 60.0f),
-	       fmodf(device->operation_time, 60.0f));
-	printf("    smoke chamber pollution:     %d\n", device->smoke_chamber_pollution);
-	printf("    battery voltage:             %.2f V\n", device->battery_voltage);
-	printf("    temperature 1:               %.1f degree celcius\n", device->temperature1);
-	printf("    temperature 2:               %.1f degree celcius\n", device->temperature2);
-	printf("    local smoke alerts:          %d\n", device->local_smoke_alerts);
-	printf("    local temperature alerts:    %d\n", device->local_temperature_alerts);
-	printf("    remote wired alerts:         %d\n", device->remote_cable_alerts);
-	printf("    remote wireless alerts:      %d\n", device->remote_radio_alerts);
-	printf("    local test alerts:           %d\n", device->local_test_alerts);
-	printf("    remote wired test alerts:    %d\n", device->remote_cable_test_alerts);
-	printf("    remote wireless test alerts: %d\n", device->remote_radio_test_alerts);
-	printf("--------------------------------------------\n");
-	printf("    unknown smoke chamber value: %d\n", device->smoke_chamber_value);
-	printf("    unknown data id=0002:        0x%08X\n", device->unknown_02);
-	for (i = 0; i < 40; i++)
+	for (i = 0; i < grf_register_nfields; i++)
 	{
-		printf("    unknown data id=%04X:        0x%08X\n", i+0x14, device->unknown_registers[i]);
+		field = &grf_register_fields[i];
+
+		/* Separate the fields of unknown meaning */
+		if (known && !field->known)
+			printf("--------------------------------------------\n");
+		known = field->known;
+
+		for (j = 0; j < field->count; j++)
+		{
+			snprintf(label, sizeof(label), field->label, field->key + j);
+			grf_register_format(field, j, device, value, sizeof(value));
+			printf("    %-29s%s\n", label, value);
+		}
 	}
-	printf("    unknown data id=0064:        0x%08X\n", device->unknown_64);
 	printf("--------------------------------------------\n");
 }
 
@@ -80,3 +84,156 @@ int grf_switch_signal(struct grf_radio *radio, const char *deviceid, bool on)
 
 	return grf_comm_switch_signal(radio, deviceid, on);
 }
+
+static int grf_print_group_data(struct grf_device *device, int result, void *userdata)
+{
+	struct grf_read_group_state *state = userdata;
+
+	/* Output the result of each device as soon as it is available */
+	if (result)
+	{
+		fprintf(stderr, "ERROR: Requesting data of device %s failed: %s\n", device->id, strerror(result));
+		state->failed++;
+		return 0;
+	}
+	printf("Data of %s:\n", device->id);
+	grf_print_data(device);
+
+	/* Losing the history is no reason to stop reading the group */
+	if (state->history)
+	{
+		result = grf_history_append(state->history, device);
+		if (result)
+			fprintf(stderr, "ERROR: Storing data of device %s failed: %s\n", device->id, strerror(result));
+	}
+
+	return 0;
+}
+
+void grf_store_group(struct grf_history *history, const char *groupid, const struct grf_devicelist *devices)
+{
+	int result;
+
+	/* The history reports the group later without scanning it again */
+	if (!history)
+		return;
+	result = grf_history_set_group(history, groupid, devices);
+	if (result)
+		fprintf(stderr, "ERROR: Storing devices of group %s failed: %s\n", groupid, strerror(result));
+}
+
+int grf_print_register(struct grf_device *device, uint16_t key, void *userdata)
+{
+	const struct grf_register_field *field;
+	char                             label[32];
+	char                             value[64];
+	size_t                           i;
+
+	/* Output all fields contained in the register as soon as it arrives */
+	for (i = 0; i < grf_register_nfields; i++)
+	{
+		field = &grf_register_fields[i];
+		if (key < field->key || key >= field->key + field->count)
+			continue;
+		snprintf(label, sizeof(label), field->label, key);
+		grf_register_format(field, key - field->key, device, value, sizeof(value));
+		printf("    %-29s%s\n", label, value);
+	}
+
+	return 0;
+}
+
+int grf_read_registers(struct grf_radio *radio, const char *deviceid, const char *keys, struct grf_device *device)
+{
+	struct grf_register_mask mask;
+	unsigned long            key;
+	char                    *end;
+
+	/* Parse the comma separated list of register keys */
+	GRF_REGISTER_MASK_ZERO(&mask);
+	do
+	{
+		key = strtoul(keys, &end, 16);
+		if (end == keys || (*end != ',' && *end != '\0') || key > GRF_REGISTER_KEY_MAX)
+		{
+			fprintf(stderr, "Invalid register key list \"%s\"\n", keys);
+			return EINVAL;
+		}
+		GRF_REGISTER_MASK_SET(key, &mask);
+		keys = end + 1;
+	} while (*end == ',');
+
+	/* Request the registers from the device */
+	printf("Requesting registers of device %s...\n", deviceid);
+	printf("Registers of %s:\n", deviceid);
+
+	return grf_comm_read_registers(radio, deviceid, &mask, device, grf_print_register, NULL);
+}
+
+int grf_read_group(struct grf_radio *radio, const char *groupid, struct grf_history *history, int *failed)
+{
+	struct grf_read_group_state state = { .history = history, .failed = 0 };
+	struct grf_devicelist       devices;
+	int                         retval;
+
+	/* Scan for devices and request the data of all of them */
+	grf_devicelist_init(&devices);
+	printf("Scanning for devices of group %s...\n", groupid);
+	retval = grf_comm_scan_devices(radio, groupid, &devices);
+	if (!retval)
+	{
+		grf_store_group(history, groupid, &devices);
+		printf("Requesting data of %zu devices in group %s...\n", devices.len, groupid);
+		retval = grf_comm_read_group(radio, &devices, grf_print_group_data, &state);
+	}
+	grf_devicelist_free(&devices);
+	*failed = state.failed;
+
+	return retval;
+}
+
+int grf_read_group_fleet(struct grf_radio *radios, size_t nradios, const char *groupid, struct grf_history *history, int *failed)
+{
+	struct grf_read_group_state state = { .history = history, .failed = 0 };
+	struct grf_fleet            fleet;
+	struct grf_devicelist       devices;
+	size_t                      count;
+	size_t                      i;
+	size_t                      j;
+	int                         result = 0;
+	int                         retval = 0;
+
+	/* Scan with all radios and spread the devices over the radios reaching them */
+	grf_fleet_init(&fleet);
+	for (i = 0; i < nradios && !retval; i++)
+		retval = grf_fleet_add_radio(&fleet, &radios[i]);
+	if (!retval)
+	{
+		printf("Scanning for devices of group %s with %zu radios...\n", groupid, nradios);
+		retval = grf_fleet_scan_group(&fleet, groupid, &count);
+	}
+	if (!retval && history)
+	{
+		/* The group consists of the devices found by any radio */
+		grf_devicelist_init(&devices);
+		for (i = 0; i < fleet.nradios && !result; i++)
+		{
+			for (j = 0; j < fleet.radios[i].found.len && !result; j++)
+				result = grf_devicelist_add(&devices, fleet.radios[i].found.ids[j]);
+		}
+		if (result)
+			fprintf(stderr, "ERROR: Storing devices of group %s failed: %s\n", groupid, strerror(result));
+		else
+			grf_store_group(history, groupid, &devices);
+		grf_devicelist_free(&devices);
+	}
+	if (!retval)
+	{
+		printf("Requesting data of %zu devices in group %s...\n", count, groupid);
+		retval = grf_fleet_run(&fleet, grf_print_group_data, &state);
+	}
+	grf_fleet_free(&fleet);
+	*failed = state.failed;
+
+	return retval;
+}
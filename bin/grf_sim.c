@@ -0,0 +1,639 @@
+/*
+ * Simulator of the radio module firmware for load testing
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <termios.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "grf.h"
+
+#include "grf_logging.h"
+
+#define GRF_SIM_VERSION             "GI_RM_V00.70"
+#define GRF_SIM_DEFAULT_GROUPS      1
+#define GRF_SIM_DEFAULT_DEVICES     40
+#define GRF_SIM_DEFAULT_LATENCY_MIN 200     /* milliseconds */
+#define GRF_SIM_DEFAULT_LATENCY_MAX 1000    /* milliseconds */
+#define GRF_SIM_DEFAULT_LINE_DELAY  300     /* milliseconds */
+#define GRF_SIM_DEFAULT_TIMEOUT     6000    /* milliseconds */
+#define GRF_SIM_DEFAULT_SD_PERCENT  50
+#define GRF_SIM_DEFAULT_LOGLEVEL    GRF_LOGGING_WARN
+
+#define GRF_SIM_FRAMESIZE           64
+#define GRF_SIM_UNKNOWN_REGISTERS   40
+
+/* Virtual smoke detector */
+struct grf_sim_device
+{
+	char      id[5];			/* 4-character ID of the detector */
+	size_t    group;			/* Index of the group the detector belongs to */
+	int       latency;			/* Response latency in milliseconds */
+	bool      needs_diagnosis;	/* Data acquisition requires starting the diagnosis mode first */
+	bool      in_diagnosis;		/* Diagnosis mode is started */
+	bool      signal;			/* Accustic signal is switched on */
+	uint32_t  registers[7];		/* Registers 0x0001 to 0x0007 */
+	uint32_t  unknown[GRF_SIM_UNKNOWN_REGISTERS];	/* Registers 0x0014 to 0x003B */
+	uint32_t  unknown_64;		/* Register 0x0064 */
+};
+
+/* Chunk of data scheduled to be sent to the client */
+struct grf_sim_output
+{
+	struct timespec due;					/* Point in time to send the data */
+	char            data[GRF_SIM_FRAMESIZE];/* Data to send */
+	size_t          len;					/* Length of the data */
+};
+
+/* State of the simulator */
+struct grf_sim
+{
+	int                    master;		/* Master side of the pseudo terminal */
+	int                    slave;		/* Slave side kept open to survive clients closing the terminal */
+
+	char                 (*groups)[5];	/* IDs of the groups */
+	size_t                 ngroups;		/* Number of groups */
+	struct grf_sim_device *devices;		/* Virtual detectors */
+	size_t                 ndevices;	/* Number of detectors */
+
+	int                    line_delay;	/* Delay between the lines of a register dump in milliseconds */
+	int                    timeout;		/* Time until the radio reports a timeout in milliseconds */
+
+	struct grf_sim_output *output;		/* Queue of scheduled output */
+	size_t                 head;		/* Index of the next output to send */
+	size_t                 len;			/* Number of entries in the output queue */
+	size_t                 size;		/* Capacity of the output queue */
+	struct timespec        busy;		/* Point in time the radio finishes the scheduled output */
+
+	char                   cmd[GRF_SIM_FRAMESIZE];	/* Command currently received */
+	size_t                 cmdlen;		/* Length of the command currently received */
+	bool                   incmd;		/* Status flag if a command is currently received */
+};
+
+static volatile sig_atomic_t terminate = 0;
+
+static void on_signal(int signum)
+{
+	terminate = 1;
+}
+
+static void usage(const char *progname)
+{
+	printf("Usage: %s [options]\n", progname);
+	printf("\n");
+	printf("  Emulates the radio module firmware %s on a pseudo terminal.\n", GRF_SIM_VERSION);
+	printf("\n");
+	printf("  options:\n"
+		"    -g  --groups <n>                         number of simulated groups (default: %d)\n"
+		"    -n  --devices <n>                        number of simulated devices per group (default: %d)\n"
+		"    -l  --latency-min <ms>                   minimal response latency of a device (default: %d)\n"
+		"    -L  --latency-max <ms>                   maximal response latency of a device (default: %d)\n"
+		"    -i  --line-delay <ms>                    delay between lines of a data read-out (default: %d)\n"
+		"    -T  --timeout <ms>                       time until the radio reports a timeout (default: %d)\n"
+		"    -p  --diagnosis <percent>                devices requiring the diagnosis start (default: %d)\n"
+		"    -s  --seed <seed>                        seed for generating the fleet (default: 1)\n"
+		"    -o  --link <path>                        create a symbolic link to the pseudo terminal\n"
+		"    -v  --verbose <level>                    set debug level to one of {error, warn, info, debug, debugio}\n"
+		"    -h  --help                               show this help\n",
+		GRF_SIM_DEFAULT_GROUPS, GRF_SIM_DEFAULT_DEVICES, GRF_SIM_DEFAULT_LATENCY_MIN, GRF_SIM_DEFAULT_LATENCY_MAX,
+		GRF_SIM_DEFAULT_LINE_DELAY, GRF_SIM_DEFAULT_TIMEOUT, GRF_SIM_DEFAULT_SD_PERCENT
+		);
+	printf("\n");
+
+	fflush(stdout);
+}
+
+/*---------------------------------------------------------------------------*/
+static uint32_t sim_random(uint32_t *state)
+{
+	/* xorshift32 to get the same fleet for the same seed on every platform */
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+
+	return *state;
+}
+
+static bool sim_id_used(struct grf_sim *sim, const char *id)
+{
+	size_t i;
+
+	for (i = 0; i < sim->ngroups; i++)
+		if (strcmp(sim->groups[i], id) == 0)
+			return true;
+	for (i = 0; i < sim->ndevices; i++)
+		if (strcmp(sim->devices[i].id, id) == 0)
+			return true;
+
+	return false;
+}
+
+static void sim_random_id(struct grf_sim *sim, uint32_t *state, char *id)
+{
+	/* Generate unique IDs for groups and devices */
+	do {
+		snprintf(id, 5, "%04X", sim_random(state) & 0xFFFF);
+	} while (sim_id_used(sim, id));
+}
+
+static int sim_generate(struct grf_sim *sim, size_t ngroups, size_t ndevices, int latency_min, int latency_max, int sd_percent, uint32_t seed)
+{
+	struct grf_sim_device *dev;
+	uint32_t               state = seed ? seed : 1;
+	size_t                 i, j;
+
+	sim->groups  = calloc(ngroups, sizeof(*sim->groups));
+	sim->devices = calloc(ngroups * ndevices, sizeof(struct grf_sim_device));
+	if (!sim->groups || !sim->devices)
+		return ENOMEM;
+
+	for (i = 0; i < ngroups; i++)
+	{
+		sim_random_id(sim, &state, sim->groups[i]);
+		sim->ngroups++;
+
+		for (j = 0; j < ndevices; j++)
+		{
+			dev = &sim->devices[sim->ndevices];
+			sim_random_id(sim, &state, dev->id);
+			dev->group           = i;
+			dev->latency         = latency_min + sim_random(&state) % (latency_max - latency_min + 1);
+			dev->needs_diagnosis = (int)(sim_random(&state) % 100) < sd_percent;
+
+			/* Plausible register contents, see recv_data() for the layout */
+			dev->registers[0] = sim_random(&state);										/* serial number */
+			dev->registers[1] = 0x01460142;												/* unknown */
+			dev->registers[2] = sim_random(&state) % (4 * 3600 * 24 * 3650);				/* operation time */
+			dev->registers[3] = ((0x60 + sim_random(&state) % 0x20) << 16) | (sim_random(&state) % 3); /* smoke chamber */
+			dev->registers[4] = ((480 + sim_random(&state) % 50) << 16) |					/* battery and temperatures */
+			                    ((80 + sim_random(&state) % 16) << 8) | (80 + sim_random(&state) % 16);
+			dev->registers[5] = (sim_random(&state) % 4) << 16;							/* alert counters */
+			dev->registers[6] = sim_random(&state) % 4;									/* remote test alerts */
+			memset(dev->unknown, 0xFF, sizeof(dev->unknown));
+			dev->unknown_64   = 0;
+			sim->ndevices++;
+		}
+	}
+
+	return 0;
+}
+
+static struct grf_sim_device *sim_find_device(struct grf_sim *sim, const char *id)
+{
+	size_t i;
+
+	for (i = 0; i < sim->ndevices; i++)
+		if (strncmp(sim->devices[i].id, id, 4) == 0)
+			return &sim->devices[i];
+
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static void timespec_add_ms(struct timespec *t, int ms)
+{
+	t->tv_sec  += ms / 1000;
+	t->tv_nsec += (ms % 1000) * 1000000L;
+	if (t->tv_nsec >= 1000000000L)
+	{
+		t->tv_sec  += 1;
+		t->tv_nsec -= 1000000000L;
+	}
+}
+
+static int timespec_diff_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 + (a->tv_nsec - b->tv_nsec) / 1000000L;
+}
+
+static int sim_schedule(struct grf_sim *sim, int delay, const char *fmt, ...)
+{
+	struct grf_sim_output *out;
+	struct timespec        now;
+	va_list                arglist;
+	int                    count;
+
+	/* Grow the queue if necessary, compacting it first */
+	if (sim->head > 0 && sim->head == sim->len)
+	{
+		sim->head = 0;
+		sim->len  = 0;
+	}
+	if (sim->len >= sim->size)
+	{
+		out = realloc(sim->output, (sim->size ? 2 * sim->size : 64) * sizeof(struct grf_sim_output));
+		if (!out)
+			return ENOMEM;
+		sim->output = out;
+		sim->size   = sim->size ? 2 * sim->size : 64;
+	}
+	out = &sim->output[sim->len];
+
+	/* The radio handles one request after the other */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_diff_ms(&sim->busy, &now) < 0)
+		sim->busy = now;
+	timespec_add_ms(&sim->busy, delay);
+	out->due = sim->busy;
+
+	va_start(arglist, fmt);
+	count = vsnprintf(out->data, GRF_SIM_FRAMESIZE, fmt, arglist);
+	va_end(arglist);
+	if (count < 0 || count >= GRF_SIM_FRAMESIZE)
+		return ENOBUFS;
+	out->len = count;
+	sim->len++;
+
+	return 0;
+}
+
+static int sim_handle_command(struct grf_sim *sim, const char *cmd)
+{
+	struct grf_sim_device *dev = NULL;
+	char                   id[5];
+	unsigned int           type;
+	size_t                 i;
+
+	grf_logging_dbg("command: %s", cmd);
+
+	/* Set the radio to command mode */
+	if (strcmp(cmd, "01TESTA1") == 0)
+		return sim_schedule(sim, 0, "%c", GRF_ACK);
+
+	/* Firmware version */
+	if (strcmp(cmd, "SV") == 0)
+		return sim_schedule(sim, 0, "%c%s%c", GRF_STX, GRF_SIM_VERSION, GRF_ETX);
+
+	/* Group scan, we assume that the first group is sending its ID */
+	if (strcmp(cmd, "GA") == 0)
+	{
+		RETURN_ON_ERROR(sim_schedule(sim, 0, "%c", GRF_ACK));
+		return sim_schedule(sim, sim->devices[0].latency, "%c%s%c", GRF_STX, sim->groups[0], GRF_ETX);
+	}
+
+	/* Device scan of a group */
+	if (sscanf(cmd, "GD:%4s", id) == 1)
+	{
+		RETURN_ON_ERROR(sim_schedule(sim, 0, "%c", GRF_ACK));
+		RETURN_ON_ERROR(sim_schedule(sim, 0, "%cREC%c", GRF_STX, GRF_ETX));
+		for (i = 0; i < sim->ndevices; i++)
+		{
+			dev = &sim->devices[i];
+			if (strcmp(sim->groups[dev->group], id) != 0)
+				continue;
+			RETURN_ON_ERROR(sim_schedule(sim, dev->latency, "%c%s%c", GRF_STX, dev->id, GRF_ETX));
+		}
+		return sim_schedule(sim, sim->timeout, "%cTimeout%c", GRF_STX, GRF_ETX);
+	}
+
+	/* Diagnosis start */
+	if (sscanf(cmd, "SD:%4s", id) == 1)
+	{
+		RETURN_ON_ERROR(sim_schedule(sim, 0, "%c", GRF_ACK));
+		dev = sim_find_device(sim, id);
+		if (!dev)
+			return sim_schedule(sim, sim->timeout, "%cTimeout%c", GRF_STX, GRF_ETX);
+		dev->in_diagnosis = true;
+		RETURN_ON_ERROR(sim_schedule(sim, dev->latency, "%cREC%c", GRF_STX, GRF_ETX));
+		return sim_schedule(sim, dev->latency, "%cDone%c", GRF_STX, GRF_ETX);
+	}
+
+	/* Data acquisition */
+	if (sscanf(cmd, "DA:%4s:%02u", id, &type) == 2)
+	{
+		RETURN_ON_ERROR(sim_schedule(sim, 0, "%c", GRF_ACK));
+		dev = sim_find_device(sim, id);
+		if (!dev || (dev->needs_diagnosis && !dev->in_diagnosis))
+			return sim_schedule(sim, sim->timeout, "%cTimeout%c", GRF_STX, GRF_ETX);
+
+		switch (type)
+		{
+			case 1:		/* send data */
+				for (i = 0; i < 7; i++)
+					RETURN_ON_ERROR(sim_schedule(sim, i ? sim->line_delay : dev->latency, "%c%04zX:%08X%c%c",
+					                             GRF_STX, i + 1, dev->registers[i], GRF_ETX, GRF_CONT));
+				for (i = 0; i < GRF_SIM_UNKNOWN_REGISTERS; i++)
+					RETURN_ON_ERROR(sim_schedule(sim, sim->line_delay, "%c%04zX:%08X%c%c",
+					                             GRF_STX, i + 0x14, dev->unknown[i], GRF_ETX, GRF_CONT));
+				RETURN_ON_ERROR(sim_schedule(sim, sim->line_delay, "%c%04X:%08X%c%c",
+				                             GRF_STX, 0x64, dev->unknown_64, GRF_ETX, GRF_CONT));
+				return sim_schedule(sim, sim->line_delay, "%cTimeout%c", GRF_STX, GRF_ETX);
+			case 3:		/* signal on */
+			case 6:		/* signal off */
+				dev->signal = (type == 3);
+				grf_logging_info("Signal of %s switched %s", dev->id, dev->signal ? "on" : "off");
+				break;
+			case 4:		/* stop */
+				dev->in_diagnosis = false;
+				break;
+			case 5:		/* start */
+				break;
+			default:
+				return sim_schedule(sim, 0, "%c", GRF_NAK);
+		}
+		return sim_schedule(sim, dev->latency, "%cDone%c", GRF_STX, GRF_ETX);
+	}
+
+	grf_logging_warn("Unknown command %s", cmd);
+
+	return sim_schedule(sim, 0, "%c", GRF_NAK);
+}
+
+static int sim_receive(struct grf_sim *sim)
+{
+	char    buf[256];
+	ssize_t count;
+	ssize_t i;
+
+	count = read(sim->master, buf, sizeof(buf));
+	if (count < 0)
+		return (errno == EAGAIN || errno == EINTR || errno == EIO) ? 0 : errno;
+	grf_logging_log_hex(GRF_LOGGING_DEBUG_IO, buf, count, "read: %zd byte(s)", count);
+
+	/* Assemble the commands framed by <STX> and <ETX> */
+	for (i = 0; i < count; i++)
+	{
+		switch (buf[i])
+		{
+			case GRF_NUL:
+				break;
+			case GRF_STX:
+				sim->incmd  = true;
+				sim->cmdlen = 0;
+				break;
+			case GRF_ETX:
+				if (!sim->incmd)
+					break;
+				sim->cmd[sim->cmdlen] = '\0';
+				sim->incmd = false;
+				RETURN_ON_ERROR(sim_handle_command(sim, sim->cmd));
+				break;
+			default:
+				if (sim->incmd && sim->cmdlen < GRF_SIM_FRAMESIZE - 1)
+					sim->cmd[sim->cmdlen++] = buf[i];
+				break;
+		}
+	}
+
+	return 0;
+}
+
+static int sim_send(struct grf_sim *sim, int *wait)
+{
+	struct grf_sim_output *out;
+	struct timespec        now;
+
+	/* Send all output that is due and determine how long to wait for the next */
+	*wait = -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (sim->head < sim->len)
+	{
+		out = &sim->output[sim->head];
+		*wait = timespec_diff_ms(&out->due, &now);
+		if (*wait > 0)
+			break;
+		grf_logging_log_hex(GRF_LOGGING_DEBUG_IO, out->data, out->len, "write: %zu byte(s)", out->len);
+		if (write(sim->master, out->data, out->len) < 0 && errno != EIO)
+			return errno;
+		sim->head++;
+		*wait = -1;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static int sim_open(struct grf_sim *sim, const char *link)
+{
+	struct termios  tty_attr;
+	const char     *name;
+
+	/* Open a new pseudo terminal and keep the slave side open
+	 * as otherwise the master reports errors once clients close it.
+	 */
+	sim->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (sim->master < 0 || grantpt(sim->master) || unlockpt(sim->master))
+		return errno;
+	name = ptsname(sim->master);
+	if (!name)
+		return errno;
+	sim->slave = open(name, O_RDWR | O_NOCTTY);
+	if (sim->slave < 0)
+		return errno;
+
+	/* Transparent transmission, just like the real UART */
+	if (tcgetattr(sim->slave, &tty_attr))
+		return errno;
+	cfmakeraw(&tty_attr);
+	if (tcsetattr(sim->slave, TCSANOW, &tty_attr))
+		return errno;
+
+	if (link)
+	{
+		unlink(link);
+		if (symlink(name, link))
+			return errno;
+	}
+
+	printf("Simulating %zu devices in %zu groups on %s\n", sim->ndevices, sim->ngroups, name);
+	fflush(stdout);
+
+	return 0;
+}
+
+static void sim_print_fleet(struct grf_sim *sim)
+{
+	size_t i;
+
+	for (i = 0; i < sim->ndevices; i++)
+		grf_logging_info("group %s device %s latency %d ms%s", sim->groups[sim->devices[i].group],
+		                 sim->devices[i].id, sim->devices[i].latency,
+		                 sim->devices[i].needs_diagnosis ? " (requires diagnosis start)" : "");
+}
+/*---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+	struct grf_sim  sim;
+	struct pollfd   pfd;
+	const char     *link = NULL;
+	int             ngroups = GRF_SIM_DEFAULT_GROUPS;
+	int             ndevices = GRF_SIM_DEFAULT_DEVICES;
+	int             latency_min = GRF_SIM_DEFAULT_LATENCY_MIN;
+	int             latency_max = GRF_SIM_DEFAULT_LATENCY_MAX;
+	int             sd_percent = GRF_SIM_DEFAULT_SD_PERCENT;
+	int             loglevel = GRF_SIM_DEFAULT_LOGLEVEL;
+	uint32_t        seed = 1;
+	int             wait;
+	int             index;
+	int             ret = 0;
+	int             c;
+
+	static struct option options[] =
+	{
+		{"groups",      required_argument, 0, 'g'},
+		{"devices",     required_argument, 0, 'n'},
+		{"latency-min", required_argument, 0, 'l'},
+		{"latency-max", required_argument, 0, 'L'},
+		{"line-delay",  required_argument, 0, 'i'},
+		{"timeout",     required_argument, 0, 'T'},
+		{"diagnosis",   required_argument, 0, 'p'},
+		{"seed",        required_argument, 0, 's'},
+		{"link",        required_argument, 0, 'o'},
+		{"verbose",     required_argument, 0, 'v'},
+		{"help",        no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	memset(&sim, 0, sizeof(struct grf_sim));
+	sim.line_delay = GRF_SIM_DEFAULT_LINE_DELAY;
+	sim.timeout    = GRF_SIM_DEFAULT_TIMEOUT;
+
+	/* Parse the command line options */
+	while ((c = getopt_long(argc, argv, "g:n:l:L:i:T:p:s:o:v:h", options, &index)) > -1)
+	{
+		switch (c)
+		{
+			case 'g':
+				ngroups = atoi(optarg);
+				break;
+			case 'n':
+				ndevices = atoi(optarg);
+				break;
+			case 'l':
+				latency_min = atoi(optarg);
+				break;
+			case 'L':
+				latency_max = atoi(optarg);
+				break;
+			case 'i':
+				sim.line_delay = atoi(optarg);
+				break;
+			case 'T':
+				sim.timeout = atoi(optarg);
+				break;
+			case 'p':
+				sd_percent = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'o':
+				link = optarg;
+				break;
+			case 'v':
+				if (strcmp(optarg, "error") == 0)
+					loglevel = GRF_LOGGING_ERR;
+				else if (strcmp(optarg, "warn") == 0)
+					loglevel = GRF_LOGGING_WARN;
+				else if (strcmp(optarg, "info") == 0)
+					loglevel = GRF_LOGGING_INFO;
+				else if (strcmp(optarg, "debug") == 0)
+					loglevel = GRF_LOGGING_DEBUG;
+				else if (strcmp(optarg, "debugio") == 0)
+					loglevel = GRF_LOGGING_DEBUG_IO;
+				else
+				{
+					fprintf(stderr, "Unknown log-level %s!\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(EXIT_SUCCESS);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Check the parameters, the IDs are limited to 16 bit */
+	if (ngroups < 1 || ndevices < 1 || (long)ngroups * (ndevices + 1) > 0x8000 ||
+	    latency_min < 0 || latency_max < latency_min || sim.line_delay < 0 || sim.timeout < 0)
+	{
+		fprintf(stderr, "Invalid fleet configuration!\n");
+		exit(EXIT_FAILURE);
+	}
+	grf_logging_setlevel(loglevel);
+
+	ret = sim_generate(&sim, ngroups, ndevices, latency_min, latency_max, sd_percent, seed);
+	if (!ret)
+		ret = sim_open(&sim, link);
+	if (ret)
+	{
+		fprintf(stderr, "ERROR: Setting up the simulator failed: %s\n", strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+	sim_print_fleet(&sim);
+
+	signal(SIGINT,  on_signal);
+	signal(SIGTERM, on_signal);
+
+	/* Serve the clients until we are asked to terminate */
+	pfd.fd     = sim.master;
+	pfd.events = POLLIN;
+	while (!terminate)
+	{
+		ret = sim_send(&sim, &wait);
+		if (ret)
+			break;
+		if (poll(&pfd, 1, wait) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ret = errno;
+			break;
+		}
+		if (pfd.revents & POLLIN)
+			ret = sim_receive(&sim);
+		if (ret)
+			break;
+	}
+
+	if (link)
+		unlink(link);
+	close(sim.slave);
+	close(sim.master);
+	free(sim.output);
+	free(sim.devices);
+	free(sim.groups);
+
+	if (ret)
+	{
+		fprintf(stderr, "ERROR: Simulation failed: %s\n", strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+
+	exit(EXIT_SUCCESS);
+}
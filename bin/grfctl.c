@@ -27,8 +27,12 @@
 #include <termios.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <stdint.h>
 
 #include "grf.h"
+#include "grf_history.h"
+#include "grf_fleet.h"
 
 #include "grf_logging.h"
 
@@ -42,14 +46,30 @@ static void on_exit_handler(void);
 extern int grf_scan_group(struct grf_radio *radio, char **groupid);
 extern int grf_scan_devices(struct grf_radio *radio, const char *groupid, struct grf_devicelist *devices);
 extern int grf_read_data(struct grf_radio *radio, const char *deviceid, struct grf_device *device);
+extern int grf_read_group(struct grf_radio *radio, const char *groupid, struct grf_history *history, int *failed);
+extern void grf_store_group(struct grf_history *history, const char *groupid, const struct grf_devicelist *devices);
+extern int grf_read_group_fleet(struct grf_radio *radios, size_t nradios, const char *groupid, struct grf_history *history, int *failed);
+extern int grf_read_registers(struct grf_radio *radio, const char *deviceid, const char *keys, struct grf_device *device);
 extern void grf_print_data(struct grf_device *device);
 extern int grf_switch_signal(struct grf_radio *radio, const char *deviceid, bool on);
+extern int grf_client_request(const char *server, char **args, int nargs, struct grf_history *history,
+                              struct grf_devicelist *devices, int *failed);
+extern int grf_parse_time(const char *str, time_t *timestamp);
+extern int grf_history_report(struct grf_history *hist, const char (*ids)[GRF_DEVICEID_LEN + 1], size_t nids,
+                              time_t since, time_t until, const char *fields, const char *period, size_t *count);
 
-static struct grf_radio radio;
+static struct grf_radio   radios[GRF_FLEET_MAX_RADIOS];
+static size_t             nradios = 0;
+static struct grf_history history = { .fd = -1 };
 
 static void on_exit_handler(void)
 {
-	grf_radio_exit(&radio);
+	size_t i;
+
+	for (i = 0; i < nradios; i++)
+		grf_radio_exit(&radios[i]);
+	if (history.fd >= 0)
+		grf_history_close(&history);
 }
 
 static void usage(const char *progname)
@@ -57,9 +77,17 @@ static void usage(const char *progname)
 	printf("Usage: %s [options] <command> [command arguments]\n", progname);
 	printf("\n");
 	printf("  options:\n"
-		"    -d  --device <device>                    use the given device (default: %s)\n"
+		"    -d  --device <device>                    use the given device or unix:<socket> of a serial server (default: %s),\n"
+		"                                             repeat to read groups with several radios at once\n"
+		"    -S  --server <socket>                    send the command to the grfd daemon listening on the given socket instead of using the device\n"
 		"    -t  --timeout <timeout>                  use the timeout in seconds while executing the command (default: %d)\n"
 		"    -v  --verbose <level>                    set debug level to one of {error, warn, info, debug, debugio}\n"
+		"    -H  --history <file>                     append the data read to the given history file respectively query it\n"
+		"    -s  --since <time>                       report readings since YYYY-MM-DD[ HH:MM[:SS]] or @<seconds since epoch>\n"
+		"    -u  --until <time>                       report readings until YYYY-MM-DD[ HH:MM[:SS]] or @<seconds since epoch>\n"
+		"    -f  --fields <fields>                    report the comma separated fields (default: battery-voltage,temperature-1,temperature-2)\n"
+		"    -p  --period <period>                    aggregate the readings per none, day, week, month or year (default: none)\n"
+		"    -g  --group                              report the history of all devices of the group given instead of a device\n"
 		"    -h  --help                               show this help\n",
 		GRF_DEFAULT_DEVICE, GRF_DEFAULT_TIMEOUT
 		);
@@ -70,8 +98,12 @@ static void usage(const char *progname)
 		"    scan-groups                              scan for detector groups\n"
 		"    scan-devices <group>                     scan for all devices in the given group\n"
 		"    request-data <device>                    read the data of the given device\n"
+		"    request-group <group>                    read the data of all devices in the given group\n"
+		"    request-registers <device> <keys>        read the comma separated hex register keys of the given device\n"
 		"    activate-signal <device>                 activate the accustic signal of the given device\n"
 		"    deactivate-signal <device>               deactivate the accustic signal of the given device\n"
+		"    history [<device|group>]                 report min, mean and max of fields in the history file per period\n"
+		"    select <field> <lt|le|eq|ge|gt> <value>  report the latest readings of the server matching the condition on the field\n"
 		);
 	printf("\n");
 	
@@ -80,7 +112,7 @@ static void usage(const char *progname)
 
 static const char *get_cmd_param(char **argv, int argc, int oidx)
 {
-	if (argc - optind < 2)
+	if (argc - oidx < 2)
 	{
 		usage(argv[0]);
 		exit(EXIT_FAILURE);
@@ -88,12 +120,64 @@ static const char *get_cmd_param(char **argv, int argc, int oidx)
 	return argv[oidx+1];
 }
 
+static void radio_setup(const char **devs, size_t ndevs, int timeout)
+{
+	int ret;
+
+	/* Setup the radios and register the on exit handler in case we die suddenly */
+	for (nradios = 0; nradios < ndevs; nradios++)
+	{
+		ret = grf_radio_init(&radios[nradios], devs[nradios], timeout);
+		if (ret)
+		{
+			fprintf(stderr, "ERROR: Initialization of radio device failed: %s\n", strerror(ret));
+			exit(EXIT_FAILURE);
+		}
+
+		/* Initialize Gira RF module */
+		ret = grf_comm_init(&radios[nradios]);
+		if (ret)
+		{
+			/* The radio is initialized and thus closed on exit */
+			nradios++;
+			fprintf(stderr, "ERROR: Initializing communication failed: %s\n", strerror(ret));
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void history_open(const char *path, int mode)
+{
+	int ret;
+
+	if (!path)
+	{
+		fprintf(stderr, "ERROR: No history file given!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	ret = grf_history_open(&history, path, mode);
+	if (ret)
+	{
+		fprintf(stderr, "ERROR: Opening history file %s failed: %s\n", path, strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+}
+
 int main(int argc, char **argv)
 {
 	const char    *cmd;
-	char          *dev = strdup(GRF_DEFAULT_DEVICE);
+	const char    *devs[GRF_FLEET_MAX_RADIOS] = { GRF_DEFAULT_DEVICE };
+	size_t         ndevs = 0;
 	int            timeout = GRF_DEFAULT_TIMEOUT;
 	int            loglevel = GRF_DEFAULT_LOGLEVEL;
+	const char    *server = NULL;
+	const char    *historyfile = NULL;
+	const char    *fields = NULL;
+	const char    *period = NULL;
+	time_t         since = 0;
+	time_t         until = (sizeof(time_t) > 4) ? (time_t)INT64_MAX : (time_t)INT32_MAX;
+	bool           group = false;
 	int            index;
 	int            ret;
 	char           c;
@@ -101,20 +185,36 @@ int main(int argc, char **argv)
 	static struct option options[] =
 	{
 		{"device",  required_argument, 0, 'd'},
+		{"server",  required_argument, 0, 'S'},
 		{"timeout", required_argument, 0, 't'},
 		{"verbose", required_argument, 0, 'v'},
+		{"history", required_argument, 0, 'H'},
+		{"since",   required_argument, 0, 's'},
+		{"until",   required_argument, 0, 'u'},
+		{"fields",  required_argument, 0, 'f'},
+		{"period",  required_argument, 0, 'p'},
+		{"group",   no_argument,       0, 'g'},
 		{"help",    no_argument,       0, 'h'},
 		{0, 0, 0, 0}
 	};
 
 	/* Parse the command line options */
-	while ((c = getopt_long(argc, argv, "d:t:v:h", options, &index)) > -1)
+	while ((c = getopt_long(argc, argv, "d:S:t:v:H:s:u:f:p:gh", options, &index)) > -1)
 	{
 		switch (c)
 		{
 			case 'd':
-				dev = strdup(optarg);
-				printf("Using device %s...\n", dev);
+				if (ndevs >= GRF_FLEET_MAX_RADIOS)
+				{
+					fprintf(stderr, "Too many devices, at most %d are supported!\n", GRF_FLEET_MAX_RADIOS);
+					exit(EXIT_FAILURE);
+				}
+				devs[ndevs++] = optarg;
+				printf("Using device %s...\n", optarg);
+				break;
+			case 'S':
+				server = optarg;
+				printf("Using server %s...\n", server);
 				break;
 			case 't':
 				timeout = atoi(optarg);
@@ -143,6 +243,26 @@ int main(int argc, char **argv)
 					exit(EXIT_FAILURE);
 				}
 				break;
+			case 'H':
+				historyfile = optarg;
+				break;
+			case 's':
+			case 'u':
+				if (grf_parse_time(optarg, (c == 's') ? &since : &until))
+				{
+					fprintf(stderr, "Invalid time %s!\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'f':
+				fields = optarg;
+				break;
+			case 'p':
+				period = optarg;
+				break;
+			case 'g':
+				group = true;
+				break;
 			case 'h':
 				usage(argv[0]);
 				exit(EXIT_SUCCESS);
@@ -159,6 +279,9 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 	
+	if (ndevs == 0)
+		ndevs = 1;
+
 	/* Adjust the log-level to the given level */
 	grf_logging_setlevel(loglevel);
 
@@ -170,35 +293,112 @@ int main(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
-	/* Setup the radio and register the on exit handler in case we die suddenly */
-	memset(&radio, 0, sizeof(struct grf_radio));
-	radio.is_initialized = false;
 	atexit(on_exit_handler);
-	ret = grf_radio_init(&radio, dev, timeout);
-	if (ret)
+
+	/* The history only requires the radio to find the devices of a group not recorded in it */
+	if(strcasecmp(cmd, "history") == 0)
 	{
-		fprintf(stderr, "ERROR: Initialization of radio device failed: %s\n", strerror(ret));
+		char                   deviceid[GRF_DEVICEID_LEN + 1];
+		struct grf_devicelist  devices;
+		size_t                 count;
+
+		history_open(historyfile, GRF_HISTORY_READ);
+		if (argc - optind < 2)
+			ret = grf_history_report(&history, NULL, 0, since, until, fields, period, &count);
+		else if (!group)
+		{
+			snprintf(deviceid, sizeof(deviceid), "%s", argv[optind + 1]);
+			ret = grf_history_report(&history, &deviceid, 1, since, until, fields, period, &count);
+		}
+		else
+		{
+			/* Ask the devices of groups read before the history recorded them */
+			grf_devicelist_init(&devices);
+			ret = grf_history_get_group(&history, argv[optind + 1], &devices);
+			if (ret == ENOENT && server)
+			{
+				char *args[] = { "scan-devices", argv[optind + 1] };
+				int   failed;
+
+				ret = grf_client_request(server, args, 2, NULL, &devices, &failed);
+			}
+			else if (ret == ENOENT)
+			{
+				radio_setup(devs, 1, timeout);
+				ret = grf_scan_devices(&radios[0], argv[optind + 1], &devices);
+			}
+			if (!ret)
+				ret = grf_history_report(&history, (const char (*)[GRF_DEVICEID_LEN + 1])devices.ids, devices.len,
+				                         since, until, fields, period, &count);
+			grf_devicelist_free(&devices);
+		}
+		if (ret)
+		{
+			fprintf(stderr, "ERROR: Querying history failed: %s\n", strerror(ret));
+			exit(EXIT_FAILURE);
+		}
+		if (count == 0)
+			printf("No readings found!\n");
+		exit(EXIT_SUCCESS);
+	}
+
+	/* Readings are appended to the history if requested */
+	if (historyfile)
+		history_open(historyfile, GRF_HISTORY_WRITE);
+
+	/* The daemon owning the radio handles the command on behalf of us */
+	if (server)
+	{
+		int failed;
+
+		ret = grf_client_request(server, argv + optind, argc - optind, historyfile ? &history : NULL, NULL, &failed);
+		if (ret)
+		{
+			fprintf(stderr, "ERROR: Command \"%s\" failed on server %s: %s\n", cmd, server, strerror(ret));
+			exit(EXIT_FAILURE);
+		}
+		if (failed)
+		{
+			fprintf(stderr, "ERROR: Requesting data of %d device(s) failed\n", failed);
+			exit(EXIT_FAILURE);
+		}
+		if (historyfile)
+		{
+			ret = grf_history_close(&history);
+			if (ret)
+			{
+				fprintf(stderr, "ERROR: Closing history file %s failed: %s\n", historyfile, strerror(ret));
+				exit(EXIT_FAILURE);
+			}
+		}
+		exit(EXIT_SUCCESS);
+	}
+
+	/* Selections are answered from the readings kept by the daemon only */
+	if (strcasecmp(cmd, "select") == 0)
+	{
+		fprintf(stderr, "ERROR: Command \"%s\" requires a server\n", cmd);
 		exit(EXIT_FAILURE);
 	}
 
-	/* Initialize Gira RF module */
-	ret = grf_comm_init(&radio);
-	if (ret)
+	/* Several radios share the work of reading a group only */
+	if (ndevs > 1 && strcasecmp(cmd, "request-group") != 0)
 	{
-		fprintf(stderr, "ERROR: Initializing communication failed: %s\n", strerror(ret));
+		fprintf(stderr, "ERROR: Command \"%s\" supports a single device only\n", cmd);
 		exit(EXIT_FAILURE);
 	}
+	radio_setup(devs, ndevs, timeout);
 
 	/* Parse the remaining command that require the radio */
 	if(strcasecmp(cmd, "show-firmware-version") == 0)
 	{
-		printf("Firmware version: %s\n", radio.firmware_version);
+		printf("Firmware version: %s\n", radios[0].firmware_version);
 	}
 	else if(strcasecmp(cmd, "scan-groups") == 0)
 	{
 		char *groupid;
 		
-		ret = grf_scan_group(&radio, &groupid);
+		ret = grf_scan_group(&radios[0], &groupid);
 		if (ret)
 		{
 			fprintf(stderr, "ERROR: Scanning group IDs failed: %s\n", strerror(ret));
@@ -216,9 +416,10 @@ int main(int argc, char **argv)
 	{
 		const char            *groupid = get_cmd_param(argv, argc, optind);
 		struct grf_devicelist  devices;
-		int                    i;
+		size_t                 i;
 		
-		ret = grf_scan_devices(&radio, groupid, &devices);
+		grf_devicelist_init(&devices);
+		ret = grf_scan_devices(&radios[0], groupid, &devices);
 		if (ret)
 		{
 			fprintf(stderr, "ERROR: Scanning devices of group %s failed: %s\n", groupid, strerror(ret));
@@ -229,18 +430,20 @@ int main(int argc, char **argv)
 		if (devices.len < 1)
 			printf("No devices found!\n");
 
-		printf("Found %d devices in group %s:\n", devices.len, groupid);
+		printf("Found %zu devices in group %s:\n", devices.len, groupid);
 		for (i = 0; i < devices.len; i++)
 		{
-			printf("    %s\n", devices.devices[i].id);
+			printf("    %s\n", devices.ids[i]);
 		}
+		grf_store_group(historyfile ? &history : NULL, groupid, &devices);
+		grf_devicelist_free(&devices);
 	}
 	else if(strcasecmp(cmd, "request-data") == 0)
 	{
 		const char            *deviceid = get_cmd_param(argv, argc, optind);
 		struct grf_device      device;
 
-		ret = grf_read_data(&radio, deviceid, &device);
+		ret = grf_read_data(&radios[0], deviceid, &device);
 		if (ret)
 		{
 			fprintf(stderr, "ERROR: Requesting data of device %s failed: %s\n", deviceid, strerror(ret));
@@ -250,12 +453,54 @@ int main(int argc, char **argv)
 		/* Output the result of the request */
 		printf("Data of %s:\n", deviceid);
 		grf_print_data(&device);
+		if (historyfile)
+		{
+			ret = grf_history_append(&history, &device);
+			if (ret)
+			{
+				fprintf(stderr, "ERROR: Storing data of device %s failed: %s\n", deviceid, strerror(ret));
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	else if(strcasecmp(cmd, "request-group") == 0)
+	{
+		const char            *groupid = get_cmd_param(argv, argc, optind);
+		int                    failed;
+
+		if (nradios > 1)
+			ret = grf_read_group_fleet(radios, nradios, groupid, historyfile ? &history : NULL, &failed);
+		else
+			ret = grf_read_group(&radios[0], groupid, historyfile ? &history : NULL, &failed);
+		if (ret)
+		{
+			fprintf(stderr, "ERROR: Requesting data of group %s failed: %s\n", groupid, strerror(ret));
+			exit(EXIT_FAILURE);
+		}
+		if (failed)
+		{
+			fprintf(stderr, "ERROR: Requesting data of %d device(s) in group %s failed\n", failed, groupid);
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if(strcasecmp(cmd, "request-registers") == 0)
+	{
+		const char            *deviceid = get_cmd_param(argv, argc, optind);
+		const char            *keys = get_cmd_param(argv, argc, optind + 1);
+		struct grf_device      device;
+
+		ret = grf_read_registers(&radios[0], deviceid, keys, &device);
+		if (ret)
+		{
+			fprintf(stderr, "ERROR: Requesting registers of device %s failed: %s\n", deviceid, strerror(ret));
+			exit(EXIT_FAILURE);
+		}
 	}
 	else if(strcasecmp(cmd, "activate-signal") == 0)
 	{
 		const char *deviceid = get_cmd_param(argv, argc, optind);
 
-		ret = grf_switch_signal(&radio, deviceid, true);
+		ret = grf_switch_signal(&radios[0], deviceid, true);
 		if (ret)
 		{
 			fprintf(stderr, "ERROR: Activating signal of device %s failed: %s\n", deviceid, strerror(ret));
@@ -266,7 +511,7 @@ int main(int argc, char **argv)
 	{
 		const char *deviceid = get_cmd_param(argv, argc, optind);
 
-		ret = grf_switch_signal(&radio, deviceid, false);
+		ret = grf_switch_signal(&radios[0], deviceid, false);
 		if (ret)
 		{
 			fprintf(stderr, "ERROR: Deactivating signal of device %s failed: %s\n", deviceid, strerror(ret));
@@ -279,12 +524,26 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	/* Close the radio */
-	ret = grf_radio_exit(&radio);
-	if (ret)
+	/* Close the radios */
+	for (; nradios > 0; nradios--)
 	{
-		fprintf(stderr, "ERROR: Closing the radio device failed: %s\n", strerror(ret));
-		exit(EXIT_FAILURE);
+		ret = grf_radio_exit(&radios[nradios - 1]);
+		if (ret)
+		{
+			fprintf(stderr, "ERROR: Closing the radio device failed: %s\n", strerror(ret));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Write the index of the history */
+	if (historyfile)
+	{
+		ret = grf_history_close(&history);
+		if (ret)
+		{
+			fprintf(stderr, "ERROR: Closing history file %s failed: %s\n", historyfile, strerror(ret));
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	exit(EXIT_SUCCESS);
@@ -0,0 +1,1173 @@
+/*
+ * Daemon owning the radio and serving requests of local clients
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The daemon keeps the radio in command mode and accepts requests over a
+ * Unix domain socket. A request is a single line consisting of a command
+ * and its arguments separated by spaces:
+ *
+ *   show-firmware-version
+ *   scan-groups
+ *   scan-devices <group>
+ *   request-data <device> [<max-age>]
+ *   request-group <group>
+ *   request-registers <device> <keys>
+ *   activate-signal <device>
+ *   deactivate-signal <device>
+ *   select <field> <lt|le|eq|ge|gt> <value>
+ *
+ * The reply consists of any number of data lines followed by either `OK` or
+ * `ERROR <errno> <description>`:
+ *
+ *   VERSION <firmware version>
+ *   GROUP <group>
+ *   DEVICE <device>
+ *   DATA <device> <timestamp> KKKK:VVVVVVVV ...    all registers of a device
+ *   REGISTER <device> KKKK:VVVVVVVV                 a single register
+ *   FAILED <device> <errno>                         a device of a group failed
+ *
+ * Requests for data not older than <max-age> seconds are answered from the
+ * data kept by the radio right away. All other requests are queued and run
+ * on the radio one after the other, signal switches first and group read-outs
+ * last. A group read-out gives way to more urgent requests between two
+ * devices and continues afterwards. Requests for the data of a device or
+ * the devices of a group arriving while the same request of another client
+ * is pending share its result instead of occupying the radio again. Each
+ * client can have a single request in progress, further requests sent by a
+ * client are handled after the reply to the previous one.
+ *
+ * The daemon keeps all readings in a fleet store. A selection is answered
+ * from the store without using the radio, it replies the latest reading of
+ * each device whose field matches the condition, e.g.
+ * `select battery-voltage lt 8.5`. The fields are named like the fields of
+ * the history report of grfctl plus `timestamp`. Only the registers kept by
+ * the store are part of the replied data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "grf.h"
+#include "grf_history.h"
+#include "grf_sched.h"
+#include "grf_store.h"
+
+#include "grf_logging.h"
+
+#define GRFD_VERSION                "0.1.0"
+#define GRFD_DEFAULT_DEVICE         "/dev/ttyUSB0"
+#define GRFD_DEFAULT_SOCKET         "/var/run/grfd.sock"
+#define GRFD_DEFAULT_TIMEOUT        60      /* seconds */
+#define GRFD_DEFAULT_MAX_AGE        60      /* seconds */
+#define GRFD_DEFAULT_LOGLEVEL       GRF_LOGGING_WARN
+
+#define GRFD_LINE_MAX               256     /* Maximum length of a request including the newline */
+#define GRFD_BACKLOG                16
+
+#define GRFD_CMD_NONE               0
+#define GRFD_CMD_SCAN_GROUPS        1
+#define GRFD_CMD_SCAN_DEVICES       2
+#define GRFD_CMD_READ_DATA          3
+#define GRFD_CMD_READ_GROUP         4
+#define GRFD_CMD_READ_REGISTERS     5
+#define GRFD_CMD_SWITCH_SIGNAL      6
+
+struct grfd;
+
+/* Connected client */
+struct grfd_client
+{
+	int                      fd;			/* Socket of the client, -1 once the client is gone */
+	bool                     eof;			/* Status flag if the client finished sending requests */
+
+	char                     in[GRFD_LINE_MAX];	/* Requests received but not handled yet */
+	size_t                   inlen;			/* Number of bytes in *in* */
+	char                    *out;			/* Replies not sent yet */
+	size_t                   outlen;		/* Number of bytes in *out* */
+	size_t                   outsize;		/* Capacity of *out* */
+
+	int                      cmd;			/* Command waiting for or running on the radio (GRFD_CMD_*) */
+	int                      stage;			/* Number of operations of the command finished */
+	char                     id[GRF_DEVICEID_LEN + 1];	/* ID of the device or group of the command */
+	bool                     on;			/* Requested state of the accustic signal */
+	char                    *group;			/* Group found by a group scan */
+	struct grf_register_mask mask;			/* Registers requested */
+	struct grf_device        device;		/* Data of the device requested */
+	struct grf_devicelist    devices;		/* Devices of the group requested */
+	struct grf_sched_job     job;			/* Job running the command on the radio */
+	struct grfd_client      *leader;		/* Client whose identical command is awaited instead (NULL if none) */
+	struct grfd_client      *waiters;		/* Clients awaiting the result of the command */
+	struct grfd_client      *next_waiter;	/* Next client awaiting the result of *leader* */
+	struct grfd             *grfd;			/* Daemon the client is connected to */
+};
+
+/* State of the daemon */
+struct grfd
+{
+	struct grf_radio         radio;			/* Radio owned by the daemon */
+	struct grf_sched         sched;			/* Scheduler of the operations on the radio */
+	struct grf_sched_job     keepalive_job;	/* Job keeping the radio in command mode */
+	struct timespec          keepalive;		/* Point in time the last keep-alive was started (CLOCK_MONOTONIC) */
+
+	int                      listener;		/* Listening socket */
+	struct grfd_client     **clients;		/* Connected clients */
+	size_t                   nclients;		/* Number of connected clients */
+	size_t                   size;			/* Capacity of *clients* */
+
+	int                      max_age;		/* Default maximum age of data answered from the kept data */
+	struct grf_history      *history;		/* History to append the data read to (may be NULL) */
+	struct grf_store         store;			/* Readings of all devices read for selections */
+};
+
+/* Fields of the fleet store selectable by clients */
+static const struct
+{
+	const char  *name;
+	int          field;
+} grfd_fields[] =
+{
+	{ "timestamp",                   GRF_STORE_FIELD_TIMESTAMP },
+	{ "operation-time",              GRF_STORE_FIELD_OPERATION_TIME },
+	{ "smoke-chamber-pollution",     GRF_STORE_FIELD_SMOKE_CHAMBER_POLLUTION },
+	{ "battery-voltage",             GRF_STORE_FIELD_BATTERY_VOLTAGE },
+	{ "temperature-1",               GRF_STORE_FIELD_TEMPERATURE1 },
+	{ "temperature-2",               GRF_STORE_FIELD_TEMPERATURE2 },
+	{ "local-smoke-alerts",          GRF_STORE_FIELD_LOCAL_SMOKE_ALERTS },
+	{ "local-temperature-alerts",    GRF_STORE_FIELD_LOCAL_TEMPERATURE_ALERTS },
+	{ "local-test-alerts",           GRF_STORE_FIELD_LOCAL_TEST_ALERTS },
+	{ "remote-wired-alerts",         GRF_STORE_FIELD_REMOTE_CABLE_ALERTS },
+	{ "remote-wireless-alerts",      GRF_STORE_FIELD_REMOTE_RADIO_ALERTS },
+	{ "remote-wired-test-alerts",    GRF_STORE_FIELD_REMOTE_CABLE_TEST_ALERTS },
+	{ "remote-wireless-test-alerts", GRF_STORE_FIELD_REMOTE_RADIO_TEST_ALERTS },
+};
+
+/* Comparisons of a selection in the order of GRF_STORE_LT ... GRF_STORE_GT */
+static const char *grfd_comparisons[] = { "lt", "le", "eq", "ge", "gt" };
+
+/* Registers consisting of fields kept by the fleet store */
+static const uint16_t grfd_stored_keys[] = { 0x0001, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007 };
+
+static volatile sig_atomic_t terminate = 0;
+
+static void on_signal(int signum)
+{
+	terminate = 1;
+}
+
+static void usage(const char *progname)
+{
+	printf("Usage: %s [options]\n", progname);
+	printf("\n");
+	printf("  Keeps the radio in command mode and serves requests of local clients, e.g. grfctl --server.\n");
+	printf("\n");
+	printf("  options:\n"
+		"    -d  --device <device>                    use the given device or unix:<socket> of a serial server (default: %s)\n"
+		"    -t  --timeout <timeout>                  use the timeout in seconds for the communication with the radio (default: %d)\n"
+		"    -S  --socket <path>                      listen for clients on the given Unix domain socket (default: %s)\n"
+		"    -m  --max-age <seconds>                  answer requests for data from data not older than this (default: %d, -1 to always read)\n"
+		"    -H  --history <file>                     append the data read and the devices of the groups to the given history file\n"
+		"    -v  --verbose <level>                    set debug level to one of {error, warn, info, debug, debugio}\n"
+		"    -V  --version                            show the program version\n"
+		"    -h  --help                               show this help\n",
+		GRFD_DEFAULT_DEVICE, GRFD_DEFAULT_TIMEOUT, GRFD_DEFAULT_SOCKET, GRFD_DEFAULT_MAX_AGE
+		);
+	printf("\n");
+
+	fflush(stdout);
+}
+
+/*---------------------------------------------------------------------------*/
+static int client_printf(struct grfd_client *client, const char *fmt, ...)
+{
+	va_list  arglist;
+	char    *out;
+	size_t   size;
+	int      count;
+
+	/* Replies to clients already gone are dropped */
+	if (client->fd < 0)
+		return 0;
+
+	do
+	{
+		va_start(arglist, fmt);
+		count = vsnprintf(client->out + client->outlen, client->outsize - client->outlen, fmt, arglist);
+		va_end(arglist);
+		if (count < 0)
+			return EINVAL;
+		if (client->outlen + count < client->outsize)
+			break;
+
+		/* Grow the buffer and format again */
+		size = client->outsize ? 2 * client->outsize : 1024;
+		while (size <= client->outlen + count)
+			size *= 2;
+		out = realloc(client->out, size);
+		if (!out)
+			return ENOMEM;
+		client->out     = out;
+		client->outsize = size;
+	} while (true);
+	client->outlen += count;
+
+	return 0;
+}
+
+static void client_reply_data(struct grfd_client *client, const struct grf_device *device)
+{
+	uint32_t value;
+	uint16_t key;
+
+	/* Send the raw registers, the client decodes them just like the radio layer */
+	client_printf(client, "DATA %s %lld", device->id, (long long)device->timestamp);
+	for (key = 0; key <= GRF_REGISTER_KEY_MAX; key++)
+	{
+		if (grf_register_get(device, key, &value) == 0)
+			client_printf(client, " %04X:%08X", key, value);
+	}
+	client_printf(client, "\n");
+}
+
+static void client_reply_stored(struct grfd_client *client, const struct grf_device *device)
+{
+	uint32_t value;
+	size_t   i;
+
+	/* Registers not kept by the store would be reported as zero */
+	client_printf(client, "DATA %s %lld", device->id, (long long)device->timestamp);
+	for (i = 0; i < sizeof(grfd_stored_keys) / sizeof(grfd_stored_keys[0]); i++)
+	{
+		if (grf_register_get(device, grfd_stored_keys[i], &value) == 0)
+			client_printf(client, " %04X:%08X", grfd_stored_keys[i], value);
+	}
+	client_printf(client, "\n");
+}
+
+static void client_reply_done(struct grfd_client *client, int result)
+{
+	if (result)
+		client_printf(client, "ERROR %d %s\n", result, strerror(result));
+	else
+		client_printf(client, "OK\n");
+}
+
+static void client_free(struct grfd_client *client)
+{
+	grf_devicelist_free(&client->devices);
+	free(client->group);
+	free(client->out);
+	free(client);
+}
+
+static void grfd_detach(struct grfd_client *client);
+static void grfd_handover(struct grfd *grfd, struct grfd_client *client);
+
+static void client_close(struct grfd *grfd, struct grfd_client *client)
+{
+	size_t i;
+
+	grf_logging_info("client %d: disconnected", client->fd);
+	for (i = 0; i < grfd->nclients; i++)
+	{
+		if (grfd->clients[i] == client)
+		{
+			grfd->clients[i] = grfd->clients[--grfd->nclients];
+			break;
+		}
+	}
+	close(client->fd);
+	client->fd = -1;
+
+	/* Storage used by a running operation is freed once the operation is finished */
+	if (client->leader)
+		grfd_detach(client);
+	else if (client->cmd != GRFD_CMD_NONE && grf_sched_cancel(&grfd->sched, &client->job) == 0)
+	{
+		if (client->waiters)
+			grfd_handover(grfd, client);
+		client->cmd = GRFD_CMD_NONE;
+	}
+	if (client->cmd == GRFD_CMD_NONE)
+		client_free(client);
+}
+
+static int client_flush(struct grfd_client *client)
+{
+	ssize_t count;
+
+	while (client->outlen > 0)
+	{
+		count = send(client->fd, client->out, client->outlen, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (count < 0)
+			return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : errno;
+		memmove(client->out, client->out + count, client->outlen - count);
+		client->outlen -= count;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static int grfd_report_register(struct grf_device *device, uint16_t key, void *userdata)
+{
+	struct grfd_client *client = userdata;
+	uint32_t            value;
+
+	if (grf_register_get(device, key, &value) == 0)
+		client_printf(client, "REGISTER %s %04X:%08X\n", device->id, key, value);
+
+	return 0;
+}
+
+static void grfd_store(struct grfd *grfd, const struct grf_device *device)
+{
+	int ret;
+
+	ret = grf_store_add(&grfd->store, device);
+	if (ret)
+		grf_logging_err("Adding data of device %s to the store failed: %s", device->id, strerror(ret));
+
+	if (!grfd->history)
+		return;
+	ret = grf_history_append(grfd->history, device);
+	if (ret)
+		grf_logging_err("Storing data of device %s failed: %s", device->id, strerror(ret));
+}
+
+static void grfd_store_group(struct grfd *grfd, const char *group, const struct grf_devicelist *devices)
+{
+	int ret;
+
+	/* The history reports the group later without scanning it again */
+	if (!grfd->history)
+		return;
+	ret = grf_history_set_group(grfd->history, group, devices);
+	if (ret)
+		grf_logging_err("Storing devices of group %s failed: %s", group, strerror(ret));
+}
+
+static void grfd_flush(struct grfd *grfd)
+{
+	int ret;
+
+	/* Queries find the readings of a finished read-out in the index */
+	if (!grfd->history)
+		return;
+	ret = grf_history_flush(grfd->history);
+	if (ret)
+		grf_logging_err("Writing the history index failed: %s", strerror(ret));
+}
+
+static int grfd_report_group_device(struct grf_device *device, int result, void *userdata)
+{
+	struct grfd_client *client = userdata;
+
+	/* Do not keep the radio busy for a client that is gone */
+	if (client->fd < 0)
+		return GRF_COMM_STOP;
+
+	/* Output the result of each device as soon as it is available */
+	if (result)
+	{
+		client_printf(client, "FAILED %s %d\n", device->id, result);
+		return 0;
+	}
+	client_reply_data(client, device);
+	grfd_store(client->grfd, device);
+
+	return 0;
+}
+
+static int grfd_start(struct grf_comm_op *op, struct grf_radio *radio, void *userdata)
+{
+	struct grfd_client *client = userdata;
+
+	switch (client->cmd)
+	{
+		case GRFD_CMD_SCAN_GROUPS:
+			return grf_comm_start_scan_groups(op, radio, &client->group);
+		case GRFD_CMD_SCAN_DEVICES:
+			return grf_comm_start_scan_devices(op, radio, client->id, &client->devices);
+		case GRFD_CMD_READ_DATA:
+			return grf_comm_start_read_data(op, radio, client->id, &client->device);
+		case GRFD_CMD_READ_GROUP:
+			/* Scan for the devices first and read them afterwards */
+			if (client->stage == 0)
+				return grf_comm_start_scan_devices(op, radio, client->id, &client->devices);
+			return grf_comm_start_read_group(op, radio, &client->devices, grfd_report_group_device, client);
+		case GRFD_CMD_READ_REGISTERS:
+			return grf_comm_start_read_registers(op, radio, client->id, &client->mask, &client->device,
+			                                     grfd_report_register, client);
+		case GRFD_CMD_SWITCH_SIGNAL:
+			return grf_comm_start_switch_signal(op, radio, client->id, client->on);
+	}
+
+	return EINVAL;
+}
+
+static void grfd_reply(struct grfd_client *client, const struct grfd_client *source)
+{
+	size_t i;
+
+	switch (source->cmd)
+	{
+		case GRFD_CMD_SCAN_GROUPS:
+			if (source->group)
+				client_printf(client, "GROUP %s\n", source->group);
+			break;
+		case GRFD_CMD_SCAN_DEVICES:
+			for (i = 0; i < source->devices.len; i++)
+				client_printf(client, "DEVICE %s\n", source->devices.ids[i]);
+			break;
+		case GRFD_CMD_READ_DATA:
+			client_reply_data(client, &source->device);
+			break;
+	}
+}
+
+static void grfd_process(struct grfd *grfd, struct grfd_client *client);
+
+static void grfd_done(struct grf_sched_job *job, int result, void *userdata)
+{
+	struct grfd_client *client = userdata;
+	struct grfd        *grfd = client->grfd;
+	struct grfd_client *waiters;
+	struct grfd_client *waiter;
+	struct grfd_client *next;
+
+	/* Continue reading the devices found unless the client is gone */
+	client->stage++;
+	if (!result && (client->cmd == GRFD_CMD_SCAN_DEVICES || client->cmd == GRFD_CMD_READ_GROUP) && client->stage == 1)
+		grfd_store_group(grfd, client->id, &client->devices);
+	if (!result && client->cmd == GRFD_CMD_READ_GROUP && client->stage == 1 && client->fd >= 0)
+	{
+		grf_sched_submit(&grfd->sched, job);
+		return;
+	}
+	if (!result && client->cmd == GRFD_CMD_READ_DATA)
+		grfd_store(grfd, &client->device);
+	if (client->cmd == GRFD_CMD_READ_DATA || client->cmd == GRFD_CMD_READ_GROUP || client->cmd == GRFD_CMD_SCAN_DEVICES)
+		grfd_flush(grfd);
+
+	/* All clients awaiting the command get the same result */
+	if (!result && client->fd >= 0)
+		grfd_reply(client, client);
+	waiters = client->waiters;
+	client->waiters = NULL;
+	for (waiter = waiters; waiter; waiter = waiter->next_waiter)
+	{
+		if (!result)
+			grfd_reply(waiter, client);
+		client_reply_done(waiter, result);
+		waiter->leader = NULL;
+		waiter->cmd    = GRFD_CMD_NONE;
+	}
+
+	free(client->group);
+	client->group = NULL;
+	grf_devicelist_free(&client->devices);
+	client->cmd   = GRFD_CMD_NONE;
+	client->stage = 0;
+	if (client->fd >= 0)
+		client_reply_done(client, result);
+
+	/* Handle the requests sent meanwhile */
+	for (waiter = waiters; waiter; waiter = next)
+	{
+		next = waiter->next_waiter;
+		waiter->next_waiter = NULL;
+		grfd_process(grfd, waiter);
+	}
+	if (client->fd < 0)
+		client_free(client);
+	else
+		grfd_process(grfd, client);
+}
+
+static void grfd_enqueue(struct grfd *grfd, struct grfd_client *client, int cmd, int priority)
+{
+	client->cmd           = cmd;
+	client->stage         = 0;
+	client->job.priority  = priority;
+	client->job.start     = grfd_start;
+	client->job.done      = grfd_done;
+	client->job.userdata  = client;
+	grf_sched_submit(&grfd->sched, &client->job);
+}
+
+static bool grfd_shares(const struct grfd_client *leader, const struct grfd_client *client, int cmd)
+{
+	return leader != client && leader->cmd == cmd && !leader->leader && strcmp(leader->id, client->id) == 0;
+}
+
+static bool grfd_attach(struct grfd *grfd, struct grfd_client *client, int cmd)
+{
+	struct grf_sched_job *job = grfd->sched.running;
+	struct grfd_client   *leader = NULL;
+	size_t                i;
+
+	/* Look for the same command of another client still waiting for its result */
+	for (i = 0; i < grfd->nclients && !leader; i++)
+	{
+		if (grfd_shares(grfd->clients[i], client, cmd))
+			leader = grfd->clients[i];
+	}
+
+	/* The command of a client gone meanwhile keeps running until it is done */
+	if (!leader && job && job != &grfd->keepalive_job && grfd_shares(job->userdata, client, cmd))
+		leader = job->userdata;
+	if (!leader)
+		return false;
+
+	grf_logging_dbg("client %d: sharing the result of client %d", client->fd, leader->fd);
+	client->cmd         = cmd;
+	client->leader      = leader;
+	client->next_waiter = leader->waiters;
+	leader->waiters     = client;
+
+	return true;
+}
+
+static void grfd_detach(struct grfd_client *client)
+{
+	struct grfd_client **link;
+
+	for (link = &client->leader->waiters; *link; link = &(*link)->next_waiter)
+	{
+		if (*link == client)
+		{
+			*link = client->next_waiter;
+			break;
+		}
+	}
+	client->leader      = NULL;
+	client->next_waiter = NULL;
+	client->cmd         = GRFD_CMD_NONE;
+}
+
+static void grfd_handover(struct grfd *grfd, struct grfd_client *client)
+{
+	struct grfd_client *leader = client->waiters;
+	struct grfd_client *waiter;
+
+	/* The first client awaiting the cancelled command queues it again for all others */
+	leader->leader      = NULL;
+	leader->waiters     = leader->next_waiter;
+	leader->next_waiter = NULL;
+	client->waiters     = NULL;
+	for (waiter = leader->waiters; waiter; waiter = waiter->next_waiter)
+		waiter->leader = leader;
+	grfd_enqueue(grfd, leader, client->cmd, client->job.priority);
+}
+
+static int grfd_parse_keys(struct grf_register_mask *mask, const char *keys)
+{
+	unsigned long key;
+	char         *end;
+
+	/* Parse the comma separated list of register keys */
+	GRF_REGISTER_MASK_ZERO(mask);
+	do
+	{
+		key = strtoul(keys, &end, 16);
+		if (end == keys || (*end != ',' && *end != '\0') || key > GRF_REGISTER_KEY_MAX)
+			return EINVAL;
+		GRF_REGISTER_MASK_SET(key, mask);
+		keys = end + 1;
+	} while (*end == ',');
+
+	return 0;
+}
+
+static int grfd_select(struct grfd *grfd, struct grfd_client *client, char **saveptr)
+{
+	struct grf_device  device;
+	size_t            *rows;
+	size_t             count;
+	size_t             i;
+	char              *name;
+	char              *comparison;
+	char              *arg;
+	char              *end;
+	double             value;
+	int                field = -1;
+	int                cmp = -1;
+
+	/* select <field> <lt|le|eq|ge|gt> <value> */
+	name       = strtok_r(NULL, " \t\r", saveptr);
+	comparison = strtok_r(NULL, " \t\r", saveptr);
+	arg        = strtok_r(NULL, " \t\r", saveptr);
+	if (!arg || strtok_r(NULL, " \t\r", saveptr))
+		return EINVAL;
+	for (i = 0; i < sizeof(grfd_fields) / sizeof(grfd_fields[0]); i++)
+	{
+		if (strcasecmp(name, grfd_fields[i].name) == 0)
+			field = grfd_fields[i].field;
+	}
+	for (i = 0; i < sizeof(grfd_comparisons) / sizeof(grfd_comparisons[0]); i++)
+	{
+		if (strcasecmp(comparison, grfd_comparisons[i]) == 0)
+			cmp = i;
+	}
+	value = strtod(arg, &end);
+	if (field < 0 || cmp < 0 || end == arg || *end != '\0')
+		return EINVAL;
+
+	/* Count the matches first to fetch them all at once */
+	count = grf_store_select(&grfd->store, field, cmp, value, true, NULL, 0);
+	if (count < 1)
+		return 0;
+	rows = malloc(count * sizeof(size_t));
+	if (!rows)
+		return ENOMEM;
+	grf_store_select(&grfd->store, field, cmp, value, true, rows, count);
+	for (i = 0; i < count; i++)
+	{
+		grf_store_get(&grfd->store, rows[i], &device);
+		client_reply_stored(client, &device);
+	}
+	free(rows);
+
+	return 0;
+}
+
+static int grfd_handle_request(struct grfd *grfd, struct grfd_client *client, char *line)
+{
+	char *saveptr;
+	char *cmd;
+	char *arg;
+	char *extra;
+	char *end;
+	long  max_age = grfd->max_age;
+
+	grf_logging_dbg("client %d: request %s", client->fd, line);
+	cmd = strtok_r(line, " \t\r", &saveptr);
+	if (!cmd)
+		return EINVAL;
+	if (strcasecmp(cmd, "show-firmware-version") == 0)
+	{
+		client_printf(client, "VERSION %s\n", grfd->radio.firmware_version ? grfd->radio.firmware_version : "");
+		return 0;
+	}
+	if (strcasecmp(cmd, "scan-groups") == 0)
+	{
+		grfd_enqueue(grfd, client, GRFD_CMD_SCAN_GROUPS, GRF_SCHED_NORMAL);
+		return EINPROGRESS;
+	}
+	if (strcasecmp(cmd, "select") == 0)
+		return grfd_select(grfd, client, &saveptr);
+
+	/* All other commands work on a device or group */
+	arg   = strtok_r(NULL, " \t\r", &saveptr);
+	extra = strtok_r(NULL, " \t\r", &saveptr);
+	if (!arg || strlen(arg) != GRF_DEVICEID_LEN || strtok_r(NULL, " \t\r", &saveptr))
+		return EINVAL;
+	memcpy(client->id, arg, GRF_DEVICEID_LEN + 1);
+
+	if (strcasecmp(cmd, "request-data") == 0)
+	{
+		if (extra)
+		{
+			max_age = strtol(extra, &end, 10);
+			if (end == extra || *end != '\0' || max_age < INT_MIN || max_age > INT_MAX)
+				return EINVAL;
+		}
+
+		/* Recent data is answered right away even while the radio is busy */
+		if (grf_comm_get_cached(&grfd->radio, client->id, max_age, &client->device))
+		{
+			client_reply_data(client, &client->device);
+			return 0;
+		}
+		if (!grfd_attach(grfd, client, GRFD_CMD_READ_DATA))
+			grfd_enqueue(grfd, client, GRFD_CMD_READ_DATA, GRF_SCHED_NORMAL);
+		return EINPROGRESS;
+	}
+	if (strcasecmp(cmd, "request-registers") == 0)
+	{
+		if (!extra || grfd_parse_keys(&client->mask, extra))
+			return EINVAL;
+		grfd_enqueue(grfd, client, GRFD_CMD_READ_REGISTERS, GRF_SCHED_NORMAL);
+		return EINPROGRESS;
+	}
+	if (extra)
+		return EINVAL;
+
+	if (strcasecmp(cmd, "scan-devices") == 0)
+	{
+		if (!grfd_attach(grfd, client, GRFD_CMD_SCAN_DEVICES))
+			grfd_enqueue(grfd, client, GRFD_CMD_SCAN_DEVICES, GRF_SCHED_NORMAL);
+	}
+	else if (strcasecmp(cmd, "request-group") == 0)
+		grfd_enqueue(grfd, client, GRFD_CMD_READ_GROUP, GRF_SCHED_BACKGROUND);
+	else if (strcasecmp(cmd, "activate-signal") == 0 || strcasecmp(cmd, "deactivate-signal") == 0)
+	{
+		/* Switching off the signal of a false alarm must not wait for read-outs */
+		client->on = (strcasecmp(cmd, "activate-signal") == 0);
+		grfd_enqueue(grfd, client, GRFD_CMD_SWITCH_SIGNAL, GRF_SCHED_URGENT);
+	}
+	else
+		return EINVAL;
+
+	return EINPROGRESS;
+}
+
+static void grfd_process(struct grfd *grfd, struct grfd_client *client)
+{
+	char   *newline;
+	char    line[GRFD_LINE_MAX];
+	size_t  len;
+	int     ret;
+
+	/* Handle one request after the other until one has to wait for the radio */
+	while (client->cmd == GRFD_CMD_NONE)
+	{
+		newline = memchr(client->in, '\n', client->inlen);
+		if (!newline)
+			break;
+		len = newline - client->in;
+		memcpy(line, client->in, len);
+		line[len] = '\0';
+		client->inlen -= len + 1;
+		memmove(client->in, newline + 1, client->inlen);
+
+		ret = grfd_handle_request(grfd, client, line);
+		if (ret != EINPROGRESS)
+			client_reply_done(client, ret);
+	}
+}
+
+static int grfd_receive(struct grfd *grfd, struct grfd_client *client)
+{
+	ssize_t count;
+
+	if (client->eof || client->inlen >= sizeof(client->in))
+		return 0;
+	count = recv(client->fd, client->in + client->inlen, sizeof(client->in) - client->inlen, MSG_DONTWAIT);
+	if (count < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : errno;
+	if (count == 0)
+	{
+		client->eof = true;
+		return 0;
+	}
+	client->inlen += count;
+
+	grfd_process(grfd, client);
+
+	/* A request not fitting the buffer cannot be handled */
+	if (client->cmd == GRFD_CMD_NONE && client->inlen >= sizeof(client->in))
+	{
+		grf_logging_warn("client %d: request too long", client->fd);
+		return EMSGSIZE;
+	}
+
+	return 0;
+}
+
+static int grfd_accept(struct grfd *grfd)
+{
+	struct grfd_client  *client;
+	struct grfd_client **clients;
+	size_t               size;
+	int                  fd;
+
+	fd = accept4(grfd->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) ? 0 : errno;
+
+	if (grfd->nclients >= grfd->size)
+	{
+		size    = grfd->size ? 2 * grfd->size : 16;
+		clients = realloc(grfd->clients, size * sizeof(struct grfd_client *));
+		if (!clients)
+		{
+			close(fd);
+			return 0;
+		}
+		grfd->clients = clients;
+		grfd->size    = size;
+	}
+	client = calloc(1, sizeof(struct grfd_client));
+	if (!client)
+	{
+		close(fd);
+		return 0;
+	}
+	client->fd   = fd;
+	client->grfd = grfd;
+	grf_devicelist_init(&client->devices);
+	grfd->clients[grfd->nclients++] = client;
+	grf_logging_info("client %d: connected", fd);
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static int grfd_listen(struct grfd *grfd, const char *path)
+{
+	struct sockaddr_un addr;
+	int                fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return ENAMETOOLONG;
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	grfd->listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (grfd->listener < 0)
+		return errno;
+	if (bind(grfd->listener, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)))
+	{
+		if (errno != EADDRINUSE)
+			return errno;
+
+		/* Remove the socket left behind by a daemon that died, but never steal a living one */
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return errno;
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == 0 || errno != ECONNREFUSED)
+		{
+			close(fd);
+			return EADDRINUSE;
+		}
+		close(fd);
+		grf_logging_info("Removing stale socket %s...", path);
+		unlink(path);
+		if (bind(grfd->listener, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)))
+			return errno;
+	}
+	if (listen(grfd->listener, GRFD_BACKLOG))
+		return errno;
+
+	return 0;
+}
+
+static int grfd_timeout(struct grfd *grfd)
+{
+	struct timespec  now;
+	struct timespec  activity;
+	const struct timespec *since;
+	long             remaining;
+	int              idle;
+
+	if (grf_sched_is_busy(&grfd->sched))
+		return grf_sched_get_timeout(&grfd->sched);
+	idle = grf_comm_get_session_idle(&grfd->radio, &activity);
+	if (idle <= 0)
+		return -1;
+
+	/* Refresh the command mode half way through the idle time of the session */
+	since = &activity;
+	if (grfd->keepalive.tv_sec > since->tv_sec ||
+	    (grfd->keepalive.tv_sec == since->tv_sec && grfd->keepalive.tv_nsec > since->tv_nsec))
+		since = &grfd->keepalive;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining = idle / 2
+	          - ((now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L);
+
+	return (remaining > 0) ? remaining : 0;
+}
+
+static int grfd_keepalive_start(struct grf_comm_op *op, struct grf_radio *radio, void *userdata)
+{
+	return grf_comm_start_keepalive(op, radio);
+}
+
+static void grfd_keepalive_done(struct grf_sched_job *job, int result, void *userdata)
+{
+	if (result)
+		grf_logging_warn("Keeping the radio in command mode failed: %s", strerror(result));
+}
+
+static void grfd_keepalive(struct grfd *grfd)
+{
+	clock_gettime(CLOCK_MONOTONIC, &grfd->keepalive);
+	grfd->keepalive_job.priority = GRF_SCHED_NORMAL;
+	grfd->keepalive_job.start    = grfd_keepalive_start;
+	grfd->keepalive_job.done     = grfd_keepalive_done;
+	grf_sched_submit(&grfd->sched, &grfd->keepalive_job);
+}
+
+static int grfd_run(struct grfd *grfd)
+{
+	struct pollfd       *pfds = NULL;
+	struct grfd_client **polled = NULL;
+	struct grfd_client  *client;
+	size_t               npolled;
+	size_t               size = 0;
+	size_t               i;
+	int                  timeout;
+	int                  ret = 0;
+
+	/* Serve the clients until we are asked to terminate */
+	while (!terminate)
+	{
+		if (size < grfd->nclients + 2)
+		{
+			size = grfd->nclients + 16;
+			free(pfds);
+			free(polled);
+			pfds   = malloc(size * sizeof(struct pollfd));
+			polled = malloc(size * sizeof(struct grfd_client *));
+			if (!pfds || !polled)
+			{
+				ret = ENOMEM;
+				break;
+			}
+		}
+
+		/* Wait for the radio, new clients and requests respectively room for replies */
+		npolled = 0;
+		pfds[0].fd     = grfd->listener;
+		pfds[0].events = POLLIN;
+		pfds[1].fd     = grf_sched_get_pollfd(&grfd->sched);
+		pfds[1].events = POLLIN;
+		for (i = 0; i < grfd->nclients; i++)
+		{
+			client = grfd->clients[i];
+			pfds[npolled + 2].events = ((client->eof || client->inlen >= sizeof(client->in)) ? 0 : POLLIN) |
+			                           (client->outlen ? POLLOUT : 0);
+			pfds[npolled + 2].fd     = pfds[npolled + 2].events ? client->fd : -1;
+			polled[npolled++] = client;
+		}
+		timeout = grfd_timeout(grfd);
+		if (poll(pfds, npolled + 2, timeout) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ret = errno;
+			break;
+		}
+
+		/* Advance the operation on the radio or keep the radio in command mode */
+		if (grf_sched_is_busy(&grfd->sched))
+			grf_sched_step(&grfd->sched);
+		else if (grfd_timeout(grfd) == 0)
+			grfd_keepalive(grfd);
+
+		if (pfds[0].revents & POLLIN)
+		{
+			ret = grfd_accept(grfd);
+			if (ret)
+				break;
+		}
+
+		/* Only the client itself is closed while handling its requests */
+		for (i = 0; i < npolled; i++)
+		{
+			client = polled[i];
+			if (!(pfds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (grfd_receive(grfd, client))
+				client_close(grfd, client);
+		}
+
+		/* Send the replies and close the clients that are done */
+		for (i = grfd->nclients; i > 0; i--)
+		{
+			client = grfd->clients[i - 1];
+			if (client_flush(client) ||
+			    (client->eof && client->cmd == GRFD_CMD_NONE && client->outlen == 0))
+				client_close(grfd, client);
+		}
+	}
+
+	free(pfds);
+	free(polled);
+
+	return ret;
+}
+/*---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+	static struct grfd  grfd;
+	struct grf_history  history;
+	struct grf_sched_job *job;
+	const char         *dev = GRFD_DEFAULT_DEVICE;
+	const char         *path = GRFD_DEFAULT_SOCKET;
+	const char         *historyfile = NULL;
+	int                 timeout = GRFD_DEFAULT_TIMEOUT;
+	int                 loglevel = GRFD_DEFAULT_LOGLEVEL;
+	int                 index;
+	int                 ret = 0;
+	int                 c;
+
+	static struct option options[] =
+	{
+		{"device",  required_argument, 0, 'd'},
+		{"timeout", required_argument, 0, 't'},
+		{"socket",  required_argument, 0, 'S'},
+		{"max-age", required_argument, 0, 'm'},
+		{"history", required_argument, 0, 'H'},
+		{"verbose", required_argument, 0, 'v'},
+		{"version", no_argument,       0, 'V'},
+		{"help",    no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	memset(&grfd, 0, sizeof(struct grfd));
+	grfd.listener = -1;
+	grfd.max_age  = GRFD_DEFAULT_MAX_AGE;
+	ret = grf_store_init(&grfd.store);
+	if (ret)
+	{
+		fprintf(stderr, "ERROR: Setting up the store failed: %s\n", strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+
+	/* Parse the command line options */
+	while ((c = getopt_long(argc, argv, "d:t:S:m:H:v:Vh", options, &index)) > -1)
+	{
+		switch (c)
+		{
+			case 'd':
+				dev = optarg;
+				break;
+			case 't':
+				timeout = atoi(optarg);
+				break;
+			case 'S':
+				path = optarg;
+				break;
+			case 'm':
+				grfd.max_age = atoi(optarg);
+				break;
+			case 'H':
+				historyfile = optarg;
+				break;
+			case 'v':
+				if (strcmp(optarg, "error") == 0)
+					loglevel = GRF_LOGGING_ERR;
+				else if (strcmp(optarg, "warn") == 0)
+					loglevel = GRF_LOGGING_WARN;
+				else if (strcmp(optarg, "info") == 0)
+					loglevel = GRF_LOGGING_INFO;
+				else if (strcmp(optarg, "debug") == 0)
+					loglevel = GRF_LOGGING_DEBUG;
+				else if (strcmp(optarg, "debugio") == 0)
+					loglevel = GRF_LOGGING_DEBUG_IO;
+				else
+				{
+					fprintf(stderr, "Unknown log-level %s!\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'V':
+				printf("grfd version %s\n", GRFD_VERSION);
+				exit(EXIT_SUCCESS);
+			case 'h':
+				usage(argv[0]);
+				exit(EXIT_SUCCESS);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	grf_logging_setlevel(loglevel);
+
+	/* Claim the socket first to not disturb the radio of a running daemon */
+	ret = grfd_listen(&grfd, path);
+	if (ret)
+	{
+		fprintf(stderr, "ERROR: Listening on %s failed: %s\n", path, strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+
+	/* Set up the radio once and keep it for all clients */
+	ret = grf_radio_init(&grfd.radio, dev, timeout);
+	if (ret)
+		fprintf(stderr, "ERROR: Initialization of radio device failed: %s\n", strerror(ret));
+	else
+	{
+		ret = grf_comm_init(&grfd.radio);
+		if (ret)
+			fprintf(stderr, "ERROR: Initializing communication failed: %s\n", strerror(ret));
+	}
+	if (!ret && historyfile)
+	{
+		ret = grf_history_open(&history, historyfile, GRF_HISTORY_WRITE);
+		if (ret)
+			fprintf(stderr, "ERROR: Opening history file %s failed: %s\n", historyfile, strerror(ret));
+		else
+			grfd.history = &history;
+	}
+	if (ret)
+	{
+		grf_radio_exit(&grfd.radio);
+		unlink(path);
+		exit(EXIT_FAILURE);
+	}
+	grf_sched_init(&grfd.sched, &grfd.radio);
+	grf_logging_info("Serving radio firmware %s on %s", grfd.radio.firmware_version, path);
+
+	signal(SIGINT,  on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	ret = grfd_run(&grfd);
+
+	/* Operations still running are abandoned along with their clients */
+	job = grfd.sched.running;
+	if (job && job != &grfd.keepalive_job && ((struct grfd_client *)job->userdata)->fd < 0)
+		client_free(job->userdata);
+	while (grfd.nclients > 0)
+	{
+		grfd.clients[0]->cmd     = GRFD_CMD_NONE;
+		grfd.clients[0]->leader  = NULL;
+		grfd.clients[0]->waiters = NULL;
+		client_close(&grfd, grfd.clients[0]);
+	}
+	free(grfd.clients);
+	close(grfd.listener);
+	unlink(path);
+	grf_radio_exit(&grfd.radio);
+	if (grfd.history)
+		grf_history_close(grfd.history);
+	grf_store_free(&grfd.store);
+
+	if (ret)
+	{
+		fprintf(stderr, "ERROR: Serving clients failed: %s\n", strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -42,6 +42,7 @@
 #include <stdint.h>
 
 #include "grf_radio.h"
+#include "grf_registers.h"
 
 #define RETURN_ON_ERROR(__func__) \
 {\
@@ -51,12 +52,12 @@
 
 #define GRF_UNKNOWN_REGISTER_INDEX(__regid__) ((__regid__) - 0x14)	/*!< Macro to determine register array index from register ID */
 
-#define GRF_MAXDEVICES          40		/*!< Maximum number of devices in one group */
+#define GRF_DEVICEID_LEN        4		/*!< Number of characters of a device ID */
 
 /*! Data structure representing a single smoke detector device */
 struct grf_device
 {
-	char    *id;						/*!< 4-character ID of the smoke detector */
+	char     id[GRF_DEVICEID_LEN + 1];	/*!< 4-character ID of the smoke detector */
 	time_t   timestamp;					/*!< Timestamp of data reception */
 
 	/* Device properties */
@@ -81,17 +82,152 @@ struct grf_device
 	uint32_t unknown_64;				/*!< Unknown data (register 0x64) */ /* FIXME */
 };
 
-/*! Data structure representing a list of smoke detector devices */
+/*! Data structure representing a growable list of smoke detector devices.
+ *
+ *  The IDs found by a scan are stored apart from the data read from the
+ *  devices, so a list only holding the result of a scan takes a few bytes
+ *  per device. The data records are allocated by \ref grf_comm_read_group().
+ */
 struct grf_devicelist
 {
-	struct grf_device  devices[GRF_MAXDEVICES];	/*!< Array of smoke detector devices*/
-	uint8_t            len;						/*!< Number of valid smoke detector devices in the array */
+	char              (*ids)[GRF_DEVICEID_LEN + 1];	/*!< IDs of the smoke detector devices */
+	struct grf_device  *records;	/*!< Data of the smoke detector devices in the order of *ids* (may be NULL) */
+	size_t              len;		/*!< Number of valid smoke detector devices in the list */
+	size_t              size;		/*!< Capacity of *ids* */
 };
 
+/*! \brief Callback reporting the result of reading a single device.
+ *
+ *  \param device	device data structure, only valid if *result* is 0
+ *  \param result	0 on success and an error code otherwise
+ *  \param userdata	user data passed to \ref grf_comm_read_group()
+ *  \returns		0 to continue, \ref GRF_COMM_STOP or an error code to stop reading further devices
+ */
+typedef int (*grf_comm_device_cb)(struct grf_device *device, int result, void *userdata);
+
+/*! \brief Callback reporting a device ID as soon as it is received by a scan.
+ *
+ *  \param id		ID of the device, only valid during the call
+ *  \param userdata	user data passed to \ref grf_comm_stream_devices()
+ *  \returns		0 to continue, \ref GRF_COMM_STOP to stop the scan successfully and an error code to abort it
+ */
+typedef int (*grf_comm_id_cb)(const char *id, void *userdata);
+
+/*! \brief Callback reporting a requested register as soon as it is received.
+ *
+ *  \param device	device data structure the register is decoded into
+ *  \param key		key of the register
+ *  \param userdata	user data passed to \ref grf_comm_read_registers()
+ *  \returns		0 to continue, \ref GRF_COMM_STOP to stop reading successfully and an error code to abort
+ */
+typedef int (*grf_comm_register_cb)(struct grf_device *device, uint16_t key, void *userdata);
+
+#define GRF_COMM_STOP               -1	/*!< Return value of callbacks to stop an operation early without error */
+
+#define GRF_COMM_SESSION_IDLE       10000	/*!< Idle time in milliseconds after which the radio is assumed to have left command mode */
+#define GRF_COMM_PATH_TTL           3600	/*!< Time in seconds a remembered start path of a device is trusted */
+#define GRF_COMM_LEASE_IDLE         30000	/*!< Idle time in milliseconds after which the data acquisition of a leased device is stopped */
+
+struct grf_comm_op;
+
+/*! \brief Callback asking a running operation to pause at the next point it can be resumed from.
+ *
+ *  \param op		operation asking
+ *  \param userdata	user data passed to \ref grf_comm_op_set_yield()
+ *  \returns		true to pause the operation and false to continue
+ */
+typedef bool (*grf_comm_yield_cb)(const struct grf_comm_op *op, void *userdata);
+
+#define GRF_COMM_OP_INIT            0	/*!< Operation started by \ref grf_comm_start_init() */
+#define GRF_COMM_OP_KEEPALIVE       1	/*!< Operation started by \ref grf_comm_start_keepalive() */
+#define GRF_COMM_OP_SCAN_GROUPS     2	/*!< Operation started by \ref grf_comm_start_scan_groups() */
+#define GRF_COMM_OP_SCAN_DEVICES    3	/*!< Operation started by \ref grf_comm_start_scan_devices() or \ref grf_comm_start_stream_devices() */
+#define GRF_COMM_OP_READ_DATA       4	/*!< Operation started by \ref grf_comm_start_read_data() or \ref grf_comm_start_read_data_cached() */
+#define GRF_COMM_OP_READ_GROUP      5	/*!< Operation started by \ref grf_comm_start_read_group() */
+#define GRF_COMM_OP_SWITCH_SIGNAL   6	/*!< Operation started by \ref grf_comm_start_switch_signal() */
+#define GRF_COMM_OP_READ_REGISTERS  7	/*!< Operation started by \ref grf_comm_start_read_registers() */
+#define GRF_COMM_OP_LEASE_DEVICE    8	/*!< Operation started by \ref grf_comm_start_lease_device() */
+#define GRF_COMM_OP_RELEASE_DEVICE  9	/*!< Operation started by \ref grf_comm_start_release_device() */
+
+struct grf_comm_exchange;
+
+/*! Data structure representing a non-blocking operation on the radio.
+ *
+ *  An operation is a sequence of exchanges, i.e. a request and its expected
+ *  answers. The members are managed by the grf_comm_start_*() functions and
+ *  \ref grf_comm_step() and should be treated as read-only by the caller.
+ */
+struct grf_comm_op
+{
+	struct grf_radio      *radio;		/*!< Radio device the operation runs on */
+	int                    type;		/*!< Type of the operation (GRF_COMM_OP_*) */
+	int                    stage;		/*!< Current stage of the operation */
+	int                    result;		/*!< Result of the operation, `EINPROGRESS` while running */
+
+	const struct grf_comm_exchange *exchange;	/*!< Exchange currently running */
+	size_t                 answer;		/*!< Index of the next expected answer of the exchange */
+	bool                   has_deadline;/*!< Status flag if the next answer has a deadline */
+	struct timespec        deadline;	/*!< Deadline for the next answer (CLOCK_MONOTONIC) */
+	struct timespec        since;		/*!< Point in time the next answer is waited for since (CLOCK_MONOTONIC) */
+	bool                   expired;		/*!< Status flag if the exchange ended by its deadline instead of a Timeout of the radio */
+
+	const char            *id;			/*!< ID of the group or device the current exchange works on */
+	bool                   on;			/*!< Requested state of the accustic signal */
+	bool                   diagnosis;	/*!< Status flag if the device is started using the diagnosis request */
+	char                 **groups;		/*!< Storage for the scanned group ID */
+	struct grf_device     *device;		/*!< Device currently read */
+	struct grf_devicelist *devices;		/*!< List of devices read */
+	size_t                 index;		/*!< Index of the device currently read in *devices* */
+	grf_comm_id_cb         id_callback;	/*!< Callback reporting scanned device IDs */
+	grf_comm_register_cb   reg_callback;/*!< Callback reporting requested registers */
+	struct grf_register_mask pending;	/*!< Requested registers not received yet */
+	bool                   skipping;	/*!< Status flag if the rest of a transfer stopped early is discarded */
+	grf_comm_device_cb     callback;	/*!< Callback reporting finished devices */
+	void                  *userdata;	/*!< User data passed to *callback* */
+	grf_comm_yield_cb      yield;		/*!< Callback asked whether to pause the operation (may be NULL) */
+	void                  *yield_data;	/*!< User data passed to *yield* */
+	bool                   paused;		/*!< Status flag if the operation is paused until \ref grf_comm_resume() */
+};
+
+/*! \brief Initialize an empty device list.
+ *
+ *  \param devices	device list to initialize
+ */
+void grf_devicelist_init(struct grf_devicelist *devices);
+
+/*! \brief Free the storage of a device list.
+ *
+ *  The list is empty afterwards and may be reused.
+ *
+ *  \param devices	device list initialized by \ref grf_devicelist_init()
+ */
+void grf_devicelist_free(struct grf_devicelist *devices);
+
+/*! \brief Append a device to a device list growing the list if necessary.
+ *
+ *  \param devices	device list initialized by \ref grf_devicelist_init()
+ *  \param id		4-character ID of the device
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_devicelist_add(struct grf_devicelist *devices, const char *id);
+
+/*! \brief Allocate the data records of all devices of a device list.
+ *
+ *  The records are zeroed, their IDs are set and their timestamps are marked
+ *  invalid (-1). Records allocated before are discarded.
+ *
+ *  \param devices	device list initialized by \ref grf_devicelist_init()
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_devicelist_alloc_records(struct grf_devicelist *devices);
+
 /*! \brief Initialization of the communication with radio.
  *
  *  This function initializes the communication with the radio device
- *  and retrieves its firmware version via
+ *  and retrieves its firmware version. The state of the protocol kept across
+ *  requests is set up with the first call and freed by \ref grf_radio_exit().
+ *  It always puts the radio into command mode and thereby starts a new
+ *  session via
     \code
      <NUL><STX>01TESTA1<ETX>   -->
                                <-- <ACK>
@@ -104,6 +240,35 @@ struct grf_devicelist
  */
 int grf_comm_init(struct grf_radio *radio);
 
+/*! \brief Keep the radio in command mode.
+ *
+ *  All requests put the radio into command mode via `<NUL><STX>01TESTA1<ETX>`
+ *  only if it is not known to be in command mode already. The session ends on
+ *  any error or after \ref GRF_COMM_SESSION_IDLE milliseconds without
+ *  successful requests. Callers with longer pauses between requests can use
+ *  this function to keep the session alive via
+    \code
+     <STX>SV<ETX>              -->
+                               <-- firmware version
+    \endcode
+ *  or to re-enter command mode if the session already ended.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_comm_keepalive(struct grf_radio *radio);
+
+/*! \brief Get the idle time after which the radio leaves command mode.
+ *
+ *  Callers keeping the session alive via \ref grf_comm_keepalive() derive
+ *  the point in time to do so from the idle time and the last activity.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param last_activity	filled with the point in time of the last successful exchange in command mode (CLOCK_MONOTONIC)
+ *  \returns		idle time in milliseconds, 0 if command mode is re-entered with every request
+ */
+int grf_comm_get_session_idle(const struct grf_radio *radio, struct timespec *last_activity);
+
 /*! \brief Scan for the group ID of a smoke detector.
  *
  *  This function initiates a scan for the group ID of a smoke detector.
@@ -141,11 +306,29 @@ int grf_comm_scan_groups(struct grf_radio *radio, char **groups);
  * 
  *  \param radio	radio device structure initialized by \ref grf_comm_init()
  *  \param group	group ID to be scanned e.g. retrieved using \ref grf_comm_scan_groups()
- *  \param devices	list of devices belonging to *group*
+ *  \param devices	list of devices belonging to *group* initialized by \ref grf_devicelist_init(), previous content is replaced
  *  \returns		0 on success and an error code otherwise
  */
 int grf_comm_scan_devices(struct grf_radio *radio, const char *group, struct grf_devicelist *devices);
 
+/*! \brief Scan for smoke detector devices within a group reporting each device as it arrives.
+ *
+ *  This function performs the same scan as \ref grf_comm_scan_devices() but
+ *  hands each device ID to *callback* as soon as it is received instead of
+ *  collecting the whole list until the radio ends the scan with `Timeout`.
+ *  The caller can stop the scan early by returning \ref GRF_COMM_STOP, e.g.
+ *  once all expected devices are found, and continue with other work right
+ *  away. The radio still sends the rest of the scan, which is discarded
+ *  before the next request on the radio is sent.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param group	group ID to be scanned e.g. retrieved using \ref grf_comm_scan_groups()
+ *  \param callback	function called for each device ID
+ *  \param userdata	user data passed to *callback*
+ *  \returns		0 on success, the error code returned by *callback* or an error code if the radio fails
+ */
+int grf_comm_stream_devices(struct grf_radio *radio, const char *group, grf_comm_id_cb callback, void *userdata);
+
 /*! \brief Retrieve the data of a smoke detector device
  *
  *  This function requests all available data from the smoke detector device with the given ID.
@@ -180,6 +363,77 @@ int grf_comm_scan_devices(struct grf_radio *radio, const char *group, struct grf
  */
 int grf_comm_read_data(struct grf_radio *radio, const char *deviceid, struct grf_device *device);
 
+/*! \brief Retrieve the data of a smoke detector device unless recent data is known
+ *
+ *  The data of every device successfully read by \ref grf_comm_read_data() or
+ *  \ref grf_comm_read_group() is kept per radio along with its timestamp. This
+ *  function returns the kept data if it is at most *max_age* seconds old and
+ *  reads the device via \ref grf_comm_read_data() otherwise.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device to be read-out
+ *  \param max_age	maximum age of the kept data in seconds (negative to always read the device)
+ *  \param device	device data structure containing the retrieved information, *device->timestamp* tells when it was received
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_comm_read_data_cached(struct grf_radio *radio, const char *deviceid, int max_age, struct grf_device *device);
+
+/*! \brief Get the kept data of a smoke detector device without touching the radio
+ *
+ *  This function returns the data kept by \ref grf_comm_read_data_cached() if it
+ *  is at most *max_age* seconds old. It may be called while an operation is
+ *  running on the radio, e.g. to answer requests for recent data right away.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device
+ *  \param max_age	maximum age of the kept data in seconds
+ *  \param device	device data structure to fill, left untouched if no recent data is known
+ *  \returns		true if recent data is known and false otherwise
+ */
+bool grf_comm_get_cached(struct grf_radio *radio, const char *deviceid, int max_age, struct grf_device *device);
+
+/*! \brief Retrieve selected registers of a smoke detector device
+ *
+ *  This function performs the same requests as \ref grf_comm_read_data() but
+ *  hands each register in *mask* to *callback* as soon as it is received and
+ *  stops waiting for the register dump once all of them arrived. The device
+ *  is stopped via `DA:$DEVICEID:04` right away and the rest of the dump is
+ *  discarded, so the remaining registers are only waited for if the radio
+ *  insists on finishing the transfer first.
+ *
+ *  Only the fields contained in the registers received are valid in *device*.
+ *  Registers requested but missing in the dump are not reported.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device to be read-out
+ *  \param mask		registers to read
+ *  \param device	device data structure containing the retrieved information
+ *  \param callback	function called for each requested register (may be NULL)
+ *  \param userdata	user data passed to *callback*
+ *  \returns		0 on success, the error code returned by *callback* or an error code if the radio fails
+ */
+int grf_comm_read_registers(struct grf_radio *radio, const char *deviceid, const struct grf_register_mask *mask,
+                            struct grf_device *device, grf_comm_register_cb callback, void *userdata);
+
+/*! \brief Retrieve the data of all smoke detector devices in a list
+ *
+ *  This function reads the data of all devices in *devices* e.g. retrieved by
+ *  \ref grf_comm_scan_devices() using the same requests as \ref grf_comm_read_data().
+ *  The radio stays in command mode for the whole read-out. Each device is
+ *  started on its own, a device requiring the diagnosis mode does not make
+ *  the following devices skip the `DA:$DEVICEID:05` request.
+ *
+ *  The result of each device is reported via *callback* as soon as the device
+ *  is finished. Failing devices do not stop the read-out.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param devices	list of devices to read, the data is stored in *devices->records*
+ *  \param callback	function called after each device (may be NULL)
+ *  \param userdata	user data passed to *callback*
+ *  \returns		0 on success, the error code returned by *callback* or an error code if the radio fails
+ */
+int grf_comm_read_group(struct grf_radio *radio, struct grf_devicelist *devices, grf_comm_device_cb callback, void *userdata);
+
 /*! \brief Switch accustic signal of the smoke detector device ON or OFF
  *
  *  This function allows to switch the accustig alert of the smoke detector
@@ -217,5 +471,238 @@ int grf_comm_read_data(struct grf_radio *radio, const char *deviceid, struct grf
  */
 int grf_comm_switch_signal(struct grf_radio *radio, const char *deviceid, bool on);
 
+/*! \brief Keep the data acquisition of a smoke detector device running.
+ *
+ *  Reading data and switching the signal start and stop the data acquisition
+ *  of the device for every request. This function starts the data acquisition
+ *  once via
+    \code
+     <STX>DA:$DEVICEID:05<ETX> -->
+                               <-- <ACK>
+                               <-- <STX>Done<ETX>
+    \endcode
+ *  or the diagnosis request and keeps it running. All following calls of
+ *  \ref grf_comm_read_data(), \ref grf_comm_read_registers() and
+ *  \ref grf_comm_switch_signal() for this device only send their actual
+ *  request until the lease is ended via \ref grf_comm_release_device().
+ *
+ *  Only one device can be leased at a time. The lease ends automatically by
+ *  stopping the data acquisition before any request for another device or
+ *  any scan, and before the next request once the device was not used for
+ *  \ref GRF_COMM_LEASE_IDLE milliseconds. \ref grf_comm_keepalive() also
+ *  ends idle leases.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device to lease
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_comm_lease_device(struct grf_radio *radio, const char *deviceid);
+
+/*! \brief Stop the data acquisition of a leased smoke detector device.
+ *
+ *  The lease obtained by \ref grf_comm_lease_device() is ended via
+    \code
+     <STX>DA:$DEVICEID:04<ETX> -->
+                               <-- <ACK>
+                               <-- <STX>Done<ETX>
+    \endcode
+ *  Nothing is sent if no device is leased.
+ *
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_comm_release_device(struct grf_radio *radio);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_init().
+ *
+ *  All grf_comm_start_*() functions send the first request of the operation
+ *  and return immediately. The caller then waits for the descriptor returned
+ *  by \ref grf_comm_op_get_pollfd() to become readable or the timeout returned
+ *  by \ref grf_comm_op_get_timeout() to expire and calls \ref grf_comm_step()
+ *  until the operation is complete. This allows to drive several radios and
+ *  other I/O from a single event loop. The blocking functions are implemented
+ *  exactly this way.
+ *
+ *  Requests are short and are handed to the device right away, only waiting
+ *  for the answers is non-blocking. Only one operation may run on a radio at
+ *  a time and all storage passed to the operation has to stay valid until
+ *  it is complete.
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_radio_init()
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_init(struct grf_comm_op *op, struct grf_radio *radio);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_keepalive().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_keepalive(struct grf_comm_op *op, struct grf_radio *radio);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_scan_groups().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param groups	newly allocated storage containing the retrieved group ID. __This memory should be free'd by the user to avoid memory leaks.__
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_scan_groups(struct grf_comm_op *op, struct grf_radio *radio, char **groups);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_scan_devices().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param group	group ID to be scanned
+ *  \param devices	list of devices belonging to *group* initialized by \ref grf_devicelist_init(), previous content is replaced
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_scan_devices(struct grf_comm_op *op, struct grf_radio *radio, const char *group, struct grf_devicelist *devices);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_stream_devices().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param group	group ID to be scanned
+ *  \param callback	function called from \ref grf_comm_step() for each device ID
+ *  \param userdata	user data passed to *callback*
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_stream_devices(struct grf_comm_op *op, struct grf_radio *radio, const char *group, grf_comm_id_cb callback, void *userdata);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_read_data().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device to be read-out
+ *  \param device	device data structure containing the retrieved information
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_read_data(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid, struct grf_device *device);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_read_data_cached().
+ *
+ *  If the kept data is recent enough, the operation is finished right away.
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device to be read-out
+ *  \param max_age	maximum age of the kept data in seconds (negative to always read the device)
+ *  \param device	device data structure containing the retrieved information
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_read_data_cached(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid, int max_age, struct grf_device *device);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_read_registers().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device to be read-out
+ *  \param mask		registers to read, copied into *op*
+ *  \param device	device data structure containing the retrieved information
+ *  \param callback	function called from \ref grf_comm_step() for each requested register (may be NULL)
+ *  \param userdata	user data passed to *callback*
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_read_registers(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid, const struct grf_register_mask *mask,
+                                  struct grf_device *device, grf_comm_register_cb callback, void *userdata);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_read_group().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param devices	list of devices to read, the data is stored in *devices->records*
+ *  \param callback	function called from \ref grf_comm_step() after each device (may be NULL)
+ *  \param userdata	user data passed to *callback*
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_read_group(struct grf_comm_op *op, struct grf_radio *radio, struct grf_devicelist *devices, grf_comm_device_cb callback, void *userdata);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_lease_device().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device to lease
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_lease_device(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_release_device().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_release_device(struct grf_comm_op *op, struct grf_radio *radio);
+
+/*! \brief Start the non-blocking variant of \ref grf_comm_switch_signal().
+ *
+ *  \param op		operation structure to initialize
+ *  \param radio	radio device structure initialized by \ref grf_comm_init()
+ *  \param deviceid	ID of the device to be switched
+ *  \param on		switches alert ON if true and OFF if false
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+int grf_comm_start_switch_signal(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid, bool on);
+
+/*! \brief Allow a running operation to pause for more urgent operations.
+ *
+ *  The operation asks *callback* at every point it can pause without leaving
+ *  the radio in a state other operations depend on, i.e. while no data
+ *  acquisition of a device is running. This is the case between the devices
+ *  of \ref grf_comm_start_read_group(). All other operations are short or
+ *  consist of a single exchange and run to their end.
+ *
+ *  Once paused, \ref grf_comm_step() returns `EINPROGRESS` without touching
+ *  the radio and *op->paused* is set. Other operations may then run on the
+ *  radio until the operation is continued by \ref grf_comm_resume().
+ *
+ *  \param op		operation started by one of the grf_comm_start_*() functions
+ *  \param callback	function asked whether to pause (NULL to never pause)
+ *  \param userdata	user data passed to *callback*
+ */
+void grf_comm_op_set_yield(struct grf_comm_op *op, grf_comm_yield_cb callback, void *userdata);
+
+/*! \brief Continue a paused operation.
+ *
+ *  \param op		operation paused on request of its yield callback
+ *  \returns		0 if the operation is continued and an error code otherwise
+ */
+int grf_comm_resume(struct grf_comm_op *op);
+
+/*! \brief Advance a non-blocking operation.
+ *
+ *  This function processes all answers of the radio available without
+ *  blocking and sends the following requests. It should be called whenever
+ *  the descriptor of the operation becomes readable or its deadline expires.
+ *
+ *  \param op		operation started by one of the grf_comm_start_*() functions
+ *  \returns		`EINPROGRESS` while the operation is running, 0 on success and an error code otherwise
+ */
+int grf_comm_step(struct grf_comm_op *op);
+
+/*! \brief Get the descriptor to wait on for the operation.
+ *
+ *  \param op		operation started by one of the grf_comm_start_*() functions
+ *  \returns		the descriptor to poll for `POLLIN`
+ */
+int grf_comm_op_get_pollfd(const struct grf_comm_op *op);
+
+/*! \brief Get the deadline of the operation.
+ *
+ *  \param op		operation started by one of the grf_comm_start_*() functions
+ *  \returns		the point in time (CLOCK_MONOTONIC) to call \ref grf_comm_step() at the latest or NULL if there is none
+ */
+const struct timespec *grf_comm_op_get_deadline(const struct grf_comm_op *op);
+
+/*! \brief Get the time until the deadline of the operation.
+ *
+ *  \param op		operation started by one of the grf_comm_start_*() functions
+ *  \returns		milliseconds until the deadline suitable for poll() or epoll_wait(), -1 if there is none
+ */
+int grf_comm_op_get_timeout(const struct grf_comm_op *op);
+
 #endif /* __GRF_H__ */
 /* @} */
@@ -21,47 +21,99 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <limits.h>
 
 #include <math.h>
 
 #include "grf.h"
 #include "grf_radio.h"
+#include "grf_registers.h"
+#include "grf_latency.h"
+#include "grf_idmap.h"
 #include "grf_logging.h"
 
-#define GRF_INIT_TEST           "%c01TESTA1%c"      /* Set RF module to command mode */
-#define GRF_INIT_SV             "%cSV%c"            /* Request sending the firmware version */
-#define GRF_SCAN_GA             "%cGA%c"            /* Request scanning group adress */
-#define GRF_SCAN_GD             "%cGD:%s%c"         /* Request scanning of all devices of a group adress */
-#define GRF_REQUEST_DA_TMPL     "%cDA:%s:%02d%c"    /* Template for data acquisition request */
-#define GRF_DA_TYPE_START       5                   /* Request starting data acquisition */
-#define GRF_DA_TYPE_SIGNAL_ON   3                   /* Request switching on accustic signal */
-#define GRF_DA_TYPE_SIGNAL_OFF  6                   /* Request switching off accustic signal */
-#define GRF_DA_TYPE_SEND        1                   /* Request sending the aquired data */
-#define GRF_DA_TYPE_STOP        4                   /* Request stopping data acquisition */
-#define GRF_REQUEST_DIAG        "%cSD:%s%c"         /* Request sending diagnosis data */
-
-#define GRF_ANSWER_TIMEOUT      "Timeout"           /* Also used for end of transmission */
-#define GRF_ANSWER_DONE         "Done"              /* Expected answer to indicate completion of command */
-#define GRF_ANSWER_REC          "REC"               /* Expected to indicate that data recording is in process */
-#define GRF_ANSWER_VERSION      "GI_RM_V00.70"      /* Expected version string */
-
-#define GRF_DATATYPE_ERROR      -1
-#define GRF_DATATYPE_CONTROL     0
-#define GRF_DATATYPE_ACK         1
-#define GRF_DATATYPE_DATA       10
-#define GRF_DATATYPE_VERSION    11
-#define GRF_DATATYPE_REC        12
-#define GRF_DATATYPE_DONE       13
-#define GRF_DATATYPE_TIMEOUT    19
+#define GRF_REQUEST_TEST        "01TESTA1"          /* Set RF module to command mode */
+#define GRF_REQUEST_SV          "SV"                /* Request sending the firmware version */
+#define GRF_REQUEST_GA          "GA"                /* Request scanning group adress */
+#define GRF_REQUEST_GD          "GD:%s"             /* Request scanning of all devices of a group adress */
+#define GRF_REQUEST_DIAG        "SD:%s"             /* Request sending diagnosis data */
+#define GRF_REQUEST_DA_START    "DA:%s:05"          /* Request starting data acquisition */
+#define GRF_REQUEST_DA_SIG_ON   "DA:%s:03"          /* Request switching on accustic signal */
+#define GRF_REQUEST_DA_SIG_OFF  "DA:%s:06"          /* Request switching off accustic signal */
+#define GRF_REQUEST_DA_SEND     "DA:%s:01"          /* Request sending the aquired data */
+#define GRF_REQUEST_DA_STOP     "DA:%s:04"          /* Request stopping data acquisition */
+
+#define GRF_EXCHANGE_INIT        0
+#define GRF_EXCHANGE_VERSION     1
+#define GRF_EXCHANGE_GROUPS      2
+#define GRF_EXCHANGE_DEVICES     3
+#define GRF_EXCHANGE_DIAGNOSIS   4
+#define GRF_EXCHANGE_START       5
+#define GRF_EXCHANGE_SEND        6
+#define GRF_EXCHANGE_SIGNAL_ON   7
+#define GRF_EXCHANGE_SIGNAL_OFF  8
+#define GRF_EXCHANGE_STOP        9
+#define GRF_EXCHANGE_DRAIN      10
+#define GRF_EXCHANGE_NONE       -1
+
+#define GRF_STAGE_BEGIN          0  /* Operation or next device of a group starts */
+#define GRF_STAGE_MODE           1  /* Entering command mode */
+#define GRF_STAGE_REQUEST        2  /* Running the single request of scans and version requests */
+#define GRF_STAGE_START          3  /* Starting data acquisition of a device */
+#define GRF_STAGE_FALLBACK       4  /* Starting data acquisition the other way after a timeout */
+#define GRF_STAGE_ACTION         5  /* Reading data or switching the signal of a device */
+#define GRF_STAGE_STOP           6  /* Stopping data acquisition of a device */
+#define GRF_STAGE_DRAIN          7  /* Discarding the rest of a stopped scan */
+#define GRF_STAGE_RELEASE        8  /* Stopping data acquisition of the leased device */
 
 #define MSGBUFSIZE		255
 
+/* Exchange of a request and the expected answers with the radio */
+struct grf_comm_exchange
+{
+	const char  *name;					/* Name of the exchange used for logging */
+	const char  *request;				/* Request template, %s is replaced by the group or device ID (NULL to only receive) */
+	bool         nul;					/* Status flag if the request is preceded by <NUL> */
+	int          answers[3];			/* Expected answers (GRF_FRAME_*) in order */
+	size_t       nanswers;				/* Number of expected answers */
+	bool         stream;				/* Status flag if data follows the answers until the radio sends Timeout */
+	int        (*on_data)(struct grf_comm_op *op, const char *data, size_t len);	/* Handler of received data */
+};
+
+/* Start path of a device remembered from its last data acquisition */
+struct grf_comm_path
+{
+	bool                diagnosis;			/* Status flag if the device required starting the diagnosis mode via SD */
+	struct timespec     updated;			/* Point in time the path worked last (CLOCK_MONOTONIC) */
+};
+
+/* State of the protocol kept across the operations on a radio */
+struct grf_comm_session
+{
+	bool                in_command_mode;	/* Status flag if the radio is known to be in command mode */
+	struct timespec     last_activity;		/* Point in time of the last successful exchange in command mode (CLOCK_MONOTONIC) */
+	int                 idle;				/* Idle time in milliseconds after which command mode is re-entered (0 to re-enter with every request) */
+	bool                draining;			/* Status flag if the remaining answers of the radio have to be discarded before the next request */
+
+	struct grf_latency *latency;			/* Latency statistics used to derive the timeouts of the answers */
+	struct grf_idmap    paths;				/* Start path per device (struct grf_comm_path) */
+	int                 path_ttl;			/* Time in seconds a remembered start path is trusted (0 to always try DA:05 first) */
+	struct grf_idmap    cache;				/* Data of each device read last (struct grf_device) */
+
+	char               *lease;				/* ID of the device whose data acquisition is kept running (NULL if none) */
+	struct timespec     lease_used;			/* Point in time the leased device was used last (CLOCK_MONOTONIC) */
+	int                 lease_idle;			/* Idle time in milliseconds after which the data acquisition of the leased device is stopped */
+};
+
 /*---------------------------------------------------------------------------*/
 static int generate_command(char *msg, size_t *len, size_t size, const char *fmt, ...)
 {
@@ -99,434 +151,1125 @@ static int generate_command(char *msg, size_t *len, size_t size, const char *fmt
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
-static int get_data(const char *msg, size_t len, char *data)
+static int on_version(struct grf_comm_op *op, const char *data, size_t len)
 {
-	assert(msg);
-	assert(data);
+	if (op->radio->firmware_version)
+		free(op->radio->firmware_version);
+	op->radio->firmware_version = strndup(data, len);
+	if (!op->radio->firmware_version)
+		return ENOMEM;
 
-	int datatype = GRF_DATATYPE_ERROR;
+	return 0;
+}
 
-	/* Empty messages are considered invalid */
-	if (len < 1)
-		return GRF_DATATYPE_ERROR;
-	
-	/* Clear the data field */
-	memset(data, '\0', len*sizeof(char));
-
-	/* Check for control characters */
-	if (len == 1)
+static int on_group(struct grf_comm_op *op, const char *data, size_t len)
+{
+	*op->groups = strndup(data, len);
+	if (!*op->groups)
+		return ENOMEM;
+
+	return 0;
+}
+
+static int on_device(struct grf_comm_op *op, const char *data, size_t len)
+{
+	char id[MSGBUFSIZE];
+	int  retval;
+
+	grf_logging_dbg("Received device ID: %.*s", (int)len, data);
+
+	if (len >= MSGBUFSIZE)
+		return EMSGSIZE;
+	memcpy(id, data, len);
+	id[len] = '\0';
+
+	/* Hand the device to the caller right away. If the caller stops the
+	 * scan, the radio keeps sending until Timeout, so the rest has to be
+	 * discarded before the next request.
+	 */
+	retval = op->id_callback(id, op->userdata);
+	if (retval)
+		op->radio->session->draining = true;
+
+	return retval;
+}
+
+static int devicelist_add(const char *id, void *userdata)
+{
+	/* A garbled ID does not spoil the rest of the scan */
+	if (strlen(id) != GRF_DEVICEID_LEN)
+	{
+		grf_logging_warn("Ignoring invalid device ID \"%s\"", id);
+		return 0;
+	}
+
+	return grf_devicelist_add(userdata, id);
+}
+
+static int on_register(struct grf_comm_op *op, const char *data, size_t len)
+{
+	uint16_t key;
+	size_t   i;
+	int      retval;
+
+	grf_logging_dbg("    data: %.*s", (int)len, data);
+
+	/* Interprete the received data */
+	retval = grf_register_decode(op->device, data, len, &key);
+	if (retval == ENOENT)
+		grf_logging_dbg("    UNKNOWN KEY: %.*s", (int)len, data);
+	else if (retval)
+		grf_logging_warn("Malformed register data %.*s", (int)len, data);
+	if (retval == EINVAL || op->type != GRF_COMM_OP_READ_REGISTERS)
+		return 0;
+
+	/* Report requested registers and stop once all of them arrived */
+	if (!GRF_REGISTER_MASK_ISSET(key, &op->pending))
+		return 0;
+	GRF_REGISTER_MASK_CLR(key, &op->pending);
+	if (op->reg_callback)
+		RETURN_ON_ERROR(op->reg_callback(op->device, key, op->userdata));
+	for (i = 0; i < GRF_REGISTER_MASK_WORDS; i++)
+	{
+		if (op->pending.bits[i])
+			return 0;
+	}
+	grf_logging_dbg("    %s", "all requested registers received");
+
+	return GRF_COMM_STOP;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/* Requests and their answers:
+ *    <NUL><STX>01TESTA1<ETX>   -->   <-- <ACK>
+ *    <STX>SV<ETX>              -->   <-- Version string
+ *    <STX>GA<ETX>              -->   <-- <ACK>, Group ID
+ *    <STX>GD:$GROUPID<ETX>     -->   <-- <ACK>, <STX>REC<ETX>, Device IDs, <STX>Timeout<ETX>
+ *    <STX>SD:$DEVICEID<ETX>    -->   <-- <ACK>, <STX>REC<ETX>, <STX>Done<ETX>
+ *    <STX>DA:$DEVICEID:05<ETX> -->   <-- <ACK>, <STX>Done<ETX>
+ *    <STX>DA:$DEVICEID:01<ETX> -->   <-- <ACK>, DATA, <STX>Timeout<ETX>
+ *    <STX>DA:$DEVICEID:03<ETX> -->   <-- <ACK>, <STX>Done<ETX>
+ *    <STX>DA:$DEVICEID:06<ETX> -->   <-- <ACK>, <STX>Done<ETX>
+ *    <STX>DA:$DEVICEID:04<ETX> -->   <-- <ACK>, <STX>Done<ETX>
+ */
+static const struct grf_comm_exchange exchanges[] =
+{
+	[GRF_EXCHANGE_INIT]       = { "init",       GRF_REQUEST_TEST,       true,  { GRF_FRAME_ACK },                                1, false, NULL },
+	[GRF_EXCHANGE_VERSION]    = { "version",    GRF_REQUEST_SV,         false, { GRF_FRAME_VERSION },                            1, false, on_version },
+	[GRF_EXCHANGE_GROUPS]     = { "groups",     GRF_REQUEST_GA,         false, { GRF_FRAME_ACK, GRF_FRAME_DATA },                2, false, on_group },
+	[GRF_EXCHANGE_DEVICES]    = { "devices",    GRF_REQUEST_GD,         false, { GRF_FRAME_ACK, GRF_FRAME_REC },                 2, true,  on_device },
+	[GRF_EXCHANGE_DIAGNOSIS]  = { "diagnosis",  GRF_REQUEST_DIAG,       false, { GRF_FRAME_ACK, GRF_FRAME_REC, GRF_FRAME_DONE }, 3, false, NULL },
+	[GRF_EXCHANGE_START]      = { "start",      GRF_REQUEST_DA_START,   false, { GRF_FRAME_ACK, GRF_FRAME_DONE },                2, false, NULL },
+	[GRF_EXCHANGE_SEND]       = { "send",       GRF_REQUEST_DA_SEND,    false, { GRF_FRAME_ACK },                                1, true,  on_register },
+	[GRF_EXCHANGE_SIGNAL_ON]  = { "signal on",  GRF_REQUEST_DA_SIG_ON,  false, { GRF_FRAME_ACK, GRF_FRAME_DONE },                2, false, NULL },
+	[GRF_EXCHANGE_SIGNAL_OFF] = { "signal off", GRF_REQUEST_DA_SIG_OFF, false, { GRF_FRAME_ACK, GRF_FRAME_DONE },                2, false, NULL },
+	[GRF_EXCHANGE_STOP]       = { "stop",       GRF_REQUEST_DA_STOP,    false, { GRF_FRAME_ACK, GRF_FRAME_DONE },                2, false, NULL },
+	[GRF_EXCHANGE_DRAIN]      = { "drain",      NULL,                   false, { 0 },                                            0, true,  NULL },
+};
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static void session_free(struct grf_comm_session *session)
+{
+	if (!session)
+		return;
+
+	free(session->lease);
+	grf_latency_free(session->latency);
+	grf_idmap_free(&session->paths);
+	grf_idmap_free(&session->cache);
+	free(session);
+}
+
+static int session_new(struct grf_radio *radio)
+{
+	assert(grf_radio_is_valid(radio));
+
+	struct grf_comm_session *session;
+
+	session = calloc(1, sizeof(struct grf_comm_session));
+	if (!session)
+		return ENOMEM;
+
+	/* Command mode has to be entered before the first request. Timeouts are
+	 * learned from the latencies of the answers and the start path from the
+	 * previous requests to each device. The data read from the devices is
+	 * kept for later requests.
+	 */
+	session->in_command_mode = false;
+	session->idle            = GRF_COMM_SESSION_IDLE;
+	session->path_ttl        = GRF_COMM_PATH_TTL;
+	session->lease_idle      = GRF_COMM_LEASE_IDLE;
+	session->latency         = grf_latency_new();
+	if (!session->latency)
 	{
-		data[0] = msg[0];
+		free(session);
+		return ENOMEM;
+	}
+	grf_idmap_init(&session->paths, sizeof(struct grf_comm_path));
+	grf_idmap_init(&session->cache, sizeof(struct grf_device));
+
+	/* The radio keeps the session until it is deinitialized */
+	radio->session      = session;
+	radio->session_free = session_free;
+
+	return 0;
+}
+
+static bool session_is_active(struct grf_radio *radio)
+{
+	assert(grf_radio_is_valid(radio));
+
+	struct grf_comm_session *session = radio->session;
+	struct timespec          now;
+	long                     idle;
+
+	if (!session->in_command_mode || session->idle <= 0)
+		return false;
+
+	/* The radio leaves command mode by itself after some idle time */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	idle = (now.tv_sec - session->last_activity.tv_sec) * 1000L
+	     + (now.tv_nsec - session->last_activity.tv_nsec) / 1000000L;
+
+	return idle < session->idle;
+}
+
+static void session_finish(struct grf_radio *radio, int retval)
+{
+	assert(grf_radio_is_valid(radio));
+
+	/* After an error we cannot be sure about the state of the radio,
+	 * so command mode is re-entered with the next request.
+	 */
+	if (retval)
+	{
+		radio->session->in_command_mode = false;
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &radio->session->last_activity);
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static const char *op_request_id(const struct grf_comm_op *op)
+{
+	return (op->stage == GRF_STAGE_RELEASE) ? op->radio->session->lease : op->id;
+}
+
+static bool op_learns_latency(const struct grf_comm_op *op)
+{
+	const struct grf_comm_exchange *exchange = op->exchange;
+
+	/* Only the fixed answers of the radio itself are learned, i.e. the <ACK>
+	 * and the firmware version. The answers of the devices following the
+	 * <ACK> are ended by the radio with Timeout after its own window, which
+	 * a learned deadline must not undercut, or the late answers are taken
+	 * for the ones of the next request. Streamed data and the rest of a
+	 * transfer skipped are paced by the radio as well.
+	 */
+	if (!exchange->request || op->answer >= exchange->nanswers || op->skipping)
+		return false;
+
+	return op->answer == 0 || exchange->answers[0] != GRF_FRAME_ACK;
+}
+
+static int op_latency_key(const struct grf_comm_op *op)
+{
+	/* Each fixed answer of an exchange has its own latencies */
+	return (op->exchange - exchanges) * 4 + op->answer;
+}
+
+static void op_record_latency(struct grf_comm_op *op)
+{
+	struct timespec now;
+	long            elapsed;
+
+	if (!op_learns_latency(op))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - op->since.tv_sec) * 1000L
+	        + (now.tv_nsec - op->since.tv_nsec) / 1000000L;
+	grf_latency_record(op->radio->session->latency, op_latency_key(op), elapsed);
+}
+
+static void op_set_deadline(struct grf_comm_op *op)
+{
+	int timeout = op->radio->timeout;
+
+	/* Each fixed answer has to arrive within the timeout learned from
+	 * previous answers, capped by the timeout of the radio. The <ACK> is
+	 * sent by the radio right away, so it is not waited for any longer
+	 * than a short moment even if the read-out may take minutes. Only the
+	 * rest of a transfer skipped before may still delay it.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &op->since);
+	if (op->exchange->request && op->answer < op->exchange->nanswers && !op->skipping &&
+	    op->exchange->answers[op->answer] == GRF_FRAME_ACK &&
+	    (timeout < 0 || timeout > GRF_RADIO_TIMEOUT_ACK))
+		timeout = GRF_RADIO_TIMEOUT_ACK;
+	if (op_learns_latency(op))
+		timeout = grf_latency_timeout(op->radio->session->latency, op_latency_key(op), timeout);
+	op->has_deadline = (timeout >= 0);
+	if (!op->has_deadline)
+		return;
+
+	op->deadline = op->since;
+	op->deadline.tv_sec  += timeout / 1000;
+	op->deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (op->deadline.tv_nsec >= 1000000000L)
+	{
+		op->deadline.tv_sec  += 1;
+		op->deadline.tv_nsec -= 1000000000L;
+	}
+}
+
+static int op_finish(struct grf_comm_op *op, int result)
+{
+	session_finish(op->radio, result);
+	op->exchange = NULL;
+	op->result   = result;
+
+	return GRF_EXCHANGE_NONE;
+}
+
+static void path_lookup(struct grf_comm_op *op)
+{
+	const struct grf_comm_path  *path;
+	struct timespec              now;
+	uint16_t                     id;
+
+	/* Without a recent path of the device itself start with DA:05 */
+	op->diagnosis = false;
+	if (op->radio->session->path_ttl <= 0 || !grf_idmap_parse(op->id, &id))
+		return;
+	path = grf_idmap_find(&op->radio->session->paths, id);
+	if (!path)
+		return;
+
+	/* Devices may change their behaviour, so only trust recent paths */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec - path->updated.tv_sec >= op->radio->session->path_ttl)
+		return;
+	op->diagnosis = path->diagnosis;
+	grf_logging_dbg("device %s: starting via %s as %ld s ago", op->id, op->diagnosis ? "SD" : "DA:05",
+	                (long)(now.tv_sec - path->updated.tv_sec));
+}
 
-		/* Determine the datatype */
-		switch(data[0])
+static void path_update(struct grf_comm_op *op)
+{
+	struct grf_comm_path *path;
+	uint16_t              id;
+
+	if (!grf_idmap_parse(op->id, &id))
+		return;
+	path = grf_idmap_insert(&op->radio->session->paths, id);
+	if (!path)
+	{
+		grf_logging_warn("Remembering start path of %s failed: %s", op->id, strerror(ENOMEM));
+		return;
+	}
+	path->diagnosis = op->diagnosis;
+	clock_gettime(CLOCK_MONOTONIC, &path->updated);
+}
+
+static void cache_update(struct grf_comm_op *op)
+{
+	struct grf_device *cached;
+	uint16_t           id;
+
+	/* Keep the data along with the time of reception */
+	op->device->timestamp = time(NULL);
+	if (!grf_idmap_parse(op->id, &id))
+		return;
+	cached = grf_idmap_insert(&op->radio->session->cache, id);
+	if (!cached)
+	{
+		grf_logging_warn("Keeping data of %s failed: %s", op->id, strerror(ENOMEM));
+		return;
+	}
+	memcpy(cached, op->device, sizeof(struct grf_device));
+}
+
+static bool cache_lookup(struct grf_radio *radio, const char *deviceid, int max_age, struct grf_device *device)
+{
+	const struct grf_device *cached;
+	uint16_t                 id;
+	time_t                   age;
+
+	if (max_age < 0 || !grf_idmap_parse(deviceid, &id))
+		return false;
+	cached = grf_idmap_find(&radio->session->cache, id);
+	if (!cached)
+		return false;
+
+	/* Data from the future means the clock was set back, do not trust it */
+	age = time(NULL) - cached->timestamp;
+	if (age < 0 || age > max_age)
+		return false;
+	memcpy(device, cached, sizeof(struct grf_device));
+	grf_logging_dbg("device %s: using data received %ld s ago", deviceid, (long)age);
+
+	return true;
+}
+
+static bool lease_held(const struct grf_comm_op *op)
+{
+	struct grf_comm_session *session = op->radio->session;
+	struct timespec          now;
+	long                     idle;
+
+	if (!session->lease)
+		return false;
+
+	/* Only requests to the leased device can use it */
+	if (op->type != GRF_COMM_OP_READ_DATA && op->type != GRF_COMM_OP_READ_REGISTERS &&
+	    op->type != GRF_COMM_OP_SWITCH_SIGNAL && op->type != GRF_COMM_OP_LEASE_DEVICE)
+		return false;
+	if (strcmp(op->id, session->lease) != 0)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	idle = (now.tv_sec - session->lease_used.tv_sec) * 1000L
+	     + (now.tv_nsec - session->lease_used.tv_nsec) / 1000000L;
+
+	return idle < session->lease_idle;
+}
+
+static bool lease_release_needed(const struct grf_comm_op *op)
+{
+	struct grf_comm_session *session = op->radio->session;
+	struct timespec          now;
+	long                     idle;
+
+	if (!session->lease || lease_held(op))
+		return false;
+
+	/* Requests not involving any device keep the lease unless it is idle */
+	if (op->type != GRF_COMM_OP_INIT && op->type != GRF_COMM_OP_KEEPALIVE)
+		return true;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	idle = (now.tv_sec - session->lease_used.tv_sec) * 1000L
+	     + (now.tv_nsec - session->lease_used.tv_nsec) / 1000000L;
+
+	return idle >= session->lease_idle;
+}
+
+static void lease_set(struct grf_comm_op *op)
+{
+	struct grf_comm_session *session = op->radio->session;
+
+	if (!session->lease)
+	{
+		session->lease = strdup(op->id);
+		if (!session->lease)
+			grf_logging_warn("Leasing device %s failed: %s", op->id, strerror(ENOMEM));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &session->lease_used);
+}
+
+static void lease_clear(struct grf_radio *radio)
+{
+	free(radio->session->lease);
+	radio->session->lease = NULL;
+}
+
+static int op_action(struct grf_comm_op *op)
+{
+	op->stage = GRF_STAGE_ACTION;
+	if (op->type == GRF_COMM_OP_SWITCH_SIGNAL)
+		return op->on ? GRF_EXCHANGE_SIGNAL_ON : GRF_EXCHANGE_SIGNAL_OFF;
+
+	return GRF_EXCHANGE_SEND;
+}
+
+static int op_first_exchange(struct grf_comm_op *op)
+{
+	/* Stop the data acquisition of a leased device no longer needed */
+	if (lease_release_needed(op))
+	{
+		grf_logging_dbg("device %s: releasing lease", op->radio->session->lease);
+		op->stage = GRF_STAGE_RELEASE;
+		return GRF_EXCHANGE_STOP;
+	}
+
+	switch (op->type)
+	{
+		case GRF_COMM_OP_INIT:
+		case GRF_COMM_OP_KEEPALIVE:
+			op->stage = GRF_STAGE_REQUEST;
+			return GRF_EXCHANGE_VERSION;
+		case GRF_COMM_OP_SCAN_GROUPS:
+			op->stage = GRF_STAGE_REQUEST;
+			return GRF_EXCHANGE_GROUPS;
+		case GRF_COMM_OP_SCAN_DEVICES:
+			op->stage = GRF_STAGE_REQUEST;
+			return GRF_EXCHANGE_DEVICES;
+		case GRF_COMM_OP_RELEASE_DEVICE:
+			return op_finish(op, 0);
+		default:
+			/* The data acquisition of a leased device is still running */
+			if (lease_held(op))
+			{
+				grf_logging_dbg("device %s: using lease", op->id);
+				if (op->type == GRF_COMM_OP_LEASE_DEVICE)
+				{
+					lease_set(op);
+					return op_finish(op, 0);
+				}
+				return op_action(op);
+			}
+
+			/* Start with the path that worked for the device last time
+			 * or otherwise with DA:05.
+			 */
+			path_lookup(op);
+			op->stage = GRF_STAGE_START;
+			return op->diagnosis ? GRF_EXCHANGE_DIAGNOSIS : GRF_EXCHANGE_START;
+	}
+}
+
+static int op_next_exchange(struct grf_comm_op *op, int result);
+
+static int op_device_done(struct grf_comm_op *op, int result)
+{
+	int retval;
+
+	if (!result && (op->type == GRF_COMM_OP_READ_DATA || op->type == GRF_COMM_OP_READ_GROUP))
+		cache_update(op);
+	if (op->type != GRF_COMM_OP_READ_GROUP)
+		return op_finish(op, result);
+
+	/* Failing devices do not stop reading the group */
+	session_finish(op->radio, result);
+	if (result)
+		grf_logging_warn("Reading device %s failed: %s", op->device->id, strerror(result));
+
+	/* Report the result and stop if requested by the caller */
+	if (op->callback)
+	{
+		retval = op->callback(op->device, result, op->userdata);
+		if (retval)
+			return op_finish(op, (retval == GRF_COMM_STOP) ? 0 : retval);
+	}
+
+	/* Continue with the next device */
+	op->index++;
+	if (op->index >= op->devices->len)
+		return op_finish(op, 0);
+	op->device    = &op->devices->records[op->index];
+	op->id        = op->device->id;
+	op->stage     = GRF_STAGE_BEGIN;
+	op->diagnosis = false;
+
+	/* No data acquisition is running between devices, so more urgent
+	 * operations may take over the radio until the group is resumed.
+	 */
+	if (op->yield && op->yield(op, op->yield_data))
+	{
+		grf_logging_dbg("Pausing before device %s (%zu/%zu)", op->id, op->index + 1, op->devices->len);
+		op->paused       = true;
+		op->exchange     = NULL;
+		op->has_deadline = false;
+		return GRF_EXCHANGE_NONE;
+	}
+
+	return op_next_exchange(op, 0);
+}
+
+static int op_next_exchange(struct grf_comm_op *op, int result)
+{
+	/* Determine the exchange to run next from the stage of the operation
+	 * and the result of the exchange just finished.
+	 */
+	switch (op->stage)
+	{
+		case GRF_STAGE_BEGIN:
+			/* Wait for the end of a stopped scan before sending anything */
+			if (op->radio->session->draining)
+			{
+				op->stage = GRF_STAGE_DRAIN;
+				return GRF_EXCHANGE_DRAIN;
+			}
+			if (op->type == GRF_COMM_OP_INIT)
+				op->radio->session->in_command_mode = false;
+			if (op->type == GRF_COMM_OP_READ_GROUP)
+				grf_logging_info("Reading device %s (%zu/%zu)", op->id, op->index + 1, op->devices->len);
+
+			/* Skip the handshake if the radio is still in command mode */
+			if (!session_is_active(op->radio))
+			{
+				op->stage = GRF_STAGE_MODE;
+				return GRF_EXCHANGE_INIT;
+			}
+			grf_logging_dbg("session: radio still in command mode (idle limit %d ms)", op->radio->session->idle);
+			return op_first_exchange(op);
+
+		case GRF_STAGE_MODE:
+			/* Without command mode nothing works, so give up */
+			if (result)
+			{
+				grf_logging_err("Entering command mode failed: %s", strerror(result));
+				return op_finish(op, result);
+			}
+			op->radio->session->in_command_mode = true;
+			if (op->type == GRF_COMM_OP_KEEPALIVE && !lease_release_needed(op))
+				return op_finish(op, 0);
+			return op_first_exchange(op);
+
+		case GRF_STAGE_REQUEST:
+			return op_finish(op, (result == GRF_COMM_STOP) ? 0 : result);
+
+		case GRF_STAGE_START:
+			/* In case we receive a timeout try the other way, i.e. start the
+			 * diagnosis mode if the device does not respond to DA:05. If the
+			 * radio did not report the timeout itself, it may still answer,
+			 * so the device fails and the radio is drained first.
+			 */
+			if (result == ETIMEDOUT && !op->expired)
+			{
+				op->diagnosis = !op->diagnosis;
+				op->stage     = GRF_STAGE_FALLBACK;
+				return op->diagnosis ? GRF_EXCHANGE_DIAGNOSIS : GRF_EXCHANGE_START;
+			}
+			/* fall through */
+		case GRF_STAGE_FALLBACK:
+			if (result)
+				return op_device_done(op, result);
+			path_update(op);
+			if (op->type == GRF_COMM_OP_LEASE_DEVICE)
+			{
+				lease_set(op);
+				return op_finish(op, 0);
+			}
+			return op_action(op);
+
+		case GRF_STAGE_ACTION:
+			/* Stop the device right away if the rest of the data is not
+			 * needed and discard whatever the radio still sends. A leased
+			 * device keeps running, so the rest is discarded before the
+			 * next request instead.
+			 */
+			if (result == GRF_COMM_STOP)
+			{
+				if (lease_held(op))
+					op->radio->session->draining = true;
+				else
+					op->skipping = true;
+				result = 0;
+			}
+			if (result && lease_held(op))
+				lease_clear(op->radio);
+			if (result)
+				return op_device_done(op, result);
+			if (lease_held(op))
+			{
+				lease_set(op);
+				return op_device_done(op, 0);
+			}
+			op->stage = GRF_STAGE_STOP;
+			return GRF_EXCHANGE_STOP;
+
+		case GRF_STAGE_STOP:
+			if (op->radio->session->lease && strcmp(op->radio->session->lease, op->id) == 0)
+				lease_clear(op->radio);
+			return op_device_done(op, result);
+
+		case GRF_STAGE_RELEASE:
+			if (result)
+				grf_logging_warn("Stopping data acquisition of %s failed: %s", op->radio->session->lease, strerror(result));
+			lease_clear(op->radio);
+			if (op->type == GRF_COMM_OP_RELEASE_DEVICE)
+				return op_finish(op, result);
+			return op_first_exchange(op);
+
+		case GRF_STAGE_DRAIN:
+			/* If the radio did not finish properly, its state is unknown
+			 * and command mode is re-entered.
+			 */
+			op->radio->session->draining = false;
+			if (result)
+				op->radio->session->in_command_mode = false;
+			op->stage = GRF_STAGE_BEGIN;
+			return op_next_exchange(op, 0);
+
+		default:
+			return op_finish(op, EINVAL);
+	}
+}
+
+static int exchange_start(struct grf_comm_op *op, int exchange)
+{
+	static const char prefix[] = { GRF_NUL, GRF_STX };
+	static const char suffix[] = { GRF_ETX };
+
+	char         request[MSGBUFSIZE];
+	struct iovec iov[3];
+	size_t       len;
+
+	op->exchange = &exchanges[exchange];
+	op->answer   = 0;
+	op->expired  = false;
+
+	/* Some exchanges only receive the answers of a previous request */
+	if (!op->exchange->request)
+	{
+		op_set_deadline(op);
+		return 0;
+	}
+
+	/* Send the request framed by <STX> and <ETX> in one go, the handshake
+	 * entering command mode is preceded by <NUL>.
+	 */
+	RETURN_ON_ERROR(generate_command(request, &len, MSGBUFSIZE, op->exchange->request, op_request_id(op) ? op_request_id(op) : ""));
+	iov[0].iov_base = (void *)(op->exchange->nul ? prefix : prefix + 1);
+	iov[0].iov_len  = op->exchange->nul ? 2 : 1;
+	iov[1].iov_base = request;
+	iov[1].iov_len  = len;
+	iov[2].iov_base = (void *)suffix;
+	iov[2].iov_len  = sizeof(suffix);
+	RETURN_ON_ERROR(grf_radio_writev(op->radio, iov, 3, GRF_RADIO_TIMEOUT_ACK));
+	op_set_deadline(op);
+
+	return 0;
+}
+
+static void op_advance(struct grf_comm_op *op, int result)
+{
+	int exchange;
+
+	/* Start the next exchange, failing to send the request finishes
+	 * the exchange right away.
+	 */
+	while ((exchange = op_next_exchange(op, result)) != GRF_EXCHANGE_NONE)
+	{
+		result = exchange_start(op, exchange);
+		if (!result)
+			break;
+		grf_logging_dbg("exchange %s: %s", op->exchange->name, strerror(result));
+	}
+}
+
+static int exchange_receive(struct grf_comm_op *op, const struct grf_frame *frame)
+{
+	const struct grf_comm_exchange *exchange = op->exchange;
+
+	/* Discard whatever the radio still sends for a scan stopped early or a
+	 * request timed out before, until it finishes with Timeout or Done.
+	 */
+	if (exchange == &exchanges[GRF_EXCHANGE_DRAIN])
+	{
+		if (frame->kind == GRF_FRAME_TIMEOUT || frame->kind == GRF_FRAME_DONE)
+			return 0;
+		op_set_deadline(op);
+		return EINPROGRESS;
+	}
+
+	/* Late answers may still arrive while entering command mode again */
+	if (exchange == &exchanges[GRF_EXCHANGE_INIT] && frame->kind != GRF_FRAME_ACK && frame->kind != GRF_FRAME_NAK)
+	{
+		grf_logging_dbg("exchange %s: discarding late answer", exchange->name);
+		return EINPROGRESS;
+	}
+
+	/* Discard the rest of a transfer stopped early. The radio either aborts
+	 * it and answers the next request right away or finishes it with Timeout.
+	 */
+	if (op->skipping)
+	{
+		if (frame->kind == GRF_FRAME_DATA || frame->kind == GRF_FRAME_TIMEOUT)
 		{
-			case GRF_ACK:
-				datatype = GRF_DATATYPE_ACK;
-				break;
-			default:
-				datatype = GRF_DATATYPE_CONTROL;
-				break;
+			op->skipping = (frame->kind == GRF_FRAME_DATA);
+			op_set_deadline(op);
+			return EINPROGRESS;
 		}
+
+		/* The answer was waited for since the last frame skipped, so its latency is not recorded */
+		op->skipping = false;
+	}
+	else
+		op_record_latency(op);
+
+	/* Check the fixed answers first and afterwards the streamed
+	 * data, which is terminated by Timeout.
+	 */
+	if (op->answer < exchange->nanswers)
+	{
+		if (frame->kind == GRF_FRAME_TIMEOUT)
+			return ETIMEDOUT;
+		if (frame->kind != exchange->answers[op->answer])
+			return EIO;
+		op->answer++;
 	}
 	else
 	{
-		/* Check the leading STX and trailing ETX */
-		if (msg[0] != GRF_STX || msg[len-1] != GRF_ETX)
-			return GRF_DATATYPE_ERROR;
-
-		/* Copy only the real content of sent data and
-		 * make sure we have a terminating \0 character.
-		 */
-		strncpy(data, msg+1, (len-2));
-
-		/* Determine the datatype */
-		if (strncmp(data, GRF_ANSWER_VERSION, 7) == 0)
-			datatype = GRF_DATATYPE_VERSION;
-		else if (strcmp(data, GRF_ANSWER_TIMEOUT) == 0)
-			datatype = GRF_DATATYPE_TIMEOUT;
-		else if (strcmp(data, GRF_ANSWER_REC) == 0)
-			datatype = GRF_DATATYPE_REC;
-		else if (strcmp(data, GRF_ANSWER_DONE) == 0)
-			datatype = GRF_DATATYPE_DONE;
-		else
-			datatype = GRF_DATATYPE_DATA;
+		if (frame->kind == GRF_FRAME_TIMEOUT)
+			return 0;
+		if (frame->kind != GRF_FRAME_DATA)
+			return EIO;
 	}
 
-	return datatype;
+	/* Hand the received data to the exchange */
+	if ((frame->kind == GRF_FRAME_DATA || frame->kind == GRF_FRAME_VERSION) && exchange->on_data)
+		RETURN_ON_ERROR(exchange->on_data(op, frame->data, frame->len));
+
+	if (op->answer == exchange->nanswers && !exchange->stream)
+		return 0;
+
+	/* Wait for the next answer */
+	op_set_deadline(op);
+
+	return EINPROGRESS;
 }
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
-static bool msg_is_ack(char *msg, size_t len)
+static void op_init(struct grf_comm_op *op, struct grf_radio *radio, int type)
 {
-	assert(msg);
-	assert(len > 0);
+	assert(radio->session);
 
-	char data[len];
+	memset(op, 0, sizeof(struct grf_comm_op));
+	op->radio  = radio;
+	op->type   = type;
+	op->stage  = GRF_STAGE_BEGIN;
+	op->result = EINPROGRESS;
+}
+
+static int op_begin(struct grf_comm_op *op)
+{
+	/* Send the first request */
+	op_advance(op, 0);
 
-	return (get_data(msg, len, data) == GRF_DATATYPE_ACK);
+	return (op->result == EINPROGRESS) ? 0 : op->result;
 }
 
-static bool msg_is_timeout(char *msg, size_t len)
+static int op_run(struct grf_comm_op *op)
 {
-	assert(msg);
-	assert(len > 0);
+	struct pollfd pfd;
+	int           retval;
 
-	char data[len];
+	/* Block until the operation is complete */
+	while ((retval = grf_comm_step(op)) == EINPROGRESS)
+	{
+		pfd.fd     = grf_comm_op_get_pollfd(op);
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, grf_comm_op_get_timeout(op)) < 0 && errno != EINTR)
+		{
+			retval = errno;
+			op_finish(op, retval);
+			return retval;
+		}
+	}
 
-	return (get_data(msg, len, data) == GRF_DATATYPE_TIMEOUT);
+	return retval;
 }
+/*---------------------------------------------------------------------------*/
 
-static bool msg_is_done(char *msg, size_t len)
+/*---------------------------------------------------------------------------*/
+int grf_comm_step(struct grf_comm_op *op)
 {
-	assert(msg);
-	assert(len > 0);
+	assert(op);
+	assert(grf_radio_is_valid(op->radio));
 
-	char data[len];
+	struct grf_frame frame;
+	struct timespec  now;
+	int              retval;
+
+	/* Process all answers available without blocking */
+	while (op->result == EINPROGRESS && !op->paused)
+	{
+		retval = grf_radio_read_frame(op->radio, &frame, 0);
+		if (retval == EAGAIN)
+		{
+			if (!op->has_deadline)
+				break;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec < op->deadline.tv_sec ||
+			    (now.tv_sec == op->deadline.tv_sec && now.tv_nsec < op->deadline.tv_nsec))
+				break;
+			grf_logging_dbg("recv: %s", "Timeout! No data received.");
+
+			/* The radio may still answer the request, so whatever it
+			 * sends is discarded before the next request. Entering command
+			 * mode discards late answers by itself.
+			 */
+			op->expired = true;
+			if (op->exchange->request && op->exchange != &exchanges[GRF_EXCHANGE_INIT])
+				op->radio->session->draining = true;
+			retval = ETIMEDOUT;
+		}
+		if (!retval)
+			retval = exchange_receive(op, &frame);
+		if (retval == EINPROGRESS)
+			continue;
+
+		/* The exchange is finished, continue with the next one */
+		if (retval && retval != GRF_COMM_STOP)
+			grf_logging_dbg("exchange %s: %s", op->exchange->name, strerror(retval));
+		op_advance(op, retval);
+	}
 
-	return (get_data(msg, len, data) == GRF_DATATYPE_DONE);
+	return op->result;
 }
 
-static bool msg_is_rec(char *msg, size_t len)
+int grf_comm_op_get_pollfd(const struct grf_comm_op *op)
 {
-	assert(msg);
-	assert(len > 0);
+	assert(op);
 
-	char data[len];
+	return grf_radio_get_pollfd(op->radio);
+}
 
-	return (get_data(msg, len, data) == GRF_DATATYPE_REC);
+const struct timespec *grf_comm_op_get_deadline(const struct grf_comm_op *op)
+{
+	assert(op);
+
+	if (op->result != EINPROGRESS || op->paused || !op->has_deadline)
+		return NULL;
+
+	return &op->deadline;
+}
+
+int grf_comm_op_get_timeout(const struct grf_comm_op *op)
+{
+	assert(op);
+
+	struct timespec now;
+	long            remaining;
+
+	if (op->result != EINPROGRESS)
+		return 0;
+	if (op->paused || !op->has_deadline)
+		return -1;
+
+	/* Round up to not wake up right before the deadline */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining = (op->deadline.tv_sec - now.tv_sec) * 1000L
+	          + (op->deadline.tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+	if (remaining < 0)
+		return 0;
+	if (remaining > INT_MAX)
+		return INT_MAX;
+
+	return remaining;
+}
+
+void grf_comm_op_set_yield(struct grf_comm_op *op, grf_comm_yield_cb callback, void *userdata)
+{
+	assert(op);
+
+	op->yield      = callback;
+	op->yield_data = userdata;
+}
+
+int grf_comm_resume(struct grf_comm_op *op)
+{
+	assert(op);
+	assert(grf_radio_is_valid(op->radio));
+
+	if (!op->paused)
+		return EINVAL;
+	op->paused = false;
+
+	/* Continue with the next device as if it was the first one */
+	return op_begin(op);
 }
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
-static int send_init_sequence(struct grf_radio *radio)
+int grf_comm_start_init(struct grf_comm_op *op, struct grf_radio *radio)
 {
+	assert(op);
 	assert(grf_radio_is_valid(radio));
 
-	char    msg[MSGBUFSIZE];
-	size_t  len;
-
-	/* Write the initialization sequence:
-	 *    <NUL><STX>01TESTA1<ETX>   -->
-	 *                              <-- <ACK>
-	 */
-	RETURN_ON_ERROR(grf_radio_write_ctrl(radio, GRF_NUL));
-	RETURN_ON_ERROR(generate_command(msg, &len, MSGBUFSIZE, GRF_INIT_TEST, GRF_STX, GRF_ETX));
-	RETURN_ON_ERROR(grf_radio_write(radio, msg, len));
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (!msg_is_ack(msg, len))
-		return EIO;
+	/* The session is set up once and kept by the radio */
+	if (!radio->session)
+		RETURN_ON_ERROR(session_new(radio));
+	op_init(op, radio, GRF_COMM_OP_INIT);
 
-	return 0;
+	return op_begin(op);
 }
 
-static int send_request_firmware_version(struct grf_radio *radio)
+int grf_comm_start_keepalive(struct grf_comm_op *op, struct grf_radio *radio)
 {
+	assert(op);
 	assert(grf_radio_is_valid(radio));
 
-	char    msg[MSGBUFSIZE];
-	char    data[MSGBUFSIZE];
-	size_t  len;
-
-	/* Get firmware version:
-	 *    <STX>SV<ETX>              -->
-	 *                              <-- Version string
-	 */
-	RETURN_ON_ERROR(generate_command(msg, &len, MSGBUFSIZE, GRF_INIT_SV, GRF_STX, GRF_ETX));
-	RETURN_ON_ERROR(grf_radio_write(radio, msg, len));
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (get_data(msg, len, data) != GRF_DATATYPE_VERSION)
-		return EIO;
-
-	radio->firmware_version = strdup(data);
-	if (!radio->firmware_version)
-		return ENOMEM;
+	op_init(op, radio, GRF_COMM_OP_KEEPALIVE);
 
-	return 0;
+	return op_begin(op);
 }
 
-static int send_request_groups(struct grf_radio *radio, char **groups)
+int grf_comm_start_scan_groups(struct grf_comm_op *op, struct grf_radio *radio, char **groups)
 {
+	assert(op);
 	assert(grf_radio_is_valid(radio));
 	assert(groups);
 
-	char    msg[MSGBUFSIZE];
-	char    data[MSGBUFSIZE];
-	size_t  len;
-
-	/* Start group scanning:
-	 *    <STX>GA<ETX>              -->
-	 *                              <-- <ACK>
-	 *                              <-- Group IDs
-	 */
-	RETURN_ON_ERROR(generate_command(msg, &len, MSGBUFSIZE, GRF_SCAN_GA, GRF_STX, GRF_ETX));
-	RETURN_ON_ERROR(grf_radio_write(radio, msg, len));
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (!msg_is_ack(msg, len))
-		return EIO;
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (get_data(msg, len, data) != GRF_DATATYPE_DATA)
-		return EIO;
-
-	*groups = strdup(data);
-	if (!*groups)
-		return ENOMEM;
+	op_init(op, radio, GRF_COMM_OP_SCAN_GROUPS);
+	op->groups = groups;
 
-	return 0;
+	return op_begin(op);
 }
 
-static int send_request_devices(struct grf_radio *radio, const char *group, struct grf_devicelist *devices)
+int grf_comm_start_scan_devices(struct grf_comm_op *op, struct grf_radio *radio, const char *group, struct grf_devicelist *devices)
 {
+	assert(op);
 	assert(grf_radio_is_valid(radio));
 	assert(group);
 	assert(devices);
 
-	char    msg[MSGBUFSIZE];
-	char    data[MSGBUFSIZE];
-	size_t  len;
+	/* Initialize the device list keeping its storage */
+	free(devices->records);
+	devices->records = NULL;
+	devices->len     = 0;
 
-	/* Start group scanning:
-	 *    <STX>GD:$GROUPID<ETX>     -->
-	 *                              <-- <ACK>
-	 *                              <-- <STX>REC<ETX>
-	 *                              <-- Device IDs
-	 */
-	RETURN_ON_ERROR(generate_command(msg, &len, MSGBUFSIZE, GRF_SCAN_GD, GRF_STX, group, GRF_ETX));
-	RETURN_ON_ERROR(grf_radio_write(radio, msg, len));
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (!msg_is_ack(msg, len))
-		return EIO;
-
-	/* Expect the REC answer */
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (!msg_is_rec(msg, len))
-		return EIO;
-
-	/* Receive devices until we get a timout */
-	devices->len = 0;
-	while (true) 
-	{
-		RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-		if (msg_is_timeout(msg, len))
-			break;
-                if (get_data(msg, len, data) != GRF_DATATYPE_DATA)
-			return EIO;
-		grf_logging_dbg("Received device ID: %s", data);
-
-		/* Check if there is still some room to store the devices */
-		if (devices->len >= GRF_MAXDEVICES)
-			return ENOBUFS;
-
-		/* Add device to the device array and set the update
-		 * time to invalid (-1) to mark that the device was
-		 * not yet updated.
-		 */
-		devices->devices[devices->len].id        = strdup(data);
-		devices->devices[devices->len].timestamp = -1;
-		devices->len++;
-
-		if (!devices->devices[devices->len].id)
-			return ENOMEM;
-	}
+	return grf_comm_start_stream_devices(op, radio, group, devicelist_add, devices);
+}
 
-	return 0;
+int grf_comm_start_stream_devices(struct grf_comm_op *op, struct grf_radio *radio, const char *group, grf_comm_id_cb callback, void *userdata)
+{
+	assert(op);
+	assert(grf_radio_is_valid(radio));
+	assert(group);
+	assert(callback);
+
+	op_init(op, radio, GRF_COMM_OP_SCAN_DEVICES);
+	op->id          = group;
+	op->id_callback = callback;
+	op->userdata    = userdata;
+
+	return op_begin(op);
 }
 
-static int send_start_diagnosis(struct grf_radio *radio, const char *deviceid)
+int grf_comm_start_read_data(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid, struct grf_device *device)
 {
+	assert(op);
 	assert(grf_radio_is_valid(radio));
 	assert(deviceid);
+	assert(device);
 
-	char    msg[MSGBUFSIZE];
-	size_t  len;
+	op_init(op, radio, GRF_COMM_OP_READ_DATA);
+	op->device = device;
 
-	/* Request data acquisition:
-	 *    <STX>SD:$DEVICEID<ETX>	      -->
-	 *                                   <-- <ACK>
-	 *                                   <-- <STX>REC<ETX>
-	 *                                   <-- <STX>Done<ETX>
-	 */
-	RETURN_ON_ERROR(generate_command(msg, &len, MSGBUFSIZE, GRF_REQUEST_DIAG, GRF_STX, deviceid, GRF_ETX));
-	RETURN_ON_ERROR(grf_radio_write(radio, msg, len));
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (!msg_is_ack(msg, len))
-		return EIO;
-
-	/* Expect the REC answer */
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (!msg_is_rec(msg, len))
-		return EIO;
-
-	/* Expect the Done answer */
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (!msg_is_done(msg, len))
-		return EIO;
+	/* Initialize the device data */
+	if (strlen(deviceid) != GRF_DEVICEID_LEN)
+		return EINVAL;
+	memcpy(device->id, deviceid, GRF_DEVICEID_LEN + 1);
+	op->id = device->id;
 
-	return 0;
+	return op_begin(op);
 }
 
-static int send_data_request(struct grf_radio *radio, const char *deviceid, uint8_t reqtype)
+int grf_comm_start_read_data_cached(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid, int max_age, struct grf_device *device)
 {
+	assert(op);
 	assert(grf_radio_is_valid(radio));
 	assert(deviceid);
+	assert(device);
 
-	char    msg[MSGBUFSIZE];
-	size_t  len;
-
-	/* Request data acquisition:
-	 *    <STX>DA:$DEVICEID:$REQTYPE<ETX> -->
-	 *                                   <-- <ACK>
-	 * if request type is 1:
-	 *                                   <-- DATA
-	 * else:
-	 *                                   <-- <STX>Done<ETX>
-	 */
-	RETURN_ON_ERROR(generate_command(msg, &len, MSGBUFSIZE, GRF_REQUEST_DA_TMPL, GRF_STX, deviceid, reqtype, GRF_ETX));
-	RETURN_ON_ERROR(grf_radio_write(radio, msg, len));
-	RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-	if (msg_is_timeout(msg, len))
-		return ETIMEDOUT;
-	if (!msg_is_ack(msg, len))
-		return EIO;
-
-	/* Expect the actual data for the send request */
-	if (reqtype != GRF_DA_TYPE_SEND)
+	/* Recent data is returned without touching the radio */
+	if (cache_lookup(radio, deviceid, max_age, device))
 	{
-		RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-		if (msg_is_timeout(msg, len))
-			return ETIMEDOUT;
-		if (!msg_is_done(msg, len))
-			return EIO;
+		op_init(op, radio, GRF_COMM_OP_READ_DATA);
+		op->device = device;
+		op->id     = device->id;
+		op->result = 0;
+		return 0;
 	}
 
-	return 0;
+	return grf_comm_start_read_data(op, radio, deviceid, device);
 }
 
-static int recv_data(struct grf_radio *radio, struct grf_device *device)
+int grf_comm_start_read_registers(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid, const struct grf_register_mask *mask,
+                                  struct grf_device *device, grf_comm_register_cb callback, void *userdata)
 {
+	assert(op);
 	assert(grf_radio_is_valid(radio));
+	assert(deviceid);
+	assert(mask);
 	assert(device);
 
-	char      msg[MSGBUFSIZE];
-	char      data[MSGBUFSIZE];
-	size_t    len;
-	uint32_t  key;
-	uint32_t  value;
+	op_init(op, radio, GRF_COMM_OP_READ_REGISTERS);
+	op->device       = device;
+	op->pending      = *mask;
+	op->reg_callback = callback;
+	op->userdata     = userdata;
+
+	/* Initialize the device data */
+	if (strlen(deviceid) != GRF_DEVICEID_LEN)
+		return EINVAL;
+	memcpy(device->id, deviceid, GRF_DEVICEID_LEN + 1);
+	op->id = device->id;
+
+	return op_begin(op);
+}
 
-	while (true)
+int grf_comm_start_read_group(struct grf_comm_op *op, struct grf_radio *radio, struct grf_devicelist *devices, grf_comm_device_cb callback, void *userdata)
+{
+	assert(op);
+	assert(grf_radio_is_valid(radio));
+	assert(devices);
+
+	op_init(op, radio, GRF_COMM_OP_READ_GROUP);
+	op->devices  = devices;
+	op->callback = callback;
+	op->userdata = userdata;
+
+	/* Nothing to do for an empty group */
+	if (devices->len < 1)
 	{
-		RETURN_ON_ERROR(grf_radio_read(radio, msg, &len, MSGBUFSIZE));
-		if (msg_is_timeout(msg, len))
-			break;
-		if (get_data(msg, len, data) != GRF_DATATYPE_DATA)
-			return EIO;
-		grf_logging_dbg("    data: %s", data);
+		op->result = 0;
+		return 0;
+	}
+	RETURN_ON_ERROR(grf_devicelist_alloc_records(devices));
+	op->device = &devices->records[0];
+	op->id     = op->device->id;
 
-		/* Interprete the received data.*/
-		sscanf(data, "%04x:%08x", &key, &value);
-		switch(key)
-		{
-			case 0x0001:	/* Serial number */
-				device->serial_number = value;
-				break;
-			case 0x0002:	/* FIXME: Unknown */
-				device->unknown_02 = value;
-				break;
-			case 0x0003:	/* Operation time */
-				device->operation_time = (float)value * 0.25f;
-				break;
-			case 0x0004:	/* Smoke chamber state */
-				device->smoke_chamber_value = (value >> 16) & 0xFFFF; /* FIXME: unknown */
-				device->local_smoke_alerts  = (value >> 8)  & 0xFF;
-				device->smoke_chamber_pollution = value & 0xFF;
-				break;
-			case 0x0005:	/* Battery and temperature */
-				device->battery_voltage = (float)((value >> 16) & 0xFFFF) * 9.184f / 500.0f;
-				device->temperature1    = (float)((value >> 8)  & 0xFF) * 0.50f - 20.0f;
-				device->temperature2    = (float)(value         & 0xFF) * 0.50f - 20.0f;
-				break;
-			case 0x0006:	/* Alert count */
-				device->local_temperature_alerts = (value >> 24) & 0xFF;
-				device->local_test_alerts        = (value >> 16) & 0xFF;
-				device->remote_cable_alerts      = (value >> 8)  & 0xFF;
-				device->remote_radio_alerts      =  value        & 0xFF;
-				break;
-			case 0x0007:	/* Remote test alert count */
-				/* FIXME: upper two bytes unknown. Always zero? */
-				device->remote_cable_test_alerts = (value >> 8)  & 0xFF;
-				device->remote_radio_test_alerts =  value        & 0xFF;
-				break;
-			case 0x0014:	/* FIXME: Unknown register */
-			case 0x0015:	/* FIXME: Unknown register */
-			case 0x0016:	/* FIXME: Unknown register */
-			case 0x0017:	/* FIXME: Unknown register */
-			case 0x0018:	/* FIXME: Unknown register */
-			case 0x0019:	/* FIXME: Unknown register */
-			case 0x001A:	/* FIXME: Unknown register */
-			case 0x001B:	/* FIXME: Unknown register */
-			case 0x001C:	/* FIXME: Unknown register */
-			case 0x001D:	/* FIXME: Unknown register */
-			case 0x001E:	/* FIXME: Unknown register */
-			case 0x001F:	/* FIXME: Unknown register */
-			case 0x0020:	/* FIXME: Unknown register */
-			case 0x0021:	/* FIXME: Unknown register */
-			case 0x0022:	/* FIXME: Unknown register */
-			case 0x0023:	/* FIXME: Unknown register */
-			case 0x0024:	/* FIXME: Unknown register */
-			case 0x0025:	/* FIXME: Unknown register */
-			case 0x0026:	/* FIXME: Unknown register */
-			case 0x0027:	/* FIXME: Unknown register */
-			case 0x0028:	/* FIXME: Unknown register */
-			case 0x0029:	/* FIXME: Unknown register */
-			case 0x002A:	/* FIXME: Unknown register */
-			case 0x002B:	/* FIXME: Unknown register */
-			case 0x002C:	/* FIXME: Unknown register */
-			case 0x002D:	/* FIXME: Unknown register */
-			case 0x002E:	/* FIXME: Unknown register */
-			case 0x002F:	/* FIXME: Unknown register */
-			case 0x0030:	/* FIXME: Unknown register */
-			case 0x0031:	/* FIXME: Unknown register */
-			case 0x0032:	/* FIXME: Unknown register */
-			case 0x0033:	/* FIXME: Unknown register */
-			case 0x0034:	/* FIXME: Unknown register */
-			case 0x0035:	/* FIXME: Unknown register */
-			case 0x0036:	/* FIXME: Unknown register */
-			case 0x0037:	/* FIXME: Unknown register */
-			case 0x0038:	/* FIXME: Unknown register */
-			case 0x0039:	/* FIXME: Unknown register */
-			case 0x003A:	/* FIXME: Unknown register */
-			case 0x003B:	/* FIXME: Unknown register */
-				device->unknown_registers[GRF_UNKNOWN_REGISTER_INDEX(key)] = value;
-				break;
-			case 0x0064:	/* FIXME: Unknown */
-				device->unknown_64 = value;
-				break;
-			default:
-				grf_logging_dbg("    UNKNOWN KEY:  key = %u    value = %u", key, value);
-				break;
-		}
+	return op_begin(op);
+}
+
+int grf_comm_start_lease_device(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid)
+{
+	assert(op);
+	assert(grf_radio_is_valid(radio));
+	assert(deviceid);
+
+	op_init(op, radio, GRF_COMM_OP_LEASE_DEVICE);
+	op->id = deviceid;
+
+	return op_begin(op);
+}
+
+int grf_comm_start_release_device(struct grf_comm_op *op, struct grf_radio *radio)
+{
+	assert(op);
+	assert(grf_radio_is_valid(radio));
+
+	op_init(op, radio, GRF_COMM_OP_RELEASE_DEVICE);
+
+	/* Nothing to do without a leased device */
+	if (!radio->session->lease)
+	{
+		op->result = 0;
+		return 0;
 	}
 
-	return 0;
+	return op_begin(op);
+}
+
+int grf_comm_start_switch_signal(struct grf_comm_op *op, struct grf_radio *radio, const char *deviceid, bool on)
+{
+	assert(op);
+	assert(grf_radio_is_valid(radio));
+	assert(deviceid);
+
+	op_init(op, radio, GRF_COMM_OP_SWITCH_SIGNAL);
+	op->id = deviceid;
+	op->on = on;
+
+	return op_begin(op);
 }
 /*---------------------------------------------------------------------------*/
 
@@ -535,150 +1278,168 @@ int grf_comm_init(struct grf_radio *radio)
 {
 	assert(grf_radio_is_valid(radio));
 
-	/* Write the initialization sequence and get firmware version:
-	 *    <NUL><STX>01TESTA1<ETX>   -->
-	 *                              <-- <ACK>
-	 *    <STX>SV<ETX>              -->
-	 *                              <-- Version string
-	 */
-	RETURN_ON_ERROR(send_init_sequence(radio));
-	RETURN_ON_ERROR(send_request_firmware_version(radio));
+	struct grf_comm_op op;
 
-	return 0;
+	RETURN_ON_ERROR(grf_comm_start_init(&op, radio));
+
+	return op_run(&op);
+}
+
+int grf_comm_keepalive(struct grf_radio *radio)
+{
+	assert(grf_radio_is_valid(radio));
+
+	struct grf_comm_op op;
+
+	RETURN_ON_ERROR(grf_comm_start_keepalive(&op, radio));
+
+	return op_run(&op);
+}
+
+int grf_comm_get_session_idle(const struct grf_radio *radio, struct timespec *last_activity)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(radio->session);
+	assert(last_activity);
+
+	*last_activity = radio->session->last_activity;
+
+	return radio->session->idle;
 }
-/*---------------------------------------------------------------------------*/
 
-/*---------------------------------------------------------------------------*/
 int grf_comm_scan_groups(struct grf_radio *radio, char **groups)
 {
 	assert(grf_radio_is_valid(radio));
 	assert(groups);
 
-	/* Write the initialization sequence and get firmware version:
-	 *    <NUL><STX>01TESTA1<ETX>   -->
-	 *                              <-- <ACK>
-	 *    <STX>GA<ETX>              -->
-	 *                              <-- Group IDs
-	 */
-	RETURN_ON_ERROR(send_init_sequence(radio));
-	RETURN_ON_ERROR(send_request_groups(radio, groups));
+	struct grf_comm_op op;
 
-	return 0;
+	RETURN_ON_ERROR(grf_comm_start_scan_groups(&op, radio, groups));
+
+	return op_run(&op);
 }
-/*---------------------------------------------------------------------------*/
 
-/*---------------------------------------------------------------------------*/
 int grf_comm_scan_devices(struct grf_radio *radio, const char *group, struct grf_devicelist *devices)
 {
 	assert(grf_radio_is_valid(radio));
 	assert(group);
 	assert(devices);
 
-	/* Initialize the device list */
-	devices->len = 0;
+	struct grf_comm_op op;
 
-	/* Write the initialization sequence and get firmware version:
-	 *    <NUL><STX>01TESTA1<ETX>   -->
-	 *                              <-- <ACK>
-	 *    <STX>GD:$GROUPID<ETX>     -->
-	 *                              <-- Device IDs
-	 */
-	RETURN_ON_ERROR(send_init_sequence(radio));
-	RETURN_ON_ERROR(send_request_devices(radio, group, devices));
+	RETURN_ON_ERROR(grf_comm_start_scan_devices(&op, radio, group, devices));
 
-	return 0;
+	return op_run(&op);
+}
+
+int grf_comm_stream_devices(struct grf_radio *radio, const char *group, grf_comm_id_cb callback, void *userdata)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(group);
+	assert(callback);
+
+	struct grf_comm_op op;
+
+	RETURN_ON_ERROR(grf_comm_start_stream_devices(&op, radio, group, callback, userdata));
+
+	return op_run(&op);
 }
-/*---------------------------------------------------------------------------*/
 
-/*---------------------------------------------------------------------------*/
 int grf_comm_read_data(struct grf_radio *radio, const char *deviceid, struct grf_device *device)
 {
 	assert(grf_radio_is_valid(radio));
 	assert(deviceid);
 	assert(device);
 
-	/* Variable declaration */
-	int retval;
+	struct grf_comm_op op;
 
-	/* Initialize the device data */
-	device->id = strdup(deviceid);
-	if (!device->id)
-		return ENOMEM;
+	RETURN_ON_ERROR(grf_comm_start_read_data(&op, radio, deviceid, device));
 
-	/* Write the initialization sequence and receive acquired data:
-	 *    <NUL><STX>01TESTA1<ETX>   -->
-	 *                              <-- <ACK>
-	 *    <STX>DA:$DEVICEID:05<ETX> -->
-	 *                              <-- <ACK>
-	 *                              <-- <STX>Done<ETX>
-	 *  in case we receive a TIMEOUT we need to start the diagnosis mode first:
-	 *    <STX>SD:$DEVICEID<ETX>    -->
-	 *                              <-- <ACK>
-	 *                              <-- <STX>REC<ETX>
-	 *                              <-- <STX>Done<ETX>
-	 *  end
-	 *    <STX>DA:$DEVICEID:01<ETX> -->
-	 *                              <-- <ACK>
-	 *                              <-- DATA
-	 *    <STX>DA:$DEVICEID:04<ETX> -->
-	 *                              <-- <ACK>
-	 *                              <-- <STX>Done<ETX>
-	 */
-	RETURN_ON_ERROR(send_init_sequence(radio));
-	retval = send_data_request(radio, deviceid, GRF_DA_TYPE_START);
-	if (retval == ETIMEDOUT)
-		retval = send_start_diagnosis(radio, deviceid);
-	RETURN_ON_ERROR(retval);
-	RETURN_ON_ERROR(send_data_request(radio, deviceid, GRF_DA_TYPE_SEND));
-	RETURN_ON_ERROR(recv_data(radio, device));
-	RETURN_ON_ERROR(send_data_request(radio, deviceid, GRF_DA_TYPE_STOP));
+	return op_run(&op);
+}
 
-	return 0;
+int grf_comm_read_data_cached(struct grf_radio *radio, const char *deviceid, int max_age, struct grf_device *device)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(deviceid);
+	assert(device);
+
+	struct grf_comm_op op;
+
+	RETURN_ON_ERROR(grf_comm_start_read_data_cached(&op, radio, deviceid, max_age, device));
+
+	return op_run(&op);
+}
+
+bool grf_comm_get_cached(struct grf_radio *radio, const char *deviceid, int max_age, struct grf_device *device)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(radio->session);
+	assert(deviceid);
+	assert(device);
+
+	return cache_lookup(radio, deviceid, max_age, device);
+}
+
+int grf_comm_read_registers(struct grf_radio *radio, const char *deviceid, const struct grf_register_mask *mask,
+                            struct grf_device *device, grf_comm_register_cb callback, void *userdata)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(deviceid);
+	assert(mask);
+	assert(device);
+
+	struct grf_comm_op op;
+
+	RETURN_ON_ERROR(grf_comm_start_read_registers(&op, radio, deviceid, mask, device, callback, userdata));
+
+	return op_run(&op);
+}
+
+int grf_comm_read_group(struct grf_radio *radio, struct grf_devicelist *devices, grf_comm_device_cb callback, void *userdata)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(devices);
+
+	struct grf_comm_op op;
+
+	RETURN_ON_ERROR(grf_comm_start_read_group(&op, radio, devices, callback, userdata));
+
+	return op_run(&op);
+}
+
+int grf_comm_lease_device(struct grf_radio *radio, const char *deviceid)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(deviceid);
+
+	struct grf_comm_op op;
+
+	RETURN_ON_ERROR(grf_comm_start_lease_device(&op, radio, deviceid));
+
+	return op_run(&op);
+}
+
+int grf_comm_release_device(struct grf_radio *radio)
+{
+	assert(grf_radio_is_valid(radio));
+
+	struct grf_comm_op op;
+
+	RETURN_ON_ERROR(grf_comm_start_release_device(&op, radio));
+
+	return op_run(&op);
 }
-/*---------------------------------------------------------------------------*/
 
-/*---------------------------------------------------------------------------*/
 int grf_comm_switch_signal(struct grf_radio *radio, const char *deviceid, bool on)
 {
 	assert(grf_radio_is_valid(radio));
 	assert(deviceid);
 
-	/* Variable declaration */
-	int retval;
+	struct grf_comm_op op;
 
-	/* Write the initialization sequence and switch the signal on or off:
-	 *    <NUL><STX>01TESTA1<ETX>   -->
-	 *                              <-- <ACK>
-	 *    <STX>DA:$DEVICEID:05<ETX> -->
-	 *                              <-- <ACK>
-	 *                              <-- <STX>Done<ETX>
-	 *  in case we receive a TIMEOUT we need to start the diagnosis mode first:
-	 *    <STX>SD:$DEVICEID<ETX>    -->
-	 *                              <-- <ACK>
-	 *                              <-- <STX>REC<ETX>
-	 *                              <-- <STX>Done<ETX>
-	 *  end
-	 *  in case we want to switch the signal on:
-	 *    <STX>DA:$DEVICEID:03<ETX> -->
-	 *                              <-- <ACK>
-	 *                              <-- DATA
-	 *  in case we want to switch the signal off:
-	 *    <STX>DA:$DEVICEID:06<ETX> -->
-	 *                              <-- <ACK>
-	 *                              <-- DATA
-	 *  end
-	 *    <STX>DA:$DEVICEID:04<ETX> -->
-	 *                              <-- <ACK>
-	 *                              <-- <STX>Done<ETX>
-	 */
-	RETURN_ON_ERROR(send_init_sequence(radio));
-	retval = send_data_request(radio, deviceid, GRF_DA_TYPE_START);
-	if (retval == ETIMEDOUT)
-		retval = send_start_diagnosis(radio, deviceid);
-	RETURN_ON_ERROR(retval);
-	RETURN_ON_ERROR(send_data_request(radio, deviceid, on ? GRF_DA_TYPE_SIGNAL_ON : GRF_DA_TYPE_SIGNAL_OFF));
-	RETURN_ON_ERROR(send_data_request(radio, deviceid, GRF_DA_TYPE_STOP));
+	RETURN_ON_ERROR(grf_comm_start_switch_signal(&op, radio, deviceid, on));
 
-	return 0;
+	return op_run(&op);
 }
 /*---------------------------------------------------------------------------*/
@@ -0,0 +1,104 @@
+/*
+ * Device list
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include "grf.h"
+
+#define GRF_DEVICELIST_INITIAL_SIZE 16
+
+/*---------------------------------------------------------------------------*/
+void grf_devicelist_init(struct grf_devicelist *devices)
+{
+	assert(devices);
+
+	memset(devices, 0, sizeof(struct grf_devicelist));
+}
+
+void grf_devicelist_free(struct grf_devicelist *devices)
+{
+	assert(devices);
+
+	free(devices->ids);
+	free(devices->records);
+	grf_devicelist_init(devices);
+}
+
+int grf_devicelist_add(struct grf_devicelist *devices, const char *id)
+{
+	assert(devices);
+	assert(id);
+
+	char   (*ids)[GRF_DEVICEID_LEN + 1];
+	size_t   size;
+
+	if (strlen(id) != GRF_DEVICEID_LEN)
+		return EINVAL;
+
+	/* Double the capacity when running out of room */
+	if (devices->len >= devices->size)
+	{
+		size = devices->size ? 2 * devices->size : GRF_DEVICELIST_INITIAL_SIZE;
+		ids  = realloc(devices->ids, size * sizeof(*ids));
+		if (!ids)
+			return ENOMEM;
+		devices->ids  = ids;
+		devices->size = size;
+	}
+	memcpy(devices->ids[devices->len], id, GRF_DEVICEID_LEN + 1);
+	devices->len++;
+
+	return 0;
+}
+
+int grf_devicelist_alloc_records(struct grf_devicelist *devices)
+{
+	assert(devices);
+
+	size_t i;
+
+	free(devices->records);
+	devices->records = NULL;
+	if (devices->len < 1)
+		return 0;
+
+	devices->records = calloc(devices->len, sizeof(struct grf_device));
+	if (!devices->records)
+		return ENOMEM;
+
+	/* Set the update time to invalid (-1) to mark that the
+	 * devices were not yet updated.
+	 */
+	for (i = 0; i < devices->len; i++)
+	{
+		memcpy(devices->records[i].id, devices->ids[i], GRF_DEVICEID_LEN + 1);
+		devices->records[i].timestamp = -1;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,436 @@
+/*
+ * Multi-radio fleet runner
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+
+#include "grf.h"
+#include "grf_fleet.h"
+#include "grf_logging.h"
+
+/*---------------------------------------------------------------------------*/
+static uint32_t fleet_mask(const struct grf_fleet *fleet)
+{
+	return (fleet->nradios >= 32) ? UINT32_MAX : ((uint32_t)1 << fleet->nradios) - 1;
+}
+
+static bool devicelist_contains(const struct grf_devicelist *devices, const char *id)
+{
+	size_t i;
+
+	for (i = 0; i < devices->len; i++)
+	{
+		if (strcmp(devices->ids[i], id) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static void queue_push(struct grf_fleet_radio *fr, struct grf_fleet_task *task)
+{
+	task->next = NULL;
+	if (fr->tail)
+		fr->tail->next = task;
+	else
+		fr->head = task;
+	fr->tail = task;
+	fr->queued++;
+}
+
+static void queue_remove(struct grf_fleet_radio *fr, struct grf_fleet_task *prev, struct grf_fleet_task *task)
+{
+	if (prev)
+		prev->next = task->next;
+	else
+		fr->head = task->next;
+	if (fr->tail == task)
+		fr->tail = prev;
+	task->next = NULL;
+	fr->queued--;
+}
+
+static int fleet_add(struct grf_fleet *fleet, const char *id, uint32_t radios)
+{
+	struct grf_fleet_task *task;
+	size_t                 best = fleet->nradios;
+	size_t                 i;
+
+	/* Queue the device at the reaching radio with the least work */
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		if ((radios & ((uint32_t)1 << i)) &&
+		    (best >= fleet->nradios || fleet->radios[i].queued < fleet->radios[best].queued))
+			best = i;
+	}
+	if (best >= fleet->nradios)
+		return EINVAL;
+
+	task = calloc(1, sizeof(struct grf_fleet_task));
+	if (!task)
+		return ENOMEM;
+	memcpy(task->device.id, id, GRF_DEVICEID_LEN + 1);
+	task->radios = radios;
+	queue_push(&fleet->radios[best], task);
+
+	return 0;
+}
+
+static struct grf_fleet_task *fleet_next(struct grf_fleet *fleet, size_t index)
+{
+	struct grf_fleet_radio *fr = &fleet->radios[index];
+	struct grf_fleet_radio *victim = NULL;
+	struct grf_fleet_task  *task;
+	struct grf_fleet_task  *prev;
+	struct grf_fleet_task  *steal = NULL;
+	struct grf_fleet_task  *steal_prev = NULL;
+	struct grf_fleet_task  *found;
+	struct grf_fleet_task  *found_prev;
+	size_t                  i;
+
+	if (fr->head)
+	{
+		task = fr->head;
+		queue_remove(fr, NULL, task);
+		return task;
+	}
+
+	/* Take over the last device we reach from the radio with the most work left */
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		if (i == index || fleet->radios[i].queued <= (victim ? victim->queued : 0))
+			continue;
+		found      = NULL;
+		found_prev = NULL;
+		for (prev = NULL, task = fleet->radios[i].head; task; prev = task, task = task->next)
+		{
+			if (task->radios & ((uint32_t)1 << index))
+			{
+				found      = task;
+				found_prev = prev;
+			}
+		}
+		if (found)
+		{
+			victim     = &fleet->radios[i];
+			steal      = found;
+			steal_prev = found_prev;
+		}
+	}
+	if (!victim)
+		return NULL;
+
+	grf_logging_dbg("Radio %s takes over device %s from radio %s", fr->radio->dev, steal->device.id, victim->radio->dev);
+	queue_remove(victim, steal_prev, steal);
+	fr->taken++;
+
+	return steal;
+}
+
+static bool fleet_busy(const struct grf_fleet *fleet)
+{
+	size_t i;
+
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		if (fleet->radios[i].busy)
+			return true;
+	}
+
+	return false;
+}
+
+static int fleet_report(struct grf_fleet_radio *fr, int result, grf_comm_device_cb callback, void *userdata)
+{
+	struct grf_fleet_task *task = fr->task;
+	int                    retval;
+
+	fr->busy = false;
+	fr->task = NULL;
+	if (result)
+		grf_logging_warn("Reading device %s with radio %s failed: %s", task->device.id, fr->radio->dev, strerror(result));
+	else
+		fr->read++;
+	retval = callback(&task->device, result, userdata);
+	free(task);
+
+	return retval;
+}
+
+static int fleet_poll(struct grf_fleet *fleet)
+{
+	struct pollfd pfds[GRF_FLEET_MAX_RADIOS];
+	int           timeout = -1;
+	int           t;
+	size_t        i;
+
+	/* Wait for the first radio to answer or to run into a timeout */
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		pfds[i].fd     = -1;
+		pfds[i].events = POLLIN;
+		if (!fleet->radios[i].busy)
+			continue;
+		pfds[i].fd = grf_comm_op_get_pollfd(&fleet->radios[i].op);
+		t = grf_comm_op_get_timeout(&fleet->radios[i].op);
+		if (t >= 0 && (timeout < 0 || t < timeout))
+			timeout = t;
+	}
+	if (poll(pfds, fleet->nradios, timeout) < 0 && errno != EINTR)
+		return errno;
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+void grf_fleet_init(struct grf_fleet *fleet)
+{
+	assert(fleet);
+
+	memset(fleet, 0, sizeof(struct grf_fleet));
+}
+
+void grf_fleet_free(struct grf_fleet *fleet)
+{
+	assert(fleet);
+
+	struct grf_fleet_radio *fr;
+	struct grf_fleet_task  *task;
+	size_t                  i;
+
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		fr = &fleet->radios[i];
+		while ((task = fr->head))
+		{
+			queue_remove(fr, NULL, task);
+			free(task);
+		}
+		grf_devicelist_free(&fr->found);
+	}
+}
+
+int grf_fleet_add_radio(struct grf_fleet *fleet, struct grf_radio *radio)
+{
+	assert(fleet);
+	assert(grf_radio_is_valid(radio));
+
+	struct grf_fleet_radio *fr;
+
+	if (fleet->nradios >= GRF_FLEET_MAX_RADIOS)
+		return ENOSPC;
+
+	fr = &fleet->radios[fleet->nradios++];
+	memset(fr, 0, sizeof(struct grf_fleet_radio));
+	fr->radio = radio;
+	grf_devicelist_init(&fr->found);
+
+	return 0;
+}
+
+int grf_fleet_add_devices(struct grf_fleet *fleet, const struct grf_devicelist *devices, uint32_t radios)
+{
+	assert(fleet);
+	assert(devices);
+
+	size_t i;
+
+	radios &= fleet_mask(fleet);
+	if (!radios)
+		return EINVAL;
+	for (i = 0; i < devices->len; i++)
+		RETURN_ON_ERROR(fleet_add(fleet, devices->ids[i], radios));
+
+	return 0;
+}
+
+int grf_fleet_scan_group(struct grf_fleet *fleet, const char *group, size_t *count)
+{
+	assert(fleet);
+	assert(group);
+	assert(count);
+
+	struct grf_fleet_radio *fr;
+	const char             *id;
+	uint32_t                radios;
+	uint32_t                scanned = 0;
+	int                     first = ENODEV;
+	int                     retval;
+	size_t                  i;
+	size_t                  j;
+	size_t                  k;
+
+	/* Scan the group with all radios at once */
+	*count = 0;
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		fr = &fleet->radios[i];
+		grf_devicelist_free(&fr->found);
+		grf_devicelist_init(&fr->found);
+		retval = grf_comm_start_scan_devices(&fr->op, fr->radio, group, &fr->found);
+		if (!retval)
+			retval = fr->op.result;
+		fr->busy = (retval == EINPROGRESS);
+		if (!retval)
+			scanned |= (uint32_t)1 << i;
+		else if (retval != EINPROGRESS && first == ENODEV)
+			first = retval;
+	}
+	while (fleet_busy(fleet))
+	{
+		retval = fleet_poll(fleet);
+		if (retval)
+			return retval;
+		for (i = 0; i < fleet->nradios; i++)
+		{
+			fr = &fleet->radios[i];
+			if (!fr->busy)
+				continue;
+			retval = grf_comm_step(&fr->op);
+			if (retval == EINPROGRESS)
+				continue;
+			fr->busy = false;
+			if (!retval)
+				scanned |= (uint32_t)1 << i;
+			else
+			{
+				grf_logging_warn("Scanning group %s with radio %s failed: %s", group, fr->radio->dev, strerror(retval));
+				if (first == ENODEV)
+					first = retval;
+			}
+		}
+	}
+	if (!scanned)
+		return first;
+
+	/* Pin each device to all radios that found it */
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		for (j = 0; j < fleet->radios[i].found.len; j++)
+		{
+			id = fleet->radios[i].found.ids[j];
+			for (k = 0; k < i && !devicelist_contains(&fleet->radios[k].found, id); k++);
+			if (k < i)
+				continue;
+			radios = (uint32_t)1 << i;
+			for (k = i + 1; k < fleet->nradios; k++)
+			{
+				if (devicelist_contains(&fleet->radios[k].found, id))
+					radios |= (uint32_t)1 << k;
+			}
+			RETURN_ON_ERROR(fleet_add(fleet, id, radios));
+			(*count)++;
+		}
+	}
+
+	return 0;
+}
+
+int grf_fleet_run(struct grf_fleet *fleet, grf_comm_device_cb callback, void *userdata)
+{
+	assert(fleet);
+	assert(callback);
+
+	struct grf_fleet_radio *fr;
+	struct grf_fleet_task  *task;
+	bool                    stop = false;
+	int                     result = 0;
+	int                     retval;
+	size_t                  i;
+
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		fleet->radios[i].read  = 0;
+		fleet->radios[i].taken = 0;
+	}
+	while (true)
+	{
+		/* Keep every radio busy as long as there are devices it reaches */
+		for (i = 0; i < fleet->nradios; i++)
+		{
+			fr = &fleet->radios[i];
+			while (!stop && !fr->busy && (fr->task = fleet_next(fleet, i)))
+			{
+				fr->busy = true;
+				retval = grf_comm_start_read_data(&fr->op, fr->radio, fr->task->device.id, &fr->task->device);
+				if (!retval)
+					break;
+				retval = fleet_report(fr, retval, callback, userdata);
+				if (retval)
+				{
+					stop   = true;
+					result = (retval == GRF_COMM_STOP) ? 0 : retval;
+				}
+			}
+		}
+		if (!fleet_busy(fleet))
+			break;
+
+		retval = fleet_poll(fleet);
+		if (retval)
+		{
+			result = retval;
+			break;
+		}
+
+		/* Report the devices finished, the ones still read are finished even when stopping */
+		for (i = 0; i < fleet->nradios; i++)
+		{
+			fr = &fleet->radios[i];
+			if (!fr->busy)
+				continue;
+			retval = grf_comm_step(&fr->op);
+			if (retval == EINPROGRESS)
+				continue;
+			retval = fleet_report(fr, retval, callback, userdata);
+			if (retval && !stop)
+			{
+				stop   = true;
+				result = (retval == GRF_COMM_STOP) ? 0 : retval;
+			}
+		}
+	}
+
+	/* Drop the devices left after stopping */
+	for (i = 0; i < fleet->nradios; i++)
+	{
+		fr = &fleet->radios[i];
+		grf_logging_info("Radio %s read %zu devices, %zu of them taken over from other radios", fr->radio->dev, fr->read, fr->taken);
+		free(fr->task);
+		fr->task = NULL;
+		fr->busy = false;
+		while ((task = fr->head))
+		{
+			queue_remove(fr, NULL, task);
+			free(task);
+		}
+	}
+
+	return result;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,138 @@
+/*
+ * Multi-radio fleet runner include file
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \ingroup comm
+ *  \file grf_fleet.h
+ *  \brief Runner reading the devices of large sites with several radios at once
+ *
+ * This file defines a fleet of radios reading smoke detector devices in
+ * parallel. Each device is pinned to the radios that can reach it, usually
+ * the radios that found it when scanning its group, and queued at the one
+ * with the least devices waiting. A radio running out of work takes over
+ * devices still waiting at the radio with the most devices left, as long as
+ * it can reach them. The time to read a site thus shrinks with every radio
+ * added as long as the radios reach the same devices.
+ *
+ * All radios are driven by non-blocking operations from the calling thread.
+ *
+ * @{
+ */
+
+#ifndef __GRF_FLEET_H__
+#define __GRF_FLEET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "grf.h"
+
+#define GRF_FLEET_MAX_RADIOS        32		/*!< Maximum number of radios of a fleet */
+#define GRF_FLEET_ALL_RADIOS        UINT32_MAX	/*!< Mask selecting all radios of a fleet */
+
+/*! Data structure representing a device waiting for or being read */
+struct grf_fleet_task
+{
+	struct grf_device      device;		/*!< Data of the device */
+	uint32_t               radios;		/*!< Mask of the radios reaching the device (bit *n* for radio *n*) */
+	struct grf_fleet_task *next;		/*!< Next device waiting at the same radio */
+};
+
+/*! Data structure representing a radio of a fleet */
+struct grf_fleet_radio
+{
+	struct grf_radio      *radio;		/*!< Radio initialized by \ref grf_comm_init() */
+	struct grf_comm_op     op;			/*!< Operation running on the radio */
+	bool                   busy;		/*!< Status flag if *op* is running */
+	struct grf_fleet_task *task;		/*!< Device currently read (NULL if none) */
+	struct grf_fleet_task *head;		/*!< First device waiting */
+	struct grf_fleet_task *tail;		/*!< Last device waiting */
+	size_t                 queued;		/*!< Number of devices waiting */
+	size_t                 read;		/*!< Number of devices read by the radio in the last run */
+	size_t                 taken;		/*!< Number of devices taken over from other radios in the last run */
+	struct grf_devicelist  found;		/*!< Devices found by the last group scan */
+};
+
+/*! Data structure representing a fleet of radios */
+struct grf_fleet
+{
+	struct grf_fleet_radio radios[GRF_FLEET_MAX_RADIOS];	/*!< Radios of the fleet */
+	size_t                 nradios;		/*!< Number of radios of the fleet */
+};
+
+/*! \brief Initialize an empty fleet.
+ *
+ *  \param fleet	fleet to initialize
+ */
+void grf_fleet_init(struct grf_fleet *fleet);
+
+/*! \brief Free all devices still waiting in a fleet.
+ *
+ *  The radios are not closed.
+ *
+ *  \param fleet	fleet initialized by \ref grf_fleet_init()
+ */
+void grf_fleet_free(struct grf_fleet *fleet);
+
+/*! \brief Add a radio to a fleet.
+ *
+ *  \param fleet	fleet initialized by \ref grf_fleet_init()
+ *  \param radio	radio initialized by \ref grf_comm_init(), it must stay valid as long as the fleet is used
+ *  \returns		0 on success and `ENOSPC` if the fleet already holds \ref GRF_FLEET_MAX_RADIOS radios
+ */
+int grf_fleet_add_radio(struct grf_fleet *fleet, struct grf_radio *radio);
+
+/*! \brief Queue devices to read at the given radios.
+ *
+ *  \param fleet	fleet initialized by \ref grf_fleet_init()
+ *  \param devices	list of devices to read
+ *  \param radios	mask of the radios reaching the devices (bit *n* for radio *n*, \ref GRF_FLEET_ALL_RADIOS for any)
+ *  \returns		0 on success, `EINVAL` if the mask selects no radio of the fleet and `ENOMEM` if out of memory
+ */
+int grf_fleet_add_devices(struct grf_fleet *fleet, const struct grf_devicelist *devices, uint32_t radios);
+
+/*! \brief Scan a group with all radios at once and queue the devices found.
+ *
+ *  Each device is pinned to the radios that found it. A radio failing to
+ *  scan the group is assumed to not reach it.
+ *
+ *  \param fleet	fleet initialized by \ref grf_fleet_init()
+ *  \param group	4-character ID of the group to scan
+ *  \param count	storage for the number of distinct devices queued
+ *  \returns		0 if at least one radio scanned the group and the error of the first radio otherwise
+ */
+int grf_fleet_scan_group(struct grf_fleet *fleet, const char *group, size_t *count);
+
+/*! \brief Read all queued devices.
+ *
+ *  The function blocks until all devices are read or the callback returns
+ *  non-zero. Devices still waiting at that point are dropped, devices
+ *  currently read are finished and reported.
+ *
+ *  \param fleet	fleet initialized by \ref grf_fleet_init()
+ *  \param callback	callback reporting each device read, \ref GRF_COMM_STOP stops without error
+ *  \param userdata	user data passed to *callback*
+ *  \returns		0 on success and the error returned by the callback or the system otherwise
+ */
+int grf_fleet_run(struct grf_fleet *fleet, grf_comm_device_cb callback, void *userdata);
+
+#endif /* __GRF_FLEET_H__ */
+/* @} */
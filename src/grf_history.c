@@ -0,0 +1,1145 @@
+/*
+ * Reading history
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "grf.h"
+#include "grf_history.h"
+#include "grf_registers.h"
+#include "grf_idmap.h"
+#include "grf_logging.h"
+
+#define HISTORY_MAGIC           "GRFHIST1"	/* Magic number at the start of the file */
+#define HISTORY_INDEX_MAGIC     "GRFHIDX1"	/* Magic number at the start of the footer */
+#define HISTORY_MAGIC_LEN       8
+#define HISTORY_VERSION         2		/* Version 1 files lack the group records and are upgraded by writers */
+
+#define HISTORY_HEADER_SIZE     16		/* magic, version (u32), reserved (u32) */
+#define HISTORY_FOOTER_SIZE     40		/* magic, index offset (u64), number of chunks (u64), number of readings (u64), number of groups (u64) */
+#define HISTORY_FOOTER_SIZE_V1  32		/* footer of version 1 files lacking the number of groups */
+#define HISTORY_ENTRY_SIZE      36		/* device (u16), count (u16), oldest (i64), newest (i64), first (u64), last (u64) */
+#define HISTORY_GROUP_SIZE      10		/* group (u16), offset (u64) */
+
+#define RECORD_KEYFRAME         1		/* Record holding all registers */
+#define RECORD_DELTA            2		/* Record holding the registers changed since the previous record of the device */
+#define RECORD_GROUP            3		/* Record holding the devices of a group */
+
+#define RECORD_HEADER_SIZE      3		/* kind (u8), device (u16) followed by the varint length of the body */
+#define RECORD_MAXSIZE          (RECORD_HEADER_SIZE + (GRF_HISTORY_REGISTERS + 4) * VARINT_MAXSIZE)
+#define VARINT_MAXSIZE          10
+
+/* Writer state of the current chunk of a device */
+struct history_device
+{
+	uint32_t     values[GRF_HISTORY_REGISTERS];	/* Registers of the previous record */
+	int64_t      timestamp;		/* Timestamp of the previous record */
+	uint64_t     offset;		/* File offset of the previous record */
+	size_t       chunk;			/* Index of the current chunk + 1 or 0 if there is none */
+};
+
+/* Record parsed from the file */
+struct history_record
+{
+	int          kind;			/* Kind of the record (RECORD_*) */
+	uint16_t     device;		/* Numeric device ID */
+	uint64_t     back;			/* Distance to the previous record of the device (0 for keyframes) */
+	int64_t      timestamp;		/* Timestamp, relative to the previous record for deltas */
+	const unsigned char *data;	/* Encoded registers */
+	const unsigned char *end;	/* End of the record */
+};
+
+/*---------------------------------------------------------------------------*/
+static void put_le(unsigned char *buf, uint64_t value, size_t bytes)
+{
+	size_t i;
+
+	for (i = 0; i < bytes; i++)
+		buf[i] = value >> (8 * i);
+}
+
+static uint64_t get_le(const unsigned char *buf, size_t bytes)
+{
+	uint64_t value = 0;
+	size_t   i;
+
+	for (i = 0; i < bytes; i++)
+		value |= (uint64_t)buf[i] << (8 * i);
+
+	return value;
+}
+
+static size_t put_varint(unsigned char *buf, uint64_t value)
+{
+	size_t len = 0;
+
+	/* 7 bits per byte, the high bit marks a following byte */
+	while (value >= 0x80)
+	{
+		buf[len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = value;
+
+	return len;
+}
+
+static bool get_varint(const unsigned char **pos, const unsigned char *end, uint64_t *value)
+{
+	unsigned int shift = 0;
+
+	*value = 0;
+	while (*pos < end && shift < 64)
+	{
+		*value |= (uint64_t)(**pos & 0x7f) << shift;
+		if (!(*(*pos)++ & 0x80))
+			return true;
+		shift += 7;
+	}
+
+	return false;
+}
+
+static inline uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static void keys_init(struct grf_history *hist)
+{
+	struct grf_device device;
+	uint32_t          value;
+	size_t            n = 0;
+	uint16_t          key;
+
+	/* Store every register known to the register table */
+	memset(&device, 0, sizeof(struct grf_device));
+	for (key = 0; key <= GRF_REGISTER_KEY_MAX && n < GRF_HISTORY_REGISTERS; key++)
+	{
+		if (grf_register_get(&device, key, &value) == 0)
+			hist->keys[n++] = key;
+	}
+	assert(n == GRF_HISTORY_REGISTERS);
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static bool record_parse(const unsigned char *map, uint64_t end, uint64_t offset, struct history_record *rec)
+{
+	const unsigned char *pos;
+	uint64_t             len;
+	uint64_t             value;
+
+	if (offset + RECORD_HEADER_SIZE >= end)
+		return false;
+	pos         = map + offset;
+	rec->kind   = pos[0];
+	rec->device = get_le(pos + 1, 2);
+	if (rec->kind != RECORD_KEYFRAME && rec->kind != RECORD_DELTA && rec->kind != RECORD_GROUP)
+		return false;
+	pos += RECORD_HEADER_SIZE;
+	if (!get_varint(&pos, map + end, &len) || len > (uint64_t)(map + end - pos))
+		return false;
+	rec->end = pos + len;
+
+	if (!get_varint(&pos, rec->end, &rec->back) || !get_varint(&pos, rec->end, &value))
+		return false;
+	if ((rec->kind == RECORD_DELTA) == (rec->back == 0) || rec->back > offset)
+		return false;
+	rec->timestamp = unzigzag(value);
+	rec->data      = pos;
+
+	return true;
+}
+
+static bool record_decode(const struct history_record *rec, uint32_t *values)
+{
+	const unsigned char *pos = rec->data;
+	uint64_t             mask;
+	uint64_t             value;
+	size_t               i;
+
+	/* Keyframes hold all registers, deltas the changed ones XOR'ed */
+	if (rec->kind == RECORD_KEYFRAME)
+		mask = (1ull << GRF_HISTORY_REGISTERS) - 1;
+	else if (!get_varint(&pos, rec->end, &mask) || mask >> GRF_HISTORY_REGISTERS)
+		return false;
+
+	for (i = 0; i < GRF_HISTORY_REGISTERS; i++)
+	{
+		if (!(mask & (1ull << i)))
+			continue;
+		if (!get_varint(&pos, rec->end, &value) || value > UINT32_MAX)
+			return false;
+		values[i] = (rec->kind == RECORD_KEYFRAME) ? value : values[i] ^ value;
+	}
+
+	return pos == rec->end;
+}
+
+static size_t record_encode(unsigned char *buf, int kind, uint16_t device, uint64_t back, int64_t timestamp,
+                            const uint32_t *previous, const uint32_t *values)
+{
+	unsigned char body[RECORD_MAXSIZE];
+	uint64_t      mask = 0;
+	size_t        len  = 0;
+	size_t        hdr;
+	size_t        i;
+
+	len += put_varint(body + len, back);
+	len += put_varint(body + len, zigzag(timestamp));
+	if (kind == RECORD_DELTA)
+	{
+		for (i = 0; i < GRF_HISTORY_REGISTERS; i++)
+		{
+			if (values[i] != previous[i])
+				mask |= 1ull << i;
+		}
+		len += put_varint(body + len, mask);
+	}
+	for (i = 0; i < GRF_HISTORY_REGISTERS; i++)
+	{
+		if (kind == RECORD_KEYFRAME)
+			len += put_varint(body + len, values[i]);
+		else if (mask & (1ull << i))
+			len += put_varint(body + len, values[i] ^ previous[i]);
+	}
+
+	buf[0] = kind;
+	put_le(buf + 1, device, 2);
+	hdr = RECORD_HEADER_SIZE + put_varint(buf + RECORD_HEADER_SIZE, len);
+	memcpy(buf + hdr, body, len);
+
+	return hdr + len;
+}
+
+static int id_compare(const void *a, const void *b)
+{
+	uint16_t ia = *(const uint16_t *)a;
+	uint16_t ib = *(const uint16_t *)b;
+
+	return (ia > ib) - (ia < ib);
+}
+
+static int group_encode(unsigned char **bufp, size_t *lenp, uint16_t group, int64_t timestamp, const struct grf_devicelist *devices)
+{
+	unsigned char *buf;
+	unsigned char *body;
+	uint16_t      *ids;
+	size_t         count = 0;
+	size_t         len   = 0;
+	size_t         hdr;
+	size_t         i;
+
+	/* The devices are stored sorted as differences to the previous ID, so
+	 * the same devices always give the same record regardless of the order
+	 * they were found in.
+	 */
+	ids = malloc((devices->len ? devices->len : 1) * sizeof(uint16_t));
+	if (!ids)
+		return ENOMEM;
+	for (i = 0; i < devices->len; i++)
+	{
+		if (!grf_idmap_parse(devices->ids[i], &ids[i]))
+		{
+			free(ids);
+			return EINVAL;
+		}
+	}
+	qsort(ids, devices->len, sizeof(uint16_t), id_compare);
+
+	buf = malloc(RECORD_HEADER_SIZE + VARINT_MAXSIZE + (devices->len + 3) * VARINT_MAXSIZE);
+	if (!buf)
+	{
+		free(ids);
+		return ENOMEM;
+	}
+	body = buf + RECORD_HEADER_SIZE + VARINT_MAXSIZE;
+	for (i = 0; i < devices->len; i++)
+	{
+		if (i == 0 || ids[i] != ids[count - 1])
+			ids[count++] = ids[i];
+	}
+	len += put_varint(body + len, 0);
+	len += put_varint(body + len, zigzag(timestamp));
+	len += put_varint(body + len, count);
+	for (i = 0; i < count; i++)
+		len += put_varint(body + len, ids[i] - (i ? ids[i - 1] : 0));
+	free(ids);
+
+	buf[0] = RECORD_GROUP;
+	put_le(buf + 1, group, 2);
+	hdr = RECORD_HEADER_SIZE + put_varint(buf + RECORD_HEADER_SIZE, len);
+	memmove(buf + hdr, body, len);
+	*bufp = buf;
+	*lenp = hdr + len;
+
+	return 0;
+}
+
+static int group_decode(const struct history_record *rec, struct grf_devicelist *devices)
+{
+	const unsigned char *pos = rec->data;
+	uint64_t             count;
+	uint64_t             delta;
+	uint64_t             id = 0;
+	char                 devid[GRF_DEVICEID_LEN + 1];
+	uint64_t             i;
+
+	if (!get_varint(&pos, rec->end, &count) || count > UINT16_MAX + 1)
+		return EINVAL;
+	for (i = 0; i < count; i++)
+	{
+		if (!get_varint(&pos, rec->end, &delta) || (i > 0 && delta == 0) || id + delta > UINT16_MAX)
+			return EINVAL;
+		id += delta;
+		snprintf(devid, sizeof(devid), "%04X", (unsigned int)id);
+		RETURN_ON_ERROR(grf_devicelist_add(devices, devid));
+	}
+
+	return (pos == rec->end) ? 0 : EINVAL;
+}
+
+static int group_read(const struct grf_history *hist, uint16_t group, uint64_t offset, unsigned char **buf, struct history_record *rec)
+{
+	unsigned char        head[RECORD_HEADER_SIZE + VARINT_MAXSIZE];
+	const unsigned char *pos = head + RECORD_HEADER_SIZE;
+	uint64_t             len;
+	ssize_t              count;
+
+	/* Readers have the record in the mapping, writers read it from the file */
+	*buf = NULL;
+	if (hist->map)
+	{
+		if (!record_parse(hist->map, hist->end, offset, rec))
+			return EINVAL;
+	}
+	else
+	{
+		count = pread(hist->fd, head, sizeof(head), offset);
+		if (count < 0)
+			return errno;
+		if (count <= RECORD_HEADER_SIZE || !get_varint(&pos, head + count, &len) || len > hist->end - offset)
+			return EINVAL;
+		len += pos - head;
+		if (offset + len > hist->end)
+			return EINVAL;
+		*buf = malloc(len);
+		if (!*buf)
+			return ENOMEM;
+		if (pread(hist->fd, *buf, len, offset) != (ssize_t)len)
+			return errno ? errno : EIO;
+		if (!record_parse(*buf, len, 0, rec))
+			return EINVAL;
+	}
+
+	return (rec->kind == RECORD_GROUP && rec->device == group) ? 0 : EINVAL;
+}
+
+static struct grf_history_group *group_find(const struct grf_history *hist, uint16_t group, size_t *pos)
+{
+	size_t lo = 0;
+	size_t hi = hist->ngroups;
+	size_t mid;
+
+	/* The groups are kept sorted by their ID */
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (hist->groups[mid].group < group)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (pos)
+		*pos = lo;
+
+	return (lo < hist->ngroups && hist->groups[lo].group == group) ? &hist->groups[lo] : NULL;
+}
+
+static int group_update(struct grf_history *hist, uint16_t group, uint64_t offset)
+{
+	struct grf_history_group *entry;
+	size_t                    size;
+	size_t                    pos;
+
+	entry = group_find(hist, group, &pos);
+	if (!entry)
+	{
+		if (hist->ngroups >= hist->groups_size)
+		{
+			size  = hist->groups_size ? 2 * hist->groups_size : 16;
+			entry = realloc(hist->groups, size * sizeof(struct grf_history_group));
+			if (!entry)
+				return ENOMEM;
+			hist->groups      = entry;
+			hist->groups_size = size;
+		}
+		entry = &hist->groups[pos];
+		memmove(entry + 1, entry, (hist->ngroups - pos) * sizeof(struct grf_history_group));
+		entry->group = group;
+		hist->ngroups++;
+	}
+	entry->offset = offset;
+
+	return 0;
+}
+
+static int groups_load(struct grf_history *hist, const unsigned char *entries)
+{
+	size_t i;
+
+	if (hist->ngroups < 1)
+		return 0;
+	hist->groups = malloc(hist->ngroups * sizeof(struct grf_history_group));
+	if (!hist->groups)
+		return ENOMEM;
+	hist->groups_size = hist->ngroups;
+	for (i = 0; i < hist->ngroups; i++)
+	{
+		hist->groups[i].group  = get_le(entries + i * HISTORY_GROUP_SIZE, 2);
+		hist->groups[i].offset = get_le(entries + i * HISTORY_GROUP_SIZE + 2, 8);
+		if (hist->groups[i].offset >= hist->end || (i > 0 && hist->groups[i].group <= hist->groups[i - 1].group))
+			return EINVAL;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static void chunk_at(const struct grf_history *hist, size_t index, struct grf_history_chunk *chunk)
+{
+	const unsigned char *entry;
+
+	if (!hist->index)
+	{
+		*chunk = hist->chunks[index];
+		return;
+	}
+
+	entry = hist->index + index * HISTORY_ENTRY_SIZE;
+	chunk->device = get_le(entry, 2);
+	chunk->count  = get_le(entry + 2, 2);
+	chunk->oldest = (int64_t)get_le(entry + 4, 8);
+	chunk->newest = (int64_t)get_le(entry + 12, 8);
+	chunk->first  = get_le(entry + 20, 8);
+	chunk->last   = get_le(entry + 28, 8);
+}
+
+static void chunk_put(unsigned char *entry, const struct grf_history_chunk *chunk)
+{
+	put_le(entry, chunk->device, 2);
+	put_le(entry + 2, chunk->count, 2);
+	put_le(entry + 4, (uint64_t)chunk->oldest, 8);
+	put_le(entry + 12, (uint64_t)chunk->newest, 8);
+	put_le(entry + 20, chunk->first, 8);
+	put_le(entry + 28, chunk->last, 8);
+}
+
+static int chunk_compare(const void *a, const void *b)
+{
+	const struct grf_history_chunk *ca = a;
+	const struct grf_history_chunk *cb = b;
+
+	if (ca->device != cb->device)
+		return (ca->device < cb->device) ? -1 : 1;
+	if (ca->oldest != cb->oldest)
+		return (ca->oldest < cb->oldest) ? -1 : 1;
+
+	return (ca->first < cb->first) ? -1 : (ca->first > cb->first);
+}
+
+static int chunk_reserve(struct grf_history *hist)
+{
+	struct grf_history_chunk *chunks;
+	size_t                    size;
+
+	if (hist->nchunks < hist->chunks_size)
+		return 0;
+	size   = hist->chunks_size ? 2 * hist->chunks_size : 64;
+	chunks = realloc(hist->chunks, size * sizeof(struct grf_history_chunk));
+	if (!chunks)
+		return ENOMEM;
+	hist->chunks      = chunks;
+	hist->chunks_size = size;
+
+	return 0;
+}
+
+static struct grf_history_chunk *chunk_start(struct grf_history *hist, uint16_t device, uint64_t offset, int64_t timestamp)
+{
+	struct grf_history_chunk *chunk = &hist->chunks[hist->nchunks++];
+
+	/* Room has to be reserved by chunk_reserve() before */
+	assert(hist->nchunks <= hist->chunks_size);
+	chunk->device = device;
+	chunk->count  = 0;
+	chunk->oldest = timestamp;
+	chunk->newest = timestamp;
+	chunk->first  = offset;
+	chunk->last   = offset;
+
+	return chunk;
+}
+
+static void chunk_extend(struct grf_history_chunk *chunk, uint64_t offset, int64_t timestamp)
+{
+	if (timestamp < chunk->oldest)
+		chunk->oldest = timestamp;
+	if (timestamp > chunk->newest)
+		chunk->newest = timestamp;
+	chunk->last = offset;
+	chunk->count++;
+}
+
+static size_t chunk_walk(const unsigned char *map, uint64_t end, const struct grf_history_chunk *chunk, uint64_t *offsets)
+{
+	struct history_record rec;
+	uint64_t              offset = chunk->last;
+	size_t                n = 0;
+
+	/* Follow the links back from the last record to the keyframe */
+	while (true)
+	{
+		if (n >= chunk->count || n >= GRF_HISTORY_CHUNK_LEN || offset >= end ||
+		    !record_parse(map, end, offset, &rec) || rec.device != chunk->device)
+			return 0;
+		offsets[n++] = offset;
+		if (rec.kind == RECORD_KEYFRAME)
+			break;
+		offset -= rec.back;
+	}
+	if (n != chunk->count || offset != chunk->first)
+		return 0;
+
+	return n;
+}
+
+static bool footer_valid(struct grf_history *hist, const unsigned char *map, size_t size, uint32_t version)
+{
+	const unsigned char *footer;
+	size_t               footer_size = (version < 2) ? HISTORY_FOOTER_SIZE_V1 : HISTORY_FOOTER_SIZE;
+	uint64_t             offset;
+	uint64_t             nchunks;
+	uint64_t             ngroups = 0;
+
+	if (size < HISTORY_HEADER_SIZE + footer_size)
+		return false;
+	footer = map + size - footer_size;
+	if (memcmp(footer, HISTORY_INDEX_MAGIC, HISTORY_MAGIC_LEN) != 0)
+		return false;
+	offset  = get_le(footer + 8, 8);
+	nchunks = get_le(footer + 16, 8);
+	if (version >= 2)
+		ngroups = get_le(footer + 32, 8);
+	if (offset < HISTORY_HEADER_SIZE || offset > size || nchunks > (size - offset) / HISTORY_ENTRY_SIZE ||
+	    ngroups > (size - offset) / HISTORY_GROUP_SIZE ||
+	    offset + nchunks * HISTORY_ENTRY_SIZE + ngroups * HISTORY_GROUP_SIZE + footer_size != size)
+		return false;
+
+	hist->end     = offset;
+	hist->nchunks = nchunks;
+	hist->ngroups = ngroups;
+	hist->records = get_le(footer + 24, 8);
+
+	return true;
+}
+
+static int history_recover(struct grf_history *hist, const unsigned char *map, size_t size)
+{
+	struct history_record     rec;
+	struct history_device    *state;
+	struct grf_idmap          current;
+	uint64_t                  offset = HISTORY_HEADER_SIZE;
+	int                       retval = 0;
+
+	grf_logging_warn("History file was not closed properly, scanning %zu bytes", size);
+
+	/* Rebuild the chunks from the records up to the first one that is
+	 * incomplete or does not fit the chain of its device.
+	 */
+	grf_idmap_init(&current, sizeof(struct history_device));
+	while (record_parse(map, size, offset, &rec))
+	{
+		/* Only the latest devices of a group are looked up */
+		if (rec.kind == RECORD_GROUP)
+		{
+			if ((retval = group_update(hist, rec.device, offset)))
+				break;
+			offset = rec.end - map;
+			continue;
+		}
+
+		state = grf_idmap_insert(&current, rec.device);
+		if (!state)
+		{
+			retval = ENOMEM;
+			break;
+		}
+		if (rec.kind == RECORD_KEYFRAME)
+		{
+			if ((retval = chunk_reserve(hist)))
+				break;
+			chunk_start(hist, rec.device, offset, rec.timestamp);
+			state->chunk     = hist->nchunks;
+			state->timestamp = rec.timestamp;
+		}
+		else
+		{
+			if (!state->chunk || offset - rec.back != state->offset ||
+			    hist->chunks[state->chunk - 1].count >= GRF_HISTORY_CHUNK_LEN)
+				break;
+			state->timestamp += rec.timestamp;
+		}
+		chunk_extend(&hist->chunks[state->chunk - 1], offset, state->timestamp);
+		state->offset = offset;
+		hist->records++;
+		offset = rec.end - map;
+	}
+	grf_idmap_free(&current);
+	hist->end = offset;
+	qsort(hist->chunks, hist->nchunks, sizeof(struct grf_history_chunk), chunk_compare);
+
+	return retval;
+}
+
+static int index_drop(struct grf_history *hist)
+{
+	/* A record replaces the index written before, drop it at once so
+	 * readers do not take the record for a part of the index.
+	 */
+	if (hist->size > hist->end)
+	{
+		if (ftruncate(hist->fd, hist->end) < 0)
+			return errno;
+		hist->size = hist->end;
+	}
+
+	return 0;
+}
+
+static int history_resume(struct grf_history *hist, const unsigned char *map)
+{
+	struct grf_history_chunk *chunk;
+	struct history_device    *state;
+	struct history_record     rec;
+	uint64_t                  offsets[GRF_HISTORY_CHUNK_LEN];
+	size_t                    n;
+	size_t                    i;
+
+	/* Continue the chunk holding the latest record of each device */
+	for (i = 0; i < hist->nchunks; i++)
+	{
+		chunk = &hist->chunks[i];
+		state = grf_idmap_insert(hist->devices, chunk->device);
+		if (!state)
+			return ENOMEM;
+		if (!state->chunk || hist->chunks[state->chunk - 1].last < chunk->last)
+			state->chunk = i + 1;
+	}
+
+	/* Restore the previous record the next delta refers to */
+	for (i = 0; i < hist->nchunks; i++)
+	{
+		chunk = &hist->chunks[i];
+		state = grf_idmap_find(hist->devices, chunk->device);
+		if (state->chunk != i + 1)
+			continue;
+		n = chunk_walk(map, hist->end, chunk, offsets);
+		if (!n)
+			return EINVAL;
+		while (n-- > 0)
+		{
+			record_parse(map, hist->end, offsets[n], &rec);
+			if (!record_decode(&rec, state->values))
+				return EINVAL;
+			state->timestamp = (rec.kind == RECORD_KEYFRAME) ? rec.timestamp : state->timestamp + rec.timestamp;
+		}
+		state->offset = chunk->last;
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_history_open(struct grf_history *hist, const char *path, int mode)
+{
+	assert(hist);
+	assert(path);
+	assert(mode == GRF_HISTORY_READ || mode == GRF_HISTORY_WRITE);
+
+	unsigned char  header[HISTORY_HEADER_SIZE];
+	struct stat    st;
+	unsigned char *map = NULL;
+	uint32_t       version = HISTORY_VERSION;
+	size_t         i;
+	int            retval;
+
+	memset(hist, 0, sizeof(struct grf_history));
+	hist->mode = mode;
+	keys_init(hist);
+
+	hist->fd = open(path, (mode == GRF_HISTORY_WRITE) ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+	if (hist->fd < 0)
+		return errno;
+
+	/* Two writers would interleave their records */
+	if (mode == GRF_HISTORY_WRITE && flock(hist->fd, LOCK_EX | LOCK_NB) < 0)
+	{
+		retval = (errno == EWOULDBLOCK) ? EBUSY : errno;
+		goto fail;
+	}
+	if (fstat(hist->fd, &st) < 0)
+	{
+		retval = errno;
+		goto fail;
+	}
+	hist->size = st.st_size;
+
+	/* Start a new file with its header */
+	if (hist->size == 0 && mode == GRF_HISTORY_WRITE)
+	{
+		memcpy(header, HISTORY_MAGIC, HISTORY_MAGIC_LEN);
+		put_le(header + 8, HISTORY_VERSION, 4);
+		put_le(header + 12, 0, 4);
+		if (pwrite(hist->fd, header, HISTORY_HEADER_SIZE, 0) != HISTORY_HEADER_SIZE)
+		{
+			retval = errno ? errno : EIO;
+			goto fail;
+		}
+		hist->end = HISTORY_HEADER_SIZE;
+	}
+	else
+	{
+		if (hist->size < HISTORY_HEADER_SIZE)
+		{
+			retval = EINVAL;
+			goto fail;
+		}
+		map = mmap(NULL, hist->size, PROT_READ, MAP_SHARED, hist->fd, 0);
+		if (map == MAP_FAILED)
+		{
+			map    = NULL;
+			retval = errno;
+			goto fail;
+		}
+		version = get_le(map + 8, 4);
+		if (memcmp(map, HISTORY_MAGIC, HISTORY_MAGIC_LEN) != 0 || version < 1 || version > HISTORY_VERSION)
+		{
+			retval = EINVAL;
+			goto fail;
+		}
+
+		/* Use the index of a properly closed file or rebuild it */
+		if (footer_valid(hist, map, hist->size, version))
+		{
+			hist->index = map + hist->end;
+			if ((retval = groups_load(hist, hist->index + hist->nchunks * HISTORY_ENTRY_SIZE)))
+				goto fail;
+		}
+		else if ((retval = history_recover(hist, map, hist->size)))
+			goto fail;
+	}
+
+	if (mode == GRF_HISTORY_READ)
+	{
+		hist->map = map;
+		return 0;
+	}
+
+	/* Writers keep the index in memory and append to the end of the records */
+	if (hist->index && hist->nchunks > 0)
+	{
+		hist->chunks = malloc(hist->nchunks * sizeof(struct grf_history_chunk));
+		if (!hist->chunks)
+		{
+			retval = ENOMEM;
+			goto fail;
+		}
+		hist->chunks_size = hist->nchunks;
+		for (i = 0; i < hist->nchunks; i++)
+			chunk_at(hist, i, &hist->chunks[i]);
+	}
+	hist->index   = NULL;
+	hist->devices = malloc(sizeof(struct grf_idmap));
+	if (!hist->devices)
+	{
+		retval = ENOMEM;
+		goto fail;
+	}
+	grf_idmap_init(hist->devices, sizeof(struct history_device));
+	if ((retval = history_resume(hist, map)))
+		goto fail;
+	if (map)
+		munmap(map, hist->size);
+	map = NULL;
+	if (ftruncate(hist->fd, hist->end) < 0)
+	{
+		retval = errno;
+		goto fail;
+	}
+	hist->size = hist->end;
+
+	/* The records of older versions are valid, only the footer grew */
+	if (version != HISTORY_VERSION)
+	{
+		put_le(header, HISTORY_VERSION, 4);
+		if (pwrite(hist->fd, header, 4, 8) != 4)
+		{
+			retval = errno ? errno : EIO;
+			goto fail;
+		}
+	}
+
+	return 0;
+
+fail:
+	if (map)
+		munmap(map, hist->size);
+	if (hist->devices)
+		grf_idmap_free(hist->devices);
+	free(hist->devices);
+	free(hist->chunks);
+	free(hist->groups);
+	close(hist->fd);
+	memset(hist, 0, sizeof(struct grf_history));
+	hist->fd = -1;
+
+	return retval;
+}
+
+int grf_history_close(struct grf_history *hist)
+{
+	assert(hist);
+
+	int retval = 0;
+
+	if (hist->mode == GRF_HISTORY_WRITE)
+	{
+		retval = grf_history_flush(hist);
+		if (hist->devices)
+			grf_idmap_free(hist->devices);
+		free(hist->devices);
+	}
+	else if (hist->map)
+		munmap((void *)hist->map, hist->size);
+
+	free(hist->chunks);
+	free(hist->groups);
+	if (close(hist->fd) < 0 && !retval)
+		retval = errno;
+	memset(hist, 0, sizeof(struct grf_history));
+	hist->fd = -1;
+
+	return retval;
+}
+
+int grf_history_flush(struct grf_history *hist)
+{
+	assert(hist);
+	assert(hist->mode == GRF_HISTORY_WRITE);
+
+	struct grf_history_chunk *chunks;
+	unsigned char            *index;
+	unsigned char             footer[HISTORY_FOOTER_SIZE];
+	size_t                    len;
+	size_t                    i;
+	int                       retval = 0;
+
+	/* Nothing was appended since the index was written */
+	if (hist->size > hist->end)
+		return 0;
+
+	/* Sort a copy, the devices refer to the chunks by their position */
+	len    = hist->nchunks * HISTORY_ENTRY_SIZE + hist->ngroups * HISTORY_GROUP_SIZE;
+	chunks = hist->nchunks ? malloc(hist->nchunks * sizeof(struct grf_history_chunk)) : NULL;
+	index  = malloc(len + HISTORY_FOOTER_SIZE);
+	if ((hist->nchunks && !chunks) || !index)
+	{
+		free(chunks);
+		free(index);
+		return ENOMEM;
+	}
+	if (chunks)
+		memcpy(chunks, hist->chunks, hist->nchunks * sizeof(struct grf_history_chunk));
+	qsort(chunks, hist->nchunks, sizeof(struct grf_history_chunk), chunk_compare);
+
+	/* Write the index sorted by device and time, the latest record of each
+	 * group sorted by group and the footer.
+	 */
+	for (i = 0; i < hist->nchunks; i++)
+		chunk_put(index + i * HISTORY_ENTRY_SIZE, &chunks[i]);
+	for (i = 0; i < hist->ngroups; i++)
+	{
+		put_le(index + hist->nchunks * HISTORY_ENTRY_SIZE + i * HISTORY_GROUP_SIZE, hist->groups[i].group, 2);
+		put_le(index + hist->nchunks * HISTORY_ENTRY_SIZE + i * HISTORY_GROUP_SIZE + 2, hist->groups[i].offset, 8);
+	}
+	memcpy(footer, HISTORY_INDEX_MAGIC, HISTORY_MAGIC_LEN);
+	put_le(footer + 8, hist->end, 8);
+	put_le(footer + 16, hist->nchunks, 8);
+	put_le(footer + 24, hist->records, 8);
+	put_le(footer + 32, hist->ngroups, 8);
+	memcpy(index + len, footer, HISTORY_FOOTER_SIZE);
+	if (pwrite(hist->fd, index, len + HISTORY_FOOTER_SIZE, hist->end) != (ssize_t)(len + HISTORY_FOOTER_SIZE))
+		retval = errno ? errno : EIO;
+	else if (fsync(hist->fd) < 0)
+		retval = errno;
+	else
+		hist->size = hist->end + len + HISTORY_FOOTER_SIZE;
+	free(chunks);
+	free(index);
+
+	return retval;
+}
+
+int grf_history_append(struct grf_history *hist, const struct grf_device *device)
+{
+	assert(hist);
+	assert(hist->mode == GRF_HISTORY_WRITE);
+	assert(device);
+
+	unsigned char             buf[RECORD_MAXSIZE];
+	uint32_t                  values[GRF_HISTORY_REGISTERS];
+	struct history_device    *state;
+	bool                      keyframe;
+	uint16_t                  id;
+	size_t                    len;
+	size_t                    i;
+
+	if (!grf_idmap_parse(device->id, &id))
+		return EINVAL;
+	state = grf_idmap_insert(hist->devices, id);
+	if (!state)
+		return ENOMEM;
+	for (i = 0; i < GRF_HISTORY_REGISTERS; i++)
+		grf_register_get(device, hist->keys[i], &values[i]);
+
+	RETURN_ON_ERROR(index_drop(hist));
+
+	/* Start a new chunk with a keyframe if the current one is full */
+	keyframe = !state->chunk || hist->chunks[state->chunk - 1].count >= GRF_HISTORY_CHUNK_LEN;
+	if (keyframe)
+	{
+		RETURN_ON_ERROR(chunk_reserve(hist));
+		len = record_encode(buf, RECORD_KEYFRAME, id, 0, device->timestamp, NULL, values);
+	}
+	else
+		len = record_encode(buf, RECORD_DELTA, id, hist->end - state->offset,
+		                    (int64_t)device->timestamp - state->timestamp, state->values, values);
+
+	/* A record is written at once, so a crash leaves at most the last
+	 * record incomplete, which is dropped by the recovery.
+	 */
+	if (pwrite(hist->fd, buf, len, hist->end) != (ssize_t)len)
+		return errno ? errno : EIO;
+	if (keyframe)
+	{
+		chunk_start(hist, id, hist->end, device->timestamp);
+		state->chunk = hist->nchunks;
+	}
+	chunk_extend(&hist->chunks[state->chunk - 1], hist->end, device->timestamp);
+
+	memcpy(state->values, values, sizeof(values));
+	state->timestamp = device->timestamp;
+	state->offset    = hist->end;
+	hist->end       += len;
+	hist->size       = hist->end;
+	hist->records++;
+
+	/* Readers find the sealed chunk without scanning the records */
+	if (hist->chunks[state->chunk - 1].count >= GRF_HISTORY_CHUNK_LEN)
+		return grf_history_flush(hist);
+
+	return 0;
+}
+
+int grf_history_set_group(struct grf_history *hist, const char *group, const struct grf_devicelist *devices)
+{
+	assert(hist);
+	assert(hist->mode == GRF_HISTORY_WRITE);
+	assert(devices);
+
+	struct grf_history_group *entry;
+	struct history_record     rec;
+	struct history_record     prev;
+	unsigned char            *buf;
+	unsigned char            *old = NULL;
+	uint16_t                  id;
+	size_t                    len;
+	int                       retval;
+
+	if (!grf_idmap_parse(group, &id))
+		return EINVAL;
+	RETURN_ON_ERROR(group_encode(&buf, &len, id, time(NULL), devices));
+	record_parse(buf, len, 0, &rec);
+
+	/* Keep the file from growing with every read-out of the same devices */
+	entry = group_find(hist, id, NULL);
+	if (entry)
+	{
+		retval = group_read(hist, id, entry->offset, &old, &prev);
+		if (!retval && prev.end - prev.data == rec.end - rec.data && memcmp(prev.data, rec.data, rec.end - rec.data) == 0)
+			goto out;
+	}
+
+	retval = index_drop(hist);
+	if (retval)
+		goto out;
+	if (pwrite(hist->fd, buf, len, hist->end) != (ssize_t)len)
+	{
+		retval = errno ? errno : EIO;
+		goto out;
+	}
+	retval = group_update(hist, id, hist->end);
+	hist->end += len;
+	hist->size = hist->end;
+
+out:
+	free(old);
+	free(buf);
+
+	return retval;
+}
+
+int grf_history_get_group(const struct grf_history *hist, const char *group, struct grf_devicelist *devices)
+{
+	assert(hist);
+	assert(devices);
+
+	struct grf_history_group *entry;
+	struct history_record     rec;
+	unsigned char            *buf;
+	uint16_t                  id;
+	int                       retval;
+
+	grf_devicelist_free(devices);
+	if (!grf_idmap_parse(group, &id))
+		return EINVAL;
+	entry = group_find(hist, id, NULL);
+	if (!entry)
+		return ENOENT;
+	retval = group_read(hist, id, entry->offset, &buf, &rec);
+	if (!retval)
+		retval = group_decode(&rec, devices);
+	free(buf);
+	if (retval)
+		grf_devicelist_free(devices);
+
+	return retval;
+}
+
+int grf_history_query(const struct grf_history *hist, const char *id, time_t since, time_t until, grf_history_cb callback, void *userdata)
+{
+	assert(hist);
+	assert(hist->mode == GRF_HISTORY_READ);
+	assert(callback);
+
+	struct grf_history_chunk chunk;
+	struct history_record    rec;
+	struct grf_device        device;
+	uint64_t                 offsets[GRF_HISTORY_CHUNK_LEN];
+	uint32_t                 values[GRF_HISTORY_REGISTERS];
+	uint16_t                 devid = 0;
+	size_t                   lo = 0;
+	size_t                   hi = hist->nchunks;
+	size_t                   mid;
+	size_t                   n;
+	size_t                   i;
+	size_t                   j;
+	size_t                   k;
+	int64_t                  timestamp;
+
+	/* Find the first chunk of the device by a binary search */
+	if (id)
+	{
+		if (!grf_idmap_parse(id, &devid))
+			return 0;
+		while (lo < hi)
+		{
+			mid = lo + (hi - lo) / 2;
+			chunk_at(hist, mid, &chunk);
+			if (chunk.device < devid)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+	}
+
+	for (i = lo; i < hist->nchunks; i++)
+	{
+		chunk_at(hist, i, &chunk);
+		if (id && chunk.device != devid)
+			break;
+		if (chunk.newest < since)
+			continue;
+		if (chunk.oldest > until)
+		{
+			if (id)
+				break;
+			continue;
+		}
+
+		/* Follow the links back to the keyframe, then decode forward */
+		n = chunk_walk(hist->map, hist->end, &chunk, offsets);
+		if (!n)
+			return EINVAL;
+
+		timestamp = 0;
+		for (j = n; j-- > 0; )
+		{
+			record_parse(hist->map, hist->end, offsets[j], &rec);
+			if (!record_decode(&rec, values))
+				return EINVAL;
+			timestamp = (rec.kind == RECORD_KEYFRAME) ? rec.timestamp : timestamp + rec.timestamp;
+			if (timestamp < since || timestamp > until)
+				continue;
+
+			memset(&device, 0, sizeof(struct grf_device));
+			snprintf(device.id, sizeof(device.id), "%04X", chunk.device);
+			device.timestamp = timestamp;
+			for (k = 0; k < GRF_HISTORY_REGISTERS; k++)
+				grf_register_set(&device, hist->keys[k], values[k]);
+			RETURN_ON_ERROR(callback(&device, userdata));
+		}
+	}
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,189 @@
+/*
+ * Reading history include file
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \ingroup comm
+ *  \file grf_history.h
+ *  \brief Append-only file keeping the readings of smoke detector devices
+ *
+ * This file defines the history file storing snapshots of the registers of
+ * smoke detector devices over time. The file consists of a header, the
+ * records in the order they were appended, an index and a footer:
+ *
+ *   - A record holds the device ID, the timestamp and the registers of one
+ *     reading. The first reading of a device in a chunk of up to
+ *     \ref GRF_HISTORY_CHUNK_LEN readings is a keyframe holding all registers
+ *     as varints. The following ones only hold the registers that changed,
+ *     XOR'ed with the previous reading, and a link to the previous record of
+ *     the same device.
+ *   - A group record holds the IDs of the devices found in a group. It is
+ *     appended whenever the devices of a group differ from the ones recorded
+ *     before, so the history of a group is reported without the radio.
+ *   - The index lists the chunks sorted by device ID and time, so the
+ *     readings of a device within a time range are found by a binary search
+ *     without touching the records of other devices. It is followed by the
+ *     latest group record of each group.
+ *
+ * Readers map the file into memory. Writers continue the last chunk of each
+ * device when reopening the file. They drop the index before appending and
+ * write it again whenever a chunk is full, when flushed and on close. Only
+ * one writer may open a file at a time. A file without index is recovered by
+ * scanning the records.
+ *
+ * @{
+ */
+
+#ifndef __GRF_HISTORY_H__
+#define __GRF_HISTORY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+struct grf_device;
+struct grf_devicelist;
+struct grf_idmap;
+
+#define GRF_HISTORY_READ            0		/*!< Open the history for queries */
+#define GRF_HISTORY_WRITE           1		/*!< Open the history for appending readings, creating the file if necessary */
+
+#define GRF_HISTORY_CHUNK_LEN       64		/*!< Maximum number of readings of a device between two keyframes */
+#define GRF_HISTORY_REGISTERS       48		/*!< Number of registers stored per reading */
+
+/*! \brief Callback reporting a reading found by \ref grf_history_query().
+ *
+ *  \param device	device data of the reading including its timestamp, only valid during the call
+ *  \param userdata	user data passed to \ref grf_history_query()
+ *  \returns		0 to continue and an error code to stop the query
+ */
+typedef int (*grf_history_cb)(const struct grf_device *device, void *userdata);
+
+/*! Data structure describing a chunk of readings of a device */
+struct grf_history_chunk
+{
+	uint16_t     device;		/*!< Numeric device ID */
+	uint16_t     count;			/*!< Number of readings in the chunk */
+	int64_t      oldest;		/*!< Oldest timestamp of the readings */
+	int64_t      newest;		/*!< Newest timestamp of the readings */
+	uint64_t     first;			/*!< File offset of the keyframe */
+	uint64_t     last;			/*!< File offset of the last reading */
+};
+
+/*! Data structure referring to the latest group record of a group */
+struct grf_history_group
+{
+	uint16_t     group;			/*!< Numeric group ID */
+	uint64_t     offset;		/*!< File offset of the group record */
+};
+
+/*! Data structure representing an open history file */
+struct grf_history
+{
+	int          fd;			/*!< File descriptor of the history file */
+	int          mode;			/*!< Mode the history is opened in (GRF_HISTORY_READ or GRF_HISTORY_WRITE) */
+	uint16_t     keys[GRF_HISTORY_REGISTERS];	/*!< Keys of the registers stored per reading */
+
+	const unsigned char *map;	/*!< Mapping of the file (readers only) */
+	size_t       size;			/*!< Size of the mapping respectively of the file */
+	uint64_t     end;			/*!< Offset of the end of the records */
+	uint64_t     records;		/*!< Number of readings in the file */
+
+	const unsigned char *index;	/*!< Index in the mapping (NULL if *chunks* is used) */
+	struct grf_history_chunk *chunks;	/*!< Index held in memory for writers and recovered files */
+	size_t       nchunks;		/*!< Number of chunks in the index */
+	size_t       chunks_size;	/*!< Capacity of *chunks* */
+	struct grf_idmap *devices;	/*!< State of the current chunk per device (writers only) */
+
+	struct grf_history_group *groups;	/*!< Latest group record per group sorted by group ID */
+	size_t       ngroups;		/*!< Number of groups */
+	size_t       groups_size;	/*!< Capacity of *groups* */
+};
+
+/*! \brief Open a history file.
+ *
+ *  \param hist		history structure to initialize
+ *  \param path		path of the history file
+ *  \param mode		GRF_HISTORY_READ or GRF_HISTORY_WRITE
+ *  \returns		0 on success, `EINVAL` if the file is no history file, `EBUSY` if another writer has it open and an error code otherwise
+ */
+int grf_history_open(struct grf_history *hist, const char *path, int mode);
+
+/*! \brief Close a history file writing the index if opened for writing.
+ *
+ *  \param hist		history opened by \ref grf_history_open()
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_history_close(struct grf_history *hist);
+
+/*! \brief Write the index of a history file so readers find the readings appended so far.
+ *
+ *  The index is written again only if readings were appended since.
+ *
+ *  \param hist		history opened by \ref grf_history_open() with GRF_HISTORY_WRITE
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_history_flush(struct grf_history *hist);
+
+/*! \brief Append a reading to a history file.
+ *
+ *  \param hist		history opened by \ref grf_history_open() with GRF_HISTORY_WRITE
+ *  \param device	device data e.g. read by \ref grf_comm_read_data(), stored along with *device->timestamp*
+ *  \returns		0 on success, `EINVAL` if the ID of *device* is no 4-digit hexadecimal number and an error code otherwise
+ */
+int grf_history_append(struct grf_history *hist, const struct grf_device *device);
+
+/*! \brief Record the devices of a group.
+ *
+ *  The devices are appended only if they differ from the ones recorded last
+ *  for the group, the order of the devices does not matter.
+ *
+ *  \param hist		history opened by \ref grf_history_open() with GRF_HISTORY_WRITE
+ *  \param group	4-digit hexadecimal ID of the group
+ *  \param devices	devices of the group e.g. found by \ref grf_comm_scan_devices()
+ *  \returns		0 on success, `EINVAL` if the ID of the group or a device is no 4-digit hexadecimal number and an error code otherwise
+ */
+int grf_history_set_group(struct grf_history *hist, const char *group, const struct grf_devicelist *devices);
+
+/*! \brief Look up the devices recorded last for a group.
+ *
+ *  \param hist		history opened by \ref grf_history_open()
+ *  \param group	4-digit hexadecimal ID of the group
+ *  \param devices	list of devices belonging to *group* sorted by ID initialized by \ref grf_devicelist_init(), previous content is replaced
+ *  \returns		0 on success, `ENOENT` if no devices are recorded for the group, `EINVAL` if the ID of the group is no 4-digit hexadecimal number or the file is corrupt and an error code otherwise
+ */
+int grf_history_get_group(const struct grf_history *hist, const char *group, struct grf_devicelist *devices);
+
+/*! \brief Report the readings within a time range.
+ *
+ *  The readings are reported ordered by device ID and, per device, by time.
+ *
+ *  \param hist		history opened by \ref grf_history_open() with GRF_HISTORY_READ
+ *  \param id		4-digit hexadecimal ID of the device or NULL for all devices
+ *  \param since	oldest timestamp to report
+ *  \param until	newest timestamp to report
+ *  \param callback	function called for each reading
+ *  \param userdata	user data passed to *callback*
+ *  \returns		0 on success, the error code returned by *callback* or `EINVAL` if the file is corrupt
+ */
+int grf_history_query(const struct grf_history *hist, const char *id, time_t since, time_t until, grf_history_cb callback, void *userdata);
+
+#endif /* __GRF_HISTORY_H__ */
+/* @} */
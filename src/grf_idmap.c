@@ -0,0 +1,176 @@
+/*
+ * Device ID map
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "grf_idmap.h"
+
+#define GRF_IDMAP_INITIAL_SIZE  16
+#define GRF_IDMAP_ALIGN         8
+
+/* Header of each entry, the value follows aligned to GRF_IDMAP_ALIGN */
+struct grf_idmap_entry
+{
+	uint16_t     id;			/* Device ID */
+	bool         used;			/* Status flag if the entry is occupied */
+};
+
+#define ENTRY_HEADER_SIZE   ((sizeof(struct grf_idmap_entry) + GRF_IDMAP_ALIGN - 1) & ~(size_t)(GRF_IDMAP_ALIGN - 1))
+
+/*---------------------------------------------------------------------------*/
+static inline struct grf_idmap_entry *entry_at(const struct grf_idmap *map, char *entries, size_t index)
+{
+	return (struct grf_idmap_entry *)(entries + index * map->entsize);
+}
+
+static inline size_t id_hash(uint16_t id, size_t size)
+{
+	/* Fibonacci hashing spreads the sequential IDs of a group */
+	return (((uint32_t)id * 2654435769u) >> 16) & (size - 1);
+}
+
+static size_t slot_find(const struct grf_idmap *map, char *entries, size_t size, uint16_t id)
+{
+	struct grf_idmap_entry *entry;
+	size_t                  i;
+
+	/* Linear probing, the load is kept below one half */
+	for (i = id_hash(id, size); ; i = (i + 1) & (size - 1))
+	{
+		entry = entry_at(map, entries, i);
+		if (!entry->used || entry->id == id)
+			return i;
+	}
+}
+
+static int map_grow(struct grf_idmap *map)
+{
+	struct grf_idmap_entry *entry;
+	char                   *entries;
+	size_t                  size = map->size ? 2 * map->size : GRF_IDMAP_INITIAL_SIZE;
+	size_t                  i;
+
+	entries = calloc(size, map->entsize);
+	if (!entries)
+		return -1;
+
+	/* Rehash all entries into the new storage */
+	for (i = 0; i < map->size; i++)
+	{
+		entry = entry_at(map, map->entries, i);
+		if (entry->used)
+			memcpy(entry_at(map, entries, slot_find(map, entries, size, entry->id)), entry, map->entsize);
+	}
+	free(map->entries);
+	map->entries = entries;
+	map->size    = size;
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+bool grf_idmap_parse(const char *id, uint16_t *value)
+{
+	unsigned long parsed;
+	char         *end;
+	size_t        i;
+
+	/* Device IDs are exactly 4 hexadecimal digits, without sign, blanks or prefix */
+	if (!id || strlen(id) != 4)
+		return false;
+	for (i = 0; i < 4; i++)
+	{
+		if (!isxdigit((unsigned char)id[i]))
+			return false;
+	}
+	parsed = strtoul(id, &end, 16);
+	if (end != id + 4 || *end != '\0')
+		return false;
+	*value = parsed;
+
+	return true;
+}
+
+void grf_idmap_init(struct grf_idmap *map, size_t valsize)
+{
+	assert(map);
+
+	memset(map, 0, sizeof(struct grf_idmap));
+	map->valsize = valsize;
+	map->entsize = (ENTRY_HEADER_SIZE + valsize + GRF_IDMAP_ALIGN - 1) & ~(size_t)(GRF_IDMAP_ALIGN - 1);
+}
+
+void grf_idmap_free(struct grf_idmap *map)
+{
+	assert(map);
+
+	free(map->entries);
+	map->entries = NULL;
+	map->len     = 0;
+	map->size    = 0;
+}
+
+void *grf_idmap_find(const struct grf_idmap *map, uint16_t id)
+{
+	assert(map);
+
+	struct grf_idmap_entry *entry;
+
+	if (!map->entries)
+		return NULL;
+
+	entry = entry_at(map, map->entries, slot_find(map, map->entries, map->size, id));
+	if (!entry->used)
+		return NULL;
+
+	return (char *)entry + ENTRY_HEADER_SIZE;
+}
+
+void *grf_idmap_insert(struct grf_idmap *map, uint16_t id)
+{
+	assert(map);
+
+	struct grf_idmap_entry *entry;
+	void                   *value;
+
+	value = grf_idmap_find(map, id);
+	if (value)
+		return value;
+
+	/* Keep the load of the table below one half */
+	if (2 * (map->len + 1) > map->size && map_grow(map))
+		return NULL;
+
+	entry       = entry_at(map, map->entries, slot_find(map, map->entries, map->size, id));
+	entry->id   = id;
+	entry->used = true;
+	map->len++;
+
+	return (char *)entry + ENTRY_HEADER_SIZE;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,91 @@
+/*
+ * Device ID map include file
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \ingroup comm
+ *  \file grf_idmap.h
+ *  \brief Hash table keeping data per smoke detector device
+ *
+ * This file defines a hash table mapping the 4-digit hexadecimal device IDs
+ * to fixed-size values. It is used to remember facts learned about each
+ * device across requests.
+ *
+ * @{
+ */
+
+#ifndef __GRF_IDMAP_H__
+#define __GRF_IDMAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*! Data structure representing a map from device IDs to values */
+struct grf_idmap
+{
+	char        *entries;		/*!< Storage of the entries */
+	size_t       entsize;		/*!< Size of an entry including its header */
+	size_t       valsize;		/*!< Size of the value of an entry */
+	size_t       len;			/*!< Number of entries in the map */
+	size_t       size;			/*!< Capacity of the map (power of two) */
+};
+
+/*! \brief Parse a 4-digit hexadecimal device ID.
+ *
+ *  \param id		device ID as string (may be NULL)
+ *  \param value	storage for the numeric device ID
+ *  \returns		true if *id* is a valid device ID and false otherwise
+ */
+bool grf_idmap_parse(const char *id, uint16_t *value);
+
+/*! \brief Initialize an empty map.
+ *
+ *  \param map		map to initialize
+ *  \param valsize	size of the value stored per device
+ */
+void grf_idmap_init(struct grf_idmap *map, size_t valsize);
+
+/*! \brief Free all entries of a map.
+ *
+ *  \param map		map initialized by \ref grf_idmap_init()
+ */
+void grf_idmap_free(struct grf_idmap *map);
+
+/*! \brief Look up the value of a device.
+ *
+ *  \param map		map initialized by \ref grf_idmap_init()
+ *  \param id		numeric device ID
+ *  \returns		the value of the device or NULL if the device is not in the map
+ */
+void *grf_idmap_find(const struct grf_idmap *map, uint16_t id);
+
+/*! \brief Look up the value of a device and add the device if necessary.
+ *
+ *  The value of newly added devices is zeroed. Adding devices may move the
+ *  values of all other devices.
+ *
+ *  \param map		map initialized by \ref grf_idmap_init()
+ *  \param id		numeric device ID
+ *  \returns		the value of the device or NULL if out of memory
+ */
+void *grf_idmap_insert(struct grf_idmap *map, uint16_t id);
+
+#endif /* __GRF_IDMAP_H__ */
+/* @} */
@@ -0,0 +1,124 @@
+/*
+ * Latency statistics
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <assert.h>
+
+#include "grf_latency.h"
+
+/*---------------------------------------------------------------------------*/
+static unsigned int bucket_index(uint32_t ms)
+{
+	unsigned int octave;
+
+	/* Values below 4 ms get a bucket each, above that every power of two
+	 * is split into 4 buckets giving a resolution of 25%.
+	 */
+	if (ms < 4)
+		return ms;
+	octave = 31 - __builtin_clz(ms);
+	if (octave > GRF_LATENCY_BUCKETS / 4)
+		return GRF_LATENCY_BUCKETS - 1;
+
+	return 4 * (octave - 1) + ((ms >> (octave - 2)) & 3);
+}
+
+static uint32_t bucket_limit(unsigned int index)
+{
+	unsigned int octave;
+
+	/* Upper bound of the values falling into the bucket */
+	if (index < 4)
+		return index;
+	octave = index / 4 + 1;
+
+	return ((uint32_t)(4 + index % 4 + 1) << (octave - 2)) - 1;
+}
+
+static void histogram_add(struct grf_latency_histogram *hist, int ms)
+{
+	hist->buckets[bucket_index((ms < 0) ? 0 : ms)]++;
+	hist->count++;
+}
+
+static uint32_t histogram_percentile(const struct grf_latency_histogram *hist, unsigned int percentile)
+{
+	uint32_t     target = (uint32_t)(((uint64_t)hist->count * percentile + 99) / 100);
+	uint32_t     sum    = 0;
+	unsigned int i;
+
+	for (i = 0; i < GRF_LATENCY_BUCKETS; i++)
+	{
+		sum += hist->buckets[i];
+		if (sum >= target)
+			return bucket_limit(i);
+	}
+
+	return bucket_limit(GRF_LATENCY_BUCKETS - 1);
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+struct grf_latency *grf_latency_new(void)
+{
+	struct grf_latency *latency;
+
+	latency = calloc(1, sizeof(struct grf_latency));
+	if (!latency)
+		return NULL;
+
+	return latency;
+}
+
+void grf_latency_free(struct grf_latency *latency)
+{
+	free(latency);
+}
+
+void grf_latency_record(struct grf_latency *latency, int key, int ms)
+{
+	assert(latency);
+	assert(key >= 0 && key < GRF_LATENCY_KEYS);
+
+	histogram_add(&latency->keys[key], ms);
+}
+
+int grf_latency_timeout(const struct grf_latency *latency, int key, int cap)
+{
+	assert(latency);
+	assert(key >= 0 && key < GRF_LATENCY_KEYS);
+
+	const struct grf_latency_histogram *hist = &latency->keys[key];
+	int64_t                             timeout;
+
+	if (cap < 0 || hist->count < GRF_LATENCY_MIN_SAMPLES)
+		return cap;
+
+	timeout = (int64_t)histogram_percentile(hist, GRF_LATENCY_PERCENTILE) * GRF_LATENCY_MARGIN;
+	if (timeout < GRF_LATENCY_MIN_TIMEOUT)
+		timeout = GRF_LATENCY_MIN_TIMEOUT;
+
+	return (timeout < cap) ? (int)timeout : cap;
+}
+/*---------------------------------------------------------------------------*/
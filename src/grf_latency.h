@@ -0,0 +1,95 @@
+/*
+ * Latency statistics include file
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \ingroup comm
+ *  \file grf_latency.h
+ *  \brief Latency statistics used to derive timeouts of the answers
+ *
+ * This file defines the statistics of the time the radio takes to deliver the
+ * answers to a request. The latencies are collected in histograms with
+ * logarithmic buckets per answer of each request. The timeout of an answer is
+ * derived from the percentile of the latencies observed so far and capped by
+ * the timeout given by the user.
+ *
+ * @{
+ */
+
+#ifndef __GRF_LATENCY_H__
+#define __GRF_LATENCY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GRF_LATENCY_KEYS            64		/*!< Number of answer keys tracked per radio */
+#define GRF_LATENCY_BUCKETS         120		/*!< Number of histogram buckets, 4 per power of two milliseconds */
+#define GRF_LATENCY_MIN_SAMPLES     20		/*!< Number of samples of an answer key required before a timeout is derived */
+#define GRF_LATENCY_PERCENTILE      99		/*!< Percentile of the latencies used to derive the timeout */
+#define GRF_LATENCY_MARGIN          2		/*!< Factor applied to the percentile to derive the timeout */
+#define GRF_LATENCY_MIN_TIMEOUT     200		/*!< Lower bound of derived timeouts in milliseconds */
+
+/*! Data structure representing a histogram of latencies */
+struct grf_latency_histogram
+{
+	uint32_t     buckets[GRF_LATENCY_BUCKETS];	/*!< Number of samples per bucket */
+	uint32_t     count;		/*!< Total number of samples */
+};
+
+/*! Data structure holding the latency statistics of a radio */
+struct grf_latency
+{
+	struct grf_latency_histogram  keys[GRF_LATENCY_KEYS];	/*!< Latencies per answer key */
+};
+
+/*! \brief Allocate empty latency statistics.
+ *
+ *  \returns		the newly allocated statistics or NULL if out of memory
+ */
+struct grf_latency *grf_latency_new(void);
+
+/*! \brief Free latency statistics allocated by \ref grf_latency_new().
+ *
+ *  \param latency	statistics to free (may be NULL)
+ */
+void grf_latency_free(struct grf_latency *latency);
+
+/*! \brief Record the latency of an answer.
+ *
+ *  \param latency	statistics to update
+ *  \param key		answer key (0 to \ref GRF_LATENCY_KEYS - 1)
+ *  \param ms		latency in milliseconds
+ */
+void grf_latency_record(struct grf_latency *latency, int key, int ms);
+
+/*! \brief Derive the timeout of an answer.
+ *
+ *  The timeout is the percentile of the latencies of the answer key multiplied
+ *  by \ref GRF_LATENCY_MARGIN. Without enough samples of the answer key the
+ *  cap is returned.
+ *
+ *  \param latency	statistics to use
+ *  \param key		answer key (0 to \ref GRF_LATENCY_KEYS - 1)
+ *  \param cap		timeout given by the user in milliseconds or a negative value for infinite
+ *  \returns		the timeout in milliseconds, never exceeding *cap*
+ */
+int grf_latency_timeout(const struct grf_latency *latency, int key, int cap);
+
+#endif /* __GRF_LATENCY_H__ */
+/* @} */
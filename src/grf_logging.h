@@ -46,6 +46,7 @@
 
 #define grf_logging_dbg_hex(_hexstr_, _hexlen_, _fmt_, ...)		grf_logging_log_hex(GRF_LOGGING_DEBUG, (_hexstr_), (_hexlen_), (_fmt_), __VA_ARGS__)	/*!< Macro to log debug information including a HEX output of the data */
 #define grf_logging_warn_hex(_hexstr_, _hexlen_, _fmt_, ...)	grf_logging_log_hex(GRF_LOGGING_WARN,  (_hexstr_), (_hexlen_), (_fmt_), __VA_ARGS__)	/*!< Macro to log warnings including a HEX output of the data */
+#define grf_logging_err_hex(_hexstr_, _hexlen_, _fmt_, ...)		grf_logging_log_hex(GRF_LOGGING_ERR,   (_hexstr_), (_hexlen_), (_fmt_), __VA_ARGS__)	/*!< Macro to log errors including a HEX output of the data */
 
 /*! \brief Set the level of output that should be shown.
  *
@@ -0,0 +1,540 @@
+/*
+ * Radio module interface independent of the transport
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <poll.h>
+#include <limits.h>
+#include <time.h>
+
+#include "grf.h"
+#include "grf_radio.h"
+#include "grf_logging.h"
+
+#define GRF_ANSWER_TIMEOUT      "Timeout"           /* Also used for end of transmission */
+#define GRF_ANSWER_DONE         "Done"              /* Expected answer to indicate completion of command */
+#define GRF_ANSWER_REC          "REC"               /* Expected to indicate that data recording is in process */
+#define GRF_ANSWER_VERSION      "GI_RM_V"           /* Expected prefix of the version string */
+
+/*---------------------------------------------------------------------------*/
+static struct timespec *grf_radio_deadline(struct grf_radio *radio, int timeout, struct timespec *deadline)
+{
+	assert(radio);
+	assert(deadline);
+
+	if (timeout == GRF_RADIO_TIMEOUT_DEFAULT)
+		timeout = radio->timeout;
+
+	/* No deadline at all in case we should block infinitely */
+	if (timeout < 0)
+		return NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec  += timeout / 1000;
+	deadline->tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000L)
+	{
+		deadline->tv_sec  += 1;
+		deadline->tv_nsec -= 1000000000L;
+	}
+
+	return deadline;
+}
+
+static int grf_radio_wait(struct grf_radio *radio, short events, const struct timespec *deadline)
+{
+	assert(radio);
+
+	struct pollfd    pfd;
+	struct timespec  now;
+	struct timespec  remaining;
+	int              ret;
+
+	pfd.fd     = radio->ops->get_pollfd(radio);
+	pfd.events = events;
+
+	while (true)
+	{
+		/* Determine the time left until the deadline */
+		if (deadline)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining.tv_sec  = deadline->tv_sec  - now.tv_sec;
+			remaining.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0)
+			{
+				remaining.tv_sec  -= 1;
+				remaining.tv_nsec += 1000000000L;
+			}
+			if (remaining.tv_sec < 0)
+				return ETIMEDOUT;
+		}
+
+		ret = ppoll(&pfd, 1, deadline ? &remaining : NULL, NULL);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			grf_logging_err("Polling %s failed: %s", radio->dev, strerror(errno));
+			return errno;
+		}
+		if (ret == 0)
+			return ETIMEDOUT;
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+			return EIO;
+
+		return 0;
+	}
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_radio_init_ops(struct grf_radio *radio, const struct grf_radio_ops *ops, const char *dev, unsigned int timeout)
+{
+	assert(radio);
+	assert(ops);
+	assert(dev);
+
+	int ret;
+
+	grf_logging_info("Initializing %s device %s", ops->name, dev);
+
+	/* Reset the radio structure */
+	memset(radio, 0, sizeof(struct grf_radio));
+	radio->is_initialized = false;
+
+	/* Copy the given data to the radio */
+	radio->dev = strdup(dev);
+	if (!radio->dev)
+		return ENOMEM;
+
+	/* Convert the timeout to milliseconds, 0 means infinite */
+	if (timeout == 0)
+		radio->timeout = GRF_RADIO_TIMEOUT_INFINITE;
+	else if (timeout > INT_MAX / 1000)
+		radio->timeout = INT_MAX;
+	else
+		radio->timeout = timeout * 1000;
+	grf_logging_dbg("init: timeout %d ms", radio->timeout);
+
+	/* Let the backend open the device */
+	ret = ops->open(radio, dev);
+	if (ret)
+	{
+		grf_logging_err("Opening radio device %s failed: %s", dev, strerror(ret));
+		free(radio->dev);
+		radio->dev = NULL;
+		return ret;
+	}
+	radio->ops            = ops;
+	radio->is_initialized = true;
+
+	return 0;
+}
+
+int grf_radio_init(struct grf_radio *radio, const char *dev, unsigned int timeout)
+{
+	assert(radio);
+	assert(dev);
+
+	/* Select the backend from the device prefix and use the UART
+	 * for plain device paths, including pseudo terminals.
+	 */
+	if (strncmp(dev, GRF_RADIO_PREFIX_UNIX, strlen(GRF_RADIO_PREFIX_UNIX)) == 0)
+		return grf_radio_init_ops(radio, &grf_radio_socket_ops, dev + strlen(GRF_RADIO_PREFIX_UNIX), timeout);
+	if (strncmp(dev, GRF_RADIO_PREFIX_REPLAY, strlen(GRF_RADIO_PREFIX_REPLAY)) == 0)
+		return grf_radio_init_ops(radio, &grf_radio_replay_ops, dev + strlen(GRF_RADIO_PREFIX_REPLAY), timeout);
+
+	return grf_radio_init_ops(radio, &grf_radio_uart_ops, dev, timeout);
+}
+
+int grf_radio_exit(struct grf_radio *radio)
+{
+	assert(radio);
+
+	int retval;
+
+	if (!radio->is_initialized)
+		return 0;
+
+	grf_logging_info("Closing communication at device %s", radio->dev);
+
+	/* Let pending output go out before the backend closes the device */
+	retval = grf_radio_drain(radio);
+	if (retval)
+		grf_logging_warn("Draining device %s failed: %s", radio->dev, strerror(retval));
+	radio->ops->close(radio);
+
+	/* Free the device name and firmware version */
+	if (radio->dev)
+		free(radio->dev);
+	if (radio->firmware_version)
+		free(radio->firmware_version);
+	if (radio->session_free)
+		radio->session_free(radio->session);
+
+	/* Reset the radio structure */
+	memset(radio, 0, sizeof(struct grf_radio));
+	radio->is_initialized = false;
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_radio_get_pollfd(struct grf_radio *radio)
+{
+	assert(grf_radio_is_valid(radio));
+
+	return radio->ops->get_pollfd(radio);
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static int grf_radio_frame(struct grf_radio *radio)
+{
+	assert(radio);
+
+	char c;
+
+	/* Feed the buffered bytes to the framer until a complete message is
+	 * assembled. Bytes following the message stay in the ring buffer for
+	 * the next call.
+	 */
+	while (radio->rx_tail != radio->rx_head)
+	{
+		c = radio->rx_buf[radio->rx_tail++ & (GRF_RADIO_RXBUFSIZE - 1)];
+
+		/* Maintain state machine for parsing */
+		if (!radio->rx_framestarted)
+		{
+			/* We either expect a control character such as ACK/NAK or
+			 * a begin-of-message tag. All other characters are treated
+			 * as errors!
+			 */
+			switch(c)
+			{
+				case GRF_NUL:
+				case GRF_ACK:
+				case GRF_NAK:
+					radio->rx_frame[0]  = c;
+					radio->rx_framelen  = 1;
+					return 0;
+				case GRF_STX:
+					radio->rx_frame[0]     = c;
+					radio->rx_framelen     = 1;
+					radio->rx_framestarted = true;
+					break;
+				case GRF_CONT:
+					/* Just digest the continuation of the
+					 * previous message.
+					 */
+					break;
+				default:
+					grf_logging_err("State invalid (INITIAL and got x%02x)!", c);
+					return EINVAL;
+			}
+		}
+		else	/* rx_framestarted */
+		{
+			/* We either expect a data character or and end-of-message tag.
+			 * All other characters are treated as errors!
+			 */
+			switch(c)
+			{
+				case GRF_ETX:
+					radio->rx_frame[radio->rx_framelen++] = c;
+					radio->rx_framestarted = false;
+					return 0;
+				case GRF_STX:
+					grf_logging_warn_hex(radio->rx_frame, radio->rx_framelen, "Missed ETX! (STARTED and got x%02x)!", c);
+					radio->rx_frame[0] = c;
+					radio->rx_framelen = 1;
+					break;
+				case GRF_NUL:
+				case GRF_ACK:
+				case GRF_NAK:
+					/* The radio aborts a transfer stopped early in the
+					 * middle of a frame and answers the stop request
+					 * right away, so drop the partial frame and resync.
+					 */
+					grf_logging_warn_hex(radio->rx_frame, radio->rx_framelen, "Dropped partial frame! (STARTED and got x%02x)", c);
+					radio->rx_frame[0]     = c;
+					radio->rx_framelen     = 1;
+					radio->rx_framestarted = false;
+					return 0;
+				default:
+					radio->rx_frame[radio->rx_framelen++] = c;
+					break;
+			}
+
+			/* Check if we exceed the frame buffer size */
+			if (radio->rx_framelen >= GRF_RADIO_FRAMESIZE)
+			{
+				radio->rx_framestarted = false;
+				radio->rx_framelen     = 0;
+				return EMSGSIZE;
+			}
+		}
+	}
+
+	return EAGAIN;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static int grf_radio_receive(struct grf_radio *radio, int timeout)
+{
+	assert(radio);
+
+	struct timespec  deadline_buf;
+	struct timespec *deadline = grf_radio_deadline(radio, timeout, &deadline_buf);
+	size_t           offset;
+	size_t           avail;
+	ssize_t          count;
+	int              retval;
+
+	/* Assemble a message from the buffered data and read all available data
+	 * from the device whenever the buffer runs dry. Wait for new data until
+	 * the deadline is reached.
+	 */
+	while ((retval = grf_radio_frame(radio)) == EAGAIN)
+	{
+		/* Read as much as fits into the contiguous free space of the
+		 * ring buffer.
+		 */
+		offset = radio->rx_head & (GRF_RADIO_RXBUFSIZE - 1);
+		avail  = GRF_RADIO_RXBUFSIZE - (radio->rx_head - radio->rx_tail);
+		if (avail > GRF_RADIO_RXBUFSIZE - offset)
+			avail = GRF_RADIO_RXBUFSIZE - offset;
+		count  = radio->ops->read(radio, radio->rx_buf + offset, avail);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0 && errno != EAGAIN)
+			return errno;
+		if (count <= 0)
+		{
+			/* Do not wait at all in non-blocking mode */
+			if (timeout == 0)
+				return EAGAIN;
+			retval = grf_radio_wait(radio, POLLIN, deadline);
+			if (retval == ETIMEDOUT)
+				grf_logging_dbg("recv: %s", "Timeout! No data received.");
+			if (retval)
+				return retval;
+			continue;
+		}
+		grf_logging_log_hex(GRF_LOGGING_DEBUG_IO, radio->rx_buf + offset, count, "read: %zd byte(s)", count);
+		radio->rx_head += count;
+	}
+
+	return retval;
+}
+
+static int grf_radio_classify(const char *payload, size_t len)
+{
+	/* Compare the length first to avoid string compares for data frames */
+	switch (len)
+	{
+		case sizeof(GRF_ANSWER_REC) - 1:
+			if (memcmp(payload, GRF_ANSWER_REC, len) == 0)
+				return GRF_FRAME_REC;
+			break;
+		case sizeof(GRF_ANSWER_DONE) - 1:
+			if (memcmp(payload, GRF_ANSWER_DONE, len) == 0)
+				return GRF_FRAME_DONE;
+			break;
+		case sizeof(GRF_ANSWER_TIMEOUT) - 1:
+			if (memcmp(payload, GRF_ANSWER_TIMEOUT, len) == 0)
+				return GRF_FRAME_TIMEOUT;
+			break;
+	}
+	if (len >= sizeof(GRF_ANSWER_VERSION) - 1 && memcmp(payload, GRF_ANSWER_VERSION, sizeof(GRF_ANSWER_VERSION) - 1) == 0)
+		return GRF_FRAME_VERSION;
+
+	return GRF_FRAME_DATA;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_radio_read(struct grf_radio *radio, char *message, size_t *len, size_t size, int timeout)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(message);
+	assert(len);
+	assert(size > 0);
+
+	*len = 0;
+	RETURN_ON_ERROR(grf_radio_receive(radio, timeout));
+
+	/* Hand out the message and make sure it is terminated */
+	if (radio->rx_framelen >= size)
+		return EMSGSIZE;
+	memcpy(message, radio->rx_frame, radio->rx_framelen);
+	message[radio->rx_framelen] = '\0';
+	*len = radio->rx_framelen;
+	radio->rx_framelen = 0;
+
+	grf_logging_dbg_hex(message, *len, "recv: %s (len=%zu)", message, *len);
+
+	return 0;
+}
+
+int grf_radio_read_frame(struct grf_radio *radio, struct grf_frame *frame, int timeout)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(frame);
+
+	RETURN_ON_ERROR(grf_radio_receive(radio, timeout));
+
+	/* Classify the frame once, the payload stays in the frame buffer */
+	if (radio->rx_framelen == 1)
+	{
+		frame->data = radio->rx_frame;
+		frame->len  = 1;
+		switch (radio->rx_frame[0])
+		{
+			case GRF_ACK:
+				frame->kind = GRF_FRAME_ACK;
+				break;
+			case GRF_NAK:
+				frame->kind = GRF_FRAME_NAK;
+				break;
+			default:
+				frame->kind = GRF_FRAME_CONTROL;
+				break;
+		}
+	}
+	else
+	{
+		frame->data = radio->rx_frame + 1;
+		frame->len  = radio->rx_framelen - 2;
+		frame->kind = grf_radio_classify(frame->data, frame->len);
+	}
+	radio->rx_framelen = 0;
+
+	grf_logging_dbg_hex(frame->data, frame->len, "recv: kind %d (len=%zu)", frame->kind, frame->len);
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_radio_writev(struct grf_radio *radio, const struct iovec *iov, int iovcnt, int timeout)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(iov);
+	assert(iovcnt > 0 && iovcnt <= IOV_MAX);
+
+	struct timespec  deadline_buf;
+	struct timespec *deadline = grf_radio_deadline(radio, timeout, &deadline_buf);
+	struct iovec     pending[iovcnt];
+	struct iovec    *cur = pending;
+	char             msg[GRF_RADIO_FRAMESIZE];
+	size_t           len = 0;
+	size_t           n;
+	ssize_t          count;
+	int              retval;
+	int              i;
+
+	/* Work on a copy to be able to advance over partially written buffers */
+	memcpy(pending, iov, iovcnt * sizeof(struct iovec));
+
+	/* Log the data sent as a whole, as long as it fits a frame */
+	for (i = 0; i < iovcnt && len < sizeof(msg); i++)
+	{
+		n = (iov[i].iov_len < sizeof(msg) - len) ? iov[i].iov_len : sizeof(msg) - len;
+		memcpy(msg + len, iov[i].iov_base, n);
+		len += n;
+	}
+	grf_logging_dbg_hex(msg, len, "send: %.*s", (int)len, msg);
+
+	while (iovcnt > 0)
+	{
+		count = radio->ops->write(radio, cur, iovcnt);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0 && errno != EAGAIN)
+			return errno;
+		if (count <= 0)
+		{
+			/* Wait until the device accepts more data */
+			retval = grf_radio_wait(radio, POLLOUT, deadline);
+			if (retval)
+				return retval;
+			continue;
+		}
+
+		/* Skip the data already written */
+		while (iovcnt > 0 && (size_t)count >= cur->iov_len)
+		{
+			count -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			cur->iov_base  = (char *)cur->iov_base + count;
+			cur->iov_len  -= count;
+		}
+	}
+
+	return 0;
+}
+
+int grf_radio_write(struct grf_radio *radio, const char *message, size_t len, int timeout)
+{
+	assert(grf_radio_is_valid(radio));
+	assert(message);
+
+	struct iovec iov;
+
+	iov.iov_base = (void *)message;
+	iov.iov_len  = len;
+
+	return grf_radio_writev(radio, &iov, 1, timeout);
+}
+
+int grf_radio_write_ctrl(struct grf_radio *radio, char ctrl, int timeout)
+{
+	assert(grf_radio_is_valid(radio));
+
+	return grf_radio_write(radio, &ctrl, sizeof(char), timeout);
+}
+
+int grf_radio_drain(struct grf_radio *radio)
+{
+	assert(grf_radio_is_valid(radio));
+
+	/* Not all backends queue data for transmission */
+	if (!radio->ops->drain)
+		return 0;
+
+	return radio->ops->drain(radio);
+}
+/*---------------------------------------------------------------------------*/
@@ -33,7 +33,10 @@
 #define __GRF_RADIO_H__
 
 #include <stdint.h>
+#include <time.h>
 #include <termios.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define GRF_BAUDRATE            B9600	/*!< Baudrate of the serial device (9600 8N1) */
 
@@ -44,21 +47,81 @@
 #define GRF_ACK                 0x06	/*!< Definition of `<ACK>` - an acknowledged message */
 #define GRF_NAK                 0x15	/*!< Definition of `<NAK>` - a not acknowledged message */
 
-#define grf_radio_is_valid(__r__) ((__r__) && (__r__)->is_initialized && (__r__)->fd >= 0) /*!< Macro to check if a radio device is initialized and sane */
+#define GRF_FRAME_CONTROL       0		/*!< Frame consisting of a single control character other than `<ACK>` and `<NAK>` */
+#define GRF_FRAME_ACK           1		/*!< Frame consisting of `<ACK>` */
+#define GRF_FRAME_NAK           2		/*!< Frame consisting of `<NAK>` */
+#define GRF_FRAME_DATA          10		/*!< Frame `<STX>...<ETX>` containing data such as IDs or registers */
+#define GRF_FRAME_VERSION       11		/*!< Frame `<STX>GI_RM_V...<ETX>` containing the firmware version */
+#define GRF_FRAME_REC           12		/*!< Frame `<STX>REC<ETX>` indicating that data recording is in process */
+#define GRF_FRAME_DONE          13		/*!< Frame `<STX>Done<ETX>` indicating the completion of a request */
+#define GRF_FRAME_TIMEOUT       19		/*!< Frame `<STX>Timeout<ETX>` indicating a timeout or the end of transmission */
+
+#define GRF_RADIO_TIMEOUT_INFINITE  -1	/*!< Timeout value to block until the operation completes */
+#define GRF_RADIO_TIMEOUT_DEFAULT   -2	/*!< Timeout value to use the timeout specified at \ref grf_radio_init() */
+#define GRF_RADIO_TIMEOUT_ACK       2000	/*!< Timeout in milliseconds for handing a request to the radio and receiving its `<ACK>` */
+
+#define GRF_RADIO_RXBUFSIZE     512		/*!< Size of the receive ring buffer (must be a power of two) */
+#define GRF_RADIO_FRAMESIZE     255		/*!< Maximum size of a single frame assembled by the framer */
+
+#define GRF_RADIO_PREFIX_UNIX   "unix:"	/*!< Device prefix selecting a Unix domain socket to a serial server */
+#define GRF_RADIO_PREFIX_REPLAY "replay:"	/*!< Device prefix selecting the replay of a recorded trace */
+
+#define grf_radio_is_valid(__r__) ((__r__) && (__r__)->is_initialized && (__r__)->ops) /*!< Macro to check if a radio device is initialized and sane */
+
+struct grf_radio;
+struct grf_comm_session;
+
+/*! Data structure representing a frame received from the radio module */
+struct grf_frame
+{
+	int          kind;		/*!< Kind of the frame (GRF_FRAME_*) */
+	const char  *data;		/*!< Payload of the frame without `<STX>` and `<ETX>`, not terminated, or the control character */
+	size_t       len;		/*!< Length of the payload */
+};
+
+/*! \brief Operations of a transport backend connecting to the radio module.
+ *
+ *  The backend only transports raw bytes, framing and timeouts are handled
+ *  by the radio layer. *read* and *write* follow the semantics of the system
+ *  calls of the same name on a non-blocking descriptor: they return -1 and set
+ *  *errno* to `EAGAIN` in case they would block. The radio layer then waits for
+ *  the descriptor returned by *get_pollfd* to become ready.
+ */
+struct grf_radio_ops
+{
+	const char *name;														/*!< Name of the backend used for logging */
+	int      (*open)(struct grf_radio *radio, const char *dev);				/*!< Open the device and set up \ref grf_radio::priv, returns 0 or an error code */
+	int      (*close)(struct grf_radio *radio);								/*!< Close the device and free \ref grf_radio::priv */
+	ssize_t  (*read)(struct grf_radio *radio, void *buf, size_t size);		/*!< Read available bytes without blocking */
+	ssize_t  (*write)(struct grf_radio *radio, const struct iovec *iov, int iovcnt);	/*!< Write bytes without blocking */
+	int      (*get_pollfd)(struct grf_radio *radio);						/*!< Get the descriptor to poll for readiness */
+	int      (*drain)(struct grf_radio *radio);								/*!< Wait until written bytes are transmitted (optional) */
+};
+
+extern const struct grf_radio_ops grf_radio_uart_ops;		/*!< Backend for serial devices and pseudo terminals */
+extern const struct grf_radio_ops grf_radio_socket_ops;		/*!< Backend for Unix domain sockets to a serial server */
+extern const struct grf_radio_ops grf_radio_replay_ops;		/*!< Backend replaying a trace recorded from a real radio */
 
 /*! Data structure representing a radio device */
 struct grf_radio
 {
-	char           *dev;			/*!< Path to the serial device attached to the radio */
-	int             fd;				/*!< File descriptor of the serial device attached to the radio */
-	bool            is_initialized;	/*!< Status flag if the initialization of the serial device is complete */
+	char           *dev;			/*!< Path to the device attached to the radio */
+	bool            is_initialized;	/*!< Status flag if the initialization of the device is complete */
 
-	uint32_t        timeout_user;	/*!< Timeout in seconds as specified by the user */
-	uint8_t         timeout_tty;	/*!< Internal timeout in 1/10 seconds to reproduce the user timeout in combination with \ref timeout_repeats */
-	uint8_t         timeout_repeats;/*!< Number of repetitions required to reproduce the user timeout with the limited TTY timeout \ref timeout_tty */
+	const struct grf_radio_ops *ops;/*!< Transport backend used to talk to the radio */
+	void           *priv;			/*!< Private data of the transport backend */
 
-	struct termios  tty_attr;		/*!< Setting actually used for the serial device */
-	struct termios  tty_attr_saved;	/*!< Saved setting of the serial device to restore on exit */
+	int             timeout;		/*!< Default timeout in milliseconds as specified by the user (\ref GRF_RADIO_TIMEOUT_INFINITE for infinite) */
+
+	char            rx_buf[GRF_RADIO_RXBUFSIZE];	/*!< Receive ring buffer holding bytes not yet consumed by the framer */
+	size_t          rx_head;		/*!< Write position of the receive ring buffer (free running) */
+	size_t          rx_tail;		/*!< Read position of the receive ring buffer (free running) */
+	char            rx_frame[GRF_RADIO_FRAMESIZE];	/*!< Frame currently assembled by the framer */
+	size_t          rx_framelen;	/*!< Number of bytes in \ref rx_frame */
+	bool            rx_framestarted;/*!< Status flag if the framer has seen a `<STX>` but no `<ETX>` yet */
+
+	struct grf_comm_session *session;	/*!< State of the protocol kept across requests, private to the communication layer (NULL before \ref grf_comm_init()) */
+	void          (*session_free)(struct grf_comm_session *session);	/*!< Function freeing \ref session on \ref grf_radio_exit() */
 
 	char           *firmware_version;/*!< Firmware version of the radio device */
 };
@@ -67,7 +130,17 @@ struct grf_radio
  *
  *  This function initializes the radio data structure and
  *  perform the setup of the serial interface to communicate
- *  with the radio device.
+ *  with the radio device. The backend is selected by the prefix
+ *  of *dev*: `unix:<path>` connects to a serial server via a
+ *  Unix domain socket, everything else is opened as a serial
+ *  device or pseudo terminal.
+ *
+ *  `replay:[fast:][strict:]<trace>` acts as a virtual radio replaying
+ *  a trace in the format found in `protocols/`. Written data is checked
+ *  against the recorded writes and the recorded reads are played back
+ *  with their original timing or, with `fast:`, as fast as possible.
+ *  Parts of the trace not matching the written data are skipped with a
+ *  warning unless `strict:` is given.
  *
  *  \param radio	radio device structure to initialize
  *  \param dev		path to the serial device attached to the radio
@@ -76,54 +149,125 @@ struct grf_radio
  */
 int grf_radio_init(struct grf_radio *radio, const char *dev, unsigned int timeout);
 
+/*! \brief Initialization of the radio device using the given backend.
+ *
+ *  This function initializes the radio data structure just like
+ *  \ref grf_radio_init(), but uses the given transport backend.
+ *
+ *  \param radio	radio device structure to initialize
+ *  \param ops		transport backend to use
+ *  \param dev		backend specific device name
+ *  \param timeout	communication timeout in seconds (0 for infinite)
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_radio_init_ops(struct grf_radio *radio, const struct grf_radio_ops *ops, const char *dev, unsigned int timeout);
+
 /*! \brief Deinitialization of the radio device.
  *
- *  This function ends the communication with the radio device,
- *  closes the serial interface and resets the radio data structure.
+ *  This function ends the communication with the radio device, waits
+ *  until pending output is transmitted using \ref grf_radio_drain(),
+ *  closes the transport backend and resets the radio data structure.
  *
  *  \param radio	radio device to deinitialize
  *  \returns		0 on success and an error code otherwise
  */
 int grf_radio_exit(struct grf_radio *radio);
 
+/*! \brief Get the descriptor to wait on for data from the radio device.
+ *
+ *  The returned descriptor becomes readable whenever new data from the radio
+ *  device is available, e.g. to integrate the radio into an event loop. Use
+ *  \ref grf_radio_read() with a timeout of 0 to consume the data.
+ *
+ *  \param radio	radio device to get the descriptor of
+ *  \returns		the descriptor to poll for `POLLIN`
+ */
+int grf_radio_get_pollfd(struct grf_radio *radio);
+
 /*! \brief Read a message from the radio device.
  *
  *  This function receives a message from the radio device. It blocks
- *  either until the message is received or the timeout specified
- *  at \ref grf_radio_init() is reached.
+ *  either until the message is received or the given timeout is reached.
+ *  All bytes available at the device are read at once and buffered; bytes
+ *  following the returned message are kept for the next call. A timeout
+ *  of 0 only returns a message that can be assembled from the data already
+ *  available and returns `EAGAIN` otherwise.
  *
  *  \param radio	radio device to read from
  *  \param message	buffer of size *size* to store the received data in
  *  \param len		buffer to store the length of the received message
  *  \param size		capacity of the *message* buffer
+ *  \param timeout	timeout in milliseconds or one of GRF_RADIO_TIMEOUT_*
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_radio_read(struct grf_radio *radio, char *message, size_t *len, size_t size, int timeout);
+
+/*! \brief Read a frame from the radio device.
+ *
+ *  This function behaves like \ref grf_radio_read() but hands out the
+ *  received frame classified by its kind instead of copying it. The payload
+ *  stays valid until the next read from the radio device.
+ *
+ *  \param radio	radio device to read from
+ *  \param frame	frame structure to store the received frame in
+ *  \param timeout	timeout in milliseconds or one of GRF_RADIO_TIMEOUT_*
  *  \returns		0 on success and an error code otherwise
  */
-int grf_radio_read(struct grf_radio *radio, char *message, size_t *len, size_t size);
+int grf_radio_read_frame(struct grf_radio *radio, struct grf_frame *frame, int timeout);
 
 /*! \brief Write a message to the radio device.
  *
  *  This function sends a message to the radio device. It blocks
- *  either until the message is sent or the timeout specified
- *  at \ref grf_radio_init() is reached.
+ *  either until the message is handed to the device or the given
+ *  timeout is reached.
  *
  *  \param radio	radio device to read from
  *  \param message	message of length *len* to send
  *  \param len		length of the message to send
+ *  \param timeout	timeout in milliseconds or one of GRF_RADIO_TIMEOUT_*
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_radio_write(struct grf_radio *radio, const char *message, size_t len, int timeout);
+
+/*! \brief Write a sequence of buffers to the radio device.
+ *
+ *  This function sends the concatenation of the given buffers to the radio
+ *  device using as few system calls as possible. It blocks either until all
+ *  data is handed to the device or the given timeout is reached. The data
+ *  might still be queued for transmission, use \ref grf_radio_drain() if
+ *  it has to be on the wire.
+ *
+ *  \param radio	radio device to write to
+ *  \param iov		array of *iovcnt* buffers to send
+ *  \param iovcnt	number of buffers in *iov*
+ *  \param timeout	timeout in milliseconds or one of GRF_RADIO_TIMEOUT_*
  *  \returns		0 on success and an error code otherwise
  */
-int grf_radio_write(struct grf_radio *radio, const char *message, size_t len);
+int grf_radio_writev(struct grf_radio *radio, const struct iovec *iov, int iovcnt, int timeout);
 
 /*! \brief Write a single (control) character to the radio device.
  *
  *  This function sends a single (control) character to the radio device.
- *  It blocks either until the message is sent or the timeout specified
- *  at \ref grf_radio_init() is reached.
+ *  It blocks either until the character is handed to the device or the
+ *  given timeout is reached.
  *
  *  \param radio	radio device to read from
  *  \param ctrl		control character to send
+ *  \param timeout	timeout in milliseconds or one of GRF_RADIO_TIMEOUT_*
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_radio_write_ctrl(struct grf_radio *radio, char ctrl, int timeout);
+
+/*! \brief Wait until all written data is transmitted.
+ *
+ *  This function blocks until all data written to the radio device
+ *  is actually transmitted. Writing does not wait for the transmission,
+ *  so call this function only where the protocol requires it.
+ *
+ *  \param radio	radio device to drain
  *  \returns		0 on success and an error code otherwise
  */
-int grf_radio_write_ctrl(struct grf_radio *radio, char ctrl);
+int grf_radio_drain(struct grf_radio *radio);
 
 #endif /* __GRF_RADIO_H__ */
 /* @} */
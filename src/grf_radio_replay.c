@@ -0,0 +1,681 @@
+/*
+ * Radio module interface replaying recorded communication
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "grf.h"
+#include "grf_radio.h"
+#include "grf_logging.h"
+
+#define GRF_REPLAY_OPT_FAST     "fast:"     /* Option to replay as fast as possible */
+#define GRF_REPLAY_OPT_STRICT   "strict:"   /* Option to not skip unmatched parts of the trace */
+
+#define GRF_REPLAY_HEX_COLUMN    4          /* Column of the hex dump in session1 style traces */
+#define GRF_REPLAY_HEX_WIDTH    48          /* Width of the hex dump in session1 style traces */
+#define GRF_REPLAY_MAXPENDING   16          /* Maximum number of outstanding read requests in IRP traces */
+
+/* Single chunk of data written to or read from the radio in the trace */
+struct grf_replay_event
+{
+	bool     write;		/* Direction of the transfer, true if written to the radio */
+	bool     masked;	/* Control characters are masked as '.' in the trace */
+	int64_t  time;		/* Time of the transfer in milliseconds relative to the trace */
+	size_t   offset;	/* Offset of the data in the data pool */
+	size_t   len;		/* Length of the data */
+};
+
+/* Private data of the replay backend */
+struct grf_replay
+{
+	int                      timerfd;	/* Timer signaling that recorded data is due */
+	bool                     fast;		/* Replay as fast as possible instead of using the original timing */
+	bool                     strict;	/* Report every deviation from the trace as error */
+
+	struct grf_replay_event *events;	/* Events of the trace */
+	size_t                   count;		/* Number of events in the trace */
+	char                    *data;		/* Data pool of all events */
+	size_t                   size;		/* Size of the data pool */
+
+	size_t                   cur;		/* Index of the next event to replay */
+	size_t                   pos;		/* Position within the next event */
+	struct timespec          base;		/* Point in time the last recorded write completed */
+	int64_t                  base_rec;	/* Recorded time of the last write */
+};
+
+/*---------------------------------------------------------------------------*/
+static int grf_replay_add_event(struct grf_replay *replay, bool write, bool masked, int64_t time)
+{
+	assert(replay);
+
+	struct grf_replay_event *events;
+
+	events = realloc(replay->events, (replay->count + 1) * sizeof(struct grf_replay_event));
+	if (!events)
+		return ENOMEM;
+	replay->events = events;
+
+	events[replay->count].write  = write;
+	events[replay->count].masked = masked;
+	events[replay->count].time   = time;
+	events[replay->count].offset = replay->size;
+	events[replay->count].len    = 0;
+	replay->count++;
+
+	return 0;
+}
+
+static int grf_replay_add_data(struct grf_replay *replay, const char *data, size_t len)
+{
+	assert(replay);
+	assert(replay->count > 0);
+	assert(data);
+
+	char *pool;
+
+	pool = realloc(replay->data, replay->size + len);
+	if (!pool)
+		return ENOMEM;
+	replay->data = pool;
+
+	memcpy(replay->data + replay->size, data, len);
+	replay->size += len;
+	replay->events[replay->count - 1].len += len;
+
+	return 0;
+}
+
+static int grf_replay_parse_hexdump(struct grf_replay *replay, const char *line)
+{
+	assert(replay);
+	assert(line);
+
+	char         hex[GRF_REPLAY_HEX_WIDTH + 1];
+	char         data[GRF_REPLAY_HEX_WIDTH / 3];
+	char        *token;
+	char        *saveptr;
+	char        *end;
+	size_t       len = 0;
+
+	/* Only parse the hex dump, the ASCII part might look like hex as well */
+	strncpy(hex, line + GRF_REPLAY_HEX_COLUMN, GRF_REPLAY_HEX_WIDTH);
+	hex[GRF_REPLAY_HEX_WIDTH] = '\0';
+
+	for (token = strtok_r(hex, " \t\r\n", &saveptr); token; token = strtok_r(NULL, " \t\r\n", &saveptr))
+	{
+		data[len++] = strtoul(token, &end, 16);
+		if (*end != '\0' || end - token != 2)
+			return EINVAL;
+	}
+
+	return grf_replay_add_data(replay, data, len);
+}
+
+static int grf_replay_parse(struct grf_replay *replay, FILE *file)
+{
+	assert(replay);
+	assert(file);
+
+	char        *line = NULL;
+	size_t       linesize = 0;
+	char         direction[16];
+	char        *payload;
+	struct tm    tm;
+	unsigned int seq;
+	unsigned int hour, min, sec;
+	unsigned int pending[GRF_REPLAY_MAXPENDING];
+	size_t       npending = 0;
+	size_t       len;
+	int64_t      time;
+	int64_t      day = 0;
+	int64_t      last = 0;
+	bool         inevent = false;
+	int          consumed;
+	int          ret = 0;
+	size_t       i;
+
+	while (!ret && getline(&line, &linesize, file) > 0)
+	{
+		/* Session1 style: "[MM/DD/YYYY HH:MM:SS] Written data" followed by hex dump lines */
+		memset(&tm, 0, sizeof(struct tm));
+		consumed = 0;
+		if (sscanf(line, "[%d/%d/%d %d:%d:%d] %15s data%n", &tm.tm_mon, &tm.tm_mday, &tm.tm_year,
+		           &tm.tm_hour, &tm.tm_min, &tm.tm_sec, direction, &consumed) == 7 && consumed > 0)
+		{
+			tm.tm_mon  -= 1;
+			tm.tm_year -= 1900;
+			tm.tm_isdst = -1;
+			time = (int64_t)mktime(&tm) * 1000;
+			ret = grf_replay_add_event(replay, strcmp(direction, "Written") == 0, false, time);
+			inevent = true;
+			continue;
+		}
+		if (inevent && strncmp(line, "    ", GRF_REPLAY_HEX_COLUMN) == 0 && isxdigit(line[GRF_REPLAY_HEX_COLUMN]))
+		{
+			ret = grf_replay_parse_hexdump(replay, line);
+			continue;
+		}
+		inevent = false;
+
+		/* Session2 style IRP traces: "SEQ  HH:MM:SS  PROCESS  IRP_MJ_WRITE  PORT  Length N: DATA"
+		 * and "SEQ  HH:MM:SS  SUCCESS  Length N: DATA" completing an earlier IRP_MJ_READ.
+		 * Some traces show the completed read in the IRP_MJ_READ line itself. Control
+		 * characters are masked as '.' and are restored after parsing.
+		 */
+		if (sscanf(line, "%u %u:%u:%u", &seq, &hour, &min, &sec) != 4)
+			continue;
+		time = ((int64_t)hour * 3600 + min * 60 + sec) * 1000;
+		if (time + day < last)
+			day += 24 * 3600 * 1000;
+		time += day;
+		last  = time;
+
+		payload  = strstr(line, "Length ");
+		consumed = 0;
+		if (!payload || sscanf(payload, "Length %zu:%n", &len, &consumed) != 1 || consumed < 1)
+		{
+			if (strstr(line, "IRP_MJ_READ") && npending < GRF_REPLAY_MAXPENDING)
+				pending[npending++] = seq;
+			continue;
+		}
+		payload += consumed + 1;
+		if (len < 1 || strlen(payload) < len)
+			continue;
+
+		if (strstr(line, "IRP_MJ_WRITE") || strstr(line, "IRP_MJ_READ"))
+		{
+			ret = grf_replay_add_event(replay, strstr(line, "IRP_MJ_WRITE") != NULL, true, time);
+			if (!ret)
+				ret = grf_replay_add_data(replay, payload, len);
+			continue;
+		}
+		for (i = 0; i < npending; i++)
+		{
+			if (pending[i] != seq)
+				continue;
+			pending[i] = pending[--npending];
+			ret = grf_replay_add_event(replay, false, true, time);
+			if (!ret)
+				ret = grf_replay_add_data(replay, payload, len);
+			break;
+		}
+	}
+	free(line);
+
+	return ret;
+}
+
+static char grf_replay_next_masked(struct grf_replay *replay, size_t event, size_t pos)
+{
+	assert(replay);
+
+	/* Look ahead for the next read character, possibly in a later event */
+	for (pos++; event < replay->count; event++, pos = 0)
+	{
+		if (replay->events[event].write)
+			continue;
+		if (pos < replay->events[event].len)
+			return replay->data[replay->events[event].offset + pos];
+	}
+
+	return '\0';
+}
+
+static void grf_replay_unmask(struct grf_replay *replay)
+{
+	assert(replay);
+
+	struct grf_replay_event *ev;
+	char                    *c;
+	char                     next;
+	bool                     inframe  = false;
+	bool                     register_frame = false;
+	size_t                   framelen = 0;
+	char                     prev     = '\0';
+	size_t                   i, j;
+
+	for (i = 0; i < replay->count; i++)
+	{
+		ev = &replay->events[i];
+		if (!ev->masked)
+			continue;
+
+		/* Written data are always complete frames, with the init sequence
+		 * starting with an additional <NUL>.
+		 */
+		if (ev->write)
+		{
+			c = replay->data + ev->offset;
+			if (ev->len > 2 && c[0] == '.' && c[1] == '.')
+			{
+				c[0] = GRF_NUL;
+				c[1] = GRF_STX;
+			}
+			else if (c[0] == '.')
+			{
+				c[0] = GRF_STX;
+			}
+			if (ev->len > 1 && c[ev->len - 1] == '.')
+				c[ev->len - 1] = GRF_ETX;
+			continue;
+		}
+
+		/* Read data is restored by following the framing */
+		for (j = 0; j < ev->len; j++)
+		{
+			c    = replay->data + ev->offset + j;
+			next = grf_replay_next_masked(replay, i, j);
+			if (*c != '.')
+			{
+				framelen++;
+				prev = *c;
+				continue;
+			}
+
+			if (inframe)
+			{
+				/* A literal dot is followed by further content */
+				if (isprint(next) && next != '.')
+				{
+					framelen++;
+					prev = *c;
+					continue;
+				}
+				*c = GRF_ETX;
+				inframe = false;
+				register_frame = (framelen == 13);
+			}
+			else if (isprint(next) && next != '.')
+			{
+				*c = GRF_STX;
+				inframe  = true;
+				framelen = 0;
+			}
+			else if (prev == GRF_ETX && register_frame)
+			{
+				*c = GRF_CONT;
+			}
+			else
+			{
+				*c = GRF_ACK;
+			}
+			prev = *c;
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static int grf_replay_arm(struct grf_replay *replay)
+{
+	assert(replay);
+
+	struct itimerspec        timer;
+	struct grf_replay_event *ev;
+	int64_t                  delta;
+
+	memset(&timer, 0, sizeof(struct itimerspec));
+
+	/* Signal the next recorded read when it is due, a disarmed timer
+	 * means that the trace waits for data to be written.
+	 */
+	if (replay->cur < replay->count && !replay->events[replay->cur].write)
+	{
+		ev = &replay->events[replay->cur];
+		if (replay->fast)
+		{
+			timer.it_value.tv_nsec = 1;
+		}
+		else
+		{
+			delta = ev->time - replay->base_rec;
+			timer.it_value.tv_sec  = replay->base.tv_sec  + delta / 1000;
+			timer.it_value.tv_nsec = replay->base.tv_nsec + (delta % 1000) * 1000000L;
+			if (timer.it_value.tv_nsec >= 1000000000L)
+			{
+				timer.it_value.tv_sec  += 1;
+				timer.it_value.tv_nsec -= 1000000000L;
+			}
+			if (timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0)
+				timer.it_value.tv_nsec = 1;
+		}
+	}
+
+	if (timerfd_settime(replay->timerfd, TFD_TIMER_ABSTIME, &timer, NULL))
+		return errno;
+
+	return 0;
+}
+
+static bool grf_replay_is_due(struct grf_replay *replay, const struct timespec *now)
+{
+	assert(replay);
+	assert(now);
+
+	struct grf_replay_event *ev = &replay->events[replay->cur];
+	int64_t                  elapsed;
+
+	if (replay->fast)
+		return true;
+
+	elapsed = (now->tv_sec - replay->base.tv_sec) * 1000 + (now->tv_nsec - replay->base.tv_nsec) / 1000000L;
+
+	return elapsed >= ev->time - replay->base_rec;
+}
+
+static bool grf_replay_match(struct grf_replay *replay, size_t *cur, size_t *pos, const struct iovec *iov, int iovcnt)
+{
+	assert(replay);
+	assert(cur);
+	assert(pos);
+	assert(iov);
+
+	struct grf_replay_event *ev;
+	const char              *data;
+	size_t                   i;
+	int                      j;
+
+	/* Compare the data with the recorded writes, possibly spanning multiple
+	 * events. The buffers are written at once, so they are matched as a whole.
+	 */
+	for (j = 0; j < iovcnt; j++)
+	{
+		data = iov[j].iov_base;
+		i    = 0;
+		while (i < iov[j].iov_len)
+		{
+			if (*cur >= replay->count)
+				return false;
+			ev = &replay->events[*cur];
+			if (!ev->write)
+				return false;
+			if (*pos == ev->len)
+			{
+				(*cur)++;
+				*pos = 0;
+				continue;
+			}
+			if (replay->data[ev->offset + *pos] != data[i])
+				return false;
+			(*pos)++;
+			i++;
+		}
+	}
+
+	/* Advance to the next event if the write is complete */
+	if (*cur < replay->count && *pos == replay->events[*cur].len)
+	{
+		(*cur)++;
+		*pos = 0;
+	}
+
+	return true;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static int grf_radio_replay_open(struct grf_radio *radio, const char *dev)
+{
+	assert(radio);
+	assert(dev);
+
+	struct grf_replay *replay;
+	FILE              *file;
+	int                ret;
+
+	replay = calloc(1, sizeof(struct grf_replay));
+	if (!replay)
+		return ENOMEM;
+
+	/* Parse the options preceding the path of the trace */
+	while (true)
+	{
+		if (strncmp(dev, GRF_REPLAY_OPT_FAST, strlen(GRF_REPLAY_OPT_FAST)) == 0)
+		{
+			replay->fast = true;
+			dev += strlen(GRF_REPLAY_OPT_FAST);
+		}
+		else if (strncmp(dev, GRF_REPLAY_OPT_STRICT, strlen(GRF_REPLAY_OPT_STRICT)) == 0)
+		{
+			replay->strict = true;
+			dev += strlen(GRF_REPLAY_OPT_STRICT);
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	/* Load the trace */
+	grf_logging_info("Loading trace %s...", dev);
+	file = fopen(dev, "r");
+	if (!file)
+	{
+		ret = errno;
+		free(replay);
+		return ret;
+	}
+	ret = grf_replay_parse(replay, file);
+	fclose(file);
+	if (!ret && replay->count < 1)
+		ret = ENODATA;
+	if (ret)
+	{
+		free(replay->events);
+		free(replay->data);
+		free(replay);
+		return ret;
+	}
+	grf_replay_unmask(replay);
+	grf_logging_dbg("    got %zu events with %zu bytes...", replay->count, replay->size);
+
+	replay->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (replay->timerfd < 0)
+	{
+		ret = errno;
+		free(replay->events);
+		free(replay->data);
+		free(replay);
+		return ret;
+	}
+	radio->priv = replay;
+
+	return 0;
+}
+
+static int grf_radio_replay_close(struct grf_radio *radio)
+{
+	assert(radio);
+	assert(radio->priv);
+
+	struct grf_replay *replay = radio->priv;
+
+	if (replay->cur < replay->count)
+		grf_logging_info("Trace ended at event %zu of %zu", replay->cur, replay->count);
+
+	close(replay->timerfd);
+	free(replay->events);
+	free(replay->data);
+	free(replay);
+	radio->priv = NULL;
+
+	return 0;
+}
+
+static ssize_t grf_radio_replay_read(struct grf_radio *radio, void *buf, size_t size)
+{
+	assert(radio);
+	assert(radio->priv);
+
+	struct grf_replay       *replay = radio->priv;
+	struct grf_replay_event *ev;
+	struct timespec          now;
+	size_t                   count = 0;
+	size_t                   n;
+
+	/* Hand out all recorded reads that are due */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (count < size && replay->cur < replay->count && !replay->events[replay->cur].write)
+	{
+		ev = &replay->events[replay->cur];
+		if (!grf_replay_is_due(replay, &now))
+			break;
+
+		n = ev->len - replay->pos;
+		if (n > size - count)
+			n = size - count;
+		memcpy((char *)buf + count, replay->data + ev->offset + replay->pos, n);
+		count       += n;
+		replay->pos += n;
+		if (replay->pos == ev->len)
+		{
+			replay->cur++;
+			replay->pos = 0;
+		}
+	}
+
+	/* Rearm the timer for the next recorded read */
+	if (grf_replay_arm(replay))
+		return -1;
+
+	if (count > 0)
+		return count;
+
+	/* In fast mode there is no point in waiting if the trace
+	 * does not contain any further data to read.
+	 */
+	if (replay->fast && (replay->cur >= replay->count || replay->events[replay->cur].write))
+		errno = ETIMEDOUT;
+	else
+		errno = EAGAIN;
+
+	return -1;
+}
+
+static ssize_t grf_radio_replay_write(struct grf_radio *radio, const struct iovec *iov, int iovcnt)
+{
+	assert(radio);
+	assert(radio->priv);
+
+	struct grf_replay *replay = radio->priv;
+	char               msg[GRF_RADIO_FRAMESIZE];
+	size_t             total = 0;
+	size_t             len;
+	size_t             skipped;
+	size_t             start;
+	size_t             cur;
+	size_t             pos;
+	bool               found;
+	int                i;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	/* Unread data of the trace is discarded, the code under test
+	 * did not wait for it.
+	 */
+	skipped = replay->cur;
+	while (replay->cur < replay->count && !replay->events[replay->cur].write)
+	{
+		replay->cur++;
+		replay->pos = 0;
+	}
+	if (replay->cur != skipped)
+	{
+		grf_logging_warn("replay: Discarded %zu unread event(s)", replay->cur - skipped);
+		if (replay->strict)
+			goto mismatch;
+	}
+
+	/* Check the written data against the trace. In case it does not
+	 * match, look for the next matching write to skip parts of the trace
+	 * not covered by the code under test, e.g. separate sessions.
+	 */
+	cur   = replay->cur;
+	pos   = replay->pos;
+	found = grf_replay_match(replay, &cur, &pos, iov, iovcnt);
+	for (start = replay->cur + 1; !found && !replay->strict && replay->pos == 0 && start < replay->count; start++)
+	{
+		cur   = start;
+		pos   = 0;
+		found = replay->events[start].write && grf_replay_match(replay, &cur, &pos, iov, iovcnt);
+		if (found)
+			grf_logging_warn("replay: Skipped %zu event(s) to match written data", start - replay->cur);
+	}
+	if (!found)
+		goto mismatch;
+	replay->cur = cur;
+	replay->pos = pos;
+
+	/* The recorded answers are timed relative to this write */
+	clock_gettime(CLOCK_MONOTONIC, &replay->base);
+	replay->base_rec = replay->events[(pos > 0 || cur == 0) ? cur : cur - 1].time;
+
+	if (grf_replay_arm(replay))
+		return -1;
+
+	return total;
+
+mismatch:
+	/* Report the data written as a whole, as long as it fits a frame */
+	total = 0;
+	for (i = 0; i < iovcnt && total < sizeof(msg); i++)
+	{
+		len = (iov[i].iov_len < sizeof(msg) - total) ? iov[i].iov_len : sizeof(msg) - total;
+		memcpy(msg + total, iov[i].iov_base, len);
+		total += len;
+	}
+	grf_logging_err_hex(msg, total, "replay: Written data does not match trace at event %zu", replay->cur);
+	errno = EIO;
+	return -1;
+}
+
+static int grf_radio_replay_get_pollfd(struct grf_radio *radio)
+{
+	assert(radio);
+	assert(radio->priv);
+
+	struct grf_replay *replay = radio->priv;
+
+	return replay->timerfd;
+}
+/*---------------------------------------------------------------------------*/
+
+const struct grf_radio_ops grf_radio_replay_ops =
+{
+	.name       = "replay",
+	.open       = grf_radio_replay_open,
+	.close      = grf_radio_replay_close,
+	.read       = grf_radio_replay_read,
+	.write      = grf_radio_replay_write,
+	.get_pollfd = grf_radio_replay_get_pollfd,
+	.drain      = NULL,
+};
@@ -0,0 +1,160 @@
+/*
+ * Radio module interface via Unix domain socket
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "grf.h"
+#include "grf_radio.h"
+#include "grf_logging.h"
+
+/* Private data of the socket backend */
+struct grf_socket
+{
+	int fd;		/* File descriptor of the socket connected to the serial server */
+};
+
+/*---------------------------------------------------------------------------*/
+static int grf_radio_socket_open(struct grf_radio *radio, const char *dev)
+{
+	assert(radio);
+	assert(dev);
+
+	struct grf_socket  *sock;
+	struct sockaddr_un  addr;
+	int                 ret;
+
+	/* Check if the path fits the socket address */
+	if (strlen(dev) >= sizeof(addr.sun_path))
+		return ENAMETOOLONG;
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, dev);
+
+	sock = malloc(sizeof(struct grf_socket));
+	if (!sock)
+		return ENOMEM;
+
+	/* Connect to the serial server. The socket is switched to non-blocking
+	 * mode only afterwards to keep connecting simple.
+	 */
+	grf_logging_info("Connecting to %s...", dev);
+	sock->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock->fd < 0)
+	{
+		ret = errno;
+		free(sock);
+		return ret;
+	}
+	if (connect(sock->fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) ||
+	    fcntl(sock->fd, F_SETFL, O_NONBLOCK))
+	{
+		ret = errno;
+		close(sock->fd);
+		free(sock);
+		return ret;
+	}
+	grf_logging_dbg("    got fd=%d...", sock->fd);
+	radio->priv = sock;
+
+	return 0;
+}
+
+static int grf_radio_socket_close(struct grf_radio *radio)
+{
+	assert(radio);
+	assert(radio->priv);
+
+	struct grf_socket *sock = radio->priv;
+
+	close(sock->fd);
+	free(sock);
+	radio->priv = NULL;
+
+	return 0;
+}
+
+static ssize_t grf_radio_socket_read(struct grf_radio *radio, void *buf, size_t size)
+{
+	assert(radio);
+	assert(radio->priv);
+
+	struct grf_socket *sock = radio->priv;
+	ssize_t            count;
+
+	/* A closed connection is an error rather than missing data */
+	count = read(sock->fd, buf, size);
+	if (count == 0)
+	{
+		errno = ECONNRESET;
+		return -1;
+	}
+
+	return count;
+}
+
+static ssize_t grf_radio_socket_write(struct grf_radio *radio, const struct iovec *iov, int iovcnt)
+{
+	assert(radio);
+	assert(radio->priv);
+
+	struct grf_socket *sock = radio->priv;
+	struct msghdr      msg;
+
+	/* Use sendmsg() to not get killed by SIGPIPE if the server is gone */
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov    = (struct iovec *)iov;
+	msg.msg_iovlen = iovcnt;
+
+	return sendmsg(sock->fd, &msg, MSG_NOSIGNAL);
+}
+
+static int grf_radio_socket_get_pollfd(struct grf_radio *radio)
+{
+	assert(radio);
+	assert(radio->priv);
+
+	struct grf_socket *sock = radio->priv;
+
+	return sock->fd;
+}
+/*---------------------------------------------------------------------------*/
+
+const struct grf_radio_ops grf_radio_socket_ops =
+{
+	.name       = "socket",
+	.open       = grf_radio_socket_open,
+	.close      = grf_radio_socket_close,
+	.read       = grf_radio_socket_read,
+	.write      = grf_radio_socket_write,
+	.get_pollfd = grf_radio_socket_get_pollfd,
+	.drain      = NULL,
+};
@@ -1,5 +1,5 @@
 /*
- * Radio module interface
+ * Radio module interface via UART
  *
  * This file is part of the grfutils project.
  *
@@ -35,50 +35,12 @@
 #include "grf_radio.h"
 #include "grf_logging.h"
 
-/*---------------------------------------------------------------------------*/
-static int grf_uart_set_timeout(int fd, cc_t timeout)
+/* Private data of the UART backend */
+struct grf_uart
 {
-	assert(fd >= 0);
-
-	struct termios tty_attr;
-
-	grf_logging_info("Setting timeout of %d to %.1f seconds...", fd, timeout/10.0f);
-
-	/* In case no timeout is given, we always block to retrieve at
-	 * least one character.
-	 */
-	if (tcgetattr(fd, &tty_attr))
-	{
-		grf_logging_err("Getting TTY attributes of %d failed: %s", fd, strerror(errno));
-		return errno;
-	}
-
-	if (timeout == 0)
-		tty_attr.c_cc[VMIN] = 1;
-	else
-		tty_attr.c_cc[VMIN] = 0;
-
-	tty_attr.c_cc[VTIME] = timeout;
-
-	grf_logging_dbg("  vmin  = %u...", tty_attr.c_cc[VMIN]);
-	grf_logging_dbg("  vtime = %u...", tty_attr.c_cc[VTIME]);
-
-	if (tcsetattr(fd, TCSANOW, &tty_attr))
-	{
-		grf_logging_err("Setting timeout of %d to %u failed: %s", fd, timeout, strerror(errno));
-		return errno;
-	}
-
-	/* Make sure settings are actually transmitted */
-	if (tcdrain(fd))
-	{
-		grf_logging_err("Draining data of TTY %d failed: %s", fd, strerror(errno));
-		return errno;
-	}
-
-	return 0;
-}
-/*---------------------------------------------------------------------------*/
+	int             fd;				/* File descriptor of the serial device attached to the radio */
+	struct termios  tty_attr_saved;	/* Saved setting of the serial device to restore on exit */
+};
 
 /*---------------------------------------------------------------------------*/
 static int grf_uart_open(const char *dev)
@@ -87,11 +49,11 @@ static int grf_uart_open(const char *dev)
 
 	int fd;
 
-	/* Open the device for read and write and prevent it from
-	 * becoming a control TTY.
+	/* Open the device for non-blocking read and write and prevent it
+	 * from becoming a control TTY. Timeouts are handled via poll().
 	 */
 	grf_logging_info("Opening %s...", dev);
-	fd = open(dev, O_RDWR | O_NOCTTY);
+	fd = open(dev, O_RDWR | O_NOCTTY | O_NONBLOCK);
 	if (fd < 0)
 		return fd;
 
@@ -100,6 +62,7 @@ static int grf_uart_open(const char *dev)
 	/* Make sure the given device is a tty. */
 	if (!isatty(fd))
 	{
+		close(fd);
 		errno = ENOTTY;
 		return -1;
 	}
@@ -141,9 +104,9 @@ static int grf_uart_setup(int fd)
 		return errno;
 	}
 
-	/* Set port to blocking */
+	/* Return whatever data is available, the port is non-blocking */
 	tty_attr.c_cc[VMIN]  = 0;
-	tty_attr.c_cc[VTIME] = 10;
+	tty_attr.c_cc[VTIME] = 0;
 
 	/* Actually set the new configuration */
 	if (tcsetattr(fd, TCSANOW, &tty_attr))
@@ -167,295 +130,125 @@ static void grf_uart_close(int fd)
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
-int grf_radio_init(struct grf_radio *radio, const char *dev, unsigned int timeout)
+static int grf_radio_uart_open(struct grf_radio *radio, const char *dev)
 {
 	assert(radio);
 	assert(dev);
 
-	uint32_t t_user = timeout * 10;
-	uint32_t i;
-	int      ret;
-
-	grf_logging_info("Initializing device %s", dev);
+	struct grf_uart *uart;
+	int              ret;
 
-	/* Reset the radio structure */
-	memset(radio, 0, sizeof(struct grf_radio));
-	radio->is_initialized = false;
-
-	/* Copy the given data to the radio */
-	radio->dev          = strdup(dev);
-	radio->timeout_user = t_user;
-	if (!radio->dev)
+	uart = malloc(sizeof(struct grf_uart));
+	if (!uart)
 		return ENOMEM;
 
-	/* The TTY layer handles the timeout as unsigned char, thus limiting the
-	 * maximal timeout to 25.5 seconds. We sometimes, especially during
-	 * read-out of devices, require longer timeouts up to 60 seconds.
-	 * Therefore, we have to split the timeout into multiple smaller ones
-	 * and repeat reading.
-	 */
-	if (timeout <= 25)
-	{
-		radio->timeout_tty     = t_user;
-		radio->timeout_repeats = 1;
-	}
-	else
-	{
-		/* Calculate the greatest common divisor between the user specified
-		 * timeout and the maximum timeout of the TTY layer (255). We use
-		 * trial divisions in this case due to the limited number of trials.
-		 * NOTE: This loop is quaranteed to end latest at i=10 due to the
-		 *       multiplication t_user = timeout * 10.
-		 */
-		i = 256;
-		while (t_user % --i != 0);
-		radio->timeout_tty     = i;
-		radio->timeout_repeats = t_user / i;
-	}
-	grf_logging_dbg("init: timeout %u 1/10s --> %u 1/10s * %u", t_user, radio->timeout_tty, radio->timeout_repeats);
-
 	/* Open UART and store the current UART setting to later restore them */
-	radio->fd = grf_uart_open(dev);
-	if (radio->fd < 0)
+	uart->fd = grf_uart_open(dev);
+	if (uart->fd < 0)
 	{
-		grf_logging_err("Opening radio device %s failed: %s", dev, strerror(errno));
-		return errno;
+		ret = errno;
+		free(uart);
+		return ret;
 	}
-	if (tcgetattr(radio->fd, &radio->tty_attr_saved))
+	if (tcgetattr(uart->fd, &uart->tty_attr_saved))
 	{
-		grf_logging_err("Getting TTY attributes of radio device %s failed: %s", dev, strerror(errno));
-		return errno;
+		ret = errno;
+		grf_logging_err("Getting TTY attributes of radio device %s failed: %s", dev, strerror(ret));
+		close(uart->fd);
+		free(uart);
+		return ret;
 	}
-	radio->is_initialized = true;
 
 	/* Setup the port settings to allow communication with the radio. */
-	memcpy(&radio->tty_attr, &radio->tty_attr_saved, sizeof(struct termios));
-	ret = grf_uart_setup(radio->fd);
+	ret = grf_uart_setup(uart->fd);
 	if (ret)
 	{
 		grf_logging_err("Setting up radio device %s failed: %s", dev, strerror(ret));
+		tcsetattr(uart->fd, TCSANOW, &uart->tty_attr_saved);
+		close(uart->fd);
+		free(uart);
 		return ret;
 	}
+	radio->priv = uart;
 
-	/* Set the timeout for request / response communication */
-	return grf_uart_set_timeout(radio->fd, radio->timeout_tty);
+	return 0;
 }
 
-int grf_radio_exit(struct grf_radio *radio)
+static int grf_radio_uart_close(struct grf_radio *radio)
 {
 	assert(radio);
+	assert(radio->priv);
 
-	if (!radio->is_initialized)
-		return 0;
+	struct grf_uart *uart = radio->priv;
 
-	grf_logging_info("Closing communication at device %s", radio->dev);
+	/* Clean all remaining data on the device, pending output was drained before */
+	tcflush(uart->fd, TCIOFLUSH);
 
-	if (radio->fd >= 0)
-	{
-		/* Clean all remaining data on the device */
-		tcflush(radio->fd, TCIOFLUSH);
+	/* Restore UART settings */
+	tcsetattr(uart->fd, TCSANOW, &uart->tty_attr_saved);
 
-		/* Restore UART settings */
-		tcsetattr(radio->fd, TCSANOW, &radio->tty_attr_saved);
+	/* Close UART */
+	grf_uart_close(uart->fd);
+	free(uart);
+	radio->priv = NULL;
 
-		/* Close UART */
-		grf_uart_close(radio->fd);
-	}
+	return 0;
+}
 
-	/* Free the device name */
-	if (radio->dev)
-		free(radio->dev);
+static ssize_t grf_radio_uart_read(struct grf_radio *radio, void *buf, size_t size)
+{
+	assert(radio);
+	assert(radio->priv);
 
-	/* Reset the radio structure */
-	memset(radio, 0, sizeof(struct grf_radio));
-	radio->is_initialized = false;
+	struct grf_uart *uart = radio->priv;
 
-	return 0;
+	return read(uart->fd, buf, size);
 }
-/*---------------------------------------------------------------------------*/
 
-/*---------------------------------------------------------------------------*/
-int grf_radio_read(struct grf_radio *radio, char *message, size_t *len, size_t size)
+static ssize_t grf_radio_uart_write(struct grf_radio *radio, const struct iovec *iov, int iovcnt)
 {
-	assert(grf_radio_is_valid(radio));
-	assert(message);
-	assert(len);
-	assert(size > 0);
-
-	char    c;
-	bool    msgstarted = false;
-	bool    stop       = false;
-	int     repeats    = radio->timeout_repeats;
-	ssize_t count;
-	int     retval     = ETIMEDOUT;
-
-	/* Clear message buffer */
-	memset(message, '\0', size * sizeof(char));
-	*len = 0;
-
-	/* Wait for data and respect the retries calculated to arrive at the
-	 * user specified timeout.
-	 */
-	errno = 0;
-	while ((count = read(radio->fd, &c, 1*sizeof(char))) > 0 || (!errno && --repeats > 0))
-	{
-		if (count < 1)
-		{
-			grf_logging_dbg("read: No data received. Retrying %d more time(s)...", repeats);
-			continue;
-		}
-		grf_logging_log(GRF_LOGGING_DEBUG_IO, "read: 0x%02x", c);
-
-		/* Maintain state machine for parsing */
-		if (!msgstarted)
-		{
-			/* We either expect a control character such as ACK/NAK or
-			 * a begin-of-message tag. All other characters are treated
-			 * as errors!
-			 */
-			switch(c)
-			{
-				case GRF_NUL:
-				case GRF_ACK:
-				case GRF_NAK:
-					message[0] = c;
-					*len       = 1;
-					retval     = 0;
-					stop       = true;
-					break;
-				case GRF_STX:
-					message[0] = c;
-					*len       = 1;
-					msgstarted = true;
-					break;
-				case GRF_CONT:
-					/* Just digest the continuation of the
-					 * previous message.
-					 */
-					break;
-				default:
-					grf_logging_err("State invalid (INITIAL and got x%02x)!", c);
-					retval     = EINVAL;
-					stop       = true;
-					break;
-			}
-		}
-		else	/* msgstarted */
-		{
-			/* We either expect a data character or and end-of-message tag.
-			 * All other characters are treated as errors!
-			 */
-			switch(c)
-			{
-				case GRF_ETX:
-					message[*len] = c;
-					*len += 1;
-					retval     = 0;
-					stop       = true;
-					break;
-				case GRF_STX:
-					grf_logging_warn("Missed ETX! (STARTED and got x%02x)!", c);
-					grf_logging_warn_hex(message, *len, "Incomplete message was: %s", message);
-					message[0] = c;
-					*len       = 1;
-					break;
-				case GRF_NUL:
-				case GRF_ACK:
-				case GRF_NAK:
-					grf_logging_err("State invalid (STARTED and got x%02x)!", c);
-					retval     = EINVAL;
-					stop       = true;
-					break;
-				default:
-					message[*len]   = c;
-					*len += 1;
-					break;
-			}
-		}
-
-		/* Check if we exceed the message buffer size */
-		if (*len >= size)
-		{
-			retval = EMSGSIZE;
-			stop   = true;
-		}
-
-		/* Stop if requested by the state machine */
-		if (stop)
-			break;
-	}
+	assert(radio);
+	assert(radio->priv);
 
-	if (*len < 1)
-	{
-		grf_logging_dbg("recv: %s", "Timeout! No data received.");
-		retval = ETIMEDOUT;
-	}
-	else
-	{
-		grf_logging_dbg_hex(message, *len, "recv: %s (len=%zu)", message, *len);
-	}
+	struct grf_uart *uart = radio->priv;
 
-	return retval;
+	return writev(uart->fd, iov, iovcnt);
 }
-/*---------------------------------------------------------------------------*/
 
-/*---------------------------------------------------------------------------*/
-int grf_radio_write(struct grf_radio *radio, const char *message, size_t len)
+static int grf_radio_uart_get_pollfd(struct grf_radio *radio)
 {
-	assert(grf_radio_is_valid(radio));
-	assert(message);
-
-	int     repeats = radio->timeout_repeats;
-	ssize_t count;
-
-	grf_logging_dbg_hex(message, len, "send: %s", message);
-
-	errno = 0;
-	while(len > 0) {
-		count = write(radio->fd, message, len*sizeof(char));
-		if (count < 0)
-		{
-			return errno;
-		}
-		else if (count == 0)
-		{
-			if (--repeats > 0)
-			{
-				grf_logging_dbg("write: No data written. Retrying %d more time(s)...", repeats);
-				continue;
-			}
-			else
-			{
-				return ETIMEDOUT;
-			}
-		}
-		message += count;
-		len     -= count;
-	}
+	assert(radio);
+	assert(radio->priv);
 
-	if (fsync(radio->fd))
-	{
-		grf_logging_err("Calling fsync on %d failed: %s", radio->fd, strerror(errno));
-		return errno;
-	}
+	struct grf_uart *uart = radio->priv;
 
-	return 0;
+	return uart->fd;
 }
 
-int grf_radio_write_ctrl(struct grf_radio *radio, char ctrl)
+static int grf_radio_uart_drain(struct grf_radio *radio)
 {
-	assert(grf_radio_is_valid(radio));
+	assert(radio);
+	assert(radio->priv);
 
-	grf_logging_dbg("sctl: 0x%02x", ctrl);
-	if (write(radio->fd, &ctrl, sizeof(char)) < 0)
-		return errno;
+	struct grf_uart *uart = radio->priv;
 
-	if (fsync(radio->fd))
+	if (tcdrain(uart->fd))
 	{
-		grf_logging_err("Calling fsync on %d failed: %s", radio->fd, strerror(errno));
+		grf_logging_err("Draining data of TTY %d failed: %s", uart->fd, strerror(errno));
 		return errno;
 	}
 
 	return 0;
 }
 /*---------------------------------------------------------------------------*/
+
+const struct grf_radio_ops grf_radio_uart_ops =
+{
+	.name       = "uart",
+	.open       = grf_radio_uart_open,
+	.close      = grf_radio_uart_close,
+	.read       = grf_radio_uart_read,
+	.write      = grf_radio_uart_write,
+	.get_pollfd = grf_radio_uart_get_pollfd,
+	.drain      = grf_radio_uart_drain,
+};
@@ -0,0 +1,304 @@
+/*
+ * Register description and decoding
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <math.h>
+
+#include "grf.h"
+#include "grf_registers.h"
+
+/* Indices of the fields in the table, in output order */
+#define GRF_FIELD_SERIAL_NUMBER             0
+#define GRF_FIELD_OPERATION_TIME            1
+#define GRF_FIELD_SMOKE_CHAMBER_POLLUTION   2
+#define GRF_FIELD_BATTERY_VOLTAGE           3
+#define GRF_FIELD_TEMPERATURE1              4
+#define GRF_FIELD_TEMPERATURE2              5
+#define GRF_FIELD_LOCAL_SMOKE_ALERTS        6
+#define GRF_FIELD_LOCAL_TEMPERATURE_ALERTS  7
+#define GRF_FIELD_REMOTE_CABLE_ALERTS       8
+#define GRF_FIELD_REMOTE_RADIO_ALERTS       9
+#define GRF_FIELD_LOCAL_TEST_ALERTS         10
+#define GRF_FIELD_REMOTE_CABLE_TEST_ALERTS  11
+#define GRF_FIELD_REMOTE_RADIO_TEST_ALERTS  12
+#define GRF_FIELD_SMOKE_CHAMBER_VALUE       13
+#define GRF_FIELD_UNKNOWN_02                14
+#define GRF_FIELD_UNKNOWN_REGISTERS         15
+#define GRF_FIELD_UNKNOWN_64                16
+#define GRF_FIELD_COUNT                     17
+
+#define GRF_FIELD(_key_, _shift_, _bits_, _type_, _member_, _format_, _label_) \
+	{ .key = (_key_), .count = 1, .shift = (_shift_), .bits = (_bits_), .type = (_type_), .format = (_format_), \
+	  .offset = offsetof(struct grf_device, _member_), .label = (_label_), .known = true }
+#define GRF_FIELD_FLOAT(_key_, _shift_, _bits_, _member_, _scale_, _bias_, _precision_, _unit_, _label_) \
+	GRF_FIELD_SCALED(_key_, _shift_, _bits_, _member_, _scale_, _bias_, GRF_REGISTER_FORMAT_FLOAT, _precision_, _unit_, _label_)
+#define GRF_FIELD_SCALED(_key_, _shift_, _bits_, _member_, _scale_, _bias_, _format_, _precision_, _unit_, _label_) \
+	{ .key = (_key_), .count = 1, .shift = (_shift_), .bits = (_bits_), .type = GRF_REGISTER_TYPE_FLOAT, .format = (_format_), \
+	  .offset = offsetof(struct grf_device, _member_), .scale = (_scale_), .bias = (_bias_), .precision = (_precision_), .unit = (_unit_), \
+	  .label = (_label_), .known = true }
+#define GRF_FIELD_UNKNOWN(_key_, _count_, _shift_, _bits_, _type_, _member_, _format_, _label_) \
+	{ .key = (_key_), .count = (_count_), .shift = (_shift_), .bits = (_bits_), .type = (_type_), .format = (_format_), \
+	  .offset = offsetof(struct grf_device, _member_), .label = (_label_), .known = false }
+
+const struct grf_register_field grf_register_fields[] =
+{
+	[GRF_FIELD_SERIAL_NUMBER]            = GRF_FIELD(0x0001, 0, 32, GRF_REGISTER_TYPE_U32, serial_number, GRF_REGISTER_FORMAT_HEX, "serial number:"),
+	[GRF_FIELD_OPERATION_TIME]           = GRF_FIELD_SCALED(0x0003, 0, 32, operation_time, 0.25f, 0.0f, GRF_REGISTER_FORMAT_TIME, 2, "seconds", "operation time:"),
+	[GRF_FIELD_SMOKE_CHAMBER_POLLUTION]  = GRF_FIELD(0x0004, 0, 8, GRF_REGISTER_TYPE_U8, smoke_chamber_pollution, GRF_REGISTER_FORMAT_DEC, "smoke chamber pollution:"),
+	[GRF_FIELD_BATTERY_VOLTAGE]          = GRF_FIELD_FLOAT(0x0005, 16, 16, battery_voltage, 9.184f / 500.0f, 0.0f, 2, "V", "battery voltage:"),
+	[GRF_FIELD_TEMPERATURE1]             = GRF_FIELD_FLOAT(0x0005, 8, 8, temperature1, 0.50f, -20.0f, 1, "degree celcius", "temperature 1:"),
+	[GRF_FIELD_TEMPERATURE2]             = GRF_FIELD_FLOAT(0x0005, 0, 8, temperature2, 0.50f, -20.0f, 1, "degree celcius", "temperature 2:"),
+	[GRF_FIELD_LOCAL_SMOKE_ALERTS]       = GRF_FIELD(0x0004, 8, 8, GRF_REGISTER_TYPE_U8, local_smoke_alerts, GRF_REGISTER_FORMAT_DEC, "local smoke alerts:"),
+	[GRF_FIELD_LOCAL_TEMPERATURE_ALERTS] = GRF_FIELD(0x0006, 24, 8, GRF_REGISTER_TYPE_U8, local_temperature_alerts, GRF_REGISTER_FORMAT_DEC, "local temperature alerts:"),
+	[GRF_FIELD_REMOTE_CABLE_ALERTS]      = GRF_FIELD(0x0006, 8, 8, GRF_REGISTER_TYPE_U8, remote_cable_alerts, GRF_REGISTER_FORMAT_DEC, "remote wired alerts:"),
+	[GRF_FIELD_REMOTE_RADIO_ALERTS]      = GRF_FIELD(0x0006, 0, 8, GRF_REGISTER_TYPE_U8, remote_radio_alerts, GRF_REGISTER_FORMAT_DEC, "remote wireless alerts:"),
+	[GRF_FIELD_LOCAL_TEST_ALERTS]        = GRF_FIELD(0x0006, 16, 8, GRF_REGISTER_TYPE_U8, local_test_alerts, GRF_REGISTER_FORMAT_DEC, "local test alerts:"),
+	/* FIXME: upper two bytes of 0x0007 unknown. Always zero? */
+	[GRF_FIELD_REMOTE_CABLE_TEST_ALERTS] = GRF_FIELD(0x0007, 8, 8, GRF_REGISTER_TYPE_U8, remote_cable_test_alerts, GRF_REGISTER_FORMAT_DEC, "remote wired test alerts:"),
+	[GRF_FIELD_REMOTE_RADIO_TEST_ALERTS] = GRF_FIELD(0x0007, 0, 8, GRF_REGISTER_TYPE_U8, remote_radio_test_alerts, GRF_REGISTER_FORMAT_DEC, "remote wireless test alerts:"),
+	/* FIXME: Unknown data */
+	[GRF_FIELD_SMOKE_CHAMBER_VALUE]      = GRF_FIELD_UNKNOWN(0x0004, 1, 16, 16, GRF_REGISTER_TYPE_U16, smoke_chamber_value, GRF_REGISTER_FORMAT_DEC, "unknown smoke chamber value:"),
+	[GRF_FIELD_UNKNOWN_02]               = GRF_FIELD_UNKNOWN(0x0002, 1, 0, 32, GRF_REGISTER_TYPE_U32, unknown_02, GRF_REGISTER_FORMAT_RAW, "unknown data id=%04X:"),
+	[GRF_FIELD_UNKNOWN_REGISTERS]        = GRF_FIELD_UNKNOWN(0x0014, 40, 0, 32, GRF_REGISTER_TYPE_U32, unknown_registers, GRF_REGISTER_FORMAT_RAW, "unknown data id=%04X:"),
+	[GRF_FIELD_UNKNOWN_64]               = GRF_FIELD_UNKNOWN(0x0064, 1, 0, 32, GRF_REGISTER_TYPE_U32, unknown_64, GRF_REGISTER_FORMAT_RAW, "unknown data id=%04X:"),
+};
+
+const size_t grf_register_nfields = GRF_FIELD_COUNT;
+
+/* Fields contained in each register */
+struct grf_register_map
+{
+	uint8_t count;				/* Number of fields in the register */
+	uint8_t fields[4];			/* Indices of the fields in grf_register_fields */
+};
+
+static const struct grf_register_map register_map[GRF_REGISTER_KEY_MAX + 1] =
+{
+	[0x0001]            = { 1, { GRF_FIELD_SERIAL_NUMBER } },
+	[0x0002]            = { 1, { GRF_FIELD_UNKNOWN_02 } },
+	[0x0003]            = { 1, { GRF_FIELD_OPERATION_TIME } },
+	[0x0004]            = { 3, { GRF_FIELD_SMOKE_CHAMBER_VALUE, GRF_FIELD_LOCAL_SMOKE_ALERTS, GRF_FIELD_SMOKE_CHAMBER_POLLUTION } },
+	[0x0005]            = { 3, { GRF_FIELD_BATTERY_VOLTAGE, GRF_FIELD_TEMPERATURE1, GRF_FIELD_TEMPERATURE2 } },
+	[0x0006]            = { 4, { GRF_FIELD_LOCAL_TEMPERATURE_ALERTS, GRF_FIELD_LOCAL_TEST_ALERTS, GRF_FIELD_REMOTE_CABLE_ALERTS, GRF_FIELD_REMOTE_RADIO_ALERTS } },
+	[0x0007]            = { 2, { GRF_FIELD_REMOTE_CABLE_TEST_ALERTS, GRF_FIELD_REMOTE_RADIO_TEST_ALERTS } },
+	[0x0014 ... 0x003B] = { 1, { GRF_FIELD_UNKNOWN_REGISTERS } },
+	[0x0064]            = { 1, { GRF_FIELD_UNKNOWN_64 } },
+};
+
+/*---------------------------------------------------------------------------*/
+static inline int hex_digit(unsigned char c)
+{
+	/* Map '0'-'9', 'A'-'F' and 'a'-'f' to their value and everything else to -1 */
+	if ((unsigned char)(c - '0') < 10)
+		return c - '0';
+	c |= 0x20;
+	if ((unsigned char)(c - 'a') < 6)
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+static inline bool hex_parse(const char *str, size_t digits, uint32_t *value)
+{
+	int    digit;
+	size_t i;
+
+	*value = 0;
+	for (i = 0; i < digits; i++)
+	{
+		digit = hex_digit(str[i]);
+		if (digit < 0)
+			return false;
+		*value = (*value << 4) | digit;
+	}
+
+	return true;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_register_decode(struct grf_device *device, const char *data, size_t len, uint16_t *keyp)
+{
+	assert(device);
+	assert(data);
+
+	uint32_t key;
+	uint32_t value;
+
+	/* Parse the fixed-width line KKKK:VVVVVVVV */
+	if (len != GRF_REGISTER_LINE_LEN || data[4] != ':')
+		return EINVAL;
+	if (!hex_parse(data, 4, &key) || !hex_parse(data + 5, 8, &value))
+		return EINVAL;
+	if (keyp)
+		*keyp = key;
+	if (key > GRF_REGISTER_KEY_MAX)
+		return ENOENT;
+
+	return grf_register_set(device, key, value);
+}
+
+int grf_register_set(struct grf_device *device, uint16_t key, uint32_t value)
+{
+	assert(device);
+
+	const struct grf_register_field *field;
+	const struct grf_register_map   *map;
+	uint32_t                         raw;
+	char                            *member;
+	uint8_t                          i;
+
+	if (key > GRF_REGISTER_KEY_MAX)
+		return ENOENT;
+
+	/* Store all fields contained in the register */
+	map = &register_map[key];
+	if (map->count == 0)
+		return ENOENT;
+	for (i = 0; i < map->count; i++)
+	{
+		field  = &grf_register_fields[map->fields[i]];
+		raw    = (field->bits < 32) ? (value >> field->shift) & ((1u << field->bits) - 1) : value;
+		member = (char *)device + field->offset;
+		switch (field->type)
+		{
+			case GRF_REGISTER_TYPE_U8:
+				*(uint8_t *)member = raw;
+				break;
+			case GRF_REGISTER_TYPE_U16:
+				*(uint16_t *)member = raw;
+				break;
+			case GRF_REGISTER_TYPE_U32:
+				((uint32_t *)member)[key - field->key] = raw;
+				break;
+			case GRF_REGISTER_TYPE_FLOAT:
+				*(float *)member = (float)raw * field->scale + field->bias;
+				break;
+		}
+	}
+
+	return 0;
+}
+
+int grf_register_get(const struct grf_device *device, uint16_t key, uint32_t *value)
+{
+	assert(device);
+	assert(value);
+
+	const struct grf_register_field *field;
+	const struct grf_register_map   *map;
+	const char                      *member;
+	uint32_t                         raw = 0;
+	float                            steps;
+	uint8_t                          i;
+
+	if (key > GRF_REGISTER_KEY_MAX)
+		return ENOENT;
+
+	/* Assemble the register from all fields it contains */
+	map = &register_map[key];
+	if (map->count == 0)
+		return ENOENT;
+	*value = 0;
+	for (i = 0; i < map->count; i++)
+	{
+		field  = &grf_register_fields[map->fields[i]];
+		member = (const char *)device + field->offset;
+		switch (field->type)
+		{
+			case GRF_REGISTER_TYPE_U8:
+				raw = *(const uint8_t *)member;
+				break;
+			case GRF_REGISTER_TYPE_U16:
+				raw = *(const uint16_t *)member;
+				break;
+			case GRF_REGISTER_TYPE_U32:
+				raw = ((const uint32_t *)member)[key - field->key];
+				break;
+			case GRF_REGISTER_TYPE_FLOAT:
+				/* Undo the scaling, the raw value is an integer */
+				steps = roundf((*(const float *)member - field->bias) / field->scale);
+				raw   = (steps > 0.0f) ? (uint32_t)steps : 0;
+				break;
+		}
+		if (field->bits < 32)
+			raw &= (1u << field->bits) - 1;
+		*value |= raw << field->shift;
+	}
+
+	return 0;
+}
+
+int grf_register_format(const struct grf_register_field *field, unsigned int index, const struct grf_device *device, char *buf, size_t size)
+{
+	assert(field);
+	assert(index < field->count);
+	assert(device);
+	assert(buf);
+
+	const char *member = (const char *)device + field->offset;
+	float       seconds;
+	uint32_t    value = 0;
+
+	if (field->type == GRF_REGISTER_TYPE_FLOAT)
+	{
+		seconds = *(const float *)member;
+		if (field->format == GRF_REGISTER_FORMAT_TIME)
+			return snprintf(buf, size, "%d days %d hours %d minutes %.2f seconds",
+			                (int)(seconds / (24.0f * 3600.0f)),
+			                (int)(fmodf(seconds, 24.0f * 3600.0f) / 3600.0f),
+			                (int)(fmodf(seconds, 3600.0f) / 60.0f),
+			                fmodf(seconds, 60.0f));
+		return snprintf(buf, size, "%.*f%s%s", field->precision, seconds,
+		                field->unit ? " " : "", field->unit ? field->unit : "");
+	}
+
+	switch (field->type)
+	{
+		case GRF_REGISTER_TYPE_U8:
+			value = *(const uint8_t *)member;
+			break;
+		case GRF_REGISTER_TYPE_U16:
+			value = *(const uint16_t *)member;
+			break;
+		case GRF_REGISTER_TYPE_U32:
+			value = ((const uint32_t *)member)[index];
+			break;
+	}
+
+	switch (field->format)
+	{
+		case GRF_REGISTER_FORMAT_HEX:
+			return snprintf(buf, size, "%08X", value);
+		case GRF_REGISTER_FORMAT_RAW:
+			return snprintf(buf, size, "0x%08X", value);
+		default:
+			return snprintf(buf, size, "%u", value);
+	}
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,141 @@
+/*
+ * Register description include file
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \ingroup comm
+ *  \file grf_registers.h
+ *  \brief Description of the registers sent by the smoke detector devices
+ *
+ * This file defines the table describing how the registers sent by a smoke
+ * detector in response to `DA:$DEVICEID:01` map to the fields of \ref grf_device.
+ * The table is used to decode the received data and to output the fields.
+ *
+ * @{
+ */
+
+#ifndef __GRF_REGISTERS_H__
+#define __GRF_REGISTERS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+struct grf_device;
+
+#define GRF_REGISTER_TYPE_U8        0	/*!< Field is stored as `uint8_t` */
+#define GRF_REGISTER_TYPE_U16       1	/*!< Field is stored as `uint16_t` */
+#define GRF_REGISTER_TYPE_U32       2	/*!< Field is stored as `uint32_t` */
+#define GRF_REGISTER_TYPE_FLOAT     3	/*!< Field is stored as `float` scaled by *scale* and shifted by *offset* */
+
+#define GRF_REGISTER_FORMAT_DEC     0	/*!< Output the field as decimal number */
+#define GRF_REGISTER_FORMAT_HEX     1	/*!< Output the field as 8-digit hexadecimal number */
+#define GRF_REGISTER_FORMAT_RAW     2	/*!< Output the field as 8-digit hexadecimal number prefixed by `0x` */
+#define GRF_REGISTER_FORMAT_FLOAT   3	/*!< Output the field as floating point number using *precision* and *unit* */
+#define GRF_REGISTER_FORMAT_TIME    4	/*!< Output the field as duration in days, hours, minutes and seconds */
+
+#define GRF_REGISTER_KEY_MAX        0x64	/*!< Highest register key sent by the smoke detector */
+#define GRF_REGISTER_LINE_LEN       13		/*!< Length of a register line `KKKK:VVVVVVVV` */
+
+#define GRF_REGISTER_MASK_WORDS     ((GRF_REGISTER_KEY_MAX + 32) / 32)	/*!< Number of words of \ref grf_register_mask */
+
+#define GRF_REGISTER_MASK_ZERO(__mask__) \
+	memset((__mask__), 0, sizeof(struct grf_register_mask))					/*!< Clear all registers in a mask */
+#define GRF_REGISTER_MASK_SET(__key__, __mask__) \
+	((__mask__)->bits[(__key__) / 32] |= (1u << ((__key__) % 32)))			/*!< Add a register to a mask */
+#define GRF_REGISTER_MASK_CLR(__key__, __mask__) \
+	((__mask__)->bits[(__key__) / 32] &= ~(1u << ((__key__) % 32)))		/*!< Remove a register from a mask */
+#define GRF_REGISTER_MASK_ISSET(__key__, __mask__) \
+	(((__key__) <= GRF_REGISTER_KEY_MAX) && ((__mask__)->bits[(__key__) / 32] & (1u << ((__key__) % 32))))	/*!< Check if a register is in a mask */
+
+/*! Data structure representing a set of registers selected by their keys */
+struct grf_register_mask
+{
+	uint32_t     bits[GRF_REGISTER_MASK_WORDS];	/*!< Bit *key* % 32 of word *key* / 32 is set for selected registers */
+};
+
+/*! Data structure describing a field of \ref grf_device stored in a register */
+struct grf_register_field
+{
+	uint16_t     key;			/*!< Key of the (first) register containing the field */
+	uint16_t     count;			/*!< Number of consecutive registers stored in an array starting at *offset* */
+	uint8_t      shift;			/*!< Position of the lowest bit of the field in the register value */
+	uint8_t      bits;			/*!< Number of bits of the field in the register value */
+	uint8_t      type;			/*!< Type of the field in \ref grf_device (GRF_REGISTER_TYPE_*) */
+	uint8_t      format;		/*!< Output format of the field (GRF_REGISTER_FORMAT_*) */
+	size_t       offset;		/*!< Offset of the field in \ref grf_device */
+	float        scale;			/*!< Scale applied to the raw value of float fields */
+	float        bias;			/*!< Offset added to the scaled value of float fields */
+	uint8_t      precision;		/*!< Number of decimal places in the output of float fields */
+	const char  *unit;			/*!< Unit appended to the output (may be NULL) */
+	const char  *label;			/*!< Label of the field, may contain `%04X` replaced by the register key */
+	bool         known;			/*!< Status flag if the meaning of the field is known */
+};
+
+extern const struct grf_register_field grf_register_fields[];	/*!< Table of all fields in output order */
+extern const size_t                    grf_register_nfields;	/*!< Number of entries in \ref grf_register_fields */
+
+/*! \brief Decode a register line into the device data.
+ *
+ *  This function parses a register line of the form `KKKK:VVVVVVVV` with
+ *  4 hexadecimal digits key and 8 hexadecimal digits value and stores the
+ *  fields contained in the register in *device*.
+ *
+ *  \param device	device data structure to store the fields in
+ *  \param data		register line to decode
+ *  \param len		length of the register line
+ *  \param key		storage for the key of the register, set unless the line is malformed (may be NULL)
+ *  \returns		0 on success, `EINVAL` for malformed lines and `ENOENT` for unknown keys
+ */
+int grf_register_decode(struct grf_device *device, const char *data, size_t len, uint16_t *key);
+
+/*! \brief Store the fields contained in a register into the device data.
+ *
+ *  \param device	device data structure to store the fields in
+ *  \param key		key of the register
+ *  \param value	raw value of the register
+ *  \returns		0 on success and `ENOENT` for unknown keys
+ */
+int grf_register_set(struct grf_device *device, uint16_t key, uint32_t value);
+
+/*! \brief Assemble the raw value of a register from the device data.
+ *
+ *  This is the inverse of \ref grf_register_set().
+ *
+ *  \param device	device data structure containing the fields
+ *  \param key		key of the register
+ *  \param value	storage for the raw value of the register
+ *  \returns		0 on success and `ENOENT` for unknown keys
+ */
+int grf_register_get(const struct grf_device *device, uint16_t key, uint32_t *value);
+
+/*! \brief Format the value of a field for output.
+ *
+ *  \param field	field to format
+ *  \param index	index of the register within the field (0 for single registers)
+ *  \param device	device data structure containing the field
+ *  \param buf		buffer of size *size* to store the formatted value in
+ *  \param size		capacity of *buf*
+ *  \returns		number of characters formatted as returned by snprintf()
+ */
+int grf_register_format(const struct grf_register_field *field, unsigned int index, const struct grf_device *device, char *buf, size_t size);
+
+#endif /* __GRF_REGISTERS_H__ */
+/* @} */
@@ -0,0 +1,258 @@
+/*
+ * Radio operation scheduler
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include "grf.h"
+#include "grf_sched.h"
+#include "grf_logging.h"
+
+/*---------------------------------------------------------------------------*/
+static void queue_push(struct grf_sched *sched, struct grf_sched_job *job, bool front)
+{
+	int priority = job->priority;
+
+	if (front)
+	{
+		job->next = sched->heads[priority];
+		sched->heads[priority] = job;
+		if (!sched->tails[priority])
+			sched->tails[priority] = job;
+		return;
+	}
+
+	job->next = NULL;
+	if (sched->tails[priority])
+		sched->tails[priority]->next = job;
+	else
+		sched->heads[priority] = job;
+	sched->tails[priority] = job;
+}
+
+static struct grf_sched_job *queue_pop(struct grf_sched *sched)
+{
+	struct grf_sched_job *job;
+	int                   priority;
+
+	/* Take the oldest job of the most urgent priority */
+	for (priority = 0; priority < GRF_SCHED_PRIORITIES; priority++)
+	{
+		job = sched->heads[priority];
+		if (!job)
+			continue;
+		sched->heads[priority] = job->next;
+		if (!job->next)
+			sched->tails[priority] = NULL;
+		job->next = NULL;
+		return job;
+	}
+
+	return NULL;
+}
+
+static bool sched_yield(const struct grf_comm_op *op, void *userdata)
+{
+	struct grf_sched *sched = userdata;
+	int               priority;
+
+	/* Give way to any more urgent job */
+	for (priority = 0; priority < sched->running->priority; priority++)
+	{
+		if (sched->heads[priority])
+			return true;
+	}
+
+	return false;
+}
+
+static void sched_done(struct grf_sched_job *job, int result)
+{
+	job->started = false;
+	if (job->done)
+		job->done(job, result, job->userdata);
+}
+
+static void sched_next(struct grf_sched *sched)
+{
+	struct grf_sched_job *job;
+	int                   retval;
+
+	/* Start or resume jobs until one keeps the radio busy */
+	while (!sched->running)
+	{
+		job = queue_pop(sched);
+		if (!job)
+			return;
+
+		sched->running = job;
+		if (job->started)
+		{
+			grf_logging_dbg("Resuming job of priority %d", job->priority);
+			retval = grf_comm_resume(&job->op);
+		}
+		else
+		{
+			job->started = true;
+			retval = job->start(&job->op, sched->radio, job->userdata);
+			if (!retval)
+				grf_comm_op_set_yield(&job->op, sched_yield, sched);
+		}
+		if (!retval)
+			retval = job->op.result;
+		if (retval == EINPROGRESS)
+			return;
+		sched->running = NULL;
+		sched_done(job, retval);
+	}
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+void grf_sched_init(struct grf_sched *sched, struct grf_radio *radio)
+{
+	assert(sched);
+	assert(grf_radio_is_valid(radio));
+
+	memset(sched, 0, sizeof(struct grf_sched));
+	sched->radio = radio;
+}
+
+int grf_sched_submit(struct grf_sched *sched, struct grf_sched_job *job)
+{
+	assert(sched);
+	assert(job);
+	assert(job->start);
+
+	if (job->priority < 0 || job->priority >= GRF_SCHED_PRIORITIES)
+		return EINVAL;
+
+	job->started = false;
+	queue_push(sched, job, false);
+	sched_next(sched);
+
+	return 0;
+}
+
+int grf_sched_cancel(struct grf_sched *sched, struct grf_sched_job *job)
+{
+	assert(sched);
+	assert(job);
+
+	struct grf_sched_job **link;
+
+	if (job == sched->running)
+		return EBUSY;
+	if (job->priority < 0 || job->priority >= GRF_SCHED_PRIORITIES)
+		return ENOENT;
+
+	for (link = &sched->heads[job->priority]; *link; link = &(*link)->next)
+	{
+		if (*link != job)
+			continue;
+		*link = job->next;
+		if (sched->tails[job->priority] == job)
+		{
+			/* Find the new end of the queue */
+			sched->tails[job->priority] = sched->heads[job->priority];
+			while (sched->tails[job->priority] && sched->tails[job->priority]->next)
+				sched->tails[job->priority] = sched->tails[job->priority]->next;
+		}
+		job->next    = NULL;
+		job->started = false;
+		return 0;
+	}
+
+	return ENOENT;
+}
+
+void grf_sched_step(struct grf_sched *sched)
+{
+	assert(sched);
+
+	struct grf_sched_job *job = sched->running;
+	int                   retval;
+
+	if (job)
+	{
+		retval = grf_comm_step(&job->op);
+		if (retval == EINPROGRESS && !job->op.paused)
+			return;
+
+		/* A paused job continues before all other jobs of its priority */
+		sched->running = NULL;
+		if (job->op.paused)
+		{
+			grf_logging_dbg("Pausing job of priority %d for more urgent jobs", job->priority);
+			queue_push(sched, job, true);
+		}
+		else
+			sched_done(job, retval);
+	}
+	sched_next(sched);
+}
+
+bool grf_sched_is_busy(const struct grf_sched *sched)
+{
+	assert(sched);
+
+	int priority;
+
+	if (sched->running)
+		return true;
+	for (priority = 0; priority < GRF_SCHED_PRIORITIES; priority++)
+	{
+		if (sched->heads[priority])
+			return true;
+	}
+
+	return false;
+}
+
+int grf_sched_get_pollfd(const struct grf_sched *sched)
+{
+	assert(sched);
+
+	if (!sched->running)
+		return -1;
+
+	return grf_comm_op_get_pollfd(&sched->running->op);
+}
+
+int grf_sched_get_timeout(const struct grf_sched *sched)
+{
+	assert(sched);
+
+	if (!sched->running)
+		return -1;
+
+	/* A job paused right away has to be put back into its queue */
+	if (sched->running->op.paused)
+		return 0;
+
+	return grf_comm_op_get_timeout(&sched->running->op);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,160 @@
+/*
+ * Radio operation scheduler include file
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \ingroup comm
+ *  \file grf_sched.h
+ *  \brief Scheduler sharing a radio between operations of different priority
+ *
+ * This file defines a scheduler running the non-blocking operations of many
+ * consumers on a single radio. Operations are queued per priority and run
+ * one after the other, the most urgent first and in the order they were
+ * submitted within a priority.
+ *
+ * A running operation is paused as soon as a more urgent one is waiting and
+ * the operation reaches a point it can be resumed from (see
+ * \ref grf_comm_op_set_yield()). A group read-out thereby lets e.g. switching
+ * off the signal of a device run after the device currently read instead of
+ * after the whole group and continues afterwards.
+ *
+ * @{
+ */
+
+#ifndef __GRF_SCHED_H__
+#define __GRF_SCHED_H__
+
+#include <stdbool.h>
+
+#include "grf.h"
+
+#define GRF_SCHED_URGENT            0		/*!< Priority of operations that must not wait, e.g. switching the signal */
+#define GRF_SCHED_NORMAL            1		/*!< Priority of interactive requests */
+#define GRF_SCHED_BACKGROUND        2		/*!< Priority of long read-outs nobody waits for */
+#define GRF_SCHED_PRIORITIES        3		/*!< Number of priorities */
+
+struct grf_sched_job;
+
+/*! \brief Callback starting the operation of a job.
+ *
+ *  \param op		operation to start using one of the grf_comm_start_*() functions
+ *  \param radio	radio to start the operation on
+ *  \param userdata	user data of the job
+ *  \returns		0 if the operation is started and an error code otherwise
+ */
+typedef int (*grf_sched_start_cb)(struct grf_comm_op *op, struct grf_radio *radio, void *userdata);
+
+/*! \brief Callback reporting the end of a job.
+ *
+ *  The job may be submitted again from within the callback.
+ *
+ *  \param job		finished job
+ *  \param result	0 on success and an error code otherwise
+ *  \param userdata	user data of the job
+ */
+typedef void (*grf_sched_done_cb)(struct grf_sched_job *job, int result, void *userdata);
+
+/*! Data structure representing an operation waiting for or running on the radio.
+ *
+ *  The caller sets *priority*, *start*, *done* and *userdata* and keeps the
+ *  job valid until it is done or cancelled. All other members are managed
+ *  by the scheduler.
+ */
+struct grf_sched_job
+{
+	int                  priority;		/*!< Priority of the job (GRF_SCHED_*) */
+	grf_sched_start_cb   start;			/*!< Callback starting the operation */
+	grf_sched_done_cb    done;			/*!< Callback reporting the end of the job (may be NULL) */
+	void                *userdata;		/*!< User data passed to the callbacks */
+
+	struct grf_comm_op   op;			/*!< Operation of the job */
+	bool                 started;		/*!< Status flag if the operation is started (and paused if not running) */
+	struct grf_sched_job *next;			/*!< Next job of the same priority */
+};
+
+/*! Data structure representing a scheduler of a radio */
+struct grf_sched
+{
+	struct grf_radio     *radio;		/*!< Radio the operations run on */
+	struct grf_sched_job *running;		/*!< Job whose operation is running on the radio (NULL if idle) */
+	struct grf_sched_job *heads[GRF_SCHED_PRIORITIES];	/*!< First job waiting per priority */
+	struct grf_sched_job *tails[GRF_SCHED_PRIORITIES];	/*!< Last job waiting per priority */
+};
+
+/*! \brief Initialize a scheduler.
+ *
+ *  \param sched	scheduler to initialize
+ *  \param radio	radio initialized by \ref grf_comm_init()
+ */
+void grf_sched_init(struct grf_sched *sched, struct grf_radio *radio);
+
+/*! \brief Queue a job.
+ *
+ *  The job is started right away if the radio is idle. Its *done* callback
+ *  may thus be called before this function returns.
+ *
+ *  \param sched	scheduler initialized by \ref grf_sched_init()
+ *  \param job		job to queue
+ *  \returns		0 on success and `EINVAL` for an invalid priority
+ */
+int grf_sched_submit(struct grf_sched *sched, struct grf_sched_job *job);
+
+/*! \brief Remove a job not running on the radio.
+ *
+ *  Paused jobs are dropped as well, they do not keep the radio in any state.
+ *
+ *  \param sched	scheduler initialized by \ref grf_sched_init()
+ *  \param job		job to remove, its *done* callback is not called
+ *  \returns		0 on success, `EBUSY` if the job is running and `ENOENT` if it is not queued
+ */
+int grf_sched_cancel(struct grf_sched *sched, struct grf_sched_job *job);
+
+/*! \brief Advance the running operation and start the next one when it is finished or paused.
+ *
+ *  This function should be called whenever the descriptor returned by
+ *  \ref grf_sched_get_pollfd() becomes readable or the timeout returned by
+ *  \ref grf_sched_get_timeout() expires.
+ *
+ *  \param sched	scheduler initialized by \ref grf_sched_init()
+ */
+void grf_sched_step(struct grf_sched *sched);
+
+/*! \brief Check if any job is running or waiting.
+ *
+ *  \param sched	scheduler initialized by \ref grf_sched_init()
+ *  \returns		true if the radio is busy and false otherwise
+ */
+bool grf_sched_is_busy(const struct grf_sched *sched);
+
+/*! \brief Get the descriptor to wait on for the running operation.
+ *
+ *  \param sched	scheduler initialized by \ref grf_sched_init()
+ *  \returns		the descriptor to poll for `POLLIN` or -1 if nothing is running
+ */
+int grf_sched_get_pollfd(const struct grf_sched *sched);
+
+/*! \brief Get the time until \ref grf_sched_step() has to be called at the latest.
+ *
+ *  \param sched	scheduler initialized by \ref grf_sched_init()
+ *  \returns		milliseconds suitable for poll() or epoll_wait(), -1 if there is no deadline
+ */
+int grf_sched_get_timeout(const struct grf_sched *sched);
+
+#endif /* __GRF_SCHED_H__ */
+/* @} */
@@ -0,0 +1,467 @@
+/*
+ * Fleet store
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <math.h>
+
+#include "grf.h"
+#include "grf_store.h"
+#include "grf_idmap.h"
+
+#define GRF_STORE_INITIAL_SIZE      64
+#define GRF_STORE_DICT_MAX          UINT16_MAX	/* Dictionary indices are stored in 16 bits */
+
+#define GRF_STORE_TEMPERATURE_BIAS  -20.0		/* Temperature represented by 0 */
+#define GRF_STORE_TEMPERATURE_SCALE 0.5			/* Temperature step in degree celcius */
+#define GRF_STORE_VOLTAGE_SCALE     0.001		/* Voltage step in Volt */
+#define GRF_STORE_TIME_SCALE        0.25		/* Operation time step in seconds */
+
+#define COLUMN_U8                   0
+#define COLUMN_U16                  1
+#define COLUMN_U32                  2
+#define COLUMN_I64                  3
+#define COLUMN_ALERTS               4
+
+/* Description of the column storing a field */
+struct store_column
+{
+	int          type;			/* Type of the column entries (COLUMN_*) */
+	size_t       offset;		/* Offset of the column pointer in struct grf_store */
+	double       scale;			/* Value represented by one step */
+	double       bias;			/* Value represented by 0 */
+};
+
+#define COLUMN(_type_, _member_, _scale_, _bias_) \
+	{ .type = (_type_), .offset = offsetof(struct grf_store, _member_), .scale = (_scale_), .bias = (_bias_) }
+
+static const struct store_column store_columns[] =
+{
+	[GRF_STORE_FIELD_TIMESTAMP]                = COLUMN(COLUMN_I64, timestamps, 1.0, 0.0),
+	[GRF_STORE_FIELD_OPERATION_TIME]           = COLUMN(COLUMN_U32, operation_times, GRF_STORE_TIME_SCALE, 0.0),
+	[GRF_STORE_FIELD_SMOKE_CHAMBER_POLLUTION]  = COLUMN(COLUMN_U8, pollutions, 1.0, 0.0),
+	[GRF_STORE_FIELD_BATTERY_VOLTAGE]          = COLUMN(COLUMN_U16, battery_voltages, GRF_STORE_VOLTAGE_SCALE, 0.0),
+	[GRF_STORE_FIELD_TEMPERATURE1]             = COLUMN(COLUMN_U8, temperatures1, GRF_STORE_TEMPERATURE_SCALE, GRF_STORE_TEMPERATURE_BIAS),
+	[GRF_STORE_FIELD_TEMPERATURE2]             = COLUMN(COLUMN_U8, temperatures2, GRF_STORE_TEMPERATURE_SCALE, GRF_STORE_TEMPERATURE_BIAS),
+	[GRF_STORE_FIELD_LOCAL_SMOKE_ALERTS]       = COLUMN(COLUMN_ALERTS, alerts, 1.0, 0.0),
+	[GRF_STORE_FIELD_LOCAL_TEMPERATURE_ALERTS] = COLUMN(COLUMN_ALERTS, alerts, 1.0, 0.0),
+	[GRF_STORE_FIELD_LOCAL_TEST_ALERTS]        = COLUMN(COLUMN_ALERTS, alerts, 1.0, 0.0),
+	[GRF_STORE_FIELD_REMOTE_CABLE_ALERTS]      = COLUMN(COLUMN_ALERTS, alerts, 1.0, 0.0),
+	[GRF_STORE_FIELD_REMOTE_RADIO_ALERTS]      = COLUMN(COLUMN_ALERTS, alerts, 1.0, 0.0),
+	[GRF_STORE_FIELD_REMOTE_CABLE_TEST_ALERTS] = COLUMN(COLUMN_ALERTS, alerts, 1.0, 0.0),
+	[GRF_STORE_FIELD_REMOTE_RADIO_TEST_ALERTS] = COLUMN(COLUMN_ALERTS, alerts, 1.0, 0.0),
+};
+
+#define STORE_NFIELDS   (sizeof(store_columns) / sizeof(store_columns[0]))
+
+#define ALERT_INDEX(_field_)    ((_field_) - GRF_STORE_FIELD_LOCAL_SMOKE_ALERTS)	/* Index of an alert counter in struct grf_store_alerts */
+
+/*---------------------------------------------------------------------------*/
+static inline bool row_is_latest(const struct grf_store *store, size_t row)
+{
+	return store->latest[row / 32] & (1u << (row % 32));
+}
+
+static uint32_t encode(double value, double scale, double bias, uint32_t max)
+{
+	double steps = nearbyint((value - bias) / scale);
+
+	/* Clamp values out of the range of the column */
+	if (!(steps > 0.0))
+		return 0;
+	if (steps > max)
+		return max;
+
+	return (uint32_t)steps;
+}
+
+static int store_grow(struct grf_store *store)
+{
+	size_t    size  = store->size ? 2 * store->size : GRF_STORE_INITIAL_SIZE;
+	size_t    words = (store->size + 31) / 32;
+	uint32_t *latest;
+
+	/* Each column is resized on its own, a column that could not be resized
+	 * keeps the old capacity which is still valid for all of them.
+	 */
+#define GROW(_member_) \
+	{ \
+		void *column = realloc(store->_member_, size * sizeof(*store->_member_)); \
+		if (!column) \
+			return ENOMEM; \
+		store->_member_ = column; \
+	}
+	GROW(ids);
+	GROW(timestamps);
+	GROW(serial_numbers);
+	GROW(operation_times);
+	GROW(battery_voltages);
+	GROW(temperatures1);
+	GROW(temperatures2);
+	GROW(pollutions);
+	GROW(chamber_values);
+	GROW(alerts);
+#undef GROW
+
+	latest = realloc(store->latest, (size / 32) * sizeof(uint32_t));
+	if (!latest)
+		return ENOMEM;
+	memset(latest + words, 0, (size / 32 - words) * sizeof(uint32_t));
+	store->latest = latest;
+	store->size   = size;
+
+	return 0;
+}
+
+static inline size_t alerts_hash(const struct grf_store_alerts *alerts, size_t size)
+{
+	uint64_t packed = 0;
+
+	memcpy(&packed, alerts->counts, GRF_STORE_ALERTS);
+
+	return (size_t)((packed * 0x9E3779B97F4A7C15ull) >> 32) & (size - 1);
+}
+
+static size_t dict_slot(const struct grf_store *store, const uint16_t *index, size_t size, const struct grf_store_alerts *alerts)
+{
+	size_t i;
+
+	/* Linear probing, the load is kept below one half */
+	for (i = alerts_hash(alerts, size); ; i = (i + 1) & (size - 1))
+	{
+		if (!index[i] || memcmp(&store->dict[index[i] - 1], alerts, sizeof(struct grf_store_alerts)) == 0)
+			return i;
+	}
+}
+
+static int dict_grow(struct grf_store *store)
+{
+	struct grf_store_alerts *dict;
+	uint16_t                *index;
+	size_t                   size;
+	size_t                   i;
+
+	if (store->dict_len >= store->dict_size)
+	{
+		size = store->dict_size ? 2 * store->dict_size : GRF_STORE_INITIAL_SIZE;
+		dict = realloc(store->dict, size * sizeof(struct grf_store_alerts));
+		if (!dict)
+			return ENOMEM;
+		store->dict      = dict;
+		store->dict_size = size;
+	}
+
+	if (2 * (store->dict_len + 1) > store->dict_index_size)
+	{
+		/* Rehash all entries into the new index */
+		size  = store->dict_index_size ? 2 * store->dict_index_size : 2 * GRF_STORE_INITIAL_SIZE;
+		index = calloc(size, sizeof(uint16_t));
+		if (!index)
+			return ENOMEM;
+		for (i = 0; i < store->dict_len; i++)
+			index[dict_slot(store, index, size, &store->dict[i])] = i + 1;
+		free(store->dict_index);
+		store->dict_index      = index;
+		store->dict_index_size = size;
+	}
+
+	return 0;
+}
+
+static int dict_lookup(struct grf_store *store, const struct grf_store_alerts *alerts, uint16_t *code)
+{
+	size_t slot;
+
+	if (store->dict_index)
+	{
+		slot = dict_slot(store, store->dict_index, store->dict_index_size, alerts);
+		if (store->dict_index[slot])
+		{
+			*code = store->dict_index[slot] - 1;
+			return 0;
+		}
+	}
+
+	/* Add a new combination of counter values */
+	if (store->dict_len >= GRF_STORE_DICT_MAX - 1)
+		return ENOSPC;
+	RETURN_ON_ERROR(dict_grow(store));
+	slot = dict_slot(store, store->dict_index, store->dict_index_size, alerts);
+	store->dict[store->dict_len] = *alerts;
+	store->dict_index[slot]      = store->dict_len + 1;
+	*code = store->dict_len++;
+
+	return 0;
+}
+
+static bool value_range(int cmp, double value, const struct store_column *column, int64_t *lo, int64_t *hi)
+{
+	double steps = (value - column->bias) / column->scale;
+	double lower;
+	double upper;
+
+	/* Translate the condition on the decoded value into a range of the
+	 * stored values, so the scan compares integers only. Values that are
+	 * a whole number of steps apart from the bias up to rounding errors
+	 * are treated as exact.
+	 */
+	if (fabs(steps - nearbyint(steps)) < 1e-6)
+		steps = nearbyint(steps);
+	steps = fmax(fmin(steps, 0x1p62), -0x1p62);
+	lower = ceil(steps);
+	upper = floor(steps);
+
+	*lo = INT64_MIN;
+	*hi = INT64_MAX;
+	switch (cmp)
+	{
+		case GRF_STORE_LT:
+			*hi = (int64_t)lower - 1;
+			break;
+		case GRF_STORE_LE:
+			*hi = (int64_t)upper;
+			break;
+		case GRF_STORE_EQ:
+			if (lower != upper)
+				return false;
+			*lo = *hi = (int64_t)lower;
+			break;
+		case GRF_STORE_GE:
+			*lo = (int64_t)lower;
+			break;
+		case GRF_STORE_GT:
+			*lo = (int64_t)upper + 1;
+			break;
+		default:
+			return false;
+	}
+
+	return true;
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+int grf_store_init(struct grf_store *store)
+{
+	assert(store);
+
+	memset(store, 0, sizeof(struct grf_store));
+	store->devices = malloc(sizeof(struct grf_idmap));
+	if (!store->devices)
+		return ENOMEM;
+	grf_idmap_init(store->devices, sizeof(uint32_t));
+
+	return 0;
+}
+
+void grf_store_free(struct grf_store *store)
+{
+	assert(store);
+
+	free(store->ids);
+	free(store->timestamps);
+	free(store->serial_numbers);
+	free(store->operation_times);
+	free(store->battery_voltages);
+	free(store->temperatures1);
+	free(store->temperatures2);
+	free(store->pollutions);
+	free(store->chamber_values);
+	free(store->alerts);
+	free(store->latest);
+	free(store->dict);
+	free(store->dict_index);
+	if (store->devices)
+		grf_idmap_free(store->devices);
+	free(store->devices);
+	memset(store, 0, sizeof(struct grf_store));
+}
+
+int grf_store_add(struct grf_store *store, const struct grf_device *device)
+{
+	assert(store);
+	assert(store->devices);
+	assert(device);
+
+	struct grf_store_alerts  alerts;
+	uint32_t                *latest;
+	uint16_t                 code;
+	uint16_t                 id;
+	size_t                   row = store->len;
+
+	if (!grf_idmap_parse(device->id, &id))
+		return EINVAL;
+	if (row >= UINT32_MAX)
+		return ENOSPC;
+
+	/* Make room for the reading in all columns and the indices */
+	if (row >= store->size)
+		RETURN_ON_ERROR(store_grow(store));
+	alerts.counts[ALERT_INDEX(GRF_STORE_FIELD_LOCAL_SMOKE_ALERTS)]       = device->local_smoke_alerts;
+	alerts.counts[ALERT_INDEX(GRF_STORE_FIELD_LOCAL_TEMPERATURE_ALERTS)] = device->local_temperature_alerts;
+	alerts.counts[ALERT_INDEX(GRF_STORE_FIELD_LOCAL_TEST_ALERTS)]        = device->local_test_alerts;
+	alerts.counts[ALERT_INDEX(GRF_STORE_FIELD_REMOTE_CABLE_ALERTS)]      = device->remote_cable_alerts;
+	alerts.counts[ALERT_INDEX(GRF_STORE_FIELD_REMOTE_RADIO_ALERTS)]      = device->remote_radio_alerts;
+	alerts.counts[ALERT_INDEX(GRF_STORE_FIELD_REMOTE_CABLE_TEST_ALERTS)] = device->remote_cable_test_alerts;
+	alerts.counts[ALERT_INDEX(GRF_STORE_FIELD_REMOTE_RADIO_TEST_ALERTS)] = device->remote_radio_test_alerts;
+	RETURN_ON_ERROR(dict_lookup(store, &alerts, &code));
+	latest = grf_idmap_insert(store->devices, id);
+	if (!latest)
+		return ENOMEM;
+
+	/* Store the fields in fixed-point form */
+	store->ids[row]              = id;
+	store->timestamps[row]       = device->timestamp;
+	store->serial_numbers[row]   = device->serial_number;
+	store->operation_times[row]  = encode(device->operation_time, GRF_STORE_TIME_SCALE, 0.0, UINT32_MAX);
+	store->battery_voltages[row] = encode(device->battery_voltage, GRF_STORE_VOLTAGE_SCALE, 0.0, UINT16_MAX);
+	store->temperatures1[row]    = encode(device->temperature1, GRF_STORE_TEMPERATURE_SCALE, GRF_STORE_TEMPERATURE_BIAS, UINT8_MAX);
+	store->temperatures2[row]    = encode(device->temperature2, GRF_STORE_TEMPERATURE_SCALE, GRF_STORE_TEMPERATURE_BIAS, UINT8_MAX);
+	store->pollutions[row]       = device->smoke_chamber_pollution;
+	store->chamber_values[row]   = device->smoke_chamber_value;
+	store->alerts[row]           = code;
+
+	/* The reading supersedes the previous reading of the device, which is
+	 * stored as row + 1 to tell it from a newly added device.
+	 */
+	if (*latest)
+		store->latest[(*latest - 1) / 32] &= ~(1u << ((*latest - 1) % 32));
+	store->latest[row / 32] |= 1u << (row % 32);
+	*latest = row + 1;
+	store->len++;
+
+	return 0;
+}
+
+bool grf_store_find(const struct grf_store *store, const char *id, size_t *row)
+{
+	assert(store);
+	assert(row);
+
+	const uint32_t *latest;
+	uint16_t        value;
+
+	if (!grf_idmap_parse(id, &value))
+		return false;
+	latest = grf_idmap_find(store->devices, value);
+	if (!latest || !*latest)
+		return false;
+	*row = *latest - 1;
+
+	return true;
+}
+
+void grf_store_get(const struct grf_store *store, size_t row, struct grf_device *device)
+{
+	assert(store);
+	assert(row < store->len);
+	assert(device);
+
+	const struct grf_store_alerts *alerts = &store->dict[store->alerts[row]];
+
+	memset(device, 0, sizeof(struct grf_device));
+	snprintf(device->id, sizeof(device->id), "%04X", store->ids[row]);
+	device->timestamp                = store->timestamps[row];
+	device->serial_number            = store->serial_numbers[row];
+	device->operation_time           = store->operation_times[row] * GRF_STORE_TIME_SCALE;
+	device->battery_voltage          = store->battery_voltages[row] * GRF_STORE_VOLTAGE_SCALE;
+	device->temperature1             = store->temperatures1[row] * GRF_STORE_TEMPERATURE_SCALE + GRF_STORE_TEMPERATURE_BIAS;
+	device->temperature2             = store->temperatures2[row] * GRF_STORE_TEMPERATURE_SCALE + GRF_STORE_TEMPERATURE_BIAS;
+	device->smoke_chamber_pollution  = store->pollutions[row];
+	device->smoke_chamber_value      = store->chamber_values[row];
+	device->local_smoke_alerts       = alerts->counts[ALERT_INDEX(GRF_STORE_FIELD_LOCAL_SMOKE_ALERTS)];
+	device->local_temperature_alerts = alerts->counts[ALERT_INDEX(GRF_STORE_FIELD_LOCAL_TEMPERATURE_ALERTS)];
+	device->local_test_alerts        = alerts->counts[ALERT_INDEX(GRF_STORE_FIELD_LOCAL_TEST_ALERTS)];
+	device->remote_cable_alerts      = alerts->counts[ALERT_INDEX(GRF_STORE_FIELD_REMOTE_CABLE_ALERTS)];
+	device->remote_radio_alerts      = alerts->counts[ALERT_INDEX(GRF_STORE_FIELD_REMOTE_RADIO_ALERTS)];
+	device->remote_cable_test_alerts = alerts->counts[ALERT_INDEX(GRF_STORE_FIELD_REMOTE_CABLE_TEST_ALERTS)];
+	device->remote_radio_test_alerts = alerts->counts[ALERT_INDEX(GRF_STORE_FIELD_REMOTE_RADIO_TEST_ALERTS)];
+}
+
+size_t grf_store_select(const struct grf_store *store, int field, int cmp, double value, bool latest, size_t *rows, size_t max)
+{
+	assert(store);
+	assert(field >= 0 && (size_t)field < STORE_NFIELDS);
+	assert(rows || max == 0);
+
+	const struct store_column *column = &store_columns[field];
+	const void                *data   = *(void * const *)((const char *)store + column->offset);
+	uint32_t                   match[GRF_STORE_DICT_MAX / 32 + 1];
+	uint8_t                    counter;
+	int64_t                    lo;
+	int64_t                    hi;
+	size_t                     count  = 0;
+	size_t                     i;
+
+	if (store->len < 1 || !value_range(cmp, value, column, &lo, &hi))
+		return 0;
+
+	/* Evaluate the condition once per combination of alert counters */
+	if (column->type == COLUMN_ALERTS)
+	{
+		memset(match, 0, sizeof(match));
+		for (i = 0; i < store->dict_len; i++)
+		{
+			counter = store->dict[i].counts[ALERT_INDEX(field)];
+			if (counter >= lo && counter <= hi)
+				match[i / 32] |= 1u << (i % 32);
+		}
+	}
+
+#define SCAN(_test_) \
+	for (i = 0; i < store->len; i++) \
+	{ \
+		if (!(_test_) || (latest && !row_is_latest(store, i))) \
+			continue; \
+		if (count < max) \
+			rows[count] = i; \
+		count++; \
+	}
+	switch (column->type)
+	{
+		case COLUMN_U8:
+			SCAN(((const uint8_t *)data)[i] >= lo && ((const uint8_t *)data)[i] <= hi);
+			break;
+		case COLUMN_U16:
+			SCAN(((const uint16_t *)data)[i] >= lo && ((const uint16_t *)data)[i] <= hi);
+			break;
+		case COLUMN_U32:
+			SCAN(((const uint32_t *)data)[i] >= lo && ((const uint32_t *)data)[i] <= hi);
+			break;
+		case COLUMN_I64:
+			SCAN(((const int64_t *)data)[i] >= lo && ((const int64_t *)data)[i] <= hi);
+			break;
+		case COLUMN_ALERTS:
+			SCAN(match[((const uint16_t *)data)[i] / 32] & (1u << (((const uint16_t *)data)[i] % 32)));
+			break;
+	}
+#undef SCAN
+
+	return count;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,173 @@
+/*
+ * Fleet store include file
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \ingroup comm
+ *  \file grf_store.h
+ *  \brief Compact in-memory store of the readings of many smoke detector devices
+ *
+ * This file defines a store keeping any number of readings per smoke detector
+ * device. Each field of the readings is kept in its own array (column), so
+ * scanning a single field over the whole fleet touches only the memory of
+ * that field. The fields are stored in fixed-point form:
+ *
+ *   - battery voltage in millivolts
+ *   - temperatures in steps of 0.5 degree celcius above -20 degree celcius,
+ *     which is the resolution of the register
+ *   - operation time in quarter seconds, which is the resolution of the register
+ *   - the seven alert counters as index into a dictionary of the distinct
+ *     combinations of counter values, as most devices share the same counts
+ *
+ * The registers of unknown meaning are not kept.
+ *
+ * @{
+ */
+
+#ifndef __GRF_STORE_H__
+#define __GRF_STORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+struct grf_device;
+struct grf_idmap;
+
+#define GRF_STORE_FIELD_TIMESTAMP                   0	/*!< Timestamp of data reception in seconds */
+#define GRF_STORE_FIELD_OPERATION_TIME              1	/*!< Time of operation in seconds */
+#define GRF_STORE_FIELD_SMOKE_CHAMBER_POLLUTION     2	/*!< Smoke chamber pollution */
+#define GRF_STORE_FIELD_BATTERY_VOLTAGE             3	/*!< Battery voltage in Volt */
+#define GRF_STORE_FIELD_TEMPERATURE1                4	/*!< First temperature in degree celcius */
+#define GRF_STORE_FIELD_TEMPERATURE2                5	/*!< Second temperature in degree celcius */
+#define GRF_STORE_FIELD_LOCAL_SMOKE_ALERTS          6	/*!< Number of local smoke alerts */
+#define GRF_STORE_FIELD_LOCAL_TEMPERATURE_ALERTS    7	/*!< Number of local temperature alerts */
+#define GRF_STORE_FIELD_LOCAL_TEST_ALERTS           8	/*!< Number of local test alerts */
+#define GRF_STORE_FIELD_REMOTE_CABLE_ALERTS         9	/*!< Number of remote alerts transmitted via wire */
+#define GRF_STORE_FIELD_REMOTE_RADIO_ALERTS         10	/*!< Number of remote alerts transmitted via radio */
+#define GRF_STORE_FIELD_REMOTE_CABLE_TEST_ALERTS    11	/*!< Number of remote test alerts transmitted via wire */
+#define GRF_STORE_FIELD_REMOTE_RADIO_TEST_ALERTS    12	/*!< Number of remote test alerts transmitted via radio */
+
+#define GRF_STORE_ALERTS            7		/*!< Number of alert counters per reading */
+
+#define GRF_STORE_LT                0		/*!< Select readings with a field less than the value */
+#define GRF_STORE_LE                1		/*!< Select readings with a field less than or equal to the value */
+#define GRF_STORE_EQ                2		/*!< Select readings with a field equal to the value */
+#define GRF_STORE_GE                3		/*!< Select readings with a field greater than or equal to the value */
+#define GRF_STORE_GT                4		/*!< Select readings with a field greater than the value */
+
+/*! Data structure representing a combination of alert counter values */
+struct grf_store_alerts
+{
+	uint8_t      counts[GRF_STORE_ALERTS];	/*!< Counter values in the order of the GRF_STORE_FIELD_*_ALERTS fields */
+};
+
+/*! Data structure representing the readings of a fleet of smoke detector devices.
+ *
+ *  All columns have one entry per reading in the order the readings were
+ *  added. The members should be treated as read-only by the caller.
+ */
+struct grf_store
+{
+	size_t       len;					/*!< Number of readings */
+	size_t       size;					/*!< Capacity of the columns */
+
+	uint16_t    *ids;					/*!< Numeric device IDs */
+	int64_t     *timestamps;			/*!< Timestamps of data reception */
+	uint32_t    *serial_numbers;		/*!< Serial numbers */
+	uint32_t    *operation_times;		/*!< Times of operation in quarter seconds */
+	uint16_t    *battery_voltages;		/*!< Battery voltages in millivolts */
+	uint8_t     *temperatures1;			/*!< First temperatures in steps of 0.5 degree above -20 degree celcius */
+	uint8_t     *temperatures2;			/*!< Second temperatures in steps of 0.5 degree above -20 degree celcius */
+	uint8_t     *pollutions;			/*!< Smoke chamber pollutions */
+	uint16_t    *chamber_values;		/*!< Smoke chamber values */
+	uint16_t    *alerts;				/*!< Alert counters as index into *dict* */
+	uint32_t    *latest;				/*!< Bit set of the readings that are the latest of their device */
+
+	struct grf_store_alerts *dict;		/*!< Distinct combinations of alert counter values */
+	size_t       dict_len;				/*!< Number of entries in *dict* */
+	size_t       dict_size;				/*!< Capacity of *dict* */
+	uint16_t    *dict_index;			/*!< Hash index of *dict* holding entry index + 1 or 0 for empty slots */
+	size_t       dict_index_size;		/*!< Capacity of *dict_index* (power of two) */
+
+	struct grf_idmap *devices;			/*!< Index of the latest reading per device */
+};
+
+/*! \brief Initialize an empty store.
+ *
+ *  \param store	store to initialize
+ *  \returns		0 on success and an error code otherwise
+ */
+int grf_store_init(struct grf_store *store);
+
+/*! \brief Free all readings of a store.
+ *
+ *  \param store	store initialized by \ref grf_store_init()
+ */
+void grf_store_free(struct grf_store *store);
+
+/*! \brief Add a reading of a device.
+ *
+ *  The reading becomes the latest reading of the device.
+ *
+ *  \param store	store initialized by \ref grf_store_init()
+ *  \param device	device data e.g. read by \ref grf_comm_read_data()
+ *  \returns		0 on success, `EINVAL` if the ID of *device* is no 4-digit hexadecimal number and an error code otherwise
+ */
+int grf_store_add(struct grf_store *store, const struct grf_device *device);
+
+/*! \brief Look up the latest reading of a device.
+ *
+ *  \param store	store initialized by \ref grf_store_init()
+ *  \param id		4-digit hexadecimal ID of the device
+ *  \param row		storage for the index of the reading
+ *  \returns		true if the device has a reading and false otherwise
+ */
+bool grf_store_find(const struct grf_store *store, const char *id, size_t *row);
+
+/*! \brief Convert a reading back into device data.
+ *
+ *  The fields not kept by the store are zeroed.
+ *
+ *  \param store	store initialized by \ref grf_store_init()
+ *  \param row		index of the reading
+ *  \param device	device data structure to fill
+ */
+void grf_store_get(const struct grf_store *store, size_t row, struct grf_device *device);
+
+/*! \brief Select the readings with a field matching a condition.
+ *
+ *  The condition is evaluated on the decoded value of the field, e.g.
+ *  `grf_store_select(store, GRF_STORE_FIELD_BATTERY_VOLTAGE, GRF_STORE_LT, 8.5, true, rows, max)`
+ *  selects all devices with a battery voltage below 8.5 V in their latest reading.
+ *
+ *  \param store	store initialized by \ref grf_store_init()
+ *  \param field	field to compare (GRF_STORE_FIELD_*)
+ *  \param cmp		comparison (GRF_STORE_LT, GRF_STORE_LE, GRF_STORE_EQ, GRF_STORE_GE or GRF_STORE_GT)
+ *  \param value	value to compare the field with in the unit of the field
+ *  \param latest	only consider the latest reading of each device
+ *  \param rows		storage for the indices of the selected readings in ascending order (may be NULL if *max* is 0)
+ *  \param max		capacity of *rows*
+ *  \returns		number of selected readings, which may exceed *max*
+ */
+size_t grf_store_select(const struct grf_store *store, int field, int cmp, double value, bool latest, size_t *rows, size_t max);
+
+#endif /* __GRF_STORE_H__ */
+/* @} */
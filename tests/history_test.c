@@ -0,0 +1,163 @@
+/*
+ * Tests of the group records of the history file
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "grf.h"
+#include "grf_history.h"
+
+static int failures = 0;
+
+#define CHECK(_cond_) \
+	do \
+	{ \
+		if (!(_cond_)) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond_); \
+			failures++; \
+		} \
+	} while (0)
+
+/*---------------------------------------------------------------------------*/
+static void devicelist_setup(struct grf_devicelist *devices, const char **ids)
+{
+	grf_devicelist_init(devices);
+	while (*ids)
+		CHECK(grf_devicelist_add(devices, *ids++) == 0);
+}
+
+static bool devicelist_equal(const struct grf_devicelist *devices, const char **ids)
+{
+	size_t i;
+
+	for (i = 0; i < devices->len && ids[i]; i++)
+	{
+		if (strcmp(devices->ids[i], ids[i]) != 0)
+			return false;
+	}
+
+	return i == devices->len && !ids[i];
+}
+
+static off_t file_size(const char *path)
+{
+	struct stat st;
+
+	return (stat(path, &st) == 0) ? st.st_size : -1;
+}
+/*---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+	static const char    *found[]  = { "ED4F", "1E05", "9821", "29DA", "1E05", NULL };
+	static const char    *sorted[] = { "1E05", "29DA", "9821", "ED4F", NULL };
+	static const char    *moved[]  = { "0001", "FFFF", NULL };
+	struct grf_history    hist;
+	struct grf_devicelist devices;
+	struct grf_devicelist result;
+	struct grf_device     device;
+	char                  path[] = "/tmp/grf-history-test-XXXXXX";
+	off_t                 size;
+	int                   fd;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("mkstemp");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	unlink(path);
+	grf_devicelist_init(&result);
+
+	/* The devices come back sorted and without duplicates */
+	CHECK(grf_history_open(&hist, path, GRF_HISTORY_WRITE) == 0);
+	CHECK(grf_history_get_group(&hist, "A0A5", &result) == ENOENT);
+	devicelist_setup(&devices, found);
+	CHECK(grf_history_set_group(&hist, "A0A5", &devices) == 0);
+	CHECK(grf_history_get_group(&hist, "A0A5", &result) == 0);
+	CHECK(devicelist_equal(&result, sorted));
+	grf_devicelist_free(&devices);
+
+	/* Readings and group records are kept apart */
+	memset(&device, 0, sizeof(struct grf_device));
+	strcpy(device.id, "A0A5");
+	device.timestamp = 1000;
+	CHECK(grf_history_append(&hist, &device) == 0);
+	CHECK(grf_history_set_group(&hist, "XYZ1", &devices) == EINVAL);
+	CHECK(grf_history_close(&hist) == 0);
+
+	/* Readers find the group in the index, the same devices are not appended again */
+	CHECK(grf_history_open(&hist, path, GRF_HISTORY_READ) == 0);
+	CHECK(grf_history_get_group(&hist, "A0A5", &result) == 0);
+	CHECK(devicelist_equal(&result, sorted));
+	CHECK(grf_history_get_group(&hist, "616B", &result) == ENOENT);
+	CHECK(hist.records == 1);
+	CHECK(grf_history_close(&hist) == 0);
+	size = file_size(path);
+	CHECK(grf_history_open(&hist, path, GRF_HISTORY_WRITE) == 0);
+	devicelist_setup(&devices, sorted);
+	CHECK(grf_history_set_group(&hist, "A0A5", &devices) == 0);
+	grf_devicelist_free(&devices);
+	CHECK(grf_history_close(&hist) == 0);
+	CHECK(file_size(path) == size);
+
+	/* Other devices replace the ones of the group */
+	CHECK(grf_history_open(&hist, path, GRF_HISTORY_WRITE) == 0);
+	devicelist_setup(&devices, moved);
+	CHECK(grf_history_set_group(&hist, "A0A5", &devices) == 0);
+	CHECK(grf_history_set_group(&hist, "616B", &devices) == 0);
+	grf_devicelist_free(&devices);
+	CHECK(grf_history_get_group(&hist, "A0A5", &result) == 0);
+	CHECK(devicelist_equal(&result, moved));
+	CHECK(grf_history_flush(&hist) == 0);
+	CHECK(grf_history_close(&hist) == 0);
+
+	/* A file without index is recovered including the groups */
+	size = file_size(path);
+	CHECK(truncate(path, size - 1) == 0);
+	CHECK(grf_history_open(&hist, path, GRF_HISTORY_READ) == 0);
+	CHECK(grf_history_get_group(&hist, "A0A5", &result) == 0);
+	CHECK(devicelist_equal(&result, moved));
+	CHECK(grf_history_get_group(&hist, "616B", &result) == 0);
+	CHECK(devicelist_equal(&result, moved));
+	CHECK(hist.records == 1);
+	CHECK(grf_history_close(&hist) == 0);
+
+	grf_devicelist_free(&result);
+	unlink(path);
+
+	if (failures)
+	{
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# This file is part of the grfutils project.
+#
+# Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+#
+# grfutils is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# grfutils is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Usage: sim_read_group.sh <grf-sim> <grfctl>
+#
+# Reads group 616B of 36 devices from the simulated radio. Once enough answers
+# are seen, the timeouts learned must not fire before the radio reports the
+# timeout of a device itself, otherwise the late answers are taken for the
+# ones of the following requests and the read-out falls apart.
+
+SIM="$1"
+CTL="$2"
+GROUP=616B
+DEVICES=36
+
+DIR=$(mktemp -d) || exit 1
+"$SIM" -n $DEVICES -p 3 -s 11 -i 2 -o "$DIR/tty" > "$DIR/sim.log" 2>&1 &
+SIMPID=$!
+trap 'kill $SIMPID 2>/dev/null; rm -rf "$DIR"' EXIT
+
+# Wait for the pseudo terminal of the simulator
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	[ -e "$DIR/tty" ] && break
+	sleep 0.5
+done
+
+"$CTL" -d "$DIR/tty" -t 30 -v info request-group $GROUP > "$DIR/ctl.log" 2>&1
+RESULT=$?
+
+if [ $RESULT -ne 0 ] || grep -q "failed" "$DIR/ctl.log"; then
+	grep -v "^    \|^---" "$DIR/ctl.log"
+	echo "Reading group $GROUP failed ($RESULT)"
+	exit 1
+fi
+READ=$(grep -c "Reading device" "$DIR/ctl.log")
+if [ "$READ" -ne $DEVICES ]; then
+	echo "Read $READ of $DEVICES devices"
+	exit 1
+fi
+
+exit 0
@@ -0,0 +1,267 @@
+/*
+ * Tests of the fleet store
+ *
+ * This file is part of the grfutils project.
+ *
+ * Copyright (c) 2014-2015 Sven Rebhan <odinshorse@googlemail.com>
+ *
+ * grfutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * grfutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with grfutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+
+#include <math.h>
+
+#include "grf.h"
+#include "grf_registers.h"
+#include "grf_store.h"
+
+#define VOLTAGE_STEP    (9.184f / 500.0f)	/* Battery voltage represented by one step of the register */
+
+static int failures = 0;
+
+#define CHECK(_cond_) \
+	do \
+	{ \
+		if (!(_cond_)) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond_); \
+			failures++; \
+		} \
+	} while (0)
+
+/*---------------------------------------------------------------------------*/
+static void device_setup(struct grf_device *device, const char *id, time_t timestamp, float temperature)
+{
+	memset(device, 0, sizeof(struct grf_device));
+	snprintf(device->id, sizeof(device->id), "%s", id);
+	device->timestamp      = timestamp;
+	device->serial_number  = 0x01234567;
+	device->operation_time = 12345.75f;
+	device->battery_voltage = 489 * VOLTAGE_STEP;
+	device->temperature1   = temperature;
+	device->temperature2   = temperature - 1.5f;
+}
+
+static size_t select_count(const struct grf_store *store, int field, int cmp, double value, bool latest)
+{
+	return grf_store_select(store, field, cmp, value, latest, NULL, 0);
+}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static void test_encodings(void)
+{
+	struct grf_store  store;
+	struct grf_device device;
+	struct grf_device stored;
+	uint32_t          expected;
+	uint32_t          value;
+	uint16_t          key;
+	size_t            row;
+
+	CHECK(grf_store_init(&store) == 0);
+
+	/* Fields kept by the store come back with the resolution of the registers */
+	device_setup(&device, "1E05", 1420070400, 21.5f);
+	device.smoke_chamber_pollution  = 3;
+	device.smoke_chamber_value      = 1234;
+	device.local_smoke_alerts       = 1;
+	device.local_temperature_alerts = 2;
+	device.local_test_alerts        = 3;
+	device.remote_cable_alerts      = 4;
+	device.remote_radio_alerts      = 5;
+	device.remote_cable_test_alerts = 6;
+	device.remote_radio_test_alerts = 7;
+	device.unknown_64               = 0xdeadbeef;
+	CHECK(grf_store_add(&store, &device) == 0);
+	CHECK(grf_store_find(&store, "1E05", &row) && row == 0);
+	CHECK(!grf_store_find(&store, "29DA", &row));
+	grf_store_get(&store, row, &stored);
+
+	CHECK(strcmp(stored.id, "1E05") == 0);
+	CHECK(stored.timestamp == 1420070400);
+	CHECK(stored.serial_number == 0x01234567);
+	CHECK(store.operation_times[row] == 49383);
+	CHECK(stored.operation_time == 12345.75f);
+	CHECK(store.battery_voltages[row] == 8982);
+	CHECK(fabsf(stored.battery_voltage - device.battery_voltage) <= 0.0005f);
+	CHECK(store.temperatures1[row] == 83);
+	CHECK(stored.temperature1 == 21.5f);
+	CHECK(stored.temperature2 == 20.0f);
+	CHECK(stored.smoke_chamber_pollution == 3);
+	CHECK(stored.smoke_chamber_value == 1234);
+	CHECK(stored.local_smoke_alerts == 1);
+	CHECK(stored.local_temperature_alerts == 2);
+	CHECK(stored.local_test_alerts == 3);
+	CHECK(stored.remote_cable_alerts == 4);
+	CHECK(stored.remote_radio_alerts == 5);
+	CHECK(stored.remote_cable_test_alerts == 6);
+	CHECK(stored.remote_radio_test_alerts == 7);
+	CHECK(stored.unknown_64 == 0);
+	for (key = 0x0001; key <= 0x0007; key++)
+	{
+		if (key == 0x0002)
+			continue;
+		CHECK(grf_register_get(&device, key, &expected) == 0);
+		CHECK(grf_register_get(&stored, key, &value) == 0);
+		CHECK(value == expected);
+	}
+
+	/* Readings sharing the alert counters share the dictionary entry */
+	device_setup(&device, "29DA", 1420070400, 21.5f);
+	device.local_smoke_alerts = 1;
+	CHECK(grf_store_add(&store, &device) == 0);
+	device_setup(&device, "9821", 1420070400, 21.5f);
+	device.local_smoke_alerts = 1;
+	CHECK(grf_store_add(&store, &device) == 0);
+	CHECK(store.dict_len == 2);
+	CHECK(store.alerts[1] == store.alerts[2]);
+	CHECK(store.alerts[0] != store.alerts[1]);
+
+	/* Values out of the range of a column are clamped */
+	device_setup(&device, "ED4F", 1420070400, -30.0f);
+	device.temperature2 = 200.0f;
+	device.battery_voltage = 100.0f;
+	CHECK(grf_store_add(&store, &device) == 0);
+	grf_store_get(&store, store.len - 1, &stored);
+	CHECK(stored.temperature1 == -20.0f);
+	CHECK(stored.temperature2 == 107.5f);
+	CHECK(fabsf(stored.battery_voltage - 65.535f) <= 0.0005f);
+
+	/* IDs other than 4-digit hexadecimal numbers are refused */
+	device_setup(&device, "XY12", 1420070400, 21.5f);
+	CHECK(grf_store_add(&store, &device) != 0);
+	CHECK(store.len == 4);
+
+	grf_store_free(&store);
+}
+
+static void test_select(void)
+{
+	struct grf_store  store;
+	struct grf_device device;
+	size_t            rows[4];
+	size_t            row;
+
+	CHECK(grf_store_init(&store) == 0);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GE, -20.0, false) == 0);
+
+	/* Three devices 0.5 degree apart */
+	device_setup(&device, "0001", 1000, 20.0f);
+	device.local_test_alerts = 2;
+	CHECK(grf_store_add(&store, &device) == 0);
+	device_setup(&device, "0002", 2000, 20.5f);
+	CHECK(grf_store_add(&store, &device) == 0);
+	device_setup(&device, "0003", 3000, 21.0f);
+	device.battery_voltage = 400 * VOLTAGE_STEP;
+	CHECK(grf_store_add(&store, &device) == 0);
+
+	/* Conditions on a value at a step of the column */
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_LT, 20.5, true) == 1);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_LE, 20.5, true) == 2);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_EQ, 20.5, true) == 1);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GE, 20.5, true) == 2);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GT, 20.5, true) == 1);
+
+	/* Conditions on a value between two steps */
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_LT, 20.25, true) == 1);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_LE, 20.25, true) == 1);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_EQ, 20.25, true) == 0);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GE, 20.25, true) == 2);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GT, 20.25, true) == 2);
+
+	/* Values beyond the range of the column */
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GT, -100.0, true) == 3);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_LT, -100.0, true) == 0);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_LT, 1e30, true) == 3);
+
+	/* Voltages are compared in millivolts, the time in quarter seconds */
+	CHECK(select_count(&store, GRF_STORE_FIELD_BATTERY_VOLTAGE, GRF_STORE_LT, 8.5, true) == 1);
+	CHECK(select_count(&store, GRF_STORE_FIELD_BATTERY_VOLTAGE, GRF_STORE_EQ, 8.982, true) == 2);
+	CHECK(select_count(&store, GRF_STORE_FIELD_OPERATION_TIME, GRF_STORE_EQ, 12345.75, true) == 3);
+	CHECK(select_count(&store, GRF_STORE_FIELD_OPERATION_TIME, GRF_STORE_EQ, 12345.6, true) == 0);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TIMESTAMP, GRF_STORE_GE, 2000, true) == 2);
+
+	/* Alert counters are compared through the dictionary */
+	CHECK(select_count(&store, GRF_STORE_FIELD_LOCAL_TEST_ALERTS, GRF_STORE_GE, 1, true) == 1);
+	CHECK(select_count(&store, GRF_STORE_FIELD_LOCAL_TEST_ALERTS, GRF_STORE_EQ, 0, true) == 2);
+
+	/* A new reading supersedes the previous one of the device */
+	device_setup(&device, "0001", 4000, 25.0f);
+	CHECK(grf_store_add(&store, &device) == 0);
+	CHECK(grf_store_find(&store, "0001", &row) && row == 3);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_EQ, 20.0, true) == 0);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_EQ, 20.0, false) == 1);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GE, 20.0, true) == 3);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GE, 20.0, false) == 4);
+	CHECK(select_count(&store, GRF_STORE_FIELD_LOCAL_TEST_ALERTS, GRF_STORE_GE, 1, true) == 0);
+
+	/* The rows are returned in ascending order up to the capacity given */
+	CHECK(grf_store_select(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GE, 20.0, true, rows, 4) == 3);
+	CHECK(rows[0] == 1 && rows[1] == 2 && rows[2] == 3);
+	rows[1] = 99;
+	CHECK(grf_store_select(&store, GRF_STORE_FIELD_TEMPERATURE1, GRF_STORE_GE, 20.0, true, rows, 1) == 3);
+	CHECK(rows[0] == 1 && rows[1] == 99);
+
+	grf_store_free(&store);
+}
+
+static void test_growth(void)
+{
+	struct grf_store  store;
+	struct grf_device device;
+	char              id[GRF_DEVICEID_LEN + 1];
+	size_t            row;
+	int               i;
+
+	/* Enough readings to resize the columns and the latest flags several times */
+	CHECK(grf_store_init(&store) == 0);
+	for (i = 0; i < 1000; i++)
+	{
+		snprintf(id, sizeof(id), "%04X", i % 300);
+		device_setup(&device, id, i, -20.0f + (i % 256) * 0.5f);
+		device.local_smoke_alerts = i % 10;
+		CHECK(grf_store_add(&store, &device) == 0);
+	}
+	CHECK(store.len == 1000);
+	CHECK(store.dict_len == 10);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TIMESTAMP, GRF_STORE_GE, 0, true) == 300);
+	CHECK(select_count(&store, GRF_STORE_FIELD_TIMESTAMP, GRF_STORE_GE, 0, false) == 1000);
+	CHECK(select_count(&store, GRF_STORE_FIELD_LOCAL_SMOKE_ALERTS, GRF_STORE_EQ, 9, false) == 100);
+	CHECK(grf_store_find(&store, "0000", &row) && row == 900);
+
+	grf_store_free(&store);
+}
+/*---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+	test_encodings();
+	test_select();
+	test_growth();
+
+	if (failures)
+	{
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}